@@ -0,0 +1,273 @@
+const char* usage = R"(
+Benchmarks the two gap storage backends of APRAccess (std::map per row vs flat CSR arrays (use_flat_map)),
+comparing the time to build the access structure, the (estimated) memory footprint and the iteration throughput.
+
+Usage:
+
+(using *_apr.h5 output of Example_get_apr)
+
+Benchmark_apr_access -i input_apr_file -d directory
+
+Options:
+
+-reps number of repeats for the timings (default 5)
+
+)";
+
+#include <algorithm>
+#include <iostream>
+#include <cmath>
+#include <random>
+#include "Benchmark_apr_access.hpp"
+
+struct BenchmarkResult{
+    double build_time = 0;
+    double memory = 0;
+    double serial_iteration = 0;
+    double neighbour_iteration = 0;
+    double random_access = 0;
+    double checksum = 0;
+};
+
+double estimate_map_memory(APRAccess& apr_access){
+    //
+    //  Estimates the memory of the std::map gap storage, each row owns a std::vector, each non-empty row a map,
+    //  and each gap a red-black tree node (node header + value) with typical allocator overhead.
+    //
+
+    const double node_size = 4*sizeof(void*) + sizeof(std::pair<const uint16_t,YGap_map>) + 2*sizeof(void*);
+
+    double memory = 0;
+    for (uint64_t level = apr_access.level_min; level <= apr_access.level_max; ++level) {
+        for (uint64_t offset = 0; offset < apr_access.gap_map.data[level].size(); ++offset) {
+            memory += sizeof(std::vector<ParticleCellGapMap>);
+            if(apr_access.gap_map.data[level][offset].size() > 0){
+                memory += sizeof(ParticleCellGapMap) + apr_access.gap_map.data[level][offset][0].map.size()*node_size;
+            }
+        }
+    }
+    return memory;
+}
+
+double estimate_flat_memory(APRAccess& apr_access){
+    double memory = 0;
+    for (uint64_t level = 0; level < apr_access.flat_map.size(); ++level) {
+        FlatGapMap& level_map = apr_access.flat_map[level];
+        memory += sizeof(FlatGapMap);
+        memory += level_map.row_begin.capacity()*sizeof(uint64_t);
+        memory += level_map.y_begin.capacity()*sizeof(uint16_t);
+        memory += level_map.y_end.capacity()*sizeof(uint16_t);
+        memory += level_map.global_index_begin.capacity()*sizeof(uint64_t);
+    }
+    return memory;
+}
+
+BenchmarkResult run_benchmark(APR<uint16_t>& apr_input,MapStorageData& map_data,std::vector<ParticleCell>& random_cells,bool use_flat_map,int number_reps){
+
+    BenchmarkResult result;
+
+    APRTimer timer;
+    timer.verbose_flag = false;
+
+    APR<uint16_t> apr = apr_input;
+
+    ///////////////////////////
+    ///
+    /// Build time (from the flattened structure as stored in the file)
+    ///
+    /////////////////////////////////
+
+    for (int r = 0; r < number_reps; ++r) {
+        apr.apr_access.gap_map = ExtraPartCellData<ParticleCellGapMap>();
+        apr.apr_access.flat_map.clear();
+        apr.apr_access.use_flat_map = use_flat_map;
+
+        timer.start_timer("build");
+        apr.apr_access.rebuild_map(apr,map_data);
+        timer.stop_timer();
+        result.build_time += timer.timings.back()/number_reps;
+    }
+
+    result.memory = use_flat_map ? estimate_flat_memory(apr.apr_access) : estimate_map_memory(apr.apr_access);
+
+    APRIterator<uint16_t> apr_iterator(apr);
+    APRIterator<uint16_t> neighbour_iterator(apr);
+    uint64_t particle_number;
+
+    ///////////////////////////
+    ///
+    /// Serial iteration over all particles
+    ///
+    /////////////////////////////////
+
+    for (int r = 0; r < number_reps; ++r) {
+        double sum = 0;
+        timer.start_timer("serial iteration");
+        for (particle_number = 0; particle_number < apr_iterator.total_number_particles(); ++particle_number) {
+            apr_iterator.set_iterator_to_particle_by_number(particle_number);
+            sum += apr.particles_intensities[apr_iterator] + apr_iterator.y();
+        }
+        timer.stop_timer();
+        result.serial_iteration += timer.timings.back()/number_reps;
+        result.checksum = sum;
+    }
+
+    ///////////////////////////
+    ///
+    /// Face neighbour access (requires random access into the gap structure)
+    ///
+    /////////////////////////////////
+
+    for (int r = 0; r < number_reps; ++r) {
+        double sum = 0;
+        timer.start_timer("neighbour iteration");
+        for (particle_number = 0; particle_number < apr_iterator.total_number_particles(); ++particle_number) {
+            apr_iterator.set_iterator_to_particle_by_number(particle_number);
+
+            for (int direction = 0; direction < 6; ++direction) {
+                apr_iterator.find_neighbours_in_direction(direction);
+
+                for (int index = 0; index < apr_iterator.number_neighbours_in_direction(direction); ++index) {
+                    if (neighbour_iterator.set_neighbour_iterator(apr_iterator, direction, index)) {
+                        sum += apr.particles_intensities[neighbour_iterator];
+                    }
+                }
+            }
+        }
+        timer.stop_timer();
+        result.neighbour_iteration += timer.timings.back()/number_reps;
+        result.checksum += sum;
+    }
+
+    ///////////////////////////
+    ///
+    /// Random access of particle cells
+    ///
+    /////////////////////////////////
+
+    for (int r = 0; r < number_reps; ++r) {
+        double sum = 0;
+        timer.start_timer("random access");
+        for (size_t i = 0; i < random_cells.size(); ++i) {
+            if(apr_iterator.set_iterator_by_particle_cell(random_cells[i])){
+                sum += apr.particles_intensities[apr_iterator];
+            }
+        }
+        timer.stop_timer();
+        result.random_access += timer.timings.back()/number_reps;
+        result.checksum += sum;
+    }
+
+    return result;
+}
+
+int main(int argc, char **argv) {
+
+    // INPUT PARSING
+
+    cmdLineOptions options = read_command_line_options(argc, argv);
+
+    // Filename
+    std::string file_name = options.directory + options.input;
+
+    // APR datastructure
+    APR<uint16_t> apr;
+
+    //read file
+    apr.read_apr(file_name);
+
+    MapStorageData map_data;
+    apr.apr_access.flatten_structure(apr,map_data);
+
+    //sample random particle cells (half existing, half random locations)
+    std::vector<ParticleCell> random_cells;
+    const uint64_t number_random = std::min((uint64_t)1000000,apr.total_number_particles());
+
+    std::mt19937 generator(0);
+    std::uniform_int_distribution<uint64_t> particle_distribution(0,apr.total_number_particles()-1);
+
+    APRIterator<uint16_t> apr_iterator(apr);
+    for (uint64_t i = 0; i < number_random; ++i) {
+        apr_iterator.set_iterator_to_particle_by_number(particle_distribution(generator));
+        ParticleCell cell;
+        cell.x = apr_iterator.x();
+        cell.y = apr_iterator.y();
+        cell.z = apr_iterator.z();
+        cell.level = apr_iterator.level();
+        if(i%2){
+            cell.y = std::uniform_int_distribution<uint16_t>(0,apr.spatial_index_y_max(cell.level)-1)(generator);
+        }
+        random_cells.push_back(cell);
+    }
+
+    BenchmarkResult map_result = run_benchmark(apr,map_data,random_cells,false,options.number_reps);
+    BenchmarkResult flat_result = run_benchmark(apr,map_data,random_cells,true,options.number_reps);
+
+    const double number_particles = apr.total_number_particles();
+
+    std::cout << "Number of particles: " << apr.total_number_particles() << " Number of gaps: " << apr.apr_access.total_number_gaps << " Number of non-empty rows: " << apr.apr_access.total_number_non_empty_rows << std::endl;
+    std::cout << std::endl;
+
+    std::cout << "backend build(s) memory(MB) serial(Mparts/s) neighbour(Mparts/s) random(Mcells/s)" << std::endl;
+    std::cout << "map " << map_result.build_time << " " << map_result.memory/1000000.0 << " " << number_particles/(map_result.serial_iteration*1000000.0) << " " << number_particles/(map_result.neighbour_iteration*1000000.0) << " " << random_cells.size()/(map_result.random_access*1000000.0) << std::endl;
+    std::cout << "flat " << flat_result.build_time << " " << flat_result.memory/1000000.0 << " " << number_particles/(flat_result.serial_iteration*1000000.0) << " " << number_particles/(flat_result.neighbour_iteration*1000000.0) << " " << random_cells.size()/(flat_result.random_access*1000000.0) << std::endl;
+
+    if(map_result.checksum != flat_result.checksum){
+        std::cerr << "Results of the two backends differ" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+bool command_option_exists(char **begin, char **end, const std::string &option)
+{
+    return std::find(begin, end, option) != end;
+}
+
+char* get_command_option(char **begin, char **end, const std::string &option)
+{
+    char ** itr = std::find(begin, end, option);
+    if (itr != end && ++itr != end)
+    {
+        return *itr;
+    }
+    return 0;
+}
+
+cmdLineOptions read_command_line_options(int argc, char **argv){
+
+    cmdLineOptions result;
+
+    if(argc == 1) {
+        std::cerr << "Usage: \"Benchmark_apr_access -i input_apr_file -d directory\"" << std::endl;
+        std::cerr << usage << std::endl;
+        exit(1);
+    }
+
+    if(command_option_exists(argv, argv + argc, "-i"))
+    {
+        result.input = std::string(get_command_option(argv, argv + argc, "-i"));
+    } else {
+        std::cout << "Input file required" << std::endl;
+        exit(2);
+    }
+
+    if(command_option_exists(argv, argv + argc, "-d"))
+    {
+        result.directory = std::string(get_command_option(argv, argv + argc, "-d"));
+    }
+
+    if(command_option_exists(argv, argv + argc, "-o"))
+    {
+        result.output = std::string(get_command_option(argv, argv + argc, "-o"));
+    }
+
+    if(command_option_exists(argv, argv + argc, "-reps"))
+    {
+        result.number_reps = std::stoi(std::string(get_command_option(argv, argv + argc, "-reps")));
+    }
+
+    return result;
+
+}
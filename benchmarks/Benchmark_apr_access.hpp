@@ -0,0 +1,24 @@
+#ifndef PARTPLAY_BENCHMARK_APR_ACCESS_HPP
+#define PARTPLAY_BENCHMARK_APR_ACCESS_HPP
+
+#include <functional>
+#include <string>
+
+#include "data_structures/APR/APR.hpp"
+
+struct cmdLineOptions{
+    std::string output = "output";
+    std::string stats = "";
+    std::string directory = "";
+    std::string input = "";
+    bool stats_file = false;
+    int number_reps = 5;
+};
+
+cmdLineOptions read_command_line_options(int argc, char **argv);
+
+bool command_option_exists(char **begin, char **end, const std::string &option);
+
+char* get_command_option(char **begin, char **end, const std::string &option);
+
+#endif //PARTPLAY_BENCHMARK_APR_ACCESS_HPP
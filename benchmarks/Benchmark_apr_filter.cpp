@@ -0,0 +1,208 @@
+const char* usage = R"(
+Benchmarks the convolution of the particle intensities with Gaussian, Laplacian of Gaussian and difference of
+Gaussians (sigma, 2*sigma) kernels directly on the particles (APRFilter), against reconstructing the image (interp_img),
+convolving it (APRFilter::convolve_mesh) and taking the mean of the result over each particle cell. Reports the
+throughput of both and the error of the particle convolution relative to the image convolution.
+
+Usage:
+
+(using *_apr.h5 output of Example_get_apr)
+
+Benchmark_apr_filter -i input_apr_file -d directory
+
+Options:
+
+-reps number of repeats for the timings (default 5)
+-sigma standard deviation of the kernels in pixels (default 2)
+-size number of taps of the kernels in pixels, odd (default 9)
+
+)";
+
+#include <algorithm>
+#include <iostream>
+#include <cmath>
+#include "Benchmark_apr_filter.hpp"
+
+struct BenchmarkResult{
+    double apr_time = 0;
+    double mesh_time = 0;
+    double relative_rms_error = 0;
+    double relative_max_error = 0;
+};
+
+void mean_over_particle_cells(APR<uint16_t>& apr,const MeshData<float>& image,ExtraParticleData<float>& parts){
+    //
+    //  Mean of the image over the pixels of each particle cell
+    //
+
+    parts.init(apr);
+
+    APRIterator<uint16_t> apr_iterator(apr);
+    uint64_t particle_number;
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static) private(particle_number) firstprivate(apr_iterator)
+#endif
+    for (particle_number = 0; particle_number < apr_iterator.total_number_particles(); ++particle_number) {
+        apr_iterator.set_iterator_to_particle_by_number(particle_number);
+
+        const uint64_t step_size = ((uint64_t) 1) << (apr_iterator.level_max() - apr_iterator.level());
+        double sum = 0;
+        uint64_t count = 0;
+        for (uint64_t z = apr_iterator.z()*step_size; z < std::min((uint64_t)(apr_iterator.z() + 1)*step_size, image.z_num); ++z) {
+            for (uint64_t x = apr_iterator.x()*step_size; x < std::min((uint64_t)(apr_iterator.x() + 1)*step_size, image.x_num); ++x) {
+                for (uint64_t y = apr_iterator.y()*step_size; y < std::min((uint64_t)(apr_iterator.y() + 1)*step_size, image.y_num); ++y) {
+                    sum += image.mesh[z*image.x_num*image.y_num + x*image.y_num + y];
+                    count++;
+                }
+            }
+        }
+        parts[apr_iterator] = sum/count;
+    }
+}
+
+BenchmarkResult run_benchmark(APR<uint16_t>& apr,APRTree<uint16_t>& apr_tree,const APRConvolutionKernel& kernel,int number_reps){
+
+    BenchmarkResult result;
+
+    APRTimer timer;
+    timer.verbose_flag = false;
+
+    APRFilter apr_filter;
+    ExtraParticleData<float> apr_filtered;
+
+    for (int r = 0; r < number_reps; ++r) {
+        timer.start_timer("apr");
+        apr_filter.convolve(apr,apr_tree,apr.particles_intensities,apr_filtered,kernel);
+        timer.stop_timer();
+        result.apr_time += timer.timings.back()/number_reps;
+    }
+
+    ExtraParticleData<float> mesh_filtered;
+
+    for (int r = 0; r < number_reps; ++r) {
+        timer.start_timer("mesh");
+        MeshData<uint16_t> image;
+        MeshData<float> filtered_image;
+        apr.interp_img(image,apr.particles_intensities);
+        APRFilter::convolve_mesh(image,filtered_image,kernel);
+        mean_over_particle_cells(apr,filtered_image,mesh_filtered);
+        timer.stop_timer();
+        result.mesh_time += timer.timings.back()/number_reps;
+    }
+
+    double error_squared = 0;
+    double value_squared = 0;
+    double max_error = 0;
+    double max_value = 0;
+    for (uint64_t p = 0; p < apr.total_number_particles(); ++p) {
+        const double error = apr_filtered.data[p] - mesh_filtered.data[p];
+        error_squared += error*error;
+        value_squared += mesh_filtered.data[p]*mesh_filtered.data[p];
+        max_error = std::max(max_error,std::abs(error));
+        max_value = std::max(max_value,(double)std::abs(mesh_filtered.data[p]));
+    }
+    result.relative_rms_error = std::sqrt(error_squared/value_squared);
+    result.relative_max_error = max_error/max_value;
+
+    return result;
+}
+
+int main(int argc, char **argv) {
+
+    // INPUT PARSING
+
+    cmdLineOptions options = read_command_line_options(argc, argv);
+
+    // Filename
+    std::string file_name = options.directory + options.input;
+
+    // APR datastructure
+    APR<uint16_t> apr;
+
+    //read file
+    apr.read_apr(file_name);
+
+    APRTimer timer;
+    timer.verbose_flag = false;
+
+    timer.start_timer("tree");
+    APRTree<uint16_t> apr_tree(apr);
+    timer.stop_timer();
+
+    const std::vector<std::string> names = {"gaussian","log","dog"};
+    const std::vector<APRConvolutionKernel> kernels = {APRConvolutionKernel::gaussian(options.sigma,options.size),
+                                                       APRConvolutionKernel::laplacian_of_gaussian(options.sigma,options.size),
+                                                       APRConvolutionKernel::difference_of_gaussians(options.sigma,2*options.sigma,options.size)};
+
+    const double number_particles = apr.total_number_particles();
+
+    std::cout << "Number of particles: " << apr.total_number_particles() << " Levels: " << apr.level_min() << "-" << apr.level_max() << std::endl;
+    std::cout << "Image: " << apr.orginal_dimensions(0) << "x" << apr.orginal_dimensions(1) << "x" << apr.orginal_dimensions(2) << " Tree: " << timer.timings.back() << " s" << std::endl;
+    std::cout << std::endl;
+
+    std::cout << "kernel apr(Mparts/s) mesh(Mparts/s) speedup relative_rms_error relative_max_error" << std::endl;
+    for (size_t i = 0; i < kernels.size(); ++i) {
+        BenchmarkResult result = run_benchmark(apr,apr_tree,kernels[i],options.number_reps);
+        std::cout << names[i] << " " << number_particles/(result.apr_time*1000000.0) << " " << number_particles/(result.mesh_time*1000000.0) << " " << result.mesh_time/result.apr_time << " " << result.relative_rms_error << " " << result.relative_max_error << std::endl;
+    }
+
+    return 0;
+}
+
+bool command_option_exists(char **begin, char **end, const std::string &option)
+{
+    return std::find(begin, end, option) != end;
+}
+
+char* get_command_option(char **begin, char **end, const std::string &option)
+{
+    char ** itr = std::find(begin, end, option);
+    if (itr != end && ++itr != end)
+    {
+        return *itr;
+    }
+    return 0;
+}
+
+cmdLineOptions read_command_line_options(int argc, char **argv){
+
+    cmdLineOptions result;
+
+    if(argc == 1) {
+        std::cerr << "Usage: \"Benchmark_apr_filter -i input_apr_file -d directory\"" << std::endl;
+        std::cerr << usage << std::endl;
+        exit(1);
+    }
+
+    if(command_option_exists(argv, argv + argc, "-i"))
+    {
+        result.input = std::string(get_command_option(argv, argv + argc, "-i"));
+    } else {
+        std::cout << "Input file required" << std::endl;
+        exit(2);
+    }
+
+    if(command_option_exists(argv, argv + argc, "-d"))
+    {
+        result.directory = std::string(get_command_option(argv, argv + argc, "-d"));
+    }
+
+    if(command_option_exists(argv, argv + argc, "-reps"))
+    {
+        result.number_reps = std::stoi(std::string(get_command_option(argv, argv + argc, "-reps")));
+    }
+
+    if(command_option_exists(argv, argv + argc, "-sigma"))
+    {
+        result.sigma = std::stof(std::string(get_command_option(argv, argv + argc, "-sigma")));
+    }
+
+    if(command_option_exists(argv, argv + argc, "-size"))
+    {
+        result.size = std::stoi(std::string(get_command_option(argv, argv + argc, "-size")));
+    }
+
+    return result;
+
+}
@@ -0,0 +1,207 @@
+const char* usage = R"(
+Benchmarks writing and reading APR files, comparing the parallel (direct chunk) blosc compression with the serial HDF5
+filter pipeline, for different chunk sizes and numbers of threads, and the uncompressed memory mapped native format.
+Throughput is given in MB/s of uncompressed data.
+
+Usage:
+
+(using *_apr.h5 output of Example_get_apr)
+
+Benchmark_apr_io -i input_apr_file -d directory
+
+Options:
+
+-o output name of the files written during the benchmark (default output, written to directory)
+-chunk chunk size in elements (default tests 16384, 100000 and 1000000)
+-reps number of repeats for the timings (default 5)
+
+)";
+
+#include <algorithm>
+#include <iostream>
+#include "Benchmark_apr_io.hpp"
+
+struct BenchmarkResult{
+    double write_time = 0;
+    double read_time = 0;
+    double file_size = 0;
+};
+
+BenchmarkResult run_benchmark(APR<uint16_t>& apr,const std::string& directory,const std::string& name,uint64_t chunk_size,bool direct_chunk_io,int number_reps){
+
+    BenchmarkResult result;
+
+    APRTimer timer;
+    timer.verbose_flag = false;
+
+    APRWriter apr_writer;
+    APRCompress<uint16_t> apr_compressor;
+    apr_compressor.set_compression_type(0);
+
+    apr_writer.direct_chunk_io = direct_chunk_io;
+
+    for (int r = 0; r < number_reps; ++r) {
+        timer.start_timer("write");
+        result.file_size = apr_writer.write_apr(apr,directory,name,apr_compressor,BLOSC_ZSTD,2,1,0,chunk_size);
+        timer.stop_timer();
+        result.write_time += timer.timings.back()/number_reps;
+
+        APR<uint16_t> apr_read;
+        timer.start_timer("read");
+        apr_writer.read_apr(apr_read,directory + name + "_apr.h5");
+        timer.stop_timer();
+        result.read_time += timer.timings.back()/number_reps;
+    }
+
+    return result;
+}
+
+int main(int argc, char **argv) {
+
+    // INPUT PARSING
+
+    cmdLineOptions options = read_command_line_options(argc, argv);
+
+    // Filename
+    std::string file_name = options.directory + options.input;
+
+    // APR datastructure
+    APR<uint16_t> apr;
+
+    //read file
+    apr.read_apr(file_name);
+
+    MapStorageData map_data;
+    apr.apr_access.flatten_structure(apr,map_data);
+
+    //uncompressed size of the data written to file
+    const double data_size = apr.total_number_particles()*sizeof(uint16_t) + map_data.global_index.size()*3*sizeof(uint16_t) +
+                             map_data.number_gaps.size()*(3*sizeof(uint16_t) + sizeof(uint8_t)) + apr.apr_access.particle_cell_type.data.size();
+
+    std::vector<uint64_t> chunk_sizes = {16384,100000,1000000};
+    if(options.chunk_size > 0){
+        chunk_sizes = {options.chunk_size};
+    }
+
+    std::vector<int> number_threads = {1};
+#ifdef HAVE_OPENMP
+    const int max_threads = omp_get_max_threads();
+    if(max_threads > 1){
+        number_threads.push_back(max_threads);
+    }
+#endif
+
+    std::vector<std::string> lines;
+
+    for (uint64_t chunk_size : chunk_sizes) {
+        for (int threads : number_threads) {
+#ifdef HAVE_OPENMP
+            omp_set_num_threads(threads);
+#endif
+            for (bool direct_chunk_io : {false, true}) {
+                BenchmarkResult result = run_benchmark(apr,options.directory,options.output,chunk_size,direct_chunk_io,options.number_reps);
+
+                lines.push_back((direct_chunk_io ? "direct " : "filter ") + std::to_string(chunk_size) + " " + std::to_string(threads) + " " +
+                                std::to_string(result.file_size) + " " + std::to_string(data_size/(1e6*result.write_time)) + " " +
+                                std::to_string(data_size/(1e6*result.read_time)));
+            }
+        }
+    }
+
+#ifdef HAVE_OPENMP
+    omp_set_num_threads(max_threads);
+#endif
+
+    //native format, opening maps the file (particles included) so the read time does not include touching the data
+    {
+        BenchmarkResult result;
+        APRTimer timer;
+        timer.verbose_flag = false;
+        APRWriter apr_writer;
+
+        for (int r = 0; r < options.number_reps; ++r) {
+            timer.start_timer("write native");
+            result.file_size = apr_writer.write_apr_native(apr,options.directory,options.output);
+            timer.stop_timer();
+            result.write_time += timer.timings.back()/options.number_reps;
+
+            APR<uint16_t> apr_read;
+            MappedParticleData<uint16_t> particles;
+            timer.start_timer("open native");
+            apr_read.read_apr_native(options.directory + options.output + ".apr",particles);
+            timer.stop_timer();
+            result.read_time += timer.timings.back()/options.number_reps;
+        }
+
+        lines.push_back("native - - " + std::to_string(result.file_size) + " " + std::to_string(data_size/(1e6*result.write_time)) + " " +
+                        std::to_string(data_size/(1e6*result.read_time)));
+    }
+
+    std::cout << std::endl;
+    std::cout << "Number of particles: " << apr.total_number_particles() << " Uncompressed data: " << data_size/1e6 << " MB" << std::endl;
+    std::cout << std::endl;
+
+    std::cout << "io chunk_size threads file(MB) write(MB/s) read(MB/s)" << std::endl;
+    for (const std::string& line : lines) {
+        std::cout << line << std::endl;
+    }
+
+    return 0;
+}
+
+bool command_option_exists(char **begin, char **end, const std::string &option)
+{
+    return std::find(begin, end, option) != end;
+}
+
+char* get_command_option(char **begin, char **end, const std::string &option)
+{
+    char ** itr = std::find(begin, end, option);
+    if (itr != end && ++itr != end)
+    {
+        return *itr;
+    }
+    return 0;
+}
+
+cmdLineOptions read_command_line_options(int argc, char **argv){
+
+    cmdLineOptions result;
+
+    if(argc == 1) {
+        std::cerr << "Usage: \"Benchmark_apr_io -i input_apr_file -d directory\"" << std::endl;
+        std::cerr << usage << std::endl;
+        exit(1);
+    }
+
+    if(command_option_exists(argv, argv + argc, "-i"))
+    {
+        result.input = std::string(get_command_option(argv, argv + argc, "-i"));
+    } else {
+        std::cout << "Input file required" << std::endl;
+        exit(2);
+    }
+
+    if(command_option_exists(argv, argv + argc, "-d"))
+    {
+        result.directory = std::string(get_command_option(argv, argv + argc, "-d"));
+    }
+
+    if(command_option_exists(argv, argv + argc, "-o"))
+    {
+        result.output = std::string(get_command_option(argv, argv + argc, "-o"));
+    }
+
+    if(command_option_exists(argv, argv + argc, "-chunk"))
+    {
+        result.chunk_size = std::stoull(std::string(get_command_option(argv, argv + argc, "-chunk")));
+    }
+
+    if(command_option_exists(argv, argv + argc, "-reps"))
+    {
+        result.number_reps = std::stoi(std::string(get_command_option(argv, argv + argc, "-reps")));
+    }
+
+    return result;
+
+}
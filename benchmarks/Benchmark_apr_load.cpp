@@ -0,0 +1,174 @@
+const char* usage = R"(
+Benchmarks loading APR files, comparing building the access structure as std::map rows (inserting each gap), building
+the maps and then converting them to the flat storage, and the bulk construction of the flat storage directly from the
+flattened structure stored in the file (use_flat_map), for 1 and the maximum number of threads.
+
+Usage:
+
+(using *_apr.h5 output of Example_get_apr)
+
+Benchmark_apr_load -i input_apr_file -d directory
+
+Options:
+
+-reps number of repeats for the timings (default 5)
+
+)";
+
+#include <algorithm>
+#include <iostream>
+#include "Benchmark_apr_load.hpp"
+
+enum class BuildMethod {Map, MapToFlat, BulkFlat};
+
+struct BenchmarkResult{
+    double build_time = 0;
+    double load_time = 0;
+};
+
+BenchmarkResult run_benchmark(APR<uint16_t>& apr_input,MapStorageData& map_data,const std::string& file_name,BuildMethod method,int number_reps){
+
+    BenchmarkResult result;
+
+    APRTimer timer;
+    timer.verbose_flag = false;
+
+    APR<uint16_t> apr = apr_input;
+
+    //building the access structure from the flattened structure (as read from file)
+    for (int r = 0; r < number_reps; ++r) {
+        apr.apr_access.gap_map = ExtraPartCellData<ParticleCellGapMap>();
+        apr.apr_access.flat_map.clear();
+        apr.apr_access.use_flat_map = (method == BuildMethod::BulkFlat);
+
+        timer.start_timer("build");
+        apr.apr_access.rebuild_map(apr,map_data);
+        if(method == BuildMethod::MapToFlat){
+            apr.apr_access.build_flat_map();
+        }
+        timer.stop_timer();
+        result.build_time += timer.timings.back()/number_reps;
+    }
+
+    //the full load, including reading and decompressing the file
+    for (int r = 0; r < number_reps; ++r) {
+        APR<uint16_t> apr_read;
+        apr_read.apr_access.use_flat_map = (method == BuildMethod::BulkFlat);
+
+        timer.start_timer("load");
+        apr_read.read_apr(file_name);
+        if(method == BuildMethod::MapToFlat){
+            apr_read.apr_access.build_flat_map();
+        }
+        timer.stop_timer();
+        result.load_time += timer.timings.back()/number_reps;
+    }
+
+    return result;
+}
+
+int main(int argc, char **argv) {
+
+    // INPUT PARSING
+
+    cmdLineOptions options = read_command_line_options(argc, argv);
+
+    // Filename
+    std::string file_name = options.directory + options.input;
+
+    // APR datastructure
+    APR<uint16_t> apr;
+
+    //read file
+    apr.read_apr(file_name);
+
+    MapStorageData map_data;
+    apr.apr_access.flatten_structure(apr,map_data);
+
+    std::vector<int> number_threads = {1};
+#ifdef HAVE_OPENMP
+    const int max_threads = omp_get_max_threads();
+    if(max_threads > 1){
+        number_threads.push_back(max_threads);
+    }
+#endif
+
+    const std::vector<std::pair<BuildMethod,std::string>> methods = {{BuildMethod::Map,"map"},{BuildMethod::MapToFlat,"map_to_flat"},{BuildMethod::BulkFlat,"bulk_flat"}};
+
+    std::vector<std::string> lines;
+
+    for (int threads : number_threads) {
+#ifdef HAVE_OPENMP
+        omp_set_num_threads(threads);
+#endif
+        for (const auto& method : methods) {
+            BenchmarkResult result = run_benchmark(apr,map_data,file_name,method.first,options.number_reps);
+
+            lines.push_back(method.second + " " + std::to_string(threads) + " " + std::to_string(result.build_time*1000) + " " +
+                            std::to_string(result.load_time*1000));
+        }
+    }
+
+#ifdef HAVE_OPENMP
+    omp_set_num_threads(max_threads);
+#endif
+
+    std::cout << std::endl;
+    std::cout << "Number of particles: " << apr.total_number_particles() << " Number of gaps: " << map_data.global_index.size() <<
+              " Number of non-empty rows: " << map_data.number_gaps.size() << std::endl;
+    std::cout << std::endl;
+
+    std::cout << "method threads build(ms) load(ms)" << std::endl;
+    for (const std::string& line : lines) {
+        std::cout << line << std::endl;
+    }
+
+    return 0;
+}
+
+bool command_option_exists(char **begin, char **end, const std::string &option)
+{
+    return std::find(begin, end, option) != end;
+}
+
+char* get_command_option(char **begin, char **end, const std::string &option)
+{
+    char ** itr = std::find(begin, end, option);
+    if (itr != end && ++itr != end)
+    {
+        return *itr;
+    }
+    return 0;
+}
+
+cmdLineOptions read_command_line_options(int argc, char **argv){
+
+    cmdLineOptions result;
+
+    if(argc == 1) {
+        std::cerr << "Usage: \"Benchmark_apr_load -i input_apr_file -d directory\"" << std::endl;
+        std::cerr << usage << std::endl;
+        exit(1);
+    }
+
+    if(command_option_exists(argv, argv + argc, "-i"))
+    {
+        result.input = std::string(get_command_option(argv, argv + argc, "-i"));
+    } else {
+        std::cout << "Input file required" << std::endl;
+        exit(2);
+    }
+
+    if(command_option_exists(argv, argv + argc, "-d"))
+    {
+        result.directory = std::string(get_command_option(argv, argv + argc, "-d"));
+    }
+
+    if(command_option_exists(argv, argv + argc, "-reps"))
+    {
+        result.number_reps = std::stoi(std::string(get_command_option(argv, argv + argc, "-reps")));
+    }
+
+    return result;
+
+}
@@ -0,0 +1,261 @@
+const char* usage = R"(
+Benchmarks solving alpha*u - lambda*laplacian(u) = f, with f the particle intensities, on the particles
+(APRDiffusionSolver) with the Gauss-Seidel smoother alone and with multigrid V-cycles over the levels of the APR
+(Jacobi and Gauss-Seidel smoothing), against a red-black Gauss-Seidel solver on the pixels of the reconstructed image.
+Reports the iterations to reach the tolerance, the mean residual reduction per iteration and the times.
+
+Usage:
+
+(using *_apr.h5 output of Example_get_apr)
+
+Benchmark_apr_solver -i input_apr_file -d directory
+
+Options:
+
+-lambda diffusion coefficient (default 1)
+-alpha coefficient of u, 0 for the Poisson problem (default 1)
+-tol relative residual to stop at (default 1e-6)
+-max_its maximum number of iterations of the smoother-only solvers (default 200)
+
+)";
+
+#include <algorithm>
+#include <iostream>
+#include <cmath>
+#include "Benchmark_apr_solver.hpp"
+
+struct BenchmarkResult{
+    uint64_t number_cells = 0;
+    std::vector<double> residuals;
+    double time = 0;
+};
+
+class MeshDiffusionSolver {
+    //
+    //  Reference solver on the pixels (h = 1, Neumann boundary), red-black Gauss-Seidel
+    //
+
+public:
+
+    MeshDiffusionSolver(const MeshData<uint16_t>& rhs,const float lambda,const float alpha) : image(rhs), lambda(lambda), alpha(alpha) {
+        u.resize(image.mesh.size(), 0);
+        f.assign(image.mesh.begin(), image.mesh.end());
+
+        if (alpha == 0) {
+            //zero mean right hand side for the Poisson problem
+            double mean = 0;
+            for (double v : f) mean += v;
+            mean /= f.size();
+            for (double& v : f) v -= mean;
+        }
+    }
+
+    std::vector<double> solve(const double tolerance,const int max_iterations){
+
+        double f_norm = 0;
+        for (double v : f) {
+            f_norm += v*v;
+        }
+        f_norm = std::sqrt(f_norm);
+
+        std::vector<double> residuals = {std::sqrt(residual())/f_norm};
+        for (int iteration = 0; (iteration < max_iterations) && (residuals.back() > tolerance); ++iteration) {
+            sweep(0);
+            sweep(1);
+            residuals.push_back(std::sqrt(residual())/f_norm);
+        }
+        return residuals;
+    }
+
+private:
+
+    const MeshData<uint16_t>& image;
+    std::vector<double> f;
+    std::vector<double> u;
+    float lambda;
+    float alpha;
+
+    template<typename Function>
+    void for_each_pixel(const int colour,Function function){
+        const int64_t y_num = image.y_num;
+        const int64_t x_num = image.x_num;
+        const int64_t z_num = image.z_num;
+        int64_t z;
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static) private(z)
+#endif
+        for (z = 0; z < z_num; ++z) {
+            for (int64_t x = 0; x < x_num; ++x) {
+                const int64_t y_begin = (colour < 0) ? 0 : ((z + x + colour) & 1);
+                const int64_t y_step = (colour < 0) ? 1 : 2;
+                for (int64_t y = y_begin; y < y_num; y += y_step) {
+                    const int64_t i = z*x_num*y_num + x*y_num + y;
+                    double sum = 0;
+                    int count = 0;
+                    if (y > 0) { sum += u[i - 1]; count++; }
+                    if (y < y_num - 1) { sum += u[i + 1]; count++; }
+                    if (x > 0) { sum += u[i - y_num]; count++; }
+                    if (x < x_num - 1) { sum += u[i + y_num]; count++; }
+                    if (z > 0) { sum += u[i - x_num*y_num]; count++; }
+                    if (z < z_num - 1) { sum += u[i + x_num*y_num]; count++; }
+                    function(i, sum, count);
+                }
+            }
+        }
+    }
+
+    void sweep(const int colour){
+        for_each_pixel(colour, [&](const int64_t i, const double sum, const int count) {
+            u[i] = (f[i] + lambda*sum)/(alpha + lambda*count);
+        });
+    }
+
+    double residual(){
+        std::vector<double> squares(image.z_num, 0);
+        for_each_pixel(-1, [&](const int64_t i, const double sum, const int count) {
+            const double r = f[i] - (alpha + lambda*count)*u[i] + lambda*sum;
+            squares[i/(image.x_num*image.y_num)] += r*r;
+        });
+        double norm = 0;
+        for (double s : squares) norm += s;
+        return norm;
+    }
+};
+
+BenchmarkResult run_apr_solver(APR<uint16_t>& apr,APRDiffusionSolver& solver,APRSmoother smoother,bool use_multigrid,const cmdLineOptions& options){
+
+    BenchmarkResult result;
+    result.number_cells = apr.total_number_particles();
+
+    solver.smoother = smoother;
+    solver.use_multigrid = use_multigrid;
+    solver.tolerance = options.tolerance;
+    solver.max_iterations = use_multigrid ? 100 : options.max_iterations;
+
+    APRTimer timer;
+    timer.verbose_flag = false;
+
+    ExtraParticleData<float> solution;
+    timer.start_timer("solve");
+    result.residuals = solver.solve(apr.particles_intensities,solution);
+    timer.stop_timer();
+    result.time = timer.timings.back();
+
+    return result;
+}
+
+void print_result(const std::string& name,const BenchmarkResult& result){
+    const uint64_t iterations = result.residuals.size() - 1;
+    const double factor = std::pow(result.residuals.back()/result.residuals.front(),1.0/std::max(iterations,(uint64_t) 1));
+    std::cout << name << " " << result.number_cells << " " << iterations << " " << result.residuals.back() << " " << factor << " " << result.time/std::max(iterations,(uint64_t) 1) << " " << result.time << std::endl;
+}
+
+int main(int argc, char **argv) {
+
+    // INPUT PARSING
+
+    cmdLineOptions options = read_command_line_options(argc, argv);
+
+    // Filename
+    std::string file_name = options.directory + options.input;
+
+    // APR datastructure
+    APR<uint16_t> apr;
+
+    //read file
+    apr.read_apr(file_name);
+
+    APRTimer timer;
+    timer.verbose_flag = false;
+
+    timer.start_timer("init");
+    APRDiffusionSolver solver(apr,options.lambda,options.alpha);
+    timer.stop_timer();
+
+    std::cout << "Number of particles: " << apr.total_number_particles() << " Levels: " << apr.level_min() << "-" << apr.level_max() << std::endl;
+    std::cout << "Image: " << apr.orginal_dimensions(0) << "x" << apr.orginal_dimensions(1) << "x" << apr.orginal_dimensions(2) << std::endl;
+    std::cout << "Solver setup (neighbours and " << solver.number_grids() << " grids): " << timer.timings.back() << " s" << std::endl;
+    std::cout << std::endl;
+
+    std::cout << "solver cells iterations relative_residual reduction_per_iteration time_per_iteration(s) time(s)" << std::endl;
+    print_result("apr_gauss_seidel", run_apr_solver(apr,solver,APRSmoother::GaussSeidel,false,options));
+    print_result("apr_multigrid_jacobi", run_apr_solver(apr,solver,APRSmoother::Jacobi,true,options));
+    print_result("apr_multigrid_gauss_seidel", run_apr_solver(apr,solver,APRSmoother::GaussSeidel,true,options));
+
+    MeshData<uint16_t> image;
+    apr.interp_img(image,apr.particles_intensities);
+
+    BenchmarkResult mesh_result;
+    mesh_result.number_cells = image.mesh.size();
+    MeshDiffusionSolver mesh_solver(image,options.lambda,options.alpha);
+    timer.start_timer("mesh");
+    mesh_result.residuals = mesh_solver.solve(options.tolerance,options.max_iterations);
+    timer.stop_timer();
+    mesh_result.time = timer.timings.back();
+    print_result("mesh_gauss_seidel", mesh_result);
+
+    return 0;
+}
+
+bool command_option_exists(char **begin, char **end, const std::string &option)
+{
+    return std::find(begin, end, option) != end;
+}
+
+char* get_command_option(char **begin, char **end, const std::string &option)
+{
+    char ** itr = std::find(begin, end, option);
+    if (itr != end && ++itr != end)
+    {
+        return *itr;
+    }
+    return 0;
+}
+
+cmdLineOptions read_command_line_options(int argc, char **argv){
+
+    cmdLineOptions result;
+
+    if(argc == 1) {
+        std::cerr << "Usage: \"Benchmark_apr_solver -i input_apr_file -d directory\"" << std::endl;
+        std::cerr << usage << std::endl;
+        exit(1);
+    }
+
+    if(command_option_exists(argv, argv + argc, "-i"))
+    {
+        result.input = std::string(get_command_option(argv, argv + argc, "-i"));
+    } else {
+        std::cout << "Input file required" << std::endl;
+        exit(2);
+    }
+
+    if(command_option_exists(argv, argv + argc, "-d"))
+    {
+        result.directory = std::string(get_command_option(argv, argv + argc, "-d"));
+    }
+
+    if(command_option_exists(argv, argv + argc, "-lambda"))
+    {
+        result.lambda = std::stof(std::string(get_command_option(argv, argv + argc, "-lambda")));
+    }
+
+    if(command_option_exists(argv, argv + argc, "-alpha"))
+    {
+        result.alpha = std::stof(std::string(get_command_option(argv, argv + argc, "-alpha")));
+    }
+
+    if(command_option_exists(argv, argv + argc, "-tol"))
+    {
+        result.tolerance = std::stod(std::string(get_command_option(argv, argv + argc, "-tol")));
+    }
+
+    if(command_option_exists(argv, argv + argc, "-max_its"))
+    {
+        result.max_iterations = std::stoi(std::string(get_command_option(argv, argv + argc, "-max_its")));
+    }
+
+    return result;
+
+}
@@ -0,0 +1,25 @@
+#ifndef PARTPLAY_BENCHMARK_APR_SOLVER_HPP
+#define PARTPLAY_BENCHMARK_APR_SOLVER_HPP
+
+#include <functional>
+#include <string>
+
+#include "data_structures/APR/APR.hpp"
+#include "numerics/APRSolver.hpp"
+
+struct cmdLineOptions{
+    std::string directory = "";
+    std::string input = "";
+    float lambda = 1.0f;
+    float alpha = 1.0f;
+    double tolerance = 1e-6;
+    int max_iterations = 200;
+};
+
+cmdLineOptions read_command_line_options(int argc, char **argv);
+
+bool command_option_exists(char **begin, char **end, const std::string &option);
+
+char* get_command_option(char **begin, char **end, const std::string &option);
+
+#endif //PARTPLAY_BENCHMARK_APR_SOLVER_HPP
@@ -0,0 +1,166 @@
+const char* usage = R"(
+Benchmarks converting a series of TIFF files to APR files (the input image converted -frames times, as the stacks of
+a time-series), reading, converting and writing each file in turn vs the pipeline of APRBatchConverter, which reads
+the next images and writes the previous APRs while converting. Reports the time per file of both, and for the
+pipeline the time each stage spent working and waiting, and its utilisation.
+
+Usage:
+
+Benchmark_batch_pipeline -i input_image_tiff -d directory -o output_directory
+
+Options:
+
+-frames number of files converted (default 10)
+-queue number of images (and of APRs) held between the stages (default 2)
+-read_threads threads reading files (default 1)
+-convert_threads OpenMP threads of the conversion (default all)
+-write_threads OpenMP threads compressing the APR files (default all)
+-Ip_th -lambda -rel_error as for Example_get_apr
+
+)";
+
+#include <algorithm>
+#include <iostream>
+#include "Benchmark_batch_pipeline.hpp"
+
+int main(int argc, char **argv) {
+
+    // INPUT PARSING
+    cmdLineOptions options = read_command_line_options(argc, argv);
+
+    APRParameters par;
+    par.input_dir = options.directory;
+    par.output_dir = options.output_dir;
+    par.Ip_th = options.Ip_th;
+    par.lambda = options.lambda;
+    par.rel_error = options.rel_error;
+
+    std::vector<std::string> input_files(options.number_frames, options.input);
+    std::vector<std::string> output_names;
+    for (int f = 0; f < options.number_frames; ++f) {
+        output_names.push_back("batch_frame_" + std::to_string(f));
+    }
+
+    //each file in turn
+    APRTimer timer;
+    timer.start_timer("serial");
+    for (int f = 0; f < options.number_frames; ++f) {
+        MeshData<uint16_t> input_image = TiffUtils::getMesh<uint16_t>(par.input_dir + input_files[f]);
+
+        APR<uint16_t> apr;
+        APRConverter<uint16_t> apr_converter;
+        apr_converter.par = par;
+        if (!apr_converter.get_apr(apr, input_image)) {
+            std::cerr << "Could not convert " << par.input_dir + input_files[f] << std::endl;
+            return 1;
+        }
+        apr.write_apr(par.output_dir, output_names[f]);
+    }
+    timer.stop_timer();
+    const double serial_time = timer.timings.back();
+
+    APRBatchConverter<uint16_t> batch_converter;
+    batch_converter.par = par;
+    batch_converter.queue_size = options.queue_size;
+    batch_converter.read_threads = options.read_threads;
+    batch_converter.convert_threads = options.convert_threads;
+    batch_converter.write_threads = options.write_threads;
+    if (!batch_converter.convert_files(input_files, output_names)) {
+        return 1;
+    }
+
+    std::cout << "serial " << serial_time/options.number_frames*1000 << " ms per file" << std::endl;
+    std::cout << "pipeline " << batch_converter.total_time/options.number_frames*1000 << " ms per file (speed-up "
+              << serial_time/batch_converter.total_time << ")" << std::endl;
+    batch_converter.print_statistics();
+
+    return 0;
+}
+
+bool command_option_exists(char **begin, char **end, const std::string &option)
+{
+    return std::find(begin, end, option) != end;
+}
+
+char* get_command_option(char **begin, char **end, const std::string &option)
+{
+    char ** itr = std::find(begin, end, option);
+    if (itr != end && ++itr != end)
+    {
+        return *itr;
+    }
+    return 0;
+}
+
+cmdLineOptions read_command_line_options(int argc, char **argv){
+
+    cmdLineOptions result;
+
+    if(argc == 1) {
+        std::cerr << "Usage: \"Benchmark_batch_pipeline -i input_image_tiff -d directory -o output_directory\"" << std::endl;
+        std::cerr << usage << std::endl;
+        exit(1);
+    }
+
+    if(command_option_exists(argv, argv + argc, "-i"))
+    {
+        result.input = std::string(get_command_option(argv, argv + argc, "-i"));
+    } else {
+        std::cout << "Input file required" << std::endl;
+        exit(2);
+    }
+
+    if(command_option_exists(argv, argv + argc, "-d"))
+    {
+        result.directory = std::string(get_command_option(argv, argv + argc, "-d"));
+    }
+
+    if(command_option_exists(argv, argv + argc, "-o"))
+    {
+        result.output_dir = std::string(get_command_option(argv, argv + argc, "-o"));
+    } else {
+        result.output_dir = result.directory;
+    }
+
+    if(command_option_exists(argv, argv + argc, "-frames"))
+    {
+        result.number_frames = std::max(1, std::stoi(std::string(get_command_option(argv, argv + argc, "-frames"))));
+    }
+
+    if(command_option_exists(argv, argv + argc, "-queue"))
+    {
+        result.queue_size = std::max(1, std::stoi(std::string(get_command_option(argv, argv + argc, "-queue"))));
+    }
+
+    if(command_option_exists(argv, argv + argc, "-read_threads"))
+    {
+        result.read_threads = std::max(1, std::stoi(std::string(get_command_option(argv, argv + argc, "-read_threads"))));
+    }
+
+    if(command_option_exists(argv, argv + argc, "-convert_threads"))
+    {
+        result.convert_threads = std::max(0, std::stoi(std::string(get_command_option(argv, argv + argc, "-convert_threads"))));
+    }
+
+    if(command_option_exists(argv, argv + argc, "-write_threads"))
+    {
+        result.write_threads = std::max(0, std::stoi(std::string(get_command_option(argv, argv + argc, "-write_threads"))));
+    }
+
+    if(command_option_exists(argv, argv + argc, "-Ip_th"))
+    {
+        result.Ip_th = std::stof(std::string(get_command_option(argv, argv + argc, "-Ip_th")));
+    }
+
+    if(command_option_exists(argv, argv + argc, "-lambda"))
+    {
+        result.lambda = std::stof(std::string(get_command_option(argv, argv + argc, "-lambda")));
+    }
+
+    if(command_option_exists(argv, argv + argc, "-rel_error"))
+    {
+        result.rel_error = std::stof(std::string(get_command_option(argv, argv + argc, "-rel_error")));
+    }
+
+    return result;
+}
@@ -0,0 +1,28 @@
+#ifndef PARTPLAY_BENCHMARK_BATCH_PIPELINE_HPP
+#define PARTPLAY_BENCHMARK_BATCH_PIPELINE_HPP
+
+#include <string>
+
+#include "algorithm/APRBatchConverter.hpp"
+
+struct cmdLineOptions{
+    std::string directory = "";
+    std::string output_dir = "";
+    std::string input = "";
+    int number_frames = 10;
+    int queue_size = 2;
+    int read_threads = 1;
+    int convert_threads = 0;
+    int write_threads = 0;
+    float Ip_th = -1;
+    float lambda = -1;
+    float rel_error = 0.1;
+};
+
+cmdLineOptions read_command_line_options(int argc, char **argv);
+
+bool command_option_exists(char **begin, char **end, const std::string &option);
+
+char* get_command_option(char **begin, char **end, const std::string &option);
+
+#endif //PARTPLAY_BENCHMARK_BATCH_PIPELINE_HPP
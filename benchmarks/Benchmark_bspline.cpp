@@ -0,0 +1,207 @@
+const char* usage = R"(
+Benchmarks the b-spline smoothing and gradient stage of the APR conversion, timing each of the separate passes over the
+image (and its down-sampled copy) and the fused version streaming through the image in z. The bandwidth (GB/s) is
+the data read and written by each pass divided by its time, for the fused version it is given for the same data as the
+sum of the separate passes (so it can be compared with them). The recursive filters and the fused version are then
+timed for each instruction set of the SIMD kernels supported by the CPU (and the scalar code).
+
+Usage:
+
+Benchmark_bspline -i input_image_tiff -d directory
+
+or, for a synthetic image,
+
+Benchmark_bspline -size 256
+
+Options:
+
+-size size of the synthetic (cubic) image (default 256)
+-reps number of repeats for the timings (default 5)
+
+)";
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include "Benchmark_bspline.hpp"
+
+typedef uint16_t ImageType;
+
+struct Stage{
+    std::string name;
+    double bytes; // read + written
+    std::function<void(MeshData<ImageType>&,MeshData<ImageType>&,MeshData<float>&)> run;
+    double time = 0;
+};
+
+int main(int argc, char **argv) {
+
+    // INPUT PARSING
+
+    cmdLineOptions options = read_command_line_options(argc, argv);
+
+    MeshData<ImageType> input_image;
+    if(options.input.size() > 0){
+        input_image = TiffUtils::getMesh<ImageType>(options.directory + options.input);
+    } else {
+        input_image.init(options.image_size, options.image_size, options.image_size);
+        std::mt19937 generator(0);
+        std::uniform_int_distribution<int> noise(0, 200);
+        for (size_t i = 0; i < input_image.mesh.size(); ++i) {
+            input_image.mesh[i] = 1000 + noise(generator);
+        }
+    }
+
+    const float lambda = 3;
+    const float tol = 0.0001;
+    const double full = input_image.mesh.size()*sizeof(ImageType);
+    const double full_ds = full/8;
+    const double full_ds_float = full_ds*sizeof(float)/sizeof(ImageType);
+
+    ComputeGradient compute_gradient;
+
+    std::vector<Stage> stages = {
+            {"bspline_filt_rec_y", 2*full, [&](MeshData<ImageType>& image,MeshData<ImageType>&,MeshData<float>&){ compute_gradient.bspline_filt_rec_y(image,lambda,tol); }},
+            {"bspline_filt_rec_x", 2*full, [&](MeshData<ImageType>& image,MeshData<ImageType>&,MeshData<float>&){ compute_gradient.bspline_filt_rec_x(image,lambda,tol); }},
+            {"bspline_filt_rec_z", 2*full, [&](MeshData<ImageType>& image,MeshData<ImageType>&,MeshData<float>&){ compute_gradient.bspline_filt_rec_z(image,lambda,tol); }},
+            {"calc_bspline_fd_ds_mag", full + 2*full_ds, [&](MeshData<ImageType>& image,MeshData<ImageType>& grad,MeshData<float>&){ compute_gradient.calc_bspline_fd_ds_mag(image,grad,1,1,1); }},
+            {"downsample", full + full_ds_float, [&](MeshData<ImageType>& image,MeshData<ImageType>&,MeshData<float>& local_scale){
+                downsample(image, local_scale, [](const float &x, const float &y) -> float { return x + y; }, [](const float &x) -> float { return x / 8.0; }); }},
+            {"calc_inv_bspline_y", 2*full_ds_float, [&](MeshData<ImageType>&,MeshData<ImageType>&,MeshData<float>& local_scale){ compute_gradient.calc_inv_bspline_y(local_scale); }},
+            {"calc_inv_bspline_x", 2*full_ds_float, [&](MeshData<ImageType>&,MeshData<ImageType>&,MeshData<float>& local_scale){ compute_gradient.calc_inv_bspline_x(local_scale); }},
+    };
+
+    double total_bytes = 0;
+    for (const Stage& stage : stages) {
+        total_bytes += stage.bytes;
+    }
+
+    Stage fused = {"fused", total_bytes, [&](MeshData<ImageType>& image,MeshData<ImageType>& grad,MeshData<float>& local_scale){
+        compute_gradient.get_gradient_bspline_fused(image,grad,local_scale,lambda,1,1,1); }};
+
+    APRTimer timer;
+    timer.verbose_flag = false;
+
+    MeshData<ImageType> image;
+    MeshData<ImageType> grad;
+    MeshData<float> local_scale;
+
+    double separate_time = 0;
+
+    for (int r = 0; r < options.number_reps; ++r) {
+        image.init(input_image);
+        std::copy(input_image.mesh.begin(), input_image.mesh.end(), image.mesh.begin());
+        grad.initDownsampled(image.y_num, image.x_num, image.z_num, 0);
+        local_scale.initDownsampled(image.y_num, image.x_num, image.z_num);
+
+        //the stages are run in the order of the conversion, each on the output of the previous one
+        for (Stage& stage : stages) {
+            timer.start_timer(stage.name);
+            stage.run(image,grad,local_scale);
+            timer.stop_timer();
+            stage.time += timer.timings.back()/options.number_reps;
+            separate_time += timer.timings.back()/options.number_reps;
+        }
+
+        std::copy(input_image.mesh.begin(), input_image.mesh.end(), image.mesh.begin());
+        grad.initDownsampled(image.y_num, image.x_num, image.z_num, 0);
+
+        timer.start_timer(fused.name);
+        fused.run(image,grad,local_scale);
+        timer.stop_timer();
+        fused.time += timer.timings.back()/options.number_reps;
+    }
+
+    std::cout << std::endl;
+    std::cout << "Image: " << input_image.y_num << "x" << input_image.x_num << "x" << input_image.z_num << " (" << full/1e6 << " MB)" << std::endl;
+    std::cout << std::endl;
+
+    std::cout << "stage time(ms) bandwidth(GB/s)" << std::endl;
+    for (const Stage& stage : stages) {
+        std::cout << stage.name << " " << stage.time*1000 << " " << stage.bytes/(1e9*stage.time) << std::endl;
+    }
+    std::cout << "separate_total " << separate_time*1000 << " " << total_bytes/(1e9*separate_time) << std::endl;
+    std::cout << fused.name << " " << fused.time*1000 << " " << fused.bytes/(1e9*fused.time) << std::endl;
+
+    //recursive filters for each instruction set
+    const BsplineSimd::InstructionSet default_set = BsplineSimd::instruction_set();
+    std::vector<Stage> filters = {stages[0], stages[1], stages[2], fused};
+
+    std::cout << std::endl;
+    std::cout << "instruction_set";
+    for (const Stage& filter : filters) {
+        std::cout << " " << filter.name << "(ms)";
+    }
+    std::cout << std::endl;
+
+    for (int set = (int)BsplineSimd::InstructionSet::Scalar; set <= (int)BsplineSimd::supported_instruction_set(); ++set) {
+        BsplineSimd::set_instruction_set((BsplineSimd::InstructionSet)set);
+
+        std::cout << BsplineSimd::instruction_set_name(BsplineSimd::instruction_set());
+        for (Stage& filter : filters) {
+            filter.time = 0;
+            for (int r = 0; r < options.number_reps; ++r) {
+                std::copy(input_image.mesh.begin(), input_image.mesh.end(), image.mesh.begin());
+                timer.start_timer(filter.name);
+                filter.run(image,grad,local_scale);
+                timer.stop_timer();
+                filter.time += timer.timings.back()/options.number_reps;
+            }
+            std::cout << " " << filter.time*1000;
+        }
+        std::cout << std::endl;
+    }
+
+    BsplineSimd::set_instruction_set(default_set);
+
+    return 0;
+}
+
+bool command_option_exists(char **begin, char **end, const std::string &option)
+{
+    return std::find(begin, end, option) != end;
+}
+
+char* get_command_option(char **begin, char **end, const std::string &option)
+{
+    char ** itr = std::find(begin, end, option);
+    if (itr != end && ++itr != end)
+    {
+        return *itr;
+    }
+    return 0;
+}
+
+cmdLineOptions read_command_line_options(int argc, char **argv){
+
+    cmdLineOptions result;
+
+    if(argc == 1) {
+        std::cerr << "Usage: \"Benchmark_bspline -i input_image_tiff -d directory\" or \"Benchmark_bspline -size 256\"" << std::endl;
+        std::cerr << usage << std::endl;
+        exit(1);
+    }
+
+    if(command_option_exists(argv, argv + argc, "-i"))
+    {
+        result.input = std::string(get_command_option(argv, argv + argc, "-i"));
+    }
+
+    if(command_option_exists(argv, argv + argc, "-d"))
+    {
+        result.directory = std::string(get_command_option(argv, argv + argc, "-d"));
+    }
+
+    if(command_option_exists(argv, argv + argc, "-size"))
+    {
+        result.image_size = std::stoull(std::string(get_command_option(argv, argv + argc, "-size")));
+    }
+
+    if(command_option_exists(argv, argv + argc, "-reps"))
+    {
+        result.number_reps = std::stoi(std::string(get_command_option(argv, argv + argc, "-reps")));
+    }
+
+    return result;
+
+}
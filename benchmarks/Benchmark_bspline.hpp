@@ -0,0 +1,22 @@
+#ifndef PARTPLAY_BENCHMARK_BSPLINE_HPP
+#define PARTPLAY_BENCHMARK_BSPLINE_HPP
+
+#include <functional>
+#include <string>
+
+#include "algorithm/APRConverter.hpp"
+
+struct cmdLineOptions{
+    std::string directory = "";
+    std::string input = "";
+    int number_reps = 5;
+    size_t image_size = 256;
+};
+
+cmdLineOptions read_command_line_options(int argc, char **argv);
+
+bool command_option_exists(char **begin, char **end, const std::string &option);
+
+char* get_command_option(char **begin, char **end, const std::string &option);
+
+#endif //PARTPLAY_BENCHMARK_BSPLINE_HPP
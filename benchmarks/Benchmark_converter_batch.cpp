@@ -0,0 +1,152 @@
+const char* usage = R"(
+Benchmarks converting a batch of images with the same dimensions (as the frames of a time-lapse), the image being
+read once and converted -frames times from memory: with a new converter for each frame, with the same converter,
+and with the same converter keeping its workspace (reuse_workspace, the image buffers and the particle cell tree are
+allocated once). For each it reports the time of the first frame and the mean, minimum and maximum time of the
+following frames, and the mean time spent allocating the image buffers per frame.
+
+Usage:
+
+Benchmark_converter_batch -i input_image_tiff -d directory
+
+Options:
+
+-frames number of frames converted (default 20)
+-Ip_th -lambda -rel_error as for Example_get_apr
+
+)";
+
+#include <algorithm>
+#include <iostream>
+#include "Benchmark_converter_batch.hpp"
+
+double sum_timings(const APRTimer& timer,const std::string& name){
+    double sum = 0;
+    for (size_t i = 0; i < std::min(timer.timing_names.size(), timer.timings.size()); ++i) {
+        if (timer.timing_names[i] == name) {
+            sum += timer.timings[i];
+        }
+    }
+    return sum;
+}
+
+int main(int argc, char **argv) {
+
+    // INPUT PARSING
+    cmdLineOptions options = read_command_line_options(argc, argv);
+
+    TiffUtils::TiffInfo input_tiff(options.directory + options.input);
+    if (!input_tiff.isFileOpened() || (input_tiff.iType != TiffUtils::TiffInfo::TiffType::TIFF_UINT16)) {
+        std::cerr << "Could not read " << options.directory + options.input << " (16 bit images only)" << std::endl;
+        return 1;
+    }
+    MeshData<uint16_t> input_image = TiffUtils::getMesh<uint16_t>(input_tiff);
+
+    std::cout << "converter first_frame(ms) per_frame(ms) min_frame(ms) max_frame(ms) allocation_per_frame(ms)" << std::endl;
+
+    for (const std::string mode : {"new", "same", "workspace"}) {
+        std::vector<double> frame_times;
+        double allocation_time = 0;
+
+        APRConverter<uint16_t> apr_converter_same;
+
+        for (int f = 0; f < options.number_frames; ++f) {
+            APRConverter<uint16_t> apr_converter_new;
+            APRConverter<uint16_t>& apr_converter = (mode == "new") ? apr_converter_new : apr_converter_same;
+
+            apr_converter.par.Ip_th = options.Ip_th;
+            apr_converter.par.lambda = options.lambda;
+            apr_converter.par.rel_error = options.rel_error;
+            apr_converter.par.reuse_workspace = (mode == "workspace");
+
+            APR<uint16_t> apr;
+
+            APRTimer timer;
+            timer.start_timer("frame");
+            apr_converter.get_apr(apr, input_image);
+            timer.stop_timer();
+
+            frame_times.push_back(timer.timings.back());
+            if (mode == "new") {
+                allocation_time += sum_timings(apr_converter.allocation_timer, "init and copy image");
+            }
+        }
+        if (mode != "new") {
+            allocation_time = sum_timings(apr_converter_same.allocation_timer, "init and copy image");
+        }
+        apr_converter_same.release_workspace();
+
+        double mean_time = 0;
+        for (size_t f = 1; f < frame_times.size(); ++f) {
+            mean_time += frame_times[f]/(frame_times.size() - 1);
+        }
+        const double min_time = (frame_times.size() > 1) ? *std::min_element(frame_times.begin() + 1, frame_times.end()) : 0;
+        const double max_time = (frame_times.size() > 1) ? *std::max_element(frame_times.begin() + 1, frame_times.end()) : 0;
+
+        std::cout << mode << " " << frame_times[0]*1000 << " " << mean_time*1000 << " " << min_time*1000 << " " << max_time*1000
+                  << " " << allocation_time/options.number_frames*1000 << std::endl;
+    }
+
+    return 0;
+}
+
+bool command_option_exists(char **begin, char **end, const std::string &option)
+{
+    return std::find(begin, end, option) != end;
+}
+
+char* get_command_option(char **begin, char **end, const std::string &option)
+{
+    char ** itr = std::find(begin, end, option);
+    if (itr != end && ++itr != end)
+    {
+        return *itr;
+    }
+    return 0;
+}
+
+cmdLineOptions read_command_line_options(int argc, char **argv){
+
+    cmdLineOptions result;
+
+    if(argc == 1) {
+        std::cerr << "Usage: \"Benchmark_converter_batch -i input_image_tiff -d directory\"" << std::endl;
+        std::cerr << usage << std::endl;
+        exit(1);
+    }
+
+    if(command_option_exists(argv, argv + argc, "-i"))
+    {
+        result.input = std::string(get_command_option(argv, argv + argc, "-i"));
+    } else {
+        std::cout << "Input file required" << std::endl;
+        exit(2);
+    }
+
+    if(command_option_exists(argv, argv + argc, "-d"))
+    {
+        result.directory = std::string(get_command_option(argv, argv + argc, "-d"));
+    }
+
+    if(command_option_exists(argv, argv + argc, "-frames"))
+    {
+        result.number_frames = std::max(1, std::stoi(std::string(get_command_option(argv, argv + argc, "-frames"))));
+    }
+
+    if(command_option_exists(argv, argv + argc, "-Ip_th"))
+    {
+        result.Ip_th = std::stof(std::string(get_command_option(argv, argv + argc, "-Ip_th")));
+    }
+
+    if(command_option_exists(argv, argv + argc, "-lambda"))
+    {
+        result.lambda = std::stof(std::string(get_command_option(argv, argv + argc, "-lambda")));
+    }
+
+    if(command_option_exists(argv, argv + argc, "-rel_error"))
+    {
+        result.rel_error = std::stof(std::string(get_command_option(argv, argv + argc, "-rel_error")));
+    }
+
+    return result;
+}
@@ -0,0 +1,23 @@
+#ifndef PARTPLAY_BENCHMARK_CONVERTER_BATCH_HPP
+#define PARTPLAY_BENCHMARK_CONVERTER_BATCH_HPP
+
+#include <string>
+
+#include "algorithm/APRConverter.hpp"
+
+struct cmdLineOptions{
+    std::string directory = "";
+    std::string input = "";
+    int number_frames = 20;
+    float Ip_th = -1;
+    float lambda = -1;
+    float rel_error = 0.1;
+};
+
+cmdLineOptions read_command_line_options(int argc, char **argv);
+
+bool command_option_exists(char **begin, char **end, const std::string &option);
+
+char* get_command_option(char **begin, char **end, const std::string &option);
+
+#endif //PARTPLAY_BENCHMARK_CONVERTER_BATCH_HPP
@@ -0,0 +1,220 @@
+const char* usage = R"(
+Benchmarks neighbour gathering filters with the particle data in the canonical (level, z, x, y) order and in the
+Morton order (APRParticleOrder), using neighbour tables (APRNeighbourTable) built for each ordering. Reports the time
+to compute the ordering and the tables, the average distance in memory (in particles) between a particle and its face
+neighbours and the fraction of neighbours closer than 1024 particles, and the throughput of the separable smoothing filter and of a gather of all six faces.
+
+Usage:
+
+(using *_apr.h5 output of Example_get_apr)
+
+Benchmark_particle_order -i input_apr_file -d directory
+
+Options:
+
+-reps number of repeats for the timings (default 5)
+-block_level level of the Morton blocks (default level_max - 4)
+
+)";
+
+#include <algorithm>
+#include <iostream>
+#include <cmath>
+#include "Benchmark_particle_order.hpp"
+
+struct BenchmarkResult{
+    double order_time = 0;
+    double table_time = 0;
+    double neighbour_distance = 0;
+    double neighbour_near = 0;
+    double smooth_time = 0;
+    double gather_time = 0;
+};
+
+void neighbour_distance(const APRNeighbourTable& neighbours,BenchmarkResult& result){
+    //
+    //  Mean distance between particles and their neighbours, and the fraction closer than 1024 particles (4 kB of floats)
+    //
+
+    double sum = 0;
+    uint64_t near = 0;
+    uint64_t count = 0;
+    for (uint64_t p = 0; p < neighbours.total_number_particles; ++p) {
+        for (uint8_t face = 0; face < 6; ++face) {
+            for (const uint64_t neighbour : neighbours.face_neighbours(face,p)) {
+                const uint64_t distance = (neighbour > p) ? (neighbour - p) : (p - neighbour);
+                sum += distance;
+                near += (distance < 1024);
+                count++;
+            }
+        }
+    }
+    result.neighbour_distance = sum/std::max(count,(uint64_t)1);
+    result.neighbour_near = near/(double)std::max(count,(uint64_t)1);
+}
+
+void gather_faces(const APRNeighbourTable& neighbours,const ExtraParticleData<float>& input,ExtraParticleData<float>& output){
+    //
+    //  Mean of the particle and all its face neighbours
+    //
+
+    int64_t particle_number;
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static) private(particle_number)
+#endif
+    for (particle_number = 0; particle_number < (int64_t)neighbours.total_number_particles; ++particle_number) {
+        float sum = input.data[particle_number];
+        float count = 1;
+        for (uint8_t face = 0; face < 6; ++face) {
+            for (const uint64_t neighbour : neighbours.face_neighbours(face,particle_number)) {
+                sum += input.data[neighbour];
+                count++;
+            }
+        }
+        output.data[particle_number] = sum/count;
+    }
+}
+
+BenchmarkResult run_benchmark(APR<uint16_t>& apr,ParticleOrdering ordering,int block_level,int number_reps,ExtraParticleData<float>& smooth_result,ExtraParticleData<float>& gather_result){
+
+    BenchmarkResult result;
+
+    APRTimer timer;
+    timer.verbose_flag = false;
+
+    APRParticleOrder particle_order;
+    APRNeighbourTable neighbours;
+
+    for (int r = 0; r < number_reps; ++r) {
+        timer.start_timer("order");
+        particle_order.init(apr,ordering,block_level);
+        timer.stop_timer();
+        result.order_time += timer.timings.back()/number_reps;
+
+        timer.start_timer("table");
+        neighbours.init(apr,particle_order);
+        timer.stop_timer();
+        result.table_time += timer.timings.back()/number_reps;
+    }
+
+    neighbour_distance(neighbours,result);
+
+    ExtraParticleData<float> input;
+    ExtraParticleData<float> intensities(apr);
+    std::copy(apr.particles_intensities.data.begin(),apr.particles_intensities.data.end(),intensities.data.begin());
+    particle_order.to_ordered(intensities,input);
+
+    APRNumerics apr_numerics;
+    const std::vector<float> filter = {0.1f, 0.8f, 0.1f};
+    ExtraParticleData<float> output;
+
+    for (int r = 0; r < number_reps; ++r) {
+        timer.start_timer("smooth");
+        apr_numerics.seperable_smooth_filter(apr,neighbours,input,output,filter,1);
+        timer.stop_timer();
+        result.smooth_time += timer.timings.back()/number_reps;
+    }
+    particle_order.to_canonical(output,smooth_result);
+
+    output.init(apr);
+    for (int r = 0; r < number_reps; ++r) {
+        timer.start_timer("gather");
+        gather_faces(neighbours,input,output);
+        timer.stop_timer();
+        result.gather_time += timer.timings.back()/number_reps;
+    }
+    particle_order.to_canonical(output,gather_result);
+
+    return result;
+}
+
+int main(int argc, char **argv) {
+
+    // INPUT PARSING
+
+    cmdLineOptions options = read_command_line_options(argc, argv);
+
+    // Filename
+    std::string file_name = options.directory + options.input;
+
+    // APR datastructure
+    APR<uint16_t> apr;
+
+    //read file
+    apr.read_apr(file_name);
+
+    ExtraParticleData<float> smooth_canonical,gather_canonical,smooth_morton,gather_morton;
+
+    BenchmarkResult canonical_result = run_benchmark(apr,ParticleOrdering::Canonical,options.block_level,options.number_reps,smooth_canonical,gather_canonical);
+    BenchmarkResult morton_result = run_benchmark(apr,ParticleOrdering::Morton,options.block_level,options.number_reps,smooth_morton,gather_morton);
+
+    const double number_particles = apr.total_number_particles();
+
+    std::cout << "Number of particles: " << apr.total_number_particles() << " Levels: " << apr.level_min() << "-" << apr.level_max() << std::endl;
+    std::cout << std::endl;
+
+    std::cout << "ordering order(s) table(s) neighbour_distance(particles) neighbours_near(fraction) smooth(Mparts/s) gather(Mparts/s)" << std::endl;
+    std::cout << "canonical " << canonical_result.order_time << " " << canonical_result.table_time << " " << canonical_result.neighbour_distance << " " << canonical_result.neighbour_near << " " << number_particles/(canonical_result.smooth_time*1000000.0) << " " << number_particles/(canonical_result.gather_time*1000000.0) << std::endl;
+    std::cout << "morton " << morton_result.order_time << " " << morton_result.table_time << " " << morton_result.neighbour_distance << " " << morton_result.neighbour_near << " " << number_particles/(morton_result.smooth_time*1000000.0) << " " << number_particles/(morton_result.gather_time*1000000.0) << std::endl;
+
+    if(!std::equal(smooth_canonical.data.begin(),smooth_canonical.data.end(),smooth_morton.data.begin()) ||
+       !std::equal(gather_canonical.data.begin(),gather_canonical.data.end(),gather_morton.data.begin())){
+        std::cerr << "Results of the two orderings differ" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+bool command_option_exists(char **begin, char **end, const std::string &option)
+{
+    return std::find(begin, end, option) != end;
+}
+
+char* get_command_option(char **begin, char **end, const std::string &option)
+{
+    char ** itr = std::find(begin, end, option);
+    if (itr != end && ++itr != end)
+    {
+        return *itr;
+    }
+    return 0;
+}
+
+cmdLineOptions read_command_line_options(int argc, char **argv){
+
+    cmdLineOptions result;
+
+    if(argc == 1) {
+        std::cerr << "Usage: \"Benchmark_particle_order -i input_apr_file -d directory\"" << std::endl;
+        std::cerr << usage << std::endl;
+        exit(1);
+    }
+
+    if(command_option_exists(argv, argv + argc, "-i"))
+    {
+        result.input = std::string(get_command_option(argv, argv + argc, "-i"));
+    } else {
+        std::cout << "Input file required" << std::endl;
+        exit(2);
+    }
+
+    if(command_option_exists(argv, argv + argc, "-d"))
+    {
+        result.directory = std::string(get_command_option(argv, argv + argc, "-d"));
+    }
+
+    if(command_option_exists(argv, argv + argc, "-reps"))
+    {
+        result.number_reps = std::stoi(std::string(get_command_option(argv, argv + argc, "-reps")));
+    }
+
+    if(command_option_exists(argv, argv + argc, "-block_level"))
+    {
+        result.block_level = std::stoi(std::string(get_command_option(argv, argv + argc, "-block_level")));
+    }
+
+    return result;
+
+}
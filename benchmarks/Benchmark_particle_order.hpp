@@ -0,0 +1,24 @@
+#ifndef PARTPLAY_BENCHMARK_PARTICLE_ORDER_HPP
+#define PARTPLAY_BENCHMARK_PARTICLE_ORDER_HPP
+
+#include <functional>
+#include <string>
+
+#include "data_structures/APR/APR.hpp"
+#include "data_structures/APR/APRNeighbourTable.hpp"
+#include "numerics/APRNumerics.hpp"
+
+struct cmdLineOptions{
+    std::string directory = "";
+    std::string input = "";
+    int number_reps = 5;
+    int block_level = -1;
+};
+
+cmdLineOptions read_command_line_options(int argc, char **argv);
+
+bool command_option_exists(char **begin, char **end, const std::string &option);
+
+char* get_command_option(char **begin, char **end, const std::string &option);
+
+#endif //PARTPLAY_BENCHMARK_PARTICLE_ORDER_HPP
@@ -0,0 +1,183 @@
+const char* usage = R"(
+Benchmarks locating the particle cells containing random points given in global (pixel) coordinates, one at a time
+with APRIterator::set_iterator_by_global_coordinate and in a batch with APRIterator::find_particles_by_global_coordinates,
+for the std::map and the flat (use_flat_map) access structures. Reports the throughput in queries per second and checks
+that both give the same particles.
+
+Usage:
+
+(using *_apr.h5 output of Example_get_apr)
+
+Benchmark_point_location -i input_apr_file -d directory
+
+Options:
+
+-reps number of repeats for the timings (default 5)
+-n number of random points (default 1000000)
+
+)";
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include "Benchmark_point_location.hpp"
+
+struct BenchmarkResult{
+    double single_time = 0;
+    double batch_time = 0;
+    uint64_t number_found = 0;
+    bool identical = true;
+};
+
+BenchmarkResult run_benchmark(APR<uint16_t>& apr,const std::vector<float>& x,const std::vector<float>& y,const std::vector<float>& z,int number_reps){
+
+    BenchmarkResult result;
+
+    APRTimer timer;
+    timer.verbose_flag = false;
+
+    APRIterator<uint16_t> apr_iterator(apr);
+    const int64_t number_points = x.size();
+
+    std::vector<uint64_t> single_index(number_points);
+    std::vector<uint16_t> single_level(number_points);
+
+    for (int r = 0; r < number_reps; ++r) {
+        timer.start_timer("single");
+        int64_t i;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static) private(i) firstprivate(apr_iterator)
+#endif
+        for (i = 0; i < number_points; ++i) {
+            if(apr_iterator.set_iterator_by_global_coordinate(x[i],y[i],z[i])){
+                single_index[i] = apr_iterator.global_index();
+                single_level[i] = apr_iterator.level();
+            } else {
+                single_index[i] = UINT64_MAX;
+                single_level[i] = 0;
+            }
+        }
+        timer.stop_timer();
+        result.single_time += timer.timings.back()/number_reps;
+    }
+
+    std::vector<uint64_t> batch_index;
+    std::vector<uint16_t> batch_level;
+
+    for (int r = 0; r < number_reps; ++r) {
+        timer.start_timer("batch");
+        result.number_found = apr_iterator.find_particles_by_global_coordinates(x,y,z,batch_index,batch_level);
+        timer.stop_timer();
+        result.batch_time += timer.timings.back()/number_reps;
+    }
+
+    result.identical = (single_index == batch_index) && (single_level == batch_level);
+
+    return result;
+}
+
+int main(int argc, char **argv) {
+
+    // INPUT PARSING
+
+    cmdLineOptions options = read_command_line_options(argc, argv);
+
+    // Filename
+    std::string file_name = options.directory + options.input;
+
+    // APR datastructure
+    APR<uint16_t> apr;
+
+    //read file
+    apr.read_apr(file_name);
+
+    //uniformly distributed points in the image
+    std::mt19937 generator(0);
+    std::uniform_real_distribution<float> y_position(0,apr.orginal_dimensions(0));
+    std::uniform_real_distribution<float> x_position(0,apr.orginal_dimensions(1));
+    std::uniform_real_distribution<float> z_position(0,apr.orginal_dimensions(2));
+
+    std::vector<float> x(options.number_points),y(options.number_points),z(options.number_points);
+    for (uint64_t i = 0; i < options.number_points; ++i) {
+        x[i] = x_position(generator);
+        y[i] = y_position(generator);
+        z[i] = z_position(generator);
+    }
+
+    //the APR is loaded with the flat gap storage, the std::map storage is built for the comparison
+    apr.apr_access.build_gap_map();
+    APR<uint16_t> apr_flat = apr;
+    apr_flat.apr_access.build_flat_map();
+
+    BenchmarkResult map_result = run_benchmark(apr,x,y,z,options.number_reps);
+    BenchmarkResult flat_result = run_benchmark(apr_flat,x,y,z,options.number_reps);
+
+    const double number_points = options.number_points;
+
+    std::cout << "Number of particles: " << apr.total_number_particles() << " Levels: " << apr.level_min() << "-" << apr.level_max() << std::endl;
+    std::cout << "Number of points: " << options.number_points << " found: " << map_result.number_found << std::endl;
+    std::cout << std::endl;
+
+    std::cout << "access single(Mqueries/s) batch(Mqueries/s) speedup" << std::endl;
+    std::cout << "map " << number_points/(map_result.single_time*1000000.0) << " " << number_points/(map_result.batch_time*1000000.0) << " " << map_result.single_time/map_result.batch_time << std::endl;
+    std::cout << "flat " << number_points/(flat_result.single_time*1000000.0) << " " << number_points/(flat_result.batch_time*1000000.0) << " " << flat_result.single_time/flat_result.batch_time << std::endl;
+
+    if(!map_result.identical || !flat_result.identical){
+        std::cerr << "Results of the single and batched queries differ" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+bool command_option_exists(char **begin, char **end, const std::string &option)
+{
+    return std::find(begin, end, option) != end;
+}
+
+char* get_command_option(char **begin, char **end, const std::string &option)
+{
+    char ** itr = std::find(begin, end, option);
+    if (itr != end && ++itr != end)
+    {
+        return *itr;
+    }
+    return 0;
+}
+
+cmdLineOptions read_command_line_options(int argc, char **argv){
+
+    cmdLineOptions result;
+
+    if(argc == 1) {
+        std::cerr << "Usage: \"Benchmark_point_location -i input_apr_file -d directory\"" << std::endl;
+        std::cerr << usage << std::endl;
+        exit(1);
+    }
+
+    if(command_option_exists(argv, argv + argc, "-i"))
+    {
+        result.input = std::string(get_command_option(argv, argv + argc, "-i"));
+    } else {
+        std::cout << "Input file required" << std::endl;
+        exit(2);
+    }
+
+    if(command_option_exists(argv, argv + argc, "-d"))
+    {
+        result.directory = std::string(get_command_option(argv, argv + argc, "-d"));
+    }
+
+    if(command_option_exists(argv, argv + argc, "-reps"))
+    {
+        result.number_reps = std::stoi(std::string(get_command_option(argv, argv + argc, "-reps")));
+    }
+
+    if(command_option_exists(argv, argv + argc, "-n"))
+    {
+        result.number_points = std::stoull(std::string(get_command_option(argv, argv + argc, "-n")));
+    }
+
+    return result;
+
+}
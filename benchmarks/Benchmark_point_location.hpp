@@ -0,0 +1,22 @@
+#ifndef PARTPLAY_BENCHMARK_POINT_LOCATION_HPP
+#define PARTPLAY_BENCHMARK_POINT_LOCATION_HPP
+
+#include <functional>
+#include <string>
+
+#include "data_structures/APR/APR.hpp"
+
+struct cmdLineOptions{
+    std::string directory = "";
+    std::string input = "";
+    int number_reps = 5;
+    uint64_t number_points = 1000000;
+};
+
+cmdLineOptions read_command_line_options(int argc, char **argv);
+
+bool command_option_exists(char **begin, char **end, const std::string &option);
+
+char* get_command_option(char **begin, char **end, const std::string &option);
+
+#endif //PARTPLAY_BENCHMARK_POINT_LOCATION_HPP
@@ -0,0 +1,173 @@
+const char* usage = R"(
+Benchmarks the particle cell tree used by the pulling scheme when converting an image: the dense tree (one byte per
+cell), the packed tree (4 bits per cell, packed_pulling_scheme) and the sparse tree (8x8x8 bricks,
+sparse_pulling_scheme). For each it reports the times of filling the tree (compute_local_particle_set), the pulling
+scheme, building the access structure from the tree and the whole conversion, the memory of the tree and the peak
+resident memory of the process. The peak only grows, so for the peak of each tree run it alone with -tree.
+
+Usage:
+
+Benchmark_pulling_scheme -i input_image_tiff -d directory
+
+Options:
+
+-tree dense, packed or sparse (default all, in this order)
+-reps number of repeats for the timings (default 3)
+-Ip_th -lambda -rel_error as for Example_get_apr
+
+)";
+
+#include <algorithm>
+#include <iostream>
+#ifndef _WIN32
+    #include <sys/resource.h>
+#endif
+#include "Benchmark_pulling_scheme.hpp"
+
+double peak_memory_mb(){
+#ifndef _WIN32
+    struct rusage usage_stats;
+    getrusage(RUSAGE_SELF, &usage_stats);
+#ifdef __APPLE__
+    return usage_stats.ru_maxrss/1e6; // bytes
+#else
+    return usage_stats.ru_maxrss/1e3; // kilobytes
+#endif
+#else
+    return 0;
+#endif
+}
+
+double get_timing(const APRTimer& timer,const std::string& name){
+    for (size_t i = 0; i < std::min(timer.timing_names.size(), timer.timings.size()); ++i) {
+        if (timer.timing_names[i] == name) {
+            return timer.timings[i];
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+
+    // INPUT PARSING
+    cmdLineOptions options = read_command_line_options(argc, argv);
+
+    std::vector<std::string> trees = {"dense", "packed", "sparse"};
+    if (options.tree.size() > 0) {
+        trees = {options.tree};
+    }
+
+    std::cout << "tree fill(ms) pulling_scheme(ms) apr_datastructure(ms) total(ms) tree(MB) peak_memory(MB) particles" << std::endl;
+
+    for (const std::string& tree : trees) {
+        double fill_time = 0;
+        double pulling_time = 0;
+        double structure_time = 0;
+        double total_time = 0;
+        double tree_mb = 0;
+        uint64_t number_particles = 0;
+
+        for (int r = 0; r < options.number_reps; ++r) {
+            APR<uint16_t> apr;
+            APRConverter<uint16_t> apr_converter;
+
+            apr_converter.par.input_image_name = options.input;
+            apr_converter.par.input_dir = options.directory;
+            apr_converter.par.Ip_th = options.Ip_th;
+            apr_converter.par.lambda = options.lambda;
+            apr_converter.par.rel_error = options.rel_error;
+            apr_converter.par.packed_pulling_scheme = (tree == "packed");
+            apr_converter.par.sparse_pulling_scheme = (tree == "sparse");
+
+            APRTimer timer;
+            timer.start_timer("conversion");
+            if (!apr_converter.get_apr(apr)) {
+                std::cerr << "Could not convert " << options.directory + options.input << std::endl;
+                return 1;
+            }
+            timer.stop_timer();
+
+            fill_time += get_timing(apr_converter.method_timer, "compute_local_particle_set")/options.number_reps;
+            pulling_time += get_timing(apr_converter.method_timer, "compute_pulling_scheme")/options.number_reps;
+            structure_time += get_timing(apr_converter.method_timer, "compute_apr_datastructure")/options.number_reps;
+            total_time += timer.timings.back()/options.number_reps;
+            tree_mb = apr_converter.particle_cell_tree_peak_bytes/1e6;
+            number_particles = apr.total_number_particles();
+        }
+
+        std::cout << tree << " " << fill_time*1000 << " " << pulling_time*1000 << " " << structure_time*1000 << " " << total_time*1000
+                  << " " << tree_mb << " " << peak_memory_mb() << " " << number_particles << std::endl;
+    }
+
+    return 0;
+}
+
+bool command_option_exists(char **begin, char **end, const std::string &option)
+{
+    return std::find(begin, end, option) != end;
+}
+
+char* get_command_option(char **begin, char **end, const std::string &option)
+{
+    char ** itr = std::find(begin, end, option);
+    if (itr != end && ++itr != end)
+    {
+        return *itr;
+    }
+    return 0;
+}
+
+cmdLineOptions read_command_line_options(int argc, char **argv){
+
+    cmdLineOptions result;
+
+    if(argc == 1) {
+        std::cerr << "Usage: \"Benchmark_pulling_scheme -i input_image_tiff -d directory\"" << std::endl;
+        std::cerr << usage << std::endl;
+        exit(1);
+    }
+
+    if(command_option_exists(argv, argv + argc, "-i"))
+    {
+        result.input = std::string(get_command_option(argv, argv + argc, "-i"));
+    } else {
+        std::cout << "Input file required" << std::endl;
+        exit(2);
+    }
+
+    if(command_option_exists(argv, argv + argc, "-d"))
+    {
+        result.directory = std::string(get_command_option(argv, argv + argc, "-d"));
+    }
+
+    if(command_option_exists(argv, argv + argc, "-tree"))
+    {
+        result.tree = std::string(get_command_option(argv, argv + argc, "-tree"));
+        if ((result.tree != "dense") && (result.tree != "packed") && (result.tree != "sparse")) {
+            std::cerr << "Unknown tree " << result.tree << std::endl;
+            exit(2);
+        }
+    }
+
+    if(command_option_exists(argv, argv + argc, "-reps"))
+    {
+        result.number_reps = std::stoi(std::string(get_command_option(argv, argv + argc, "-reps")));
+    }
+
+    if(command_option_exists(argv, argv + argc, "-Ip_th"))
+    {
+        result.Ip_th = std::stof(std::string(get_command_option(argv, argv + argc, "-Ip_th")));
+    }
+
+    if(command_option_exists(argv, argv + argc, "-lambda"))
+    {
+        result.lambda = std::stof(std::string(get_command_option(argv, argv + argc, "-lambda")));
+    }
+
+    if(command_option_exists(argv, argv + argc, "-rel_error"))
+    {
+        result.rel_error = std::stof(std::string(get_command_option(argv, argv + argc, "-rel_error")));
+    }
+
+    return result;
+}
@@ -116,6 +116,42 @@ int main(int argc, char **argv) {
 
     timer.stop_timer();
 
+    ////////////////////////////
+    ///
+    /// OpenMP Parallel row iteration
+    ///
+    /// Particles are ordered by level, z, x and then y, so each (level,z,x) row is a contiguous range of particles. Each row is split
+    /// into gaps (runs of consecutive y), which allows tight loops directly over the particle data (ExtraParticleData::data).
+    ///
+    ///////////////////////////
+
+    ExtraParticleData<float> calc_example_3(apr);
+
+    timer.start_timer("APR parallel row iterator loop");
+
+    for (unsigned int level = apr_iterator.level_min(); level <= apr_iterator.level_max(); ++level) {
+        uint64_t z;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(dynamic) private(z) firstprivate(apr_iterator)
+#endif
+        for (z = 0; z < apr_iterator.spatial_index_z_max(level); ++z) {
+            for (unsigned int x = 0; x < apr_iterator.spatial_index_x_max(level); ++x) {
+                //returns false if there are no particles in the row
+                if (apr_iterator.set_iterator_to_row(level, z, x)) {
+                    do {
+                        //the gap covers y from gap_y_begin() to gap_y_end() (inclusive)
+                        uint16_t y = apr_iterator.gap_y_begin();
+                        for (uint64_t index = apr_iterator.gap_particles_begin(); index < apr_iterator.gap_particles_end(); ++index, ++y) {
+                            calc_example_3.data[index] = apr.particles_intensities.data[index] + y;
+                        }
+                    } while (apr_iterator.move_to_next_gap_in_row());
+                }
+            }
+        }
+    }
+
+    timer.stop_timer();
+
     ////////////////////////////////////////
     ///
     /// One shot operations
@@ -56,27 +56,36 @@ int main(int argc, char **argv) {
     //remove the file extension
     name.erase(name.end()-3,name.end());
 
+    //find the neighbours of all particles once, both the smoothing and the gradient visit them
+    timer.start_timer("build neighbour table");
+    APRNeighbourTable neighbours(apr);
+    timer.stop_timer();
+
     if(options.smooth_number>0) {
         //smooth the image with a simply sepeable filter *smooth_number times
 
         APRNumerics aprNumerics;
         ExtraParticleData<uint16_t> smooth(apr);
         std::vector<float> filter = {0.1f, 0.8f, 0.1f}; // << Feel free to play with these
-        aprNumerics.seperable_smooth_filter(apr, apr.particles_intensities, smooth, filter, options.smooth_number);
+        timer.start_timer("smooth");
+        aprNumerics.seperable_smooth_filter(apr, neighbours, apr.particles_intensities, smooth, filter, options.smooth_number);
+        timer.stop_timer();
 
         std::swap(apr.particles_intensities.data, smooth.data);
     }
 
     //Calculate the gradient of the APR
-    ExtraParticleData<std::vector<float>> gradient; //vector for holding the derivative in the three directions, initialized to have the same number of elements as particles.
+    MultiChannelParticleData<float> gradient; //holds the derivative in the three directions (three channels per particle)
 
     std::vector<float> delta = {1,1,options.anisotropy_z};
 
-    APRNumerics::compute_gradient_vector(apr,gradient,false,delta);
+    timer.start_timer("gradient");
+    APRNumerics::compute_gradient_vector(apr,neighbours,gradient,false,delta);
+    timer.stop_timer();
 
     ExtraParticleData<float> gradient_magnitude(apr);
     //compute the magnitude of the gradient, scale it by 5 for visualization when writing as uint16 int
-    gradient.map(apr,gradient_magnitude,[](const std::vector<float> &a) { return 20.0f*sqrt(pow(a[0], 2.0f) + pow(a[1], 2.0f) + pow(a[2], 2.0f)); });
+    gradient.map(gradient_magnitude,[](const ParticleChannels<const float> &a) { return 20.0f*sqrt(pow(a[0], 2.0f) + pow(a[1], 2.0f) + pow(a[2], 2.0f)); });
 
     // write result to image
     MeshData<float> gradient_magnitude_image;
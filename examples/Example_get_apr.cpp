@@ -24,6 +24,9 @@ Advanced (Direct) Settings:
 -min_signal min_signal_val (directly sets a minimum absolute signal size relative to the local background, also useful for removing background, otherwise set using estimated background noise estimate and minimal SNR of 6)
 -mask_file mask_file_tiff (takes an input image uint16_t, assumes all zero regions should be ignored by the APR, useful for pre-processing of isolating desired content, or using another channel as a mask)
 -rel_error rel_error_value (Reasonable ranges are from .08-.15), Default: 0.1
+-mem_budget memory_budget_in_MB (converts the image in z-slabs read from the file to limit the memory used, for images larger than RAM)
+-sparse_pulling (uses the sparse particle cell tree in the pulling scheme, less memory and faster for sparse images)
+-packed_pulling (uses the packed particle cell tree in the pulling scheme, half the memory of the default tree)
 )";
 
 #include <algorithm>
@@ -52,6 +55,9 @@ int main(int argc, char **argv) {
     apr_converter.par.mask_file = options.mask_file;
     apr_converter.par.min_signal = options.min_signal;
     apr_converter.par.SNR_min = options.SNR_min;
+    apr_converter.par.memory_budget_mb = options.memory_budget_mb;
+    apr_converter.par.sparse_pulling_scheme = options.sparse_pulling_scheme;
+    apr_converter.par.packed_pulling_scheme = options.packed_pulling_scheme;
 
     //where things are
     apr_converter.par.input_image_name = options.input;
@@ -203,5 +209,20 @@ cmdLineOptions read_command_line_options(int argc, char **argv){
         result.mask_file = std::string(get_command_option(argv, argv + argc, "-mask_file"));
     }
 
+    if(command_option_exists(argv, argv + argc, "-mem_budget"))
+    {
+        result.memory_budget_mb = std::stof(std::string(get_command_option(argv, argv + argc, "-mem_budget")));
+    }
+
+    if(command_option_exists(argv, argv + argc, "-sparse_pulling"))
+    {
+        result.sparse_pulling_scheme = true;
+    }
+
+    if(command_option_exists(argv, argv + argc, "-packed_pulling"))
+    {
+        result.packed_pulling_scheme = true;
+    }
+
     return result;
 }
\ No newline at end of file
@@ -25,6 +25,9 @@ struct cmdLineOptions{
     float lambda = -1;
     float min_signal = -1;
     float rel_error = 0.1;
+    float memory_budget_mb = 0;
+    bool sparse_pulling_scheme = false;
+    bool packed_pulling_scheme = false;
 };
 
 bool command_option_exists(char **begin, char **end, const std::string &option);
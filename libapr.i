@@ -53,7 +53,7 @@ namespace std {
   }
 %}
 
-%typemap(javacode) ExtraParticleData<std::vector<float>> %{
+%typemap(javacode) MultiChannelParticleData<float> %{
   // ensure premature GC doesn't happen by storing a reference to the APR
   // in-class
   private static java.util.ArrayList<APRStd> aprReferences = new java.util.ArrayList<APRStd>();
@@ -73,6 +73,7 @@ namespace std {
 %include "src/data_structures/APR/APRIterator.hpp"
 %include "src/numerics/APRNumerics.hpp"
 %include "src/data_structures/APR/ExtraParticleData.hpp"
+%include "src/data_structures/APR/MultiChannelParticleData.hpp"
 %include "src/data_structures/APR/ExtraPartCellData.hpp"
 
 %pointer_class(uint16_t, UInt16Pointer);
@@ -98,7 +99,9 @@ namespace std {
 
 %template(ExtraParticleDataStd) ExtraParticleData<uint16_t>;
 %template(ExtraParticleDataFloat) ExtraParticleData<float>;
-%template(ExtraParticleDataFloatVec) ExtraParticleData<std::vector<float>>;
+
+%template(MultiChannelParticleData) MultiChannelParticleData::MultiChannelParticleData<uint16_t>;
+%template(MultiChannelParticleDataFloat) MultiChannelParticleData<float>;
 
 %template(ExtraPartCellDataStd) ExtraPartCellData<uint16_t>;
 %template(ExtraPartCellDataFloat) ExtraPartCellData<float>;
@@ -0,0 +1,430 @@
+////////////////////////////////
+///
+/// APR Batch Converter converts a sequence of TIFF files (a directory, the stacks of a time-series) to APR files in a
+/// pipeline, reading the next images and writing the previous APRs while the current one is converted
+///
+////////////////////////////////
+
+#ifndef PARTPLAY_APR_BATCH_CONVERTER_HPP
+#define PARTPLAY_APR_BATCH_CONVERTER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+#include "APRConverter.hpp"
+#include "../io/APRWriter.hpp"
+
+#ifdef HAVE_OPENMP
+	#include "omp.h"
+#endif
+
+
+/**
+ * Queue holding at most capacity items between two stages of the pipeline, push blocks while it is full and pop while
+ * it is empty (until it is closed)
+ */
+template<typename T>
+class BoundedQueue {
+public:
+
+    explicit BoundedQueue(size_t aCapacity) : capacity(std::max(aCapacity, (size_t)1)) {}
+
+    /**
+     * Adds the item, returns false (dropping it) if the queue is closed
+     */
+    bool push(T &&item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_full.wait(lock, [&] { return (items.size() < capacity) || closed; });
+        if (closed) {
+            return false;
+        }
+        items.push_back(std::move(item));
+        not_empty.notify_one();
+        return true;
+    }
+
+    /**
+     * Takes the next item, returns false if the queue is closed and empty
+     */
+    bool pop(T &item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_empty.wait(lock, [&] { return !items.empty() || closed; });
+        if (items.empty()) {
+            return false;
+        }
+        item = std::move(items.front());
+        items.pop_front();
+        not_full.notify_one();
+        return true;
+    }
+
+    /**
+     * No more items will be pushed, the items in the queue can still be taken
+     */
+    void close() {
+        std::unique_lock<std::mutex> lock(mutex);
+        closed = true;
+        not_empty.notify_all();
+        not_full.notify_all();
+    }
+
+    /**
+     * Closes the queue when going out of scope, so the next stage finishes also if the stage pushing to it throws
+     */
+    class Closer {
+    public:
+        explicit Closer(BoundedQueue &aQueue) : queue(aQueue) {}
+        ~Closer() { queue.close(); }
+    private:
+        BoundedQueue &queue;
+    };
+
+private:
+
+    const size_t capacity;
+    std::deque<T> items;
+    bool closed = false;
+
+    std::mutex mutex;
+    std::condition_variable not_full;
+    std::condition_variable not_empty;
+};
+
+
+template<typename ImageType>
+class APRBatchConverter {
+
+public:
+
+    // parameters of the conversion (as for APRConverter), the input files are read from par.input_dir and the APR files
+    // written to par.output_dir
+    APRParameters par;
+
+    // images read and not yet converted, and APRs converted and not yet written, held between the stages (each)
+    size_t queue_size = 2;
+
+    // threads reading (and decoding) files at once
+    unsigned int read_threads = 1;
+    // OpenMP threads of the conversion (0 for the OpenMP default)
+    unsigned int convert_threads = 0;
+    // OpenMP threads compressing the APR files, which are written by one thread as HDF5 is not thread safe (0 for the OpenMP default)
+    unsigned int write_threads = 0;
+
+    struct StageStatistics {
+        unsigned int threads = 0;
+        size_t items = 0;
+        double busy_time = 0;         // working, summed over the threads of the stage (seconds)
+        double input_wait_time = 0;   // waiting for the previous stage
+        double output_wait_time = 0;  // blocked on the full queue to the next stage
+
+        // fraction of the time the threads of the stage were working
+        double utilisation(double total_time) const { return (threads*total_time > 0) ? busy_time/(threads*total_time) : 0; }
+    };
+
+    StageStatistics read_statistics;
+    StageStatistics convert_statistics;
+    StageStatistics write_statistics;
+    double total_time = 0;
+
+    // files that could not be read (not a TIFF file of ImageType), converted or written
+    std::vector<std::string> failed_files;
+
+    /**
+     * Converts the files, the APR of input_files[i] is written as output_names[i] + "_apr.h5". Returns false if a file
+     * failed (it is skipped, and listed in failed_files)
+     */
+    bool convert_files(const std::vector<std::string> &input_files, const std::vector<std::string> &output_names);
+
+    /**
+     * As above, with the name of each input file without its directory and extension as output name
+     */
+    bool convert_files(const std::vector<std::string> &input_files);
+
+    void print_statistics() const;
+
+private:
+
+    struct ImageItem {
+        size_t index;
+        std::unique_ptr<MeshData<ImageType>> image;
+    };
+
+    struct APRItem {
+        size_t index;
+        std::unique_ptr<APR<ImageType>> apr;
+    };
+
+    typedef std::chrono::steady_clock Clock;
+
+    static double seconds(Clock::time_point begin, Clock::time_point end) {
+        return std::chrono::duration<double>(end - begin).count();
+    }
+
+    static bool has_image_type(const TiffUtils::TiffInfo &aTiff);
+    static void set_number_threads(unsigned int number_threads);
+
+    void add_failed(const std::string &file_name, const char *reason = nullptr);
+
+    /**
+     * Joins the threads when going out of scope (std::thread terminates the program if destroyed joinable)
+     */
+    class ThreadJoiner {
+    public:
+        explicit ThreadJoiner(std::vector<std::thread> &aThreads) : threads(aThreads) {}
+        ~ThreadJoiner() {
+            for (std::thread &thread : threads) {
+                if (thread.joinable()) {
+                    thread.join();
+                }
+            }
+        }
+    private:
+        std::vector<std::thread> &threads;
+    };
+
+    std::mutex statistics_mutex;
+};
+
+
+template<typename ImageType>
+bool APRBatchConverter<ImageType>::convert_files(const std::vector<std::string> &input_files) {
+    std::vector<std::string> output_names;
+    for (const std::string &file_name : input_files) {
+        const size_t name_begin = file_name.find_last_of("/\\") + 1; // 0 if there is no directory
+        const size_t extension = file_name.find_last_of('.');
+        const size_t name_end = ((extension == std::string::npos) || (extension < name_begin)) ? file_name.size() : extension;
+        output_names.push_back(file_name.substr(name_begin, name_end - name_begin));
+    }
+    return convert_files(input_files, output_names);
+}
+
+template<typename ImageType>
+bool APRBatchConverter<ImageType>::convert_files(const std::vector<std::string> &input_files, const std::vector<std::string> &output_names) {
+    //
+    //  Three stages connected by bounded queues: read_threads threads read the files (in parallel, so the images can
+    //  arrive out of order), one thread converts them with the same APRConverter (reusing its workspace) and one thread
+    //  writes the APRs. Each stage records the time working and waiting on its queues. An exception converting a file
+    //  (e.g. out of memory) only fails that file, and a stage always closes the queue to the next stage.
+    //
+
+    read_statistics = StageStatistics();
+    convert_statistics = StageStatistics();
+    write_statistics = StageStatistics();
+    failed_files.clear();
+
+    read_statistics.threads = std::max(read_threads, 1u);
+    convert_statistics.threads = 1;
+    write_statistics.threads = 1;
+
+    BoundedQueue<ImageItem> image_queue(queue_size);
+    BoundedQueue<APRItem> apr_queue(queue_size);
+
+    const Clock::time_point start = Clock::now();
+
+    std::atomic<size_t> next_file(0);
+    std::atomic<unsigned int> active_readers(read_statistics.threads);
+
+    auto read_stage = [&]() {
+        StageStatistics statistics;
+        for (size_t i = next_file++; i < input_files.size(); i = next_file++) {
+            const Clock::time_point begin = Clock::now();
+
+            ImageItem item;
+            item.index = i;
+            try {
+                TiffUtils::TiffInfo input_tiff(par.input_dir + input_files[i]);
+                if (input_tiff.isFileOpened() && has_image_type(input_tiff)) {
+                    item.image.reset(new MeshData<ImageType>(TiffUtils::getMesh<ImageType>(input_tiff)));
+                }
+            } catch (const std::exception &e) {
+                item.image.reset();
+                add_failed(input_files[i], e.what());
+                continue;
+            }
+            const Clock::time_point end = Clock::now();
+            statistics.busy_time += seconds(begin, end);
+
+            if (!item.image) {
+                add_failed(input_files[i]);
+                continue;
+            }
+            statistics.items++;
+
+            //the queue is only closed early if the pipeline could not be started
+            if (!image_queue.push(std::move(item))) {
+                break;
+            }
+            statistics.output_wait_time += seconds(end, Clock::now());
+        }
+
+        //the last reader closes the queue
+        if (--active_readers == 0) {
+            image_queue.close();
+        }
+
+        std::lock_guard<std::mutex> lock(statistics_mutex);
+        read_statistics.items += statistics.items;
+        read_statistics.busy_time += statistics.busy_time;
+        read_statistics.output_wait_time += statistics.output_wait_time;
+    };
+
+    auto convert_stage = [&]() {
+        typename BoundedQueue<APRItem>::Closer apr_queue_closer(apr_queue);
+        set_number_threads(convert_threads);
+
+        APRConverter<ImageType> apr_converter;
+
+        ImageItem item;
+        Clock::time_point wait_begin = Clock::now();
+        while (image_queue.pop(item)) {
+            const Clock::time_point begin = Clock::now();
+            convert_statistics.input_wait_time += seconds(wait_begin, begin);
+
+            //automatic parameters are estimated for each image, as when converting it on its own
+            apr_converter.par = par;
+            apr_converter.par.reuse_workspace = true;
+
+            APRItem apr_item;
+            apr_item.index = item.index;
+            bool converted = false;
+            try {
+                apr_item.apr.reset(new APR<ImageType>());
+                converted = apr_converter.get_apr(*apr_item.apr, *item.image);
+                if (!converted) {
+                    add_failed(input_files[item.index]);
+                }
+            } catch (const std::exception &e) {
+                //the workspace may be left partially initialized
+                apr_converter.release_workspace();
+                add_failed(input_files[item.index], e.what());
+            }
+            item.image.reset();
+
+            const Clock::time_point end = Clock::now();
+            convert_statistics.busy_time += seconds(begin, end);
+
+            if (converted) {
+                convert_statistics.items++;
+                apr_queue.push(std::move(apr_item));
+            }
+            wait_begin = Clock::now();
+            convert_statistics.output_wait_time += seconds(end, wait_begin);
+        }
+    };
+
+    auto write_stage = [&]() {
+        set_number_threads(write_threads);
+
+        APRWriter apr_writer;
+        APRCompress<ImageType> apr_compressor;
+        apr_compressor.set_compression_type(0);
+
+        APRItem item;
+        Clock::time_point wait_begin = Clock::now();
+        while (apr_queue.pop(item)) {
+            const Clock::time_point begin = Clock::now();
+            write_statistics.input_wait_time += seconds(wait_begin, begin);
+
+            bool written = false;
+            try {
+                written = apr_writer.write_apr(*item.apr, par.output_dir, output_names[item.index], apr_compressor) > 0;
+                if (!written) {
+                    add_failed(input_files[item.index]);
+                }
+            } catch (const std::exception &e) {
+                add_failed(input_files[item.index], e.what());
+            }
+            item.apr.reset();
+
+            wait_begin = Clock::now();
+            write_statistics.busy_time += seconds(begin, wait_begin);
+
+            if (written) {
+                write_statistics.items++;
+            }
+        }
+    };
+
+    {
+        std::vector<std::thread> threads;
+        ThreadJoiner thread_joiner(threads);
+        try {
+            for (unsigned int t = 0; t < read_statistics.threads; ++t) {
+                threads.emplace_back(read_stage);
+            }
+            threads.emplace_back(convert_stage);
+            threads.emplace_back(write_stage);
+        } catch (...) {
+            //a stage could not be started, so its queues would never be emptied, stop the running stages before joining them
+            image_queue.close();
+            apr_queue.close();
+            throw;
+        }
+    }
+
+    total_time = seconds(start, Clock::now());
+
+    return failed_files.empty();
+}
+
+template<typename ImageType>
+void APRBatchConverter<ImageType>::print_statistics() const {
+    std::cout << "converted " << write_statistics.items << " files in " << total_time << " s";
+    if (failed_files.size() > 0) {
+        std::cout << ", " << failed_files.size() << " failed";
+    }
+    std::cout << std::endl;
+    std::cout << "stage threads items busy(s) waiting_input(s) waiting_output(s) utilisation(%)" << std::endl;
+    const std::vector<std::pair<std::string, const StageStatistics*>> stages = {{"read", &read_statistics}, {"convert", &convert_statistics}, {"write", &write_statistics}};
+    for (const auto &stage : stages) {
+        const StageStatistics &statistics = *stage.second;
+        std::cout << stage.first << " " << statistics.threads << " " << statistics.items << " " << statistics.busy_time << " "
+                  << statistics.input_wait_time << " " << statistics.output_wait_time << " " << 100*statistics.utilisation(total_time) << std::endl;
+    }
+}
+
+template<typename ImageType>
+bool APRBatchConverter<ImageType>::has_image_type(const TiffUtils::TiffInfo &aTiff) {
+    switch (aTiff.iType) {
+        case TiffUtils::TiffInfo::TiffType::TIFF_UINT8:
+            return std::is_same<ImageType, uint8_t>::value;
+        case TiffUtils::TiffInfo::TiffType::TIFF_UINT16:
+            return std::is_same<ImageType, uint16_t>::value;
+        case TiffUtils::TiffInfo::TiffType::TIFF_FLOAT:
+            return std::is_same<ImageType, float>::value;
+        default:
+            return false;
+    }
+}
+
+template<typename ImageType>
+void APRBatchConverter<ImageType>::set_number_threads(unsigned int number_threads) {
+    //the OpenMP number of threads is per thread, so this only sets the budget of the calling stage
+#ifdef HAVE_OPENMP
+    if (number_threads > 0) {
+        omp_set_num_threads(number_threads);
+    }
+#else
+    (void) number_threads;
+#endif
+}
+
+template<typename ImageType>
+void APRBatchConverter<ImageType>::add_failed(const std::string &file_name, const char *reason) {
+    std::lock_guard<std::mutex> lock(statistics_mutex);
+    std::cerr << "Could not convert " << par.input_dir + file_name;
+    if (reason != nullptr) {
+        std::cerr << " (" << reason << ")";
+    }
+    std::cerr << std::endl;
+    failed_files.push_back(file_name);
+}
+
+
+#endif //PARTPLAY_APR_BATCH_CONVERTER_HPP
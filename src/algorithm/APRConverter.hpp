@@ -48,6 +48,22 @@ public:
         }
     };
 
+    /**
+     * Constructs the APR from an image already in memory (for example a frame of a time-lapse)
+     */
+    template<typename T>
+    bool get_apr(APR<ImageType> &aAPR, MeshData<T> &input_image) {
+        apr = &aAPR;
+
+        method_timer.start_timer("calculate automatic parameters");
+        auto_parameters(input_image);
+        method_timer.stop_timer();
+
+        return get_apr_method(aAPR, input_image);
+    }
+
+    void release_workspace();
+
 private:
     //get apr without setting parameters, and with an already loaded image.
     template<typename T>
@@ -56,18 +72,41 @@ private:
     //pointer to the APR structure so member functions can have access if they need
     const APR<ImageType> *apr;
 
+    //image buffers of the pipeline, kept between conversions with par.reuse_workspace
+    MeshData<ImageType> image_temp;
+    MeshData<ImageType> grad_temp;
+    MeshData<float> local_scale_temp;
+    MeshData<float> local_scale_temp2;
+    std::vector<MeshData<float>> level_scale_temp; // down-sampled Local Particle Cell set, per level
+
+    template<typename U>
+    bool init_workspace_buffer(MeshData<U> &buffer, size_t y_num, size_t x_num, size_t z_num, bool zero_fill = true);
+    void release_image_buffers();
+
     template<typename T>
     void init_apr(APR<ImageType>& aAPR, MeshData<T>& input_image);
+    void init_apr(APR<ImageType>& aAPR, size_t y_num, size_t x_num, size_t z_num);
 
     template<typename T>
     void auto_parameters(const MeshData<T> &input_img);
+    template<typename T>
+    void auto_parameters(const MeshData<T> &input_img, const std::vector<size_t> &selectedSlicesOffsets, const std::vector<int64_t> &patchSlicesOffsets);
+    template<typename T>
+    void auto_parameters_from_file(const TiffUtils::TiffInfo &aTiffFile);
 
     template<typename T>
     bool get_apr_method_from_file(APR<ImageType> &aAPR, const TiffUtils::TiffInfo &aTiffFile);
+    template<typename T>
+    bool get_apr_method_slabs(APR<ImageType> &aAPR, const TiffUtils::TiffInfo &aTiffFile);
+    size_t get_slab_halo();
 
+    template<typename T>
+    float offset_image(const MeshData<T> &input_image, MeshData<ImageType> &image_temp);
     void get_gradient(MeshData<ImageType> &image_temp, MeshData<ImageType> &grad_temp, MeshData<float> &local_scale_temp, MeshData<float> &local_scale_temp2, float bspline_offset);
     void get_local_intensity_scale(MeshData<float> &local_scale_temp, MeshData<float> &local_scale_temp2);
-    void get_local_particle_cell_set(MeshData<ImageType> &grad_temp, MeshData<float> &local_scale_temp, MeshData<float> &local_scale_temp2);
+    void get_local_particle_cell_set(MeshData<ImageType> &grad_temp, MeshData<float> &local_scale_temp);
+    void compute_level(MeshData<ImageType> &grad_temp, MeshData<float> &local_scale_temp);
+    void fill_particle_cell_tree(MeshData<float> &local_scale_temp, size_t z_offset);
 };
 
 
@@ -76,6 +115,10 @@ private:
  */
 template<typename ImageType> template<typename T>
 bool APRConverter<ImageType>::get_apr_method_from_file(APR<ImageType> &aAPR, const TiffUtils::TiffInfo &aTiffFile) {
+    if (par.memory_budget_mb > 0) {
+        return get_apr_method_slabs<T>(aAPR, aTiffFile);
+    }
+
     allocation_timer.start_timer("read tif input image");
     MeshData<T> inputImage = TiffUtils::getMesh<T>(aTiffFile);
     allocation_timer.stop_timer();
@@ -104,14 +147,18 @@ bool APRConverter<ImageType>::get_apr_method(APR<ImageType> &aAPR, MeshData<T>&
 
     //assuming uint16, the total memory cost shoudl be approximately (1 + 1 + 1/8 + 2/8 + 2/8) = 2 5/8 original image size in u16bit
     //storage of the particle cell tree for computing the pulling scheme
+    //(the buffers are members, with par.reuse_workspace they are kept for the next image with the same dimensions)
     allocation_timer.start_timer("init and copy image");
-    MeshData<ImageType> image_temp(input_image, false /* don't copy */); // global image variable useful for passing between methods, or re-using memory (should be the only full sized copy of the image)
-    MeshData<ImageType> grad_temp; // should be a down-sampled image
-    grad_temp.initDownsampled(input_image.y_num, input_image.x_num, input_image.z_num, 0);
-    MeshData<float> local_scale_temp; // Used as down-sampled images for some averaging steps where it is useful to not lose precision, or get over-flow errors
-    local_scale_temp.initDownsampled(input_image.y_num, input_image.x_num, input_image.z_num);
-    MeshData<float> local_scale_temp2;
-    local_scale_temp2.initDownsampled(input_image.y_num, input_image.x_num, input_image.z_num);
+    const size_t y_num_ds = (input_image.y_num + 1)/2;
+    const size_t x_num_ds = (input_image.x_num + 1)/2;
+    const size_t z_num_ds = (input_image.z_num + 1)/2;
+    init_workspace_buffer(image_temp, input_image.y_num, input_image.x_num, input_image.z_num, false); // overwritten by offset_image, global image variable useful for passing between methods, or re-using memory (should be the only full sized copy of the image)
+    if (init_workspace_buffer(grad_temp, y_num_ds, x_num_ds, z_num_ds)) { // should be a down-sampled image
+        //the gradient is a max reduction into the buffer
+        grad_temp.fill(0);
+    }
+    init_workspace_buffer(local_scale_temp, y_num_ds, x_num_ds, z_num_ds); // Used as down-sampled images for some averaging steps where it is useful to not lose precision, or get over-flow errors
+    init_workspace_buffer(local_scale_temp2, y_num_ds, x_num_ds, z_num_ds);
     allocation_timer.stop_timer();
 
     /////////////////////////////////
@@ -120,20 +167,7 @@ bool APRConverter<ImageType>::get_apr_method(APR<ImageType> &aAPR, MeshData<T>&
 
     computation_timer.start_timer("Calculations");
 
-    fine_grained_timer.start_timer("offset image");
-    //offset image by factor (this is required if there are zero areas in the background with uint16_t and uint8_t images, as the Bspline co-efficients otherwise may be negative!)
-    // Warning both of these could result in over-flow (if your image is non zero, with a 'buffer' and has intensities up to uint16_t maximum value then set image_type = "", i.e. uncomment the following line)
-    float bspline_offset = 0;
-    if (std::is_same<uint16_t, ImageType>::value) {
-        bspline_offset = 100;
-        image_temp.copyFromMeshWithUnaryOp(input_image, [=](const auto &a) { return (a + bspline_offset); });
-    } else if (std::is_same<uint8_t, ImageType>::value){
-        bspline_offset = 5;
-        image_temp.copyFromMeshWithUnaryOp(input_image, [=](const auto &a) { return (a + bspline_offset); });
-    } else {
-        image_temp.copyFromMesh(input_image);
-    }
-    fine_grained_timer.stop_timer();
+    float bspline_offset = offset_image(input_image, image_temp);
 
     method_timer.start_timer("compute_gradient_magnitude_using_bsplines");
     get_gradient(image_temp, grad_temp, local_scale_temp, local_scale_temp2, bspline_offset);
@@ -144,33 +178,226 @@ bool APRConverter<ImageType>::get_apr_method(APR<ImageType> &aAPR, MeshData<T>&
     method_timer.stop_timer();
 
     method_timer.start_timer("initialize_particle_cell_tree");
+    use_sparse_tree = par.sparse_pulling_scheme;
+    use_packed_tree = par.packed_pulling_scheme;
     initialize_particle_cell_tree(aAPR);
     method_timer.stop_timer();
 
     method_timer.start_timer("compute_local_particle_set");
-    get_local_particle_cell_set(grad_temp, local_scale_temp, local_scale_temp2);
+    get_local_particle_cell_set(grad_temp, local_scale_temp);
     method_timer.stop_timer();
 
     method_timer.start_timer("compute_pulling_scheme");
     PullingScheme::pulling_scheme_main();
     method_timer.stop_timer();
 
-    method_timer.start_timer("downsample_pyramid");
-    std::vector<MeshData<T>> downsampled_img;
-    //Down-sample the image for particle intensity estimation
-    downsamplePyrmaid(input_image, downsampled_img, aAPR.level_max(), aAPR.level_min());
+    method_timer.start_timer("compute_apr_datastructure");
+    if (use_sparse_tree) {
+        aAPR.apr_access.initialize_structure_from_particle_cell_tree(aAPR,particle_cell_tree_sparse);
+    } else if (use_packed_tree) {
+        aAPR.apr_access.initialize_structure_from_particle_cell_tree(aAPR,particle_cell_tree_packed);
+    } else {
+        aAPR.apr_access.initialize_structure_from_particle_cell_tree(aAPR,particle_cell_tree);
+    }
+    method_timer.stop_timer();
+
+    method_timer.start_timer("sample_particles");
+    //the particle intensities (the mean over the Particle Cells) are computed directly from the image, without the down-sampled pyramid
+    aAPR.get_parts_from_img(input_image,aAPR.particles_intensities);
+    method_timer.stop_timer();
+
+    computation_timer.stop_timer();
+
+    if (!par.reuse_workspace) {
+        release_workspace();
+    }
+
+    aAPR.parameters = par;
+
+    total_timer.stop_timer();
+
+    return true;
+}
+
+/**
+ * Frees the buffers kept between conversions (par.reuse_workspace) and the particle cell tree
+ */
+template<typename ImageType>
+void APRConverter<ImageType>::release_workspace() {
+    release_image_buffers();
+    release_particle_cell_tree();
+}
+
+template<typename ImageType>
+void APRConverter<ImageType>::release_image_buffers() {
+    image_temp.init(0, 0, 0);
+    grad_temp.init(0, 0, 0);
+    local_scale_temp.init(0, 0, 0);
+    local_scale_temp2.init(0, 0, 0);
+    level_scale_temp.clear();
+    level_scale_temp.shrink_to_fit();
+}
+
+template<typename ImageType> template<typename U>
+bool APRConverter<ImageType>::init_workspace_buffer(MeshData<U> &buffer, size_t y_num, size_t x_num, size_t z_num, bool zero_fill) {
+    //
+    //  Keeps the buffer if it already has the dimensions (returns true), otherwise allocates it, first touched in parallel
+    //  (MeshData::init with a value) so its pages are placed with the threads working on them. Without zero_fill the
+    //  buffer is only allocated, for buffers fully overwritten in parallel by the caller (first touching them there)
+    //
+
+    if ((buffer.y_num == y_num) && (buffer.x_num == x_num) && (buffer.z_num == z_num) && (buffer.mesh.size() > 0)) {
+        return true;
+    }
+    if (zero_fill) {
+        buffer.init(y_num, x_num, z_num, 0);
+    } else {
+        buffer.init(y_num, x_num, z_num);
+    }
+    return false;
+}
+
+/**
+ * Converts the image in z-slabs read directly from the file, so that apart from the particle cell tree only one slab of the
+ * image buffers is held in memory (sized from par.memory_budget_mb). The APR is an approximation of the one of the whole
+ * image, as the B-spline smoothing is truncated at the halo of the slabs (see get_slab_halo)
+ */
+template<typename ImageType> template<typename T>
+bool APRConverter<ImageType>::get_apr_method_slabs(APR<ImageType> &aAPR, const TiffUtils::TiffInfo &aTiffFile) {
+    //
+    //  Each slab is extended by a halo covering the support of the gradient and the Local Intensity Scale, and the B-spline
+    //  smoothing up to a relative error of its truncation tolerance, so the Local Particle Cell set of its interior is the same as
+    //  when computed on the whole image except for cells with a level on the edge of a threshold. The interior is added to the
+    //  particle cell tree, and the pulling scheme is then run on the complete tree (so propagation across slabs is exact).
+    //  The particle intensities are sampled in a second pass over the slabs.
+    //
+
+    apr = &aAPR;
+
+    if (par.mask_file != "") {
+        std::cerr << "Masks are not supported when converting the image in slabs (memory_budget_mb > 0)" << std::endl;
+        return false;
+    }
+
+    const size_t y_num = aTiffFile.iImgWidth;
+    const size_t x_num = aTiffFile.iImgHeight;
+    const size_t z_num = aTiffFile.iNumberOfDirectories;
+
+    method_timer.start_timer("calculate automatic parameters");
+    auto_parameters_from_file<T>(aTiffFile);
+    method_timer.stop_timer();
+
+    total_timer.start_timer("Total_pipeline_slabs");
+
+    init_apr(aAPR, y_num, x_num, z_num);
+
+    method_timer.start_timer("initialize_particle_cell_tree");
+    use_sparse_tree = par.sparse_pulling_scheme;
+    use_packed_tree = par.packed_pulling_scheme;
+    initialize_particle_cell_tree(aAPR);
+    method_timer.stop_timer();
+
+    //slab boundaries are aligned with the largest Particle Cells, so the down-sampling of each slab is exact
+    const size_t alignment = std::max((size_t)2, (size_t)1 << (aAPR.level_max() - aAPR.level_min()));
+    const size_t halo = get_slab_halo();
+
+    //per slice: input, offset image, down-sampled gradient and two down-sampled float buffers
+    const double tree_bytes = particle_cell_tree_size_in_bytes();
+    const double slice_bytes = (1.0*y_num*x_num)*(sizeof(T) + sizeof(ImageType) + sizeof(ImageType)/8.0 + 2*sizeof(float)/8.0);
+    const double budget_slices = (par.memory_budget_mb*1000000.0 - tree_bytes)/slice_bytes;
+
+    const size_t slab_size = alignment*std::max((int64_t)1, (int64_t)floor((budget_slices - 2*halo)/alignment));
+
+    if (budget_slices < (2*halo + alignment)) {
+        std::cout << "Memory budget too small, using the minimal slab of " << slab_size << " slices (" << (tree_bytes + (slab_size + 2*halo)*slice_bytes)/1000000.0 << " MB)" << std::endl;
+    }
+
+    computation_timer.start_timer("Calculations");
+
+    for (size_t z_begin = 0; z_begin < z_num; z_begin += slab_size) {
+        const size_t z_end = std::min(z_begin + slab_size, z_num);
+        //halo is even, so the slab is aligned with the down-sampled grid
+        const size_t z_begin_halo = (z_begin > halo) ? z_begin - halo : 0;
+        const size_t z_end_halo = std::min(z_end + halo, z_num);
+
+        float bspline_offset;
+        {
+            allocation_timer.start_timer("read tif slab");
+            MeshData<T> input_slab = TiffUtils::getMeshSlab<T>(aTiffFile, z_begin_halo, z_end_halo);
+            allocation_timer.stop_timer();
+
+            init_workspace_buffer(image_temp, input_slab.y_num, input_slab.x_num, input_slab.z_num, false);
+            bspline_offset = offset_image(input_slab, image_temp);
+        }
+
+        allocation_timer.start_timer("init slab buffers");
+        const size_t y_num_ds = (image_temp.y_num + 1)/2;
+        const size_t x_num_ds = (image_temp.x_num + 1)/2;
+        const size_t z_num_slab_ds = (image_temp.z_num + 1)/2;
+        if (init_workspace_buffer(grad_temp, y_num_ds, x_num_ds, z_num_slab_ds)) {
+            grad_temp.fill(0);
+        }
+        init_workspace_buffer(local_scale_temp, y_num_ds, x_num_ds, z_num_slab_ds);
+        init_workspace_buffer(local_scale_temp2, y_num_ds, x_num_ds, z_num_slab_ds);
+        allocation_timer.stop_timer();
+
+        method_timer.start_timer("compute_gradient_magnitude_using_bsplines");
+        get_gradient(image_temp, grad_temp, local_scale_temp, local_scale_temp2, bspline_offset);
+        method_timer.stop_timer();
+
+        method_timer.start_timer("compute_local_intensity_scale");
+        get_local_intensity_scale(local_scale_temp, local_scale_temp2);
+        method_timer.stop_timer();
+
+        method_timer.start_timer("compute_local_particle_set");
+        compute_level(grad_temp, local_scale_temp);
+
+        //keep only the interior of the slab (down-sampled)
+        const size_t slice_size_ds = local_scale_temp.x_num*local_scale_temp.y_num;
+        const size_t z_begin_ds = (z_begin - z_begin_halo)/2;
+        const size_t z_num_ds = (z_end - z_begin + 1)/2;
+        init_workspace_buffer(local_scale_temp2, local_scale_temp.y_num, local_scale_temp.x_num, z_num_ds);
+        std::copy(local_scale_temp.mesh.begin() + z_begin_ds*slice_size_ds, local_scale_temp.mesh.begin() + (z_begin_ds + z_num_ds)*slice_size_ds, local_scale_temp2.mesh.begin());
+
+        fill_particle_cell_tree(local_scale_temp2, z_begin/2);
+        method_timer.stop_timer();
+    }
+
+    if (!par.reuse_workspace) {
+        release_image_buffers();
+    }
+
+    method_timer.start_timer("compute_pulling_scheme");
+    PullingScheme::pulling_scheme_main();
     method_timer.stop_timer();
 
     method_timer.start_timer("compute_apr_datastructure");
-    aAPR.apr_access.initialize_structure_from_particle_cell_tree(aAPR,particle_cell_tree);
+    if (use_sparse_tree) {
+        aAPR.apr_access.initialize_structure_from_particle_cell_tree(aAPR,particle_cell_tree_sparse);
+    } else if (use_packed_tree) {
+        aAPR.apr_access.initialize_structure_from_particle_cell_tree(aAPR,particle_cell_tree_packed);
+    } else {
+        aAPR.apr_access.initialize_structure_from_particle_cell_tree(aAPR,particle_cell_tree);
+    }
     method_timer.stop_timer();
 
     method_timer.start_timer("sample_particles");
-    aAPR.get_parts_from_img(downsampled_img,aAPR.particles_intensities);
+    aAPR.particles_intensities.data.resize(aAPR.total_number_particles());
+    for (size_t z_begin = 0; z_begin < z_num; z_begin += slab_size) {
+        const size_t z_end = std::min(z_begin + slab_size, z_num);
+
+        MeshData<T> input_slab = TiffUtils::getMeshSlab<T>(aTiffFile, z_begin, z_end);
+        aAPR.get_parts_from_img(input_slab, aAPR.particles_intensities, [](const float x, const float y) -> float { return x + y; },
+                                [](const float x) -> float { return x/8.0; }, z_begin);
+    }
     method_timer.stop_timer();
 
     computation_timer.stop_timer();
 
+    if (!par.reuse_workspace) {
+        release_particle_cell_tree();
+    }
+
     aAPR.parameters = par;
 
     total_timer.stop_timer();
@@ -179,13 +406,71 @@ bool APRConverter<ImageType>::get_apr_method(APR<ImageType> &aAPR, MeshData<T>&
 }
 
 template<typename ImageType>
-void APRConverter<ImageType>::get_local_particle_cell_set(MeshData<ImageType> &grad_temp, MeshData<float> &local_scale_temp, MeshData<float> &local_scale_temp2) {
+size_t APRConverter<ImageType>::get_slab_halo() {
+    //
+    //  Number of slices a slab has to be extended by in z, for the Local Particle Cell set of its interior to match the whole image.
+    //  The stencils of the gradient and the Local Intensity Scale are covered exactly, the recursive B-spline filter (infinite
+    //  support) only up to a relative error of tol^2, so the result is approximate: the smoothed values at the slab interior
+    //  differ from the whole image ones by about float rounding, which can move a Particle Cell across a level threshold.
+    //
+
+    float var_rescale;
+    std::vector<int> var_win;
+    get_window(var_rescale,var_win,par);
+
+    //gradient stencil and down-sampling, then (down-sampled) inverse B-spline and the two means of the Local Intensity Scale
+    size_t halo = 2 + 2*(1 + var_win[2] + var_win[5]);
+
+    if (par.lambda > 0) {
+        //the recursive B-spline filter decays as rho^k, twice the filter's own truncation length is used (error ~ tol^2)
+        const float lambda = par.lambda;
+        const float tol = 0.0001;
+        float xi = 1 - 96*lambda + 24*lambda*sqrt(3 + 144*lambda);
+        float rho = (24*lambda - 1 - sqrt(xi))/(24*lambda)*sqrt((1/xi)*(48*lambda + 24*lambda*sqrt(3 + 144*lambda)));
+        halo += 2*(size_t)(ceil(std::abs(log(tol)/log(rho))));
+    }
+
+    return halo + (halo % 2);
+}
+
+template<typename ImageType> template<typename T>
+float APRConverter<ImageType>::offset_image(const MeshData<T> &input_image, MeshData<ImageType> &image_temp) {
+    fine_grained_timer.start_timer("offset image");
+    //offset image by factor (this is required if there are zero areas in the background with uint16_t and uint8_t images, as the Bspline co-efficients otherwise may be negative!)
+    // Warning both of these could result in over-flow (if your image is non zero, with a 'buffer' and has intensities up to uint16_t maximum value then set image_type = "", i.e. uncomment the following line)
+    float bspline_offset = 0;
+    if (std::is_same<uint16_t, ImageType>::value) {
+        bspline_offset = 100;
+        image_temp.copyFromMeshWithUnaryOp(input_image, [=](const auto &a) { return (a + bspline_offset); });
+    } else if (std::is_same<uint8_t, ImageType>::value){
+        bspline_offset = 5;
+        image_temp.copyFromMeshWithUnaryOp(input_image, [=](const auto &a) { return (a + bspline_offset); });
+    } else {
+        image_temp.copyFromMesh(input_image);
+    }
+    fine_grained_timer.stop_timer();
+
+    return bspline_offset;
+}
+
+template<typename ImageType>
+void APRConverter<ImageType>::get_local_particle_cell_set(MeshData<ImageType> &grad_temp, MeshData<float> &local_scale_temp) {
     //
     //  Computes the Local Particle Cell Set from a down-sampled local intensity scale (\sigma) and gradient magnitude
     //
     //  Down-sampled due to the Equivalence Optimization
     //
 
+    compute_level(grad_temp, local_scale_temp);
+    fill_particle_cell_tree(local_scale_temp, 0);
+}
+
+template<typename ImageType>
+void APRConverter<ImageType>::compute_level(MeshData<ImageType> &grad_temp, MeshData<float> &local_scale_temp) {
+    //
+    //  Computes the (down-sampled) Particle Cell level from the gradient magnitude and local intensity scale, stored in local_scale_temp
+    //
+
     fine_grained_timer.start_timer("compute_level_first");
     //divide gradient magnitude by Local Intensity Scale (first step in calculating the Local Resolution Estimate L(y), minus constants)
     #ifdef HAVE_OPENMP
@@ -199,26 +484,39 @@ void APRConverter<ImageType>::get_local_particle_cell_set(MeshData<ImageType> &g
     float min_dim = std::min(par.dy,std::min(par.dx,par.dz));
     float level_factor = pow(2,(*apr).level_max())*min_dim;
 
-    int l_max = (*apr).level_max() - 1;
-    int l_min = (*apr).level_min();
-
     fine_grained_timer.start_timer("compute_level_second");
     //incorporate other factors and compute the level of the Particle Cell, effectively construct LPC L_n
     compute_level_for_array(local_scale_temp,level_factor,par.rel_error);
-    fill(l_max,local_scale_temp);
     fine_grained_timer.stop_timer();
+}
+
+template<typename ImageType>
+void APRConverter<ImageType>::fill_particle_cell_tree(MeshData<float> &local_scale_temp, size_t z_offset) {
+    //
+    //  Adds the Local Particle Cell set to the particle cell tree, from the level computed by compute_level (or a z-slab of it starting at z_offset)
+    //
+
+    int l_max = (*apr).level_max() - 1;
+    int l_min = (*apr).level_min();
 
     fine_grained_timer.start_timer("level_loop_initialize_tree");
+    fill(l_max,local_scale_temp,z_offset);
+
+    level_scale_temp.resize(l_max + 1);
+    const MeshData<float> *level_scale = &local_scale_temp;
     for(int l_ = l_max - 1; l_ >= l_min; l_--){
 
-        //down sample the resolution level k, using a max reduction
-        downsample(local_scale_temp, local_scale_temp2,
+        //down sample the resolution level k, using a max reduction (into the buffer of the level, kept with the same dimensions)
+        MeshData<float> &level_scale_ds = level_scale_temp[l_];
+        init_workspace_buffer(level_scale_ds, (level_scale->y_num + 1)/2, (level_scale->x_num + 1)/2, (level_scale->z_num + 1)/2);
+        downsample(*level_scale, level_scale_ds,
                    [](const float &x, const float &y) -> float { return std::max(x, y); },
-                   [](const float &x) -> float { return x; }, true);
+                   [](const float &x) -> float { return x; });
+        z_offset /= 2;
         //for those value of level k, add to the hash table
-        fill(l_,local_scale_temp2);
-        //assign the previous mesh to now be resampled.
-        local_scale_temp.swap(local_scale_temp2);
+        fill(l_,level_scale_ds,z_offset);
+        //the level is now resampled
+        level_scale = &level_scale_ds;
     }
     fine_grained_timer.stop_timer();
 }
@@ -232,32 +530,25 @@ void APRConverter<ImageType>::get_gradient(MeshData<ImageType> &image_temp, Mesh
 
     fine_grained_timer.verbose_flag = false;
 
-    fine_grained_timer.start_timer("smooth_bspline");
     if(par.lambda > 0) {
-        get_smooth_bspline_3D(image_temp, par.lambda);
-    }
-    fine_grained_timer.stop_timer();
-
-    fine_grained_timer.start_timer("calc_bspline_fd_mag_ds");
-    calc_bspline_fd_ds_mag(image_temp,grad_temp,par.dx,par.dy,par.dz);
-    fine_grained_timer.stop_timer();
-
-    fine_grained_timer.start_timer("down-sample_b-spline");
-    downsample(image_temp, local_scale_temp,
-               [](const float &x, const float &y) -> float { return x + y; },
-               [](const float &x) -> float { return x / 8.0; });
-    fine_grained_timer.stop_timer();
-
-    if(par.lambda > 0){
-        fine_grained_timer.start_timer("calc_inv_bspline_y");
-        calc_inv_bspline_y(local_scale_temp);
-        fine_grained_timer.stop_timer();
-        fine_grained_timer.start_timer("calc_inv_bspline_x");
-        calc_inv_bspline_x(local_scale_temp);
+        //smoothing, gradient, down-sampling and the inverse filters in y and x streamed through the image in z
+        fine_grained_timer.start_timer("smooth_bspline_gradient_fused");
+        get_gradient_bspline_fused(image_temp, grad_temp, local_scale_temp, par.lambda, par.dx, par.dy, par.dz);
         fine_grained_timer.stop_timer();
+
         fine_grained_timer.start_timer("calc_inv_bspline_z");
         calc_inv_bspline_z(local_scale_temp);
         fine_grained_timer.stop_timer();
+    } else {
+        fine_grained_timer.start_timer("calc_bspline_fd_mag_ds");
+        calc_bspline_fd_ds_mag(image_temp,grad_temp,par.dx,par.dy,par.dz);
+        fine_grained_timer.stop_timer();
+
+        fine_grained_timer.start_timer("down-sample_b-spline");
+        downsample(image_temp, local_scale_temp,
+                   [](const float &x, const float &y) -> float { return x + y; },
+                   [](const float &x) -> float { return x / 8.0; });
+        fine_grained_timer.stop_timer();
     }
 
     fine_grained_timer.start_timer("load_and_apply_mask");
@@ -324,13 +615,18 @@ void APRConverter<ImageType>::get_local_intensity_scale(MeshData<float> &local_s
 
 template<typename ImageType> template<typename T>
 void APRConverter<ImageType>::init_apr(APR<ImageType>& aAPR,MeshData<T>& input_image){
+    init_apr(aAPR, input_image.y_num, input_image.x_num, input_image.z_num);
+}
+
+template<typename ImageType>
+void APRConverter<ImageType>::init_apr(APR<ImageType>& aAPR, size_t y_num, size_t x_num, size_t z_num){
     //
     //  Initializing the size of the APR, min and maximum level (in the data structures it is called depth)
     //
 
-    aAPR.apr_access.org_dims[0] = input_image.y_num;
-    aAPR.apr_access.org_dims[1] = input_image.x_num;
-    aAPR.apr_access.org_dims[2] = input_image.z_num;
+    aAPR.apr_access.org_dims[0] = y_num;
+    aAPR.apr_access.org_dims[1] = x_num;
+    aAPR.apr_access.org_dims[2] = z_num;
 
     int max_dim = std::max(std::max(aAPR.apr_access.org_dims[1], aAPR.apr_access.org_dims[0]), aAPR.apr_access.org_dims[2]);
     int min_dim = std::min(std::min(aAPR.apr_access.org_dims[1], aAPR.apr_access.org_dims[0]), aAPR.apr_access.org_dims[2]);
@@ -343,28 +639,84 @@ void APRConverter<ImageType>::init_apr(APR<ImageType>& aAPR,MeshData<T>& input_i
     aAPR.apr_access.level_max = levelMax;
 }
 
-template<typename ImageType> template<typename T>
-void APRConverter<ImageType>::auto_parameters(const MeshData<T>& input_img){
-    //
-    //  Simple automatic parameter selection for 3D APR Flouresence Images
-    //
-
-    APRTimer par_timer;
-    par_timer.verbose_flag = false;
-
+/**
+ * Selects the slices used for estimating the parameters, the histogram is computed on selectedSlicesOffsets and the noise
+ * patches (3x3x3) around patchSlicesOffsets
+ */
+inline void get_auto_parameters_slices(size_t y_num, size_t x_num, size_t z_num, std::vector<size_t> &selectedSlicesOffsets, std::vector<int64_t> &patchSlicesOffsets) {
     //
     //  Do not compute the statistics over the whole image, but only a smaller sub-set.
     //
     const double total_required_pixel = 10*1000*1000;
-    size_t num_slices = std::min((unsigned int)ceil(total_required_pixel/(1.0*input_img.y_num*input_img.x_num)),(unsigned int)input_img.z_num);
-    size_t delta = std::max((unsigned int)1,(unsigned int)(input_img.z_num/num_slices));
-    std::vector<size_t> selectedSlicesOffsets;
+    size_t num_slices = std::min((unsigned int)ceil(total_required_pixel/(1.0*y_num*x_num)),(unsigned int)z_num);
+    size_t delta = std::max((unsigned int)1,(unsigned int)(z_num/num_slices));
+    selectedSlicesOffsets.clear();
     selectedSlicesOffsets.reserve(num_slices);
+    patchSlicesOffsets.clear();
+    patchSlicesOffsets.reserve(num_slices);
     //evenly space the slices across the image
     for (size_t i1 = 0; i1 < num_slices; ++i1) {
         selectedSlicesOffsets.push_back(delta*i1);
+        // limit slice to range [1, z_num-2]
+        patchSlicesOffsets.push_back(std::min((int) z_num - 2, std::max((int) (delta*i1), (int) 1)));
+    }
+}
+
+template<typename ImageType> template<typename T>
+void APRConverter<ImageType>::auto_parameters(const MeshData<T>& input_img){
+    std::vector<size_t> selectedSlicesOffsets;
+    std::vector<int64_t> patchSlicesOffsets;
+    get_auto_parameters_slices(input_img.y_num, input_img.x_num, input_img.z_num, selectedSlicesOffsets, patchSlicesOffsets);
+
+    auto_parameters(input_img, selectedSlicesOffsets, patchSlicesOffsets);
+}
+
+template<typename ImageType> template<typename T>
+void APRConverter<ImageType>::auto_parameters_from_file(const TiffUtils::TiffInfo &aTiffFile){
+    //
+    //  Same as auto_parameters, but only reads the slices required for the statistics from the file
+    //
+
+    const size_t y_num = aTiffFile.iImgWidth;
+    const size_t x_num = aTiffFile.iImgHeight;
+    const size_t z_num = aTiffFile.iNumberOfDirectories;
+
+    std::vector<size_t> selectedSlicesOffsets;
+    std::vector<int64_t> patchSlicesOffsets;
+    get_auto_parameters_slices(y_num, x_num, z_num, selectedSlicesOffsets, patchSlicesOffsets);
+
+    if (z_num < 3) {
+        MeshData<T> input_img = TiffUtils::getMeshSlab<T>(aTiffFile, 0, z_num);
+        auto_parameters(input_img, selectedSlicesOffsets, patchSlicesOffsets);
+        return;
     }
 
+    //each selected slice is read with its patch neighbourhood [patch - 1, patch + 1] (which contains the selected slice)
+    const size_t slice_size = y_num*x_num;
+    MeshData<T> input_img(y_num, x_num, 3*selectedSlicesOffsets.size());
+    std::vector<size_t> sampleSlicesOffsets;
+    std::vector<int64_t> samplePatchSlicesOffsets;
+
+    for (size_t s = 0; s < selectedSlicesOffsets.size(); ++s) {
+        MeshData<T> slices = TiffUtils::getMeshSlab<T>(aTiffFile, patchSlicesOffsets[s] - 1, patchSlicesOffsets[s] + 2);
+        std::copy(slices.mesh.begin(), slices.mesh.end(), input_img.mesh.begin() + 3*s*slice_size);
+
+        sampleSlicesOffsets.push_back(3*s + (selectedSlicesOffsets[s] + 1 - patchSlicesOffsets[s]));
+        samplePatchSlicesOffsets.push_back(3*s + 1);
+    }
+
+    auto_parameters(input_img, sampleSlicesOffsets, samplePatchSlicesOffsets);
+}
+
+template<typename ImageType> template<typename T>
+void APRConverter<ImageType>::auto_parameters(const MeshData<T>& input_img, const std::vector<size_t> &selectedSlicesOffsets, const std::vector<int64_t> &patchSlicesOffsets){
+    //
+    //  Simple automatic parameter selection for 3D APR Flouresence Images
+    //
+
+    APRTimer par_timer;
+    par_timer.verbose_flag = false;
+
     // Get min value
     par_timer.start_timer("get_min");
     float min_val = 99999999;
@@ -459,7 +811,6 @@ void APRConverter<ImageType>::auto_parameters(const MeshData<T>& input_img){
     }
 
 
-    int64_t z_num = input_img.z_num;
     int64_t x_num = input_img.x_num;
     int64_t y_num = input_img.y_num;
 
@@ -468,8 +819,7 @@ void APRConverter<ImageType>::auto_parameters(const MeshData<T>& input_img){
     uint64_t counter_p = 0;
     if (patches.size() > 0) {
         for (size_t s = 0; s < selectedSlicesOffsets.size(); ++s) {
-            // limit slice to range [1, z_num-2]
-            int64_t z = std::min((int) z_num - 2, std::max((int) selectedSlicesOffsets[s], (int) 1));
+            int64_t z = patchSlicesOffsets[s];
             for (int64_t x = 1; x < (x_num - 1); ++x) {
                 for (int64_t y = 1; y < (y_num - 1); ++y) {
                     float val = input_img.mesh[z * x_num * y_num + x * y_num + y];
@@ -33,6 +33,20 @@ public:
     float noise_sd_estimate = 0;
     float background_intensity_estimate = 0;
 
+    // if > 0 the image is converted in z-slabs read from file, keeping the memory used by the image buffers within the budget (in MB),
+    // the APR can differ from the in-memory conversion at a few Particle Cells (the B-spline smoothing is truncated at the slab halos)
+    float memory_budget_mb = 0;
+
+    // use the sparse (brick) particle cell tree in the pulling scheme, faster and smaller for sparse images, same result
+    bool sparse_pulling_scheme = false;
+
+    // use the packed (4 bits per cell) particle cell tree in the pulling scheme, half the memory of the dense tree, same result
+    bool packed_pulling_scheme = false;
+
+    // keep the image buffers and the particle cell tree of the converter between conversions of images with the same
+    // dimensions (time-lapses, batches), instead of allocating them for each image, until release_workspace() is called
+    bool reuse_workspace = false;
+
     std::string name;
     std::string output_dir;
     std::string input_image_name;
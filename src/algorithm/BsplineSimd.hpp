@@ -0,0 +1,299 @@
+//  Explicitly vectorized (SSE2, AVX2 and AVX-512) kernels of the recursive b-spline filters used by ComputeGradient.
+//  The instruction set is chosen at run time from the ones supported by the CPU, the kernels are compiled for each of
+//  them (with GCC target options) so no special compiler flags are needed. The scalar code in ComputeGradient is the
+//  reference, and is used for other compilers/architectures, unsupported image types, or when selected with
+//  set_instruction_set(InstructionSet::Scalar).
+//
+//  The y filter (recursive along the memory direction) processes L rows at once, transposing them into L lanes.
+//
+
+#ifndef PARTPLAY_BSPLINESIMD_HPP
+#define PARTPLAY_BSPLINESIMD_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+
+#if defined(__GNUC__) && !defined(__clang__) && (defined(__x86_64__) || defined(__i386__)) && !defined(APR_NO_SIMD)
+    #define APR_BSPLINE_SIMD
+    #include <immintrin.h>
+#endif
+
+namespace BsplineSimd {
+
+    enum class InstructionSet : int {
+        Scalar = 0,
+        SSE2 = 1,
+        AVX2 = 2,
+        AVX512 = 3
+    };
+
+    inline const char *instruction_set_name(InstructionSet aSet) {
+        switch (aSet) {
+            case InstructionSet::SSE2: return "SSE2";
+            case InstructionSet::AVX2: return "AVX2";
+            case InstructionSet::AVX512: return "AVX-512";
+            default: return "scalar";
+        }
+    }
+
+    /**
+     * Best instruction set supported by the CPU (and this build)
+     */
+    inline InstructionSet supported_instruction_set() {
+#ifdef APR_BSPLINE_SIMD
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) return InstructionSet::AVX512;
+        if (__builtin_cpu_supports("avx2")) return InstructionSet::AVX2;
+        if (__builtin_cpu_supports("sse2")) return InstructionSet::SSE2;
+#endif
+        return InstructionSet::Scalar;
+    }
+
+    inline InstructionSet &selected_instruction_set() {
+        static InstructionSet instruction_set = supported_instruction_set();
+        return instruction_set;
+    }
+
+    /**
+     * Instruction set used by the kernels (by default the best supported one)
+     */
+    inline InstructionSet instruction_set() {
+        return selected_instruction_set();
+    }
+
+    /**
+     * Selects the instruction set used by the kernels (limited to the supported ones), e.g. Scalar to use the reference code
+     */
+    inline void set_instruction_set(InstructionSet aSet) {
+        selected_instruction_set() = (InstructionSet) std::min((int) aSet, (int) supported_instruction_set());
+    }
+
+    // image types the kernels support
+    template<typename T>
+    struct IsSupportedType {
+        static const bool value = std::is_same<T, float>::value || std::is_same<T, uint16_t>::value;
+    };
+
+#ifdef APR_BSPLINE_SIMD
+
+#pragma GCC push_options
+#pragma GCC target("sse2")
+    namespace sse2 {
+        struct Ops {
+            typedef __m128 V;
+            static const size_t L = 4;
+
+            static inline V set1(float a) { return _mm_set1_ps(a); }
+            static inline V add(V a, V b) { return _mm_add_ps(a, b); }
+            static inline V mul(V a, V b) { return _mm_mul_ps(a, b); }
+            static inline V as_uint16(V a) { return _mm_cvtepi32_ps(_mm_and_si128(_mm_cvttps_epi32(a), _mm_set1_epi32(0xFFFF))); }
+            static inline V load(const float *p) { return _mm_loadu_ps(p); }
+            static inline V load(const uint16_t *p) {
+                return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *) p), _mm_setzero_si128()));
+            }
+            static inline void store(float *p, V a) { _mm_storeu_ps(p, a); }
+            static inline void store(uint16_t *p, V a) {
+                //keep the lower 16 bits (as the scalar conversion), sign extended so the saturating pack does not change them
+                __m128i i = _mm_srai_epi32(_mm_slli_epi32(_mm_cvttps_epi32(a), 16), 16);
+                _mm_storel_epi64((__m128i *) p, _mm_packs_epi32(i, i));
+            }
+            static inline V add_double(V a, V b, V c) {
+                const __m128d low = _mm_add_pd(_mm_add_pd(_mm_cvtps_pd(a), _mm_cvtps_pd(b)), _mm_cvtps_pd(c));
+                const __m128d high = _mm_add_pd(_mm_add_pd(_mm_cvtps_pd(_mm_movehl_ps(a, a)), _mm_cvtps_pd(_mm_movehl_ps(b, b))),
+                                                _mm_cvtps_pd(_mm_movehl_ps(c, c)));
+                return _mm_movelh_ps(_mm_cvtpd_ps(low), _mm_cvtpd_ps(high));
+            }
+        };
+
+        #include "BsplineSimdKernels.hpp"
+    }
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+    namespace avx2 {
+        struct Ops {
+            typedef __m256 V;
+            static const size_t L = 8;
+
+            static inline V set1(float a) { return _mm256_set1_ps(a); }
+            static inline V add(V a, V b) { return _mm256_add_ps(a, b); }
+            static inline V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+            static inline V as_uint16(V a) { return _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_cvttps_epi32(a), _mm256_set1_epi32(0xFFFF))); }
+            static inline V load(const float *p) { return _mm256_loadu_ps(p); }
+            static inline V load(const uint16_t *p) {
+                return _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *) p)));
+            }
+            static inline void store(float *p, V a) { _mm256_storeu_ps(p, a); }
+            static inline void store(uint16_t *p, V a) {
+                __m256i i = _mm256_srai_epi32(_mm256_slli_epi32(_mm256_cvttps_epi32(a), 16), 16);
+                i = _mm256_permute4x64_epi64(_mm256_packs_epi32(i, i), 0xD8);
+                _mm_storeu_si128((__m128i *) p, _mm256_castsi256_si128(i));
+            }
+            static inline V add_double(V a, V b, V c) {
+                const __m256d low = _mm256_add_pd(_mm256_add_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(a)), _mm256_cvtps_pd(_mm256_castps256_ps128(b))),
+                                                  _mm256_cvtps_pd(_mm256_castps256_ps128(c)));
+                const __m256d high = _mm256_add_pd(_mm256_add_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(a, 1)), _mm256_cvtps_pd(_mm256_extractf128_ps(b, 1))),
+                                                   _mm256_cvtps_pd(_mm256_extractf128_ps(c, 1)));
+                return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(low)), _mm256_cvtpd_ps(high), 1);
+            }
+        };
+
+        #include "BsplineSimdKernels.hpp"
+    }
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized" // undefined elements in the avx512f intrinsics
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+    namespace avx512 {
+        struct Ops {
+            typedef __m512 V;
+            static const size_t L = 16;
+
+            static inline V set1(float a) { return _mm512_set1_ps(a); }
+            //the rounding mode versions are not contracted into fused multiply-add (which avx512f enables)
+            static inline V add(V a, V b) { return _mm512_add_round_ps(a, b, _MM_FROUND_CUR_DIRECTION); }
+            static inline V mul(V a, V b) { return _mm512_mul_round_ps(a, b, _MM_FROUND_CUR_DIRECTION); }
+            static inline V as_uint16(V a) { return _mm512_cvtepi32_ps(_mm512_and_si512(_mm512_cvttps_epi32(a), _mm512_set1_epi32(0xFFFF))); }
+            static inline V load(const float *p) { return _mm512_loadu_ps(p); }
+            static inline V load(const uint16_t *p) {
+                return _mm512_cvtepi32_ps(_mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *) p)));
+            }
+            static inline void store(float *p, V a) { _mm512_storeu_ps(p, a); }
+            static inline void store(uint16_t *p, V a) {
+                _mm256_storeu_si256((__m256i *) p, _mm512_cvtepi32_epi16(_mm512_cvttps_epi32(a)));
+            }
+            static inline __m512d high_to_double(V a) { return _mm512_cvtps_pd(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(a), 1))); }
+            static inline V add_double(V a, V b, V c) {
+                const __m512d low = _mm512_add_pd(_mm512_add_pd(_mm512_cvtps_pd(_mm512_castps512_ps256(a)), _mm512_cvtps_pd(_mm512_castps512_ps256(b))),
+                                                  _mm512_cvtps_pd(_mm512_castps512_ps256(c)));
+                const __m512d high = _mm512_add_pd(_mm512_add_pd(high_to_double(a), high_to_double(b)), high_to_double(c));
+                const __m256d low_float = _mm256_castps_pd(_mm512_cvtpd_ps(low));
+                const __m256d high_float = _mm256_castps_pd(_mm512_cvtpd_ps(high));
+                return _mm512_castpd_ps(_mm512_insertf64x4(_mm512_insertf64x4(_mm512_setzero_pd(), low_float, 0), high_float, 1));
+            }
+        };
+
+        #include "BsplineSimdKernels.hpp"
+    }
+#pragma GCC diagnostic pop
+#pragma GCC pop_options
+
+#endif
+
+    /**
+     * Number of rows filtered at once in y (0 if the kernels are not used for the image type)
+     */
+    template<typename T>
+    inline size_t lanes_y() {
+        if (!IsSupportedType<T>::value) return 0;
+        switch (instruction_set()) {
+            case InstructionSet::SSE2: return 4;
+            case InstructionSet::AVX2: return 8;
+            case InstructionSet::AVX512: return 16;
+            default: return 0;
+        }
+    }
+
+    /**
+     * Causal and anti-causal filter in y of the lanes_y<T>() rows starting at rows (each y_num long), buffer is a work
+     * vector. Returns false if the kernels are not used, then nothing is done.
+     */
+    template<typename T>
+    inline bool filter_y_rows(T *rows, size_t y_num, size_t k0, float b1, float b2, float norm_factor,
+                              const std::vector<float> &bc1_vec, const std::vector<float> &bc2_vec,
+                              const std::vector<float> &bc3_vec, const std::vector<float> &bc4_vec, std::vector<float> &buffer) {
+        const size_t L = lanes_y<T>();
+        if (L == 0) return false;
+
+        buffer.resize(y_num*L);
+
+        //transpose into lanes
+        for (size_t l = 0; l < L; ++l) {
+            const T *row = rows + l*y_num;
+            for (size_t k = 0; k < y_num; ++k) {
+                buffer[k*L + l] = row[k];
+            }
+        }
+
+        const bool store_as_uint16 = std::is_same<T, uint16_t>::value;
+#ifdef APR_BSPLINE_SIMD
+        switch (instruction_set()) {
+            case InstructionSet::SSE2:
+                sse2::filter_y_lanes(buffer.data(), y_num, k0, b1, b2, norm_factor, bc1_vec.data(), bc2_vec.data(), bc3_vec.data(), bc4_vec.data(), store_as_uint16);
+                break;
+            case InstructionSet::AVX2:
+                avx2::filter_y_lanes(buffer.data(), y_num, k0, b1, b2, norm_factor, bc1_vec.data(), bc2_vec.data(), bc3_vec.data(), bc4_vec.data(), store_as_uint16);
+                break;
+            case InstructionSet::AVX512:
+                avx512::filter_y_lanes(buffer.data(), y_num, k0, b1, b2, norm_factor, bc1_vec.data(), bc2_vec.data(), bc3_vec.data(), bc4_vec.data(), store_as_uint16);
+                break;
+            default:
+                return false;
+        }
+#else
+        (void) k0; (void) b1; (void) b2; (void) norm_factor; (void) store_as_uint16;
+        (void) bc1_vec; (void) bc2_vec; (void) bc3_vec; (void) bc4_vec;
+#endif
+
+        //transpose back
+        for (size_t l = 0; l < L; ++l) {
+            T *row = rows + l*y_num;
+            for (size_t k = 0; k < y_num; ++k) {
+                row[k] = buffer[k*L + l];
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Causal step of the filter in x (accumulate_double = false) or z (true) for n elements, see BsplineSimdKernels.hpp.
+     * Returns false if the kernels are not used, then nothing is done.
+     */
+    template<typename T>
+    inline bool causal(const T *input, T *output, float *temp_vec1, float *temp_vec2, size_t n, float b1, float b2, bool accumulate_double) {
+#ifdef APR_BSPLINE_SIMD
+        if (IsSupportedType<T>::value) {
+            typedef typename std::conditional<IsSupportedType<T>::value, T, float>::type S;
+            switch (instruction_set()) {
+                case InstructionSet::SSE2: sse2::causal((const S *) input, (S *) output, temp_vec1, temp_vec2, n, b1, b2, accumulate_double); return true;
+                case InstructionSet::AVX2: avx2::causal((const S *) input, (S *) output, temp_vec1, temp_vec2, n, b1, b2, accumulate_double); return true;
+                case InstructionSet::AVX512: avx512::causal((const S *) input, (S *) output, temp_vec1, temp_vec2, n, b1, b2, accumulate_double); return true;
+                default: break;
+            }
+        }
+#endif
+        (void) input; (void) output; (void) temp_vec1; (void) temp_vec2; (void) n; (void) b1; (void) b2; (void) accumulate_double;
+        return false;
+    }
+
+    /**
+     * Anti-causal step of the filter in x or z for n elements, see BsplineSimdKernels.hpp.
+     * Returns false if the kernels are not used, then nothing is done.
+     */
+    template<typename T>
+    inline bool anti_causal(const T *input, T *output, float *temp_vec3, float *temp_vec4, size_t n, float b1, float b2, float norm_factor) {
+#ifdef APR_BSPLINE_SIMD
+        if (IsSupportedType<T>::value) {
+            typedef typename std::conditional<IsSupportedType<T>::value, T, float>::type S;
+            switch (instruction_set()) {
+                case InstructionSet::SSE2: sse2::anti_causal((const S *) input, (S *) output, temp_vec3, temp_vec4, n, b1, b2, norm_factor); return true;
+                case InstructionSet::AVX2: avx2::anti_causal((const S *) input, (S *) output, temp_vec3, temp_vec4, n, b1, b2, norm_factor); return true;
+                case InstructionSet::AVX512: avx512::anti_causal((const S *) input, (S *) output, temp_vec3, temp_vec4, n, b1, b2, norm_factor); return true;
+                default: break;
+            }
+        }
+#endif
+        (void) input; (void) output; (void) temp_vec3; (void) temp_vec4; (void) n; (void) b1; (void) b2; (void) norm_factor;
+        return false;
+    }
+}
+
+
+#endif //PARTPLAY_BSPLINESIMD_HPP
@@ -0,0 +1,152 @@
+//  Kernels of the recursive b-spline filters written with the vector operations of an instruction set (Ops: vector type
+//  V of L floats, set1/load/store/add/mul...). This file has no include guard, it is included by BsplineSimd.hpp once
+//  for each instruction set, inside a namespace compiled for that instruction set.
+//
+//  The operations are done in the same order as the scalar code of ComputeGradient (and without fused multiply-add),
+//  so the results are bit identical, unless the compiler is allowed to reorder the scalar code (-ffast-math, as in the
+//  Release build), in which case they differ by float rounding.
+//
+
+inline Ops::V stored_value(Ops::V v, bool store_as_uint16) {
+    return store_as_uint16 ? Ops::as_uint16(v) : v;
+}
+
+/**
+ * Causal and anti-causal filter along y of L rows stored interleaved (element k of row l at buffer[k*L + l]),
+ * store_as_uint16 emulates storing the intermediate results in a uint16_t image.
+ */
+inline void filter_y_lanes(float *buffer, size_t y_num, size_t k0, float b1_, float b2_, float norm_factor_,
+                           const float *bc1_vec, const float *bc2_vec, const float *bc3_vec, const float *bc4_vec,
+                           bool store_as_uint16) {
+    typedef Ops::V V;
+    const size_t L = Ops::L;
+
+    const V b1 = Ops::set1(b1_);
+    const V b2 = Ops::set1(b2_);
+    const V norm_factor = Ops::set1(norm_factor_);
+
+    //forwards direction
+    V temp1 = Ops::set1(0);
+    V temp2 = Ops::set1(0);
+    V temp3 = Ops::set1(0);
+    V temp4 = Ops::set1(0);
+
+    for (size_t k = 0; k < k0; ++k) {
+        const V first = Ops::load(buffer + k*L);
+        const V last = Ops::load(buffer + (y_num - 1 - k)*L);
+        temp1 = Ops::add(temp1, Ops::mul(Ops::set1(bc1_vec[k]), first));
+        temp2 = Ops::add(temp2, Ops::mul(Ops::set1(bc2_vec[k]), first));
+        temp3 = Ops::add(temp3, Ops::mul(Ops::set1(bc3_vec[k]), last));
+        temp4 = Ops::add(temp4, Ops::mul(Ops::set1(bc4_vec[k]), last));
+    }
+
+    //initialize the sequence
+    Ops::store(buffer, stored_value(temp2, store_as_uint16));
+    Ops::store(buffer + L, stored_value(temp1, store_as_uint16));
+
+    for (size_t k = 2; k < y_num; ++k) {
+        const V temp = Ops::add(Ops::add(Ops::mul(temp1, b1), Ops::mul(temp2, b2)), Ops::load(buffer + k*L));
+        Ops::store(buffer + k*L, stored_value(temp, store_as_uint16));
+        temp2 = temp1;
+        temp1 = temp;
+    }
+
+    Ops::store(buffer + (y_num - 2)*L, stored_value(temp3, store_as_uint16));
+    Ops::store(buffer + (y_num - 1)*L, stored_value(temp4, store_as_uint16));
+
+    //backwards direction
+    temp2 = Ops::load(buffer + (y_num - 1)*L);
+    temp1 = Ops::load(buffer + (y_num - 2)*L);
+
+    Ops::store(buffer + (y_num - 1)*L, Ops::mul(temp2, norm_factor));
+    Ops::store(buffer + (y_num - 2)*L, Ops::mul(temp1, norm_factor));
+
+    for (int64_t k = y_num - 3; k >= 0; --k) {
+        const V temp = Ops::add(Ops::add(Ops::mul(temp1, b1), Ops::mul(temp2, b2)), Ops::load(buffer + k*L));
+        Ops::store(buffer + k*L, Ops::mul(temp, norm_factor));
+        temp2 = temp1;
+        temp1 = temp;
+    }
+}
+
+/**
+ * Causal step of the filter in x (or z when accumulate_double, which evaluates the sum in double as the scalar code for z does)
+ * for L elements: temp_vec2 = input + b1*temp_vec1 + b2*temp_vec2, output = temp_vec2
+ */
+template<typename T>
+inline void causal_vector(const T *input, T *output, float *temp_vec1, float *temp_vec2, Ops::V b1, Ops::V b2, bool accumulate_double) {
+    const Ops::V in = Ops::load(input);
+    const Ops::V t1 = Ops::mul(b1, Ops::load(temp_vec1));
+    const Ops::V t2 = Ops::mul(b2, Ops::load(temp_vec2));
+    const Ops::V temp = accumulate_double ? Ops::add_double(in, t1, t2) : Ops::add(Ops::add(in, t1), t2);
+    Ops::store(temp_vec2, temp);
+    Ops::store(output, temp);
+}
+
+/**
+ * Anti-causal step of the filter in x or z for L elements:
+ * temp = input + b1*temp_vec3 + b2*temp_vec4, output = temp*norm_factor, temp_vec4 = temp_vec3, temp_vec3 = temp
+ */
+template<typename T>
+inline void anti_causal_vector(const T *input, T *output, float *temp_vec3, float *temp_vec4, Ops::V b1, Ops::V b2, Ops::V norm_factor) {
+    const Ops::V t3 = Ops::load(temp_vec3);
+    const Ops::V temp = Ops::add(Ops::add(Ops::load(input), Ops::mul(b1, t3)), Ops::mul(b2, Ops::load(temp_vec4)));
+    Ops::store(output, Ops::mul(temp, norm_factor));
+    Ops::store(temp_vec4, t3);
+    Ops::store(temp_vec3, temp);
+}
+
+/**
+ * Causal step for n elements, the last (n mod L) elements are processed in a zero padded vector (a scalar loop could be
+ * contracted to fused multiply-add by the compiler for the instruction set)
+ */
+template<typename T>
+inline void causal(const T *input, T *output, float *temp_vec1, float *temp_vec2, size_t n, float b1_, float b2_, bool accumulate_double) {
+    const size_t L = Ops::L;
+    const Ops::V b1 = Ops::set1(b1_);
+    const Ops::V b2 = Ops::set1(b2_);
+
+    size_t k = 0;
+    for (; k + L <= n; k += L) {
+        causal_vector(input + k, output + k, temp_vec1 + k, temp_vec2 + k, b1, b2, accumulate_double);
+    }
+    if (k < n) {
+        const size_t r = n - k;
+        T in[L] = {}, out[L];
+        float t1[L] = {}, t2[L] = {};
+        std::copy(input + k, input + n, in);
+        std::copy(temp_vec1 + k, temp_vec1 + n, t1);
+        std::copy(temp_vec2 + k, temp_vec2 + n, t2);
+        causal_vector(in, out, t1, t2, b1, b2, accumulate_double);
+        std::copy(out, out + r, output + k);
+        std::copy(t2, t2 + r, temp_vec2 + k);
+    }
+}
+
+/**
+ * Anti-causal step for n elements (the last (n mod L) elements in a zero padded vector)
+ */
+template<typename T>
+inline void anti_causal(const T *input, T *output, float *temp_vec3, float *temp_vec4, size_t n, float b1_, float b2_, float norm_factor_) {
+    const size_t L = Ops::L;
+    const Ops::V b1 = Ops::set1(b1_);
+    const Ops::V b2 = Ops::set1(b2_);
+    const Ops::V norm_factor = Ops::set1(norm_factor_);
+
+    size_t k = 0;
+    for (; k + L <= n; k += L) {
+        anti_causal_vector(input + k, output + k, temp_vec3 + k, temp_vec4 + k, b1, b2, norm_factor);
+    }
+    if (k < n) {
+        const size_t r = n - k;
+        T in[L] = {}, out[L];
+        float t3[L] = {}, t4[L] = {};
+        std::copy(input + k, input + n, in);
+        std::copy(temp_vec3 + k, temp_vec3 + n, t3);
+        std::copy(temp_vec4 + k, temp_vec4 + n, t4);
+        anti_causal_vector(in, out, t3, t4, b1, b2, norm_factor);
+        std::copy(out, out + r, output + k);
+        std::copy(t3, t3 + r, temp_vec3 + k);
+        std::copy(t4, t4 + r, temp_vec4 + k);
+    }
+}
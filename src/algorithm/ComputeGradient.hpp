@@ -12,6 +12,7 @@
 	#include "omp.h"
 #endif
 #include "../algorithm/APRParameters.hpp"
+#include "../algorithm/BsplineSimd.hpp"
 #include "../misc/APRTimer.hpp"
 
 class ComputeGradient {
@@ -21,6 +22,9 @@ public:
     template<typename T>
     void get_smooth_bspline_3D(MeshData<T> &input, float lambda);
 
+    template<typename T,typename S>
+    void get_gradient_bspline_fused(MeshData<T> &input, MeshData<T> &grad, MeshData<S> &local_scale, float lambda, float hx, float hy, float hz);
+
 // Calculate inverse B-Spline Transform
 
     template<typename T>
@@ -36,6 +40,17 @@ public:
         float temp_1, temp_2, temp_3;
     };
 
+    struct BsplineCoefficients {
+        size_t k0; // number of terms used for the boundary conditions
+        float b1;
+        float b2;
+        float norm_factor;
+        std::vector<float> bc1_vec; // forward y(1) init
+        std::vector<float> bc2_vec; // forward y(0) init
+        std::vector<float> bc3_vec; // backward y(N-1) init
+        std::vector<float> bc4_vec; // backward y(N) init
+    };
+
 // Gradient computation
 
     template<typename S>
@@ -57,6 +72,27 @@ public:
     template<typename T>
     void bspline_filt_rec_z(MeshData<T> &image, float lambda, float tol);
 
+    inline BsplineCoefficients get_bspline_coefficients(float lambda, float tol, size_t k0_max, size_t k0_min = 0);
+
+    template<typename T>
+    inline void bspline_filt_rec_y_row(T *row, size_t y_num, const BsplineCoefficients &c);
+
+    template<typename T>
+    inline void bspline_filt_rec_y_rows(T *rows, size_t number_rows, size_t y_num, const BsplineCoefficients &c, std::vector<float> &buffer);
+
+    template<typename T>
+    inline void bspline_filt_rec_x_plane(T *plane, size_t x_num, size_t y_num, size_t y_begin, size_t y_end, const BsplineCoefficients &c,
+                                         std::vector<float> &temp_vec1, std::vector<float> &temp_vec2, std::vector<float> &temp_vec3, std::vector<float> &temp_vec4);
+
+    template<typename T>
+    inline void calc_inv_bspline_y_row(T *row, size_t y_num, std::vector<float> &temp_vec);
+
+    template<typename T>
+    inline void calc_inv_bspline_x_plane(T *plane, int64_t x_num, int64_t y_num, int64_t y_begin, int64_t y_end, std::vector<three_temps> &temp_vec);
+
+    template<typename S>
+    inline void calc_bspline_fd_ds_mag_row(const MeshData<S> &input, MeshData<S> &grad, size_t z, size_t x, std::vector<S> &temp, const float hx, const float hy, const float hz);
+
     inline float impulse_resp(float k, float rho, float omg);
 
     inline float impulse_resp_back(float k, float rho, float omg, float gamma, float c0);
@@ -137,6 +173,240 @@ void ComputeGradient::get_smooth_bspline_3D(MeshData<T>& input, float lambda) {
 }
 
 
+/**
+ * Fused equivalent of get_smooth_bspline_3D, calc_bspline_fd_ds_mag, the (mean) down-sampling of the smoothed image to
+ * local_scale and calc_inv_bspline_y/x on it (calc_inv_bspline_z is still to be applied to local_scale).
+ *
+ * The volume is streamed through plane by plane in z: the y and x filters of a plane are followed by the causal z step
+ * while the plane is in cache, and on the way back the anti-causal z step of a plane is followed by the gradient, the
+ * down-sampling and the inverse filters of the planes it completes. The first and last k0 planes (needed for the
+ * boundary conditions in z) are filtered in y and x up front. The result is the same as the separate passes.
+ *
+ * @param input - image, replaced by its smoothing bspline co-efficients
+ * @param grad - output down-sampled gradient (must be initialized)
+ * @param local_scale - output down-sampled mean of the smoothed image (must be initialized)
+ */
+template<typename T,typename S>
+void ComputeGradient::get_gradient_bspline_fused(MeshData<T> &input, MeshData<T> &grad, MeshData<S> &local_scale, float lambda, float hx, float hy, float hz) {
+
+    const size_t z_num = input.z_num;
+    const size_t x_num = input.x_num;
+    const size_t y_num = input.y_num;
+
+    const size_t x_num_ds = local_scale.x_num;
+    const size_t y_num_ds = local_scale.y_num;
+
+    float tol = 0.0001;
+
+    if ((z_num < 3) || (x_num < 3) || (y_num < 3)) {
+        get_smooth_bspline_3D(input, lambda);
+        calc_bspline_fd_ds_mag(input, grad, hx, hy, hz);
+        downsample(input, local_scale,
+                   [](const float &x, const float &y) -> float { return x + y; },
+                   [](const float &x) -> float { return x / 8.0; });
+        calc_inv_bspline_y(local_scale);
+        calc_inv_bspline_x(local_scale);
+        return;
+    }
+
+    //k0 clamped as in the separate passes (see get_bspline_coefficients)
+    const BsplineCoefficients cy = get_bspline_coefficients(lambda, tol, std::min(z_num, y_num), 2);
+    const BsplineCoefficients cx = get_bspline_coefficients(lambda, tol, std::min(z_num, x_num));
+    const BsplineCoefficients cz = get_bspline_coefficients(lambda, tol, z_num);
+
+    const size_t k0 = cz.k0;
+    const float b1 = cz.b1;
+    const float b2 = cz.b2;
+    const float norm_factor = cz.norm_factor;
+
+    const size_t xnumynum = x_num * y_num;
+    const size_t y_block = 128; // columns per task for the filters in x
+    const size_t x_block = 16; // rows per task for the filter in y (a multiple of the SIMD lanes)
+
+    auto plane = [&](size_t z) { return input.mesh.begin() + z * xnumynum; };
+
+    auto filter_plane_yx = [&](size_t z) {
+        T *p = plane(z);
+        std::vector<float> buffer;
+        int64_t x;
+        #ifdef HAVE_OPENMP
+        #pragma omp parallel for default(shared) schedule(static) firstprivate(buffer)
+        #endif
+        for (x = 0; x < (int64_t)x_num; x += x_block) {
+            bspline_filt_rec_y_rows(p + x * y_num, std::min((size_t)x + x_block, x_num) - x, y_num, cy, buffer);
+        }
+
+        std::vector<float> temp_vec1(y_num), temp_vec2(y_num), temp_vec3(y_num), temp_vec4(y_num);
+        int64_t y_begin;
+        #ifdef HAVE_OPENMP
+        #pragma omp parallel for default(shared) schedule(static) firstprivate(temp_vec1, temp_vec2, temp_vec3, temp_vec4)
+        #endif
+        for (y_begin = 0; y_begin < (int64_t)y_num; y_begin += y_block) {
+            bspline_filt_rec_x_plane(p, x_num, y_num, y_begin, std::min(y_begin + y_block, y_num), cx, temp_vec1, temp_vec2, temp_vec3, temp_vec4);
+        }
+    };
+
+    auto finish_plane = [&](size_t z) {
+        //gradient of plane z (its neighbours in z are final)
+        std::vector<T> temp(y_num, 0);
+        int64_t x_2;
+        #ifdef HAVE_OPENMP
+        #pragma omp parallel for default(shared) schedule(static) firstprivate(temp)
+        #endif
+        for (x_2 = 0; x_2 < (int64_t)x_num_ds; ++x_2) {
+            for (size_t x = 2 * x_2; x < std::min((size_t)(2 * x_2 + 2), x_num); ++x) {
+                calc_bspline_fd_ds_mag_row(input, grad, z, x, temp, hx, hy, hz);
+            }
+        }
+
+        if ((z % 2) != 0) return;
+
+        //the down-sampled plane z/2 is complete
+        const size_t z_ds = z / 2;
+        const size_t shz = std::min(z + 1, z_num - 1);
+        S *p_ds = local_scale.mesh.begin() + z_ds * x_num_ds * y_num_ds;
+
+        std::vector<float> temp_inv(y_num_ds, 0);
+        #ifdef HAVE_OPENMP
+        #pragma omp parallel for default(shared) schedule(static) firstprivate(temp_inv)
+        #endif
+        for (x_2 = 0; x_2 < (int64_t)x_num_ds; ++x_2) {
+            const size_t shx = std::min((size_t)(2 * x_2 + 1), x_num - 1);
+            const T *in = input.mesh.begin();
+            S *row_ds = p_ds + x_2 * y_num_ds;
+
+            for (size_t y = 0; y < y_num_ds; ++y) {
+                const size_t shy = std::min(2 * y + 1, y_num - 1);
+                float sum = in[z * xnumynum + 2 * x_2 * y_num + 2 * y];
+                sum = sum + (float)in[z * xnumynum + 2 * x_2 * y_num + shy];
+                sum = sum + (float)in[z * xnumynum + shx * y_num + 2 * y];
+                sum = sum + (float)in[z * xnumynum + shx * y_num + shy];
+                sum = sum + (float)in[shz * xnumynum + 2 * x_2 * y_num + 2 * y];
+                sum = sum + (float)in[shz * xnumynum + 2 * x_2 * y_num + shy];
+                sum = sum + (float)in[shz * xnumynum + shx * y_num + 2 * y];
+                sum = sum + (float)in[shz * xnumynum + shx * y_num + shy];
+                row_ds[y] = (float)(sum / 8.0);
+            }
+
+            calc_inv_bspline_y_row(row_ds, y_num_ds, temp_inv);
+        }
+
+        std::vector<three_temps> temp_three(y_num_ds);
+        int64_t y_begin;
+        #ifdef HAVE_OPENMP
+        #pragma omp parallel for default(shared) schedule(static) firstprivate(temp_three)
+        #endif
+        for (y_begin = 0; y_begin < (int64_t)y_num_ds; y_begin += y_block) {
+            calc_inv_bspline_x_plane(p_ds, x_num_ds, y_num_ds, y_begin, std::min(y_begin + y_block, y_num_ds), temp_three);
+        }
+    };
+
+    //state of the recursive filter in z (per pixel of a plane), initialized with the boundary conditions
+    std::vector<float> temp_vec1(xnumynum, 0);
+    std::vector<float> temp_vec2(xnumynum, 0);
+    std::vector<float> temp_vec3(xnumynum, 0);
+    std::vector<float> temp_vec4(xnumynum, 0);
+
+    APRTimer fused_timer;
+    fused_timer.verbose_flag = false;
+
+    fused_timer.start_timer("boundary_planes");
+    for (size_t z = 0; z < k0; ++z) {
+        filter_plane_yx(z);
+    }
+    for (size_t z = std::max(k0, z_num - k0); z < z_num; ++z) {
+        filter_plane_yx(z);
+    }
+
+    int64_t x;
+    #ifdef HAVE_OPENMP
+    #pragma omp parallel for default(shared) schedule(static)
+    #endif
+    for (x = 0; x < (int64_t)x_num; ++x) {
+        const size_t iynum = x * y_num;
+        for (size_t j = 0; j < k0; ++j) {
+            const T *forward = plane(j) + iynum;
+            const T *backward = plane(z_num - 1 - j) + iynum;
+            #ifdef HAVE_OPENMP
+            #pragma omp simd
+            #endif
+            for (size_t k = 0; k < y_num; ++k) {
+                //forwards boundary condition
+                temp_vec1[iynum + k] += cz.bc1_vec[j] * forward[k];
+                temp_vec2[iynum + k] += cz.bc2_vec[j] * forward[k];
+                //backwards boundary condition
+                temp_vec3[iynum + k] += cz.bc3_vec[j] * backward[k];
+                temp_vec4[iynum + k] += cz.bc4_vec[j] * backward[k];
+            }
+        }
+    }
+    fused_timer.stop_timer();
+
+    // ------  Causal Filter Loop
+    fused_timer.start_timer("causal_loop");
+    std::copy(temp_vec2.begin(), temp_vec2.end(), plane(0)); //z(0)
+    std::copy(temp_vec1.begin(), temp_vec1.end(), plane(1)); //y(1)
+
+    for (size_t j = 2; j < z_num; ++j) {
+        if ((j >= k0) && (j < (z_num - k0))) {
+            filter_plane_yx(j);
+        }
+
+        T *p = plane(j);
+        #ifdef HAVE_OPENMP
+        #pragma omp parallel for default(shared) schedule(static)
+        #endif
+        for (x = 0; x < (int64_t)x_num; ++x) {
+            const size_t iynum = x * y_num;
+            if (!BsplineSimd::causal(p + iynum, p + iynum, &temp_vec1[iynum], &temp_vec2[iynum], y_num, b1, b2, true)) {
+                #ifdef HAVE_OPENMP
+                #pragma omp simd
+                #endif
+                for (size_t k = iynum; k < iynum + y_num; ++k) {
+                    temp_vec2[k] = 1.0*p[k] + b1*temp_vec1[k]+  b2*temp_vec2[k];
+                    p[k] = temp_vec2[k];
+                }
+            }
+        }
+        std::swap(temp_vec1, temp_vec2);
+    }
+    fused_timer.stop_timer();
+
+    // ------ Anti-Causal Filter Loop
+    fused_timer.start_timer("anti_causal_loop");
+    T *p_end = plane(z_num - 1);
+    T *p_end_1 = plane(z_num - 2);
+    for (size_t k = 0; k < xnumynum; ++k) {
+        p_end[k] = temp_vec4[k]*norm_factor; //y(N)
+        p_end_1[k] = temp_vec3[k]*norm_factor; //y(N-1)
+    }
+    finish_plane(z_num - 1);
+
+    for (int64_t j = z_num - 3; j >= 0; --j) {
+        T *p = plane(j);
+        #ifdef HAVE_OPENMP
+        #pragma omp parallel for default(shared) schedule(static)
+        #endif
+        for (x = 0; x < (int64_t)x_num; ++x) {
+            const size_t iynum = x * y_num;
+            if (!BsplineSimd::anti_causal(p + iynum, p + iynum, &temp_vec3[iynum], &temp_vec4[iynum], y_num, b1, b2, norm_factor)) {
+                #ifdef HAVE_OPENMP
+                #pragma omp simd
+                #endif
+                for (size_t k = iynum; k < iynum + y_num; ++k) {
+                    float temp = (p[k] +  b1*temp_vec3[k]+  b2*temp_vec4[k]);
+                    p[k] = temp*norm_factor;
+                    temp_vec4[k] = temp_vec3[k];
+                    temp_vec3[k] = temp;
+                }
+            }
+        }
+        finish_plane(j + 1);
+    }
+    finish_plane(0);
+    fused_timer.stop_timer();
+}
+
 inline float ComputeGradient::impulse_resp(float k,float rho,float omg){
     //  Impulse Response Function
 
@@ -150,13 +420,16 @@ inline float ComputeGradient::impulse_resp_back(float k,float rho,float omg,floa
     return c0*pow(rho,std::abs(k))*(cos(omg*std::abs(k)) + gamma*sin(omg*std::abs(k)))*(1.0/(pow((1 - 2.0*rho*cos(omg) + pow(rho,2)),2)));
 }
 
-template<typename T>
-void ComputeGradient::bspline_filt_rec_y(MeshData<T>& image,float lambda,float tol){
+inline ComputeGradient::BsplineCoefficients ComputeGradient::get_bspline_coefficients(float lambda, float tol, size_t k0_max, size_t k0_min) {
     //
     //  Bevan Cheeseman 2016
     //
-    // Recursive Filter Implimentation for Smoothing BSplines
+    // Coefficients and boundary conditions of the recursive filter for smoothing BSplines
     // B-Spline Signal Processing: Part 11-Efficient Design and Applications, Unser 1993
+    //
+    // The boundary conditions use k0 samples, clamped to [k0_min, k0_max]. The filters pass the length they run along,
+    // limited by z_num as before (y and x used to be clamped to z_num only, which read past the end of rows shorter than
+    // k0, so for such non-cubic images the y and x boundaries now differ from the earlier results)
 
     float xi = 1 - 96*lambda + 24*lambda*sqrt(3 + 144*lambda); // eq 4.6
     float rho = (24*lambda - 1 - sqrt(xi))/(24*lambda)*sqrt((1/xi)*(48*lambda + 24*lambda*sqrt(3 + 144*lambda))); // eq 4.5
@@ -165,15 +438,13 @@ void ComputeGradient::bspline_filt_rec_y(MeshData<T>& image,float lambda,float t
     float c0 = (1+ pow(rho,2))/(1-pow(rho,2)) * (1 - 2*rho*cos(omg) + pow(rho,2))/(1 + 2*rho*cos(omg) + pow(rho,2)); // eq 4.8
     float gamma = (1-pow(rho,2))/(1+pow(rho,2)) * (1/tan(omg)); // eq 4.8
 
-    const float b1 = 2*rho*cos(omg);
-    const float b2 = -pow(rho,2.0);
+    BsplineCoefficients c;
+    c.b1 = 2*rho*cos(omg);
+    c.b2 = -pow(rho,2.0);
+    c.norm_factor = pow((1 - 2.0*rho*cos(omg) + pow(rho,2)),2);
 
-    const size_t z_num = image.z_num;
-    const size_t x_num = image.x_num;
-    const size_t y_num = image.y_num;
-
-    const size_t k0 = std::max(std::min((size_t)(ceil(std::abs(log(tol)/log(rho)))),z_num),(size_t)2);
-    const float norm_factor = pow((1 - 2.0*rho*cos(omg) + pow(rho,2)),2);
+    const size_t k0 = std::max(std::min((size_t)(ceil(std::abs(log(tol)/log(rho)))),k0_max),k0_min);
+    c.k0 = k0;
 
     // for boundaries
     std::vector<float> impulse_resp_vec_f(k0+3);  //forward
@@ -186,168 +457,161 @@ void ComputeGradient::bspline_filt_rec_y(MeshData<T>& image,float lambda,float t
         impulse_resp_vec_b[k] = impulse_resp_back(k,rho,omg,gamma,c0);
     }
 
-    std::vector<float> bc1_vec(k0, 0);  //forward
+    c.bc1_vec.resize(k0, 0);  //forward
     //y(1) init
-    bc1_vec[1] = impulse_resp_vec_f[0];
+    c.bc1_vec[1] = impulse_resp_vec_f[0];
     for (size_t k = 0; k < k0; ++k) {
-        bc1_vec[k] += impulse_resp_vec_f[k+1];
+        c.bc1_vec[k] += impulse_resp_vec_f[k+1];
     }
 
-    std::vector<float> bc2_vec(k0, 0);  //backward
+    c.bc2_vec.resize(k0, 0);  //backward
     //y(0) init
     for (size_t k = 0; k < k0; ++k) {
-        bc2_vec[k] = impulse_resp_vec_f[k];
+        c.bc2_vec[k] = impulse_resp_vec_f[k];
     }
 
-    std::vector<float> bc3_vec(k0, 0);  //forward
+    c.bc3_vec.resize(k0, 0);  //forward
     //y(N-1) init
-    bc3_vec[0] = impulse_resp_vec_b[1];
+    c.bc3_vec[0] = impulse_resp_vec_b[1];
     for (size_t k = 0; k < (k0-1); ++k) {
-        bc3_vec[k+1] += impulse_resp_vec_b[k] + impulse_resp_vec_b[k+2];
+        c.bc3_vec[k+1] += impulse_resp_vec_b[k] + impulse_resp_vec_b[k+2];
     }
 
-    std::vector<float> bc4_vec(k0, 0);  //backward
+    c.bc4_vec.resize(k0, 0);  //backward
     //y(N) init
-    bc4_vec[0] = impulse_resp_vec_b[0];
+    c.bc4_vec[0] = impulse_resp_vec_b[0];
     for (size_t k = 1; k < k0; ++k) {
-        bc4_vec[k] += 2*impulse_resp_vec_b[k];
+        c.bc4_vec[k] += 2*impulse_resp_vec_b[k];
     }
 
-    APRTimer btime;
-    btime.verbose_flag = false;
-
-    //forwards direction
-    btime.start_timer("forward_loop_y");
-    #ifdef HAVE_OPENMP
-	#pragma omp parallel for default(shared)
-    #endif
-    for (size_t z = 0; z < z_num; ++z) {
-        const size_t jxnumynum = z * x_num * y_num;
+    return c;
+}
 
-        for (size_t x = 0; x < x_num; ++x) {
-            float temp1 = 0;
-            float temp2 = 0;
-            float temp3 = 0;
-            float temp4 = 0;
-            const size_t iynum = x * y_num;
+template<typename T>
+inline void ComputeGradient::bspline_filt_rec_y_row(T *row, size_t y_num, const BsplineCoefficients &c) {
+    //
+    //  Causal and anti-causal recursive filter along one row (y, the memory direction)
+    //
 
-            for (size_t k = 0; k < k0; ++k) {
-                temp1 += bc1_vec[k]*image.mesh[jxnumynum + iynum + k];
-                temp2 += bc2_vec[k]*image.mesh[jxnumynum + iynum + k];
-                temp3 += bc3_vec[k]*image.mesh[jxnumynum + iynum + y_num - 1 - k];
-                temp4 += bc4_vec[k]*image.mesh[jxnumynum + iynum + y_num - 1 - k];
-            }
+    const size_t k0 = c.k0;
+    const float b1 = c.b1;
+    const float b2 = c.b2;
+    const float norm_factor = c.norm_factor;
 
-            //initialize the sequence
-            image.mesh[jxnumynum + iynum + 0] = temp2;
-            image.mesh[jxnumynum + iynum + 1] = temp1;
+    //forwards direction
+    {
+        float temp1 = 0;
+        float temp2 = 0;
+        float temp3 = 0;
+        float temp4 = 0;
+
+        for (size_t k = 0; k < k0; ++k) {
+            temp1 += c.bc1_vec[k]*row[k];
+            temp2 += c.bc2_vec[k]*row[k];
+            temp3 += c.bc3_vec[k]*row[y_num - 1 - k];
+            temp4 += c.bc4_vec[k]*row[y_num - 1 - k];
+        }
 
-            for (auto it = (image.mesh.begin()+jxnumynum + iynum + 2); it !=  (image.mesh.begin()+jxnumynum + iynum + y_num); ++it) {
-                float  temp = temp1*b1 + temp2*b2 + *it;
-                *it = temp;
-                temp2 = temp1;
-                temp1 = temp;
-            }
+        //initialize the sequence
+        row[0] = temp2;
+        row[1] = temp1;
 
-            image.mesh[jxnumynum + iynum + y_num - 2] = temp3;
-            image.mesh[jxnumynum + iynum + y_num - 1] = temp4;
+        for (auto it = (row + 2); it != (row + y_num); ++it) {
+            float  temp = temp1*b1 + temp2*b2 + *it;
+            *it = temp;
+            temp2 = temp1;
+            temp1 = temp;
         }
-    }
-    btime.stop_timer();
 
+        row[y_num - 2] = temp3;
+        row[y_num - 1] = temp4;
+    }
 
-    btime.start_timer("backward_loop_y");
-    #ifdef HAVE_OPENMP
-	#pragma omp parallel for default(shared)
-    #endif
-    for (int64_t j = z_num - 1; j >= 0; --j) {
-        const size_t jxnumynum = j * x_num * y_num;
+    //backwards direction
+    {
+        float temp2 = row[y_num - 1];
+        float temp1 = row[y_num - 2];
 
-        for (int64_t i = x_num - 1; i >= 0; --i) {
-            const size_t iynum = i * y_num;
+        row[y_num - 1]*=norm_factor;
+        row[y_num - 2]*=norm_factor;
 
-            float temp2 = image.mesh[jxnumynum + iynum + y_num - 1];
-            float temp1 = image.mesh[jxnumynum + iynum + y_num - 2];
+        for (auto it = (row + y_num - 3); it != (row - 1); --it) {
+            float temp = temp1*b1 + temp2*b2 + *it;
+            *it = temp*norm_factor;
+            temp2 = temp1;
+            temp1 = temp;
+        }
+    }
+}
 
-            image.mesh[jxnumynum + iynum + y_num - 1]*=norm_factor;
-            image.mesh[jxnumynum + iynum + y_num - 2]*=norm_factor;
+template<typename T>
+inline void ComputeGradient::bspline_filt_rec_y_rows(T *rows, size_t number_rows, size_t y_num, const BsplineCoefficients &c, std::vector<float> &buffer) {
+    //
+    //  Recursive filter along number_rows consecutive rows, groups of rows are filtered at once with the SIMD kernels
+    //  (if available), the remaining rows with the scalar code. buffer is a work vector.
+    //
 
-            for (auto it = (image.mesh.begin()+jxnumynum + iynum + y_num-3); it !=  (image.mesh.begin()+jxnumynum + iynum-1); --it) {
-                float temp = temp1*b1 + temp2*b2 + *it;
-                *it = temp*norm_factor;
-                temp2 = temp1;
-                temp1 = temp;
-            }
+    size_t r = 0;
+    const size_t lanes = BsplineSimd::lanes_y<T>();
+    if (lanes > 0) {
+        for (; r + lanes <= number_rows; r += lanes) {
+            BsplineSimd::filter_y_rows(rows + r*y_num, y_num, c.k0, c.b1, c.b2, c.norm_factor, c.bc1_vec, c.bc2_vec, c.bc3_vec, c.bc4_vec, buffer);
         }
     }
-    btime.stop_timer();
+    for (; r < number_rows; ++r) {
+        bspline_filt_rec_y_row(rows + r*y_num, y_num, c);
+    }
 }
 
 template<typename T>
-void ComputeGradient::bspline_filt_rec_z(MeshData<T>& image,float lambda,float tol){
+void ComputeGradient::bspline_filt_rec_y(MeshData<T>& image,float lambda,float tol){
     //
     //  Bevan Cheeseman 2016
     //
-    //  Recursive Filter Implimentation for Smoothing BSplines
-
-    float xi = 1 - 96*lambda + 24*lambda*sqrt(3 + 144*lambda);
-    float rho = (24*lambda - 1 - sqrt(xi))/(24*lambda)*sqrt((1/xi)*(48*lambda + 24*lambda*sqrt(3 + 144*lambda)));
-    float omg = atan(sqrt((1/xi)*(144*lambda - 1)));
-    float c0 = (1+ pow(rho,2))/(1-pow(rho,2)) * (1 - 2*rho*cos(omg) + pow(rho,2))/(1 + 2*rho*cos(omg) + pow(rho,2));
-    float gamma = (1-pow(rho,2))/(1+pow(rho,2)) * (1/tan(omg));
-
-    const float b1 = 2*rho*cos(omg);
-    const float b2 = -pow(rho,2.0);
+    // Recursive Filter Implimentation for Smoothing BSplines
+    // B-Spline Signal Processing: Part 11-Efficient Design and Applications, Unser 1993
 
     const size_t z_num = image.z_num;
     const size_t x_num = image.x_num;
     const size_t y_num = image.y_num;
 
-    const size_t k0 = std::min((size_t)(ceil(std::abs(log(tol)/log(rho)))),z_num);
-    const float norm_factor = pow((1 - 2.0*rho*cos(omg) + pow(rho,2)),2);
-
-    //////////////////////////////////////////////////////////////
-    //
-    //  Setting up boundary conditions
-    //
-    //////////////////////////////////////////////////////////////
+    const BsplineCoefficients c = get_bspline_coefficients(lambda, tol, std::min(z_num, y_num), 2);
 
-    std::vector<float> impulse_resp_vec_f(k0+3);  //forward
-    for (size_t k = 0; k < (k0+3);k++){
-        impulse_resp_vec_f[k] = impulse_resp(k,rho,omg);
-    }
+    APRTimer btime;
+    btime.verbose_flag = false;
 
-    std::vector<float> impulse_resp_vec_b(k0+3);  //backward
-    for (size_t k = 0; k < (k0+3);k++){
-        impulse_resp_vec_b[k] = impulse_resp_back(k,rho,omg,gamma,c0);
-    }
+    std::vector<float> buffer;
 
-    std::vector<float> bc1_vec(k0, 0);  //forward
-    //y(1) init
-    bc1_vec[1] = impulse_resp_vec_f[0];
-    for(size_t k = 0; k < k0; k++){
-        bc1_vec[k] += impulse_resp_vec_f[k+1];
+    btime.start_timer("forward_backward_loop_y");
+    #ifdef HAVE_OPENMP
+	#pragma omp parallel for default(shared) firstprivate(buffer)
+    #endif
+    for (size_t z = 0; z < z_num; ++z) {
+        bspline_filt_rec_y_rows(image.mesh.begin() + z*x_num*y_num, x_num, y_num, c, buffer);
     }
+    btime.stop_timer();
+}
 
-    std::vector<float> bc2_vec(k0, 0);  //backward
-    //y(0) init
-    for(size_t k = 0; k < k0; k++){
-        bc2_vec[k] = impulse_resp_vec_f[k];
-    }
+template<typename T>
+void ComputeGradient::bspline_filt_rec_z(MeshData<T>& image,float lambda,float tol){
+    //
+    //  Bevan Cheeseman 2016
+    //
+    //  Recursive Filter Implimentation for Smoothing BSplines
 
-    std::vector<float> bc3_vec(k0, 0);  //forward
-    //y(N-1) init
-    bc3_vec[0] = impulse_resp_vec_b[1];
-    for(size_t k = 0; k < (k0-1); k++){
-        bc3_vec[k+1] += impulse_resp_vec_b[k] + impulse_resp_vec_b[k+2];
-    }
+    const size_t z_num = image.z_num;
+    const size_t x_num = image.x_num;
+    const size_t y_num = image.y_num;
 
-    std::vector<float> bc4_vec(k0, 0);  //backward
-    //y(N) init
-    bc4_vec[0] = impulse_resp_vec_b[0];
-    for(size_t k = 1; k < k0; k++){
-        bc4_vec[k] += 2*impulse_resp_vec_b[k];
-    }
+    const BsplineCoefficients c = get_bspline_coefficients(lambda, tol, z_num);
+    const size_t k0 = c.k0;
+    const float b1 = c.b1;
+    const float b2 = c.b2;
+    const float norm_factor = c.norm_factor;
+    const std::vector<float> &bc1_vec = c.bc1_vec;
+    const std::vector<float> &bc2_vec = c.bc2_vec;
+    const std::vector<float> &bc3_vec = c.bc3_vec;
+    const std::vector<float> &bc4_vec = c.bc4_vec;
 
     //forwards direction
     std::vector<float> temp_vec1(y_num,0);
@@ -398,15 +662,17 @@ void ComputeGradient::bspline_filt_rec_z(MeshData<T>& image,float lambda,float t
         for (size_t j = 2; j < z_num; ++j) {
             size_t index = j * x_num * y_num + iynum;
 
-            #ifdef HAVE_OPENMP
-	        #pragma omp simd
-            #endif
-            for (size_t k = 0; k < y_num; ++k) {
-                temp_vec2[k] = 1.0*image.mesh[index + k] + b1*temp_vec1[k]+  b2*temp_vec2[k];
+            if (!BsplineSimd::causal(&image.mesh[index], &image.mesh[index], temp_vec1.data(), temp_vec2.data(), y_num, b1, b2, true)) {
+                #ifdef HAVE_OPENMP
+                #pragma omp simd
+                #endif
+                for (size_t k = 0; k < y_num; ++k) {
+                    temp_vec2[k] = 1.0*image.mesh[index + k] + b1*temp_vec1[k]+  b2*temp_vec2[k];
+                }
+                std::copy(temp_vec2.begin(), temp_vec2.begin()+ y_num, image.mesh.begin() + index);
             }
 
             std::swap(temp_vec1, temp_vec2);
-            std::copy(temp_vec1.begin(), temp_vec1.begin()+ y_num, image.mesh.begin() + index);
         }
 
         // ------ Anti-Causal Filter Loop
@@ -425,86 +691,124 @@ void ComputeGradient::bspline_filt_rec_z(MeshData<T>& image,float lambda,float t
         for (int64_t j = z_num - 3; j >= 0; --j) {
             size_t index = j * x_num * y_num + i * y_num;
 
-            #ifdef HAVE_OPENMP
-	        #pragma omp simd
-            #endif
-            for (int64_t k = y_num - 1; k >= 0; --k) {
-                float temp = (image.mesh[index + k] +  b1*temp_vec3[k]+  b2*temp_vec4[k]);
-                image.mesh[index + k] = temp*norm_factor;
-                temp_vec4[k] = temp_vec3[k];
-                temp_vec3[k] = temp;
+            if (!BsplineSimd::anti_causal(&image.mesh[index], &image.mesh[index], temp_vec3.data(), temp_vec4.data(), y_num, b1, b2, norm_factor)) {
+                #ifdef HAVE_OPENMP
+                #pragma omp simd
+                #endif
+                for (int64_t k = y_num - 1; k >= 0; --k) {
+                    float temp = (image.mesh[index + k] +  b1*temp_vec3[k]+  b2*temp_vec4[k]);
+                    image.mesh[index + k] = temp*norm_factor;
+                    temp_vec4[k] = temp_vec3[k];
+                    temp_vec3[k] = temp;
+                }
             }
         }
     }
 }
 
 template<typename T>
-void ComputeGradient::bspline_filt_rec_x(MeshData<T>& image,float lambda,float tol){
+inline void ComputeGradient::bspline_filt_rec_x_plane(T *plane, size_t x_num, size_t y_num, size_t y_begin, size_t y_end, const BsplineCoefficients &c,
+                                                      std::vector<float> &temp_vec1, std::vector<float> &temp_vec2, std::vector<float> &temp_vec3, std::vector<float> &temp_vec4) {
     //
-    //  Bevan Cheeseman 2016
+    //  Causal and anti-causal recursive filter in x of the columns [y_begin, y_end) of one xy plane, temp_vec* are work
+    //  vectors of size y_num
     //
-    //  Recursive Filter Implimentation for Smoothing BSplines
 
-    float xi = 1 - 96*lambda + 24*lambda*sqrt(3 + 144*lambda);
-    float rho = (24*lambda - 1 - sqrt(xi))/(24*lambda)*sqrt((1/xi)*(48*lambda + 24*lambda*sqrt(3 + 144*lambda)));
-    float omg = atan(sqrt((1/xi)*(144*lambda - 1)));
-    float c0 = (1+ pow(rho,2))/(1-pow(rho,2)) * (1 - 2*rho*cos(omg) + pow(rho,2))/(1 + 2*rho*cos(omg) + pow(rho,2));
-    float gamma = (1-pow(rho,2))/(1+pow(rho,2)) * (1/tan(omg));
+    const size_t k0 = c.k0;
+    const float b1 = c.b1;
+    const float b2 = c.b2;
+    const float norm_factor = c.norm_factor;
+
+    std::fill(temp_vec1.begin() + y_begin, temp_vec1.begin() + y_end, 0);
+    std::fill(temp_vec2.begin() + y_begin, temp_vec2.begin() + y_end, 0);
+    std::fill(temp_vec3.begin() + y_begin, temp_vec3.begin() + y_end, 0);
+    std::fill(temp_vec4.begin() + y_begin, temp_vec4.begin() + y_end, 0);
+
+    for (size_t i = 0; i < k0; ++i) {
+
+        for (size_t k = y_begin; k < y_end; ++k) {
+            //forwards boundary condition
+            temp_vec1[k] += c.bc1_vec[i]*plane[i*y_num + k];
+            temp_vec2[k] += c.bc2_vec[i]*plane[i*y_num + k];
+            //backwards boundary condition
+            temp_vec3[k] += c.bc3_vec[i]*plane[(x_num - 1 - i)*y_num + k];
+            temp_vec4[k] += c.bc4_vec[i]*plane[(x_num - 1 - i)*y_num + k];
+        }
+    }
 
-    const float b1 = 2*rho*cos(omg);
-    const float b2 = -pow(rho,2.0);
+    //initialization
+    for (size_t k = y_begin; k < y_end; ++k) {
+        //y(0)
+        plane[k] = temp_vec2[k];
+    }
 
-    const size_t z_num = image.z_num;
-    const size_t x_num = image.x_num;
-    const size_t y_num = image.y_num;
+    for (size_t k = y_begin; k < y_end; ++k) {
+        //y(1)
+        plane[y_num + k] = temp_vec1[k];
+    }
 
-    const size_t k0 = std::min((size_t)(ceil(std::abs(log(tol)/log(rho)))),z_num);
-    const float norm_factor = pow((1 - 2.0*rho*cos(omg) + pow(rho,2)),2);
+    for (size_t i = 2;i < x_num; ++i) {
+        size_t index = i * y_num;
 
-    //////////////////////////////////////////////////////////////
-    //
-    //  Setting up boundary conditions
-    //
-    //////////////////////////////////////////////////////////////
+        if (!BsplineSimd::causal(plane + index + y_begin, plane + index + y_begin, temp_vec1.data() + y_begin, temp_vec2.data() + y_begin,
+                                 y_end - y_begin, b1, b2, false)) {
+            #ifdef HAVE_OPENMP
+            #pragma omp simd
+            #endif
+            for (size_t k = y_begin; k < y_end; k++) {
+                temp_vec2[k] = plane[index + k] + b1*temp_vec1[k]+  b2*temp_vec2[k];
+            }
+            std::copy(temp_vec2.begin() + y_begin, temp_vec2.begin() + y_end, plane + index + y_begin);
+        }
 
-    std::vector<float> impulse_resp_vec_f(k0+3);  //forward
-    for (size_t k = 0; k < (k0+3);k++){
-        impulse_resp_vec_f[k] = impulse_resp(k,rho,omg);
+        std::swap(temp_vec1, temp_vec2);
     }
 
-    std::vector<float> impulse_resp_vec_b(k0+3);  //backward
-    for (size_t k = 0; k < (k0+3);k++){
-        impulse_resp_vec_b[k] = impulse_resp_back(k,rho,omg,gamma,c0);
-    }
 
-    std::vector<float> bc1_vec(k0, 0);  //forward
-    //y(1) init
-    bc1_vec[1] = impulse_resp_vec_f[0];
-    for(size_t k = 0; k < k0;k++){
-        bc1_vec[k] += impulse_resp_vec_f[k+1];
-    }
+    //Anti-Causal Filter Loop
 
-    std::vector<float> bc2_vec(k0, 0);  //backward
-    //y(0) init
-    for(size_t k = 0; k < k0;k++){
-        bc2_vec[k] = impulse_resp_vec_f[k];
+    //initialization
+    for (size_t k = y_begin; k < y_end; ++k) {
+        //y(N)
+        plane[(x_num - 1)*y_num + k] = temp_vec4[k]*norm_factor;
     }
 
-    std::vector<float> bc3_vec(k0, 0);  //forward
-    //y(N-1) init
-    bc3_vec[0] = impulse_resp_vec_b[1];
-    for(size_t k = 0; k < (k0-1);k++){
-        bc3_vec[k+1] += impulse_resp_vec_b[k] + impulse_resp_vec_b[k+2];
+    for (size_t k = y_begin; k < y_end; ++k) {
+        //y(N-1)
+        plane[(x_num - 2)*y_num + k] = temp_vec3[k]*norm_factor;
     }
 
-    std::vector<float> bc4_vec(k0, 0);  //backward
-    //y(N) init
-    bc4_vec[0] = impulse_resp_vec_b[0];
-    for(size_t k = 1; k < k0;k++){
-        bc4_vec[k] += 2*impulse_resp_vec_b[k];
+    //main loop
+    for (int64_t i = x_num - 3; i >= 0; --i){
+        size_t index = i*y_num;
+
+        if (!BsplineSimd::anti_causal(plane + index + y_begin, plane + index + y_begin, temp_vec3.data() + y_begin, temp_vec4.data() + y_begin,
+                                      y_end - y_begin, b1, b2, norm_factor)) {
+            #ifdef HAVE_OPENMP
+            #pragma omp simd
+            #endif
+            for (size_t k = y_begin; k < y_end; k++){
+                float temp = (plane[index + k] + b1*temp_vec3[ k]+  b2*temp_vec4[ k]);
+                plane[index + k] = temp*norm_factor;
+                temp_vec4[k] = temp_vec3[k];
+                temp_vec3[k] = temp;
+            }
+        }
     }
+}
 
-    //forwards direction
+template<typename T>
+void ComputeGradient::bspline_filt_rec_x(MeshData<T>& image,float lambda,float tol){
+    //
+    //  Bevan Cheeseman 2016
+    //
+    //  Recursive Filter Implimentation for Smoothing BSplines
+
+    const size_t z_num = image.z_num;
+    const size_t x_num = image.x_num;
+    const size_t y_num = image.y_num;
+
+    const BsplineCoefficients c = get_bspline_coefficients(lambda, tol, std::min(z_num, x_num));
 
     std::vector<float> temp_vec1(y_num,0);
     std::vector<float> temp_vec2(y_num,0);
@@ -515,84 +819,43 @@ void ComputeGradient::bspline_filt_rec_x(MeshData<T>& image,float lambda,float t
 	#pragma omp parallel for default(shared) firstprivate(temp_vec1, temp_vec2, temp_vec3, temp_vec4)
     #endif
     for (size_t j = 0;j < z_num; ++j) {
-        std::fill(temp_vec1.begin(), temp_vec1.end(), 0);
-        std::fill(temp_vec2.begin(), temp_vec2.end(), 0);
-        std::fill(temp_vec3.begin(), temp_vec3.end(), 0);
-        std::fill(temp_vec4.begin(), temp_vec4.end(), 0);
-
-        size_t jxnumynum = j * y_num * x_num;
-
-        for (size_t i = 0; i < k0; ++i) {
-
-            for (size_t k = 0; k < y_num; ++k) {
-                //forwards boundary condition
-                temp_vec1[k] += bc1_vec[i]*image.mesh[jxnumynum + i*y_num + k];
-                temp_vec2[k] += bc2_vec[i]*image.mesh[jxnumynum + i*y_num + k];
-                //backwards boundary condition
-                temp_vec3[k] += bc3_vec[i]*image.mesh[jxnumynum + (x_num - 1 - i)*y_num + k];
-                temp_vec4[k] += bc4_vec[i]*image.mesh[jxnumynum + (x_num - 1 - i)*y_num + k];
-            }
-        }
-
-        //initialization
-        for (int64_t k = y_num - 1; k >= 0; --k) {
-            //y(0)
-            image.mesh[jxnumynum  + k] = temp_vec2[k];
-        }
-
-        for (int64_t k = y_num - 1; k >= 0; --k) {
-            //y(1)
-            image.mesh[jxnumynum  + y_num + k] = temp_vec1[k];
-        }
-
-        for (size_t i = 2;i < x_num; ++i) {
-            size_t index = i * y_num + jxnumynum;
-
-            #ifdef HAVE_OPENMP
-            #pragma omp simd
-            #endif
-            for (int64_t k = y_num - 1; k >= 0; k--) {
-                temp_vec2[k] = image.mesh[index + k] + b1*temp_vec1[k]+  b2*temp_vec2[k];
-            }
-
-            std::swap(temp_vec1, temp_vec2);
-            std::copy(temp_vec1.begin(), temp_vec1.begin() + y_num, image.mesh.begin() + index);
-        }
-
+        bspline_filt_rec_x_plane(image.mesh.begin() + j*x_num*y_num, x_num, y_num, 0, y_num, c, temp_vec1, temp_vec2, temp_vec3, temp_vec4);
+    }
+}
 
-        //Anti-Causal Filter Loop
+/**
+ * Caclulation of signal value from B-Spline co-efficients
+ */
+template<typename T>
+inline void ComputeGradient::calc_inv_bspline_y_row(T *row, size_t y_num, std::vector<float> &temp_vec) {
+    //
+    //  Inverse cubic bspline filter of one row (y), temp_vec is a work vector of size y_num
+    //
 
-        //initialization
-        for (int64_t k = y_num - 1; k >= 0; --k) {
-            //y(N)
-            image.mesh[jxnumynum  + (x_num - 1)*y_num + k] = temp_vec4[k]*norm_factor;
-        }
+    const float a1 = 1.0/6.0;
+    const float a2 = 4.0/6.0;
+    const float a3 = 1.0/6.0;
 
-        for (int64_t k = y_num - 1; k >= 0; --k) {
-            //y(N-1)
-            image.mesh[jxnumynum  + (x_num - 2)*y_num + k] = temp_vec3[k]*norm_factor;
-        }
+#ifdef HAVE_OPENMP
+#pragma omp simd
+#endif
+    for (size_t k = 0; k < y_num; ++k) {
+        temp_vec[k] = row[k];
+    }
 
-        //main loop
-        for (int64_t i = x_num - 3; i >= 0; --i){
-            size_t index = jxnumynum + i*y_num;
+    //LHS boundary condition
+    row[0] = a2*temp_vec[0];
+    row[0] += (a1+a3)*temp_vec[1];
 
-            #ifdef HAVE_OPENMP
-            #pragma omp simd
-            #endif
-            for (int64_t k = y_num - 1; k >= 0; k--){
-                float temp = (image.mesh[index + k] + b1*temp_vec3[ k]+  b2*temp_vec4[ k]);
-                image.mesh[index + k] = temp*norm_factor;
-                temp_vec4[k] = temp_vec3[k];
-                temp_vec3[k] = temp;
-            }
-        }
+    for (size_t k = 1; k < (y_num-1);k++){
+        row[k] = a1*temp_vec[k-1] + a2*temp_vec[k] + a3*temp_vec[k+1];
     }
+
+    //RHS boundary condition
+    row[y_num - 1] = (a1+a3)*temp_vec[y_num - 2];
+    row[y_num - 1] += a2*temp_vec[y_num - 1];
 }
 
-/**
- * Caclulation of signal value from B-Spline co-efficients
- */
 template<typename T>
 void ComputeGradient::calc_inv_bspline_y(MeshData<T>& input){
     //  Bevan Cheeseman 2016
@@ -603,10 +866,6 @@ void ComputeGradient::calc_inv_bspline_y(MeshData<T>& input){
     const int64_t x_num = input.x_num;
     const int64_t y_num = input.y_num;
 
-    const float a1 = 1.0/6.0;
-    const float a2 = 4.0/6.0;
-    const float a3 = 1.0/6.0;
-
     std::vector<float> temp_vec(y_num, 0);
 
 #ifdef HAVE_OPENMP
@@ -614,27 +873,7 @@ void ComputeGradient::calc_inv_bspline_y(MeshData<T>& input){
 #endif
     for (int64_t j = 0; j < z_num; ++j) {
         for (int64_t i = 0;i < x_num; ++i) {
-
-#ifdef HAVE_OPENMP
-#pragma omp simd
-#endif
-            for (int64_t k = 0; k < (y_num); ++k) {
-                int64_t idx = j * x_num * y_num + i * y_num + k;
-                temp_vec[k] = input.mesh[idx];
-            }
-
-            //LHS boundary condition
-            input.mesh[j*x_num*y_num + i*y_num] = a2*temp_vec[0];
-            input.mesh[j*x_num*y_num + i*y_num] += (a1+a3)*temp_vec[1];
-
-            for (int64_t k = 1; k < (y_num-1);k++){
-                const int64_t idx = j * x_num * y_num + i * y_num + k;
-                input.mesh[idx] = a1*temp_vec[k-1] + a2*temp_vec[k] + a3*temp_vec[k+1];
-            }
-
-            //RHS boundary condition
-            input.mesh[j*x_num*y_num + i*y_num + y_num - 1] = (a1+a3)*temp_vec[y_num - 2];
-            input.mesh[j*x_num*y_num + i*y_num + y_num - 1] += a2*temp_vec[y_num - 1];
+            calc_inv_bspline_y_row(input.mesh.begin() + j*x_num*y_num + i*y_num, y_num, temp_vec);
         }
     }
 }
@@ -706,6 +945,55 @@ void ComputeGradient::calc_inv_bspline_z(MeshData<T>& input){
 }
 
 
+template<typename T>
+inline void ComputeGradient::calc_inv_bspline_x_plane(T *plane, int64_t x_num, int64_t y_num, int64_t y_begin, int64_t y_end, std::vector<three_temps> &temp_vec) {
+    //
+    //  Inverse cubic bspline filter in x of the columns [y_begin, y_end) of one xy plane, temp_vec is a work vector of size y_num
+    //
+
+    const float a1 = 1.0/6.0;
+    const float a2 = 4.0/6.0;
+    const float a3 = 1.0/6.0;
+
+    //initialize the loop
+    for (int64_t k = y_end - 1; k >= y_begin; --k) {
+        temp_vec[k].temp_1 = plane[y_num + k]; // second column in the XY plane
+        temp_vec[k].temp_2 = plane[k];   // first column in the XY plane
+    }
+
+    //LHS boundary condition is accounted for with this initialization
+    for (int64_t i = 0; i < x_num-1; ++i) {
+        int64_t iynum = i * y_num;
+
+        //initialize the loop
+        #ifdef HAVE_OPENMP
+        #pragma omp simd
+        #endif
+        for (int64_t k = y_begin; k < y_end; ++k) {
+            temp_vec[k].temp_3 = plane[iynum + y_num + k]; // get (i+1)th column
+        }
+
+        #ifdef HAVE_OPENMP
+        #pragma omp simd
+        #endif
+        for (int64_t k = y_begin; k < y_end; k++) {
+            plane[iynum + k] = a1 * temp_vec[k].temp_1 + a2 * temp_vec[k].temp_2 + a3 * temp_vec[k].temp_3;
+        }
+
+        // move two first y-columns to the right
+        // TODO: instead of temp_vec of triple-floats we could use 3 separate vectors and switch them instead of copying data
+        for (int64_t k = y_begin; k < y_end; k++) {
+            temp_vec[k].temp_1 = temp_vec[k].temp_2;
+            temp_vec[k].temp_2 = temp_vec[k].temp_3;
+        }
+    }
+
+    //then do the last boundary point (RHS)
+    for (int64_t k = y_end - 1; k >= y_begin; k--) {
+        plane[x_num*y_num - y_num + k] = (a1+a3) * temp_vec[k].temp_1 + a2 * temp_vec[k].temp_2;
+    }
+}
+
 template<typename T>
 void ComputeGradient::calc_inv_bspline_x(MeshData<T>& input) {
     //  Bevan Cheeseman 2016
@@ -716,10 +1004,6 @@ void ComputeGradient::calc_inv_bspline_x(MeshData<T>& input) {
     int64_t x_num = input.x_num;
     int64_t y_num = input.y_num;
 
-    const float a1 = 1.0/6.0;
-    const float a2 = 4.0/6.0;
-    const float a3 = 1.0/6.0;
-
     std::vector<three_temps> temp_vec(y_num);
     int64_t xnumynum = x_num * y_num;
 
@@ -727,49 +1011,69 @@ void ComputeGradient::calc_inv_bspline_x(MeshData<T>& input) {
 	#pragma omp parallel for default(shared) firstprivate(temp_vec)
     #endif
     for(int64_t j = 0; j < z_num; ++j) {
-        int64_t jxnumynum = j * xnumynum;
+        calc_inv_bspline_x_plane(input.mesh.begin() + j*xnumynum, x_num, y_num, 0, y_num, temp_vec);
+    }
+}
 
-        //initialize the loop
-        for (int64_t k = y_num - 1; k >= 0; --k) {
-            temp_vec[k].temp_1 = input.mesh[jxnumynum + y_num + k]; // second column in the XY plane
-            temp_vec[k].temp_2 = input.mesh[jxnumynum + k];   // first column in the XY plane
-        }
 
-        //LHS boundary condition is accounted for with this initialization
-        for (int64_t i = 0; i < x_num-1; ++i) {
-            int64_t iynum = i * y_num;
+template<typename S>
+inline void ComputeGradient::calc_bspline_fd_ds_mag_row(const MeshData<S> &input, MeshData<S> &grad, size_t z, size_t x, std::vector<S> &temp, const float hx, const float hy, const float hz) {
+    //
+    //  Gradient magnitude of the row (z, x) maximum down-sampled into grad, temp is a work vector of size y_num
+    //
+    const size_t z_num = input.z_num;
+    const size_t x_num = input.x_num;
+    const size_t y_num = input.y_num;
+
+    const size_t x_num_ds = grad.x_num;
+    const size_t y_num_ds = grad.y_num;
 
-            //initialize the loop
-            #ifdef HAVE_OPENMP
-	        #pragma omp simd
-            #endif
-            for (int64_t k = 0; k < y_num; ++k) {
-                temp_vec[k].temp_3 = input.mesh[jxnumynum + iynum + y_num + k]; // get (i+1)th column
-            }
+    const size_t xnumynum = x_num * y_num;
 
-            #ifdef HAVE_OPENMP
-	        #pragma omp simd
-            #endif
-            for (int64_t k = 0; k < (y_num); k++) {
-                input.mesh[jxnumynum + iynum + k] = a1 * temp_vec[k].temp_1 + a2 * temp_vec[k].temp_2 + a3 * temp_vec[k].temp_3;
-            }
+    // Belows pointers up, down... are forming stencil in X (left <-> right) and Z ( up <-> down) direction and
+    // are pointing to whole Y column. If out of bounds then 'replicate' (nearest array border value) approach is used.
+    //
+    //                 up
+    //   ...   left  center  right ...
+    //                down
+    const size_t zMinus = z > 0 ? z - 1 : 0 /* boundary */;
+    const size_t zPlus = std::min(z + 1, z_num - 1 /* boundary */);
+    const size_t xMinus = x > 0 ? x - 1 : 0 /* boundary */;
+    const size_t xPlus = std::min(x + 1, x_num - 1 /* boundary */);
+
+    const S *left = input.mesh.begin() + z * xnumynum + xMinus * y_num;
+    const S *center = input.mesh.begin() + z * xnumynum + x * y_num;
+    const S *right = input.mesh.begin() + z * xnumynum + xPlus * y_num;
+    const S *up = input.mesh.begin() + zMinus * xnumynum + x * y_num;
+    const S *down = input.mesh.begin() + zPlus * xnumynum + x * y_num;
+
+    //compute the boundary values
+    if (y_num >= 2) {
+        temp[0] = sqrt(pow((right[0] - left[0]) / (2 * hx), 2.0) + pow((down[0] - up[0]) / (2 * hz), 2.0) + pow((center[1] - center[0 /* boundary */]) / (2 * hy), 2.0));
+        temp[y_num - 1] = sqrt(pow((right[y_num - 1] - left[y_num - 1]) / (2 * hx), 2.0) + pow((down[y_num - 1] - up[y_num - 1]) / (2 * hz), 2.0) + pow((center[y_num - 1 /* boundary */] - center[y_num - 2]) / (2 * hy), 2.0));
+    }
+    else {
+        temp[0] = 0; // same values minus same values in x/y/z
+    }
 
-            // move two first y-columns to the right
-            // TODO: instead of temp_vec of triple-floats we could use 3 separate vectors and switch them instead of copying data
-            for (int64_t k = 0; k < (y_num); k++) {
-                temp_vec[k].temp_1 = temp_vec[k].temp_2;
-                temp_vec[k].temp_2 = temp_vec[k].temp_3;
-            }
-        }
+    //do the y gradient in range 1..y_num-2
+    #ifdef HAVE_OPENMP
+    #pragma omp simd
+    #endif
+    for (size_t y = 1; y < y_num - 1; ++y) {
+        temp[y] = sqrt(pow((right[y] - left[y]) / (2 * hx), 2.0) + pow((down[y] - up[y]) / (2 * hz), 2.0) + pow((center[y + 1] - center[y - 1]) / (2 * hy), 2.0));
+    }
 
-        //then do the last boundary point (RHS)
-        for (int64_t k = y_num - 1; k >= 0; k--) {
-            input.mesh[jxnumynum + xnumynum - y_num + k] = (a1+a3) * temp_vec[k].temp_1 + a2 * temp_vec[k].temp_2;
-        }
+    // Set as a downsampled gradient maximum from 2x2x2 gradient cubes
+    int64_t z_2 = z / 2;
+    int64_t x_2 = x / 2;
+    for (size_t k = 0; k < y_num_ds; ++k) {
+        size_t k_s = std::min(2 * k + 1, y_num - 1);
+        const size_t idx = z_2 * x_num_ds * y_num_ds + x_2 * y_num_ds + k;
+        grad.mesh[idx] = std::max(temp[2 * k], std::max(temp[k_s], grad.mesh[idx]));
     }
 }
 
-
 /**
  * Calculates downsampled gradient (maximum magnitude) with 'replicate' boundary approach (nearest border value)
  * @param input - input mesh
@@ -784,64 +1088,14 @@ void ComputeGradient::calc_bspline_fd_ds_mag(const MeshData<S> &input, MeshData<
     const size_t x_num = input.x_num;
     const size_t y_num = input.y_num;
 
-    const size_t x_num_ds = grad.x_num;
-    const size_t y_num_ds = grad.y_num;
-
     std::vector<S> temp(y_num, 0);
-    const size_t xnumynum = x_num * y_num;
 
     #ifdef HAVE_OPENMP
     #pragma omp parallel for default(shared) firstprivate(temp)
     #endif
     for (size_t z = 0; z < z_num; ++z) {
-        // Belows pointers up, down... are forming stencil in X (left <-> right) and Z ( up <-> down) direction and
-        // are pointing to whole Y column. If out of bounds then 'replicate' (nearest array border value) approach is used.
-        //
-        //                 up
-        //   ...   left  center  right ...
-        //                down
-        const S *left = input.mesh.begin() + z * xnumynum + 0 * y_num; // boundary value is chosen
-        const S *center = input.mesh.begin() + z * xnumynum + 0 * y_num;
-
-        //LHS boundary condition is accounted for wiht this initialization
-        const size_t zMinus = z > 0 ? z - 1 : 0 /* boundary */;
-        const size_t zPlus = std::min(z + 1, z_num - 1 /* boundary */);
-
         for (size_t x = 0; x < x_num; ++x) {
-            const S *up = input.mesh.begin() + zMinus * xnumynum + x * y_num;
-            const S *down = input.mesh.begin() + zPlus * xnumynum + x * y_num;
-            const size_t xPlus = std::min(x + 1, x_num - 1 /* boundary */);
-            const S *right = input.mesh.begin() + z * xnumynum + xPlus * y_num;
-
-            //compute the boundary values
-            if (y_num >= 2) {
-                temp[0] = sqrt(pow((right[0] - left[0]) / (2 * hx), 2.0) + pow((down[0] - up[0]) / (2 * hz), 2.0) + pow((center[1] - center[0 /* boundary */]) / (2 * hy), 2.0));
-                temp[y_num - 1] = sqrt(pow((right[y_num - 1] - left[y_num - 1]) / (2 * hx), 2.0) + pow((down[y_num - 1] - up[y_num - 1]) / (2 * hz), 2.0) + pow((center[y_num - 1 /* boundary */] - center[y_num - 2]) / (2 * hy), 2.0));
-            }
-            else {
-                temp[0] = 0; // same values minus same values in x/y/z
-            }
-
-            //do the y gradient in range 1..y_num-2
-            #ifdef HAVE_OPENMP
-            #pragma omp simd
-            #endif
-            for (size_t y = 1; y < y_num - 1; ++y) {
-                temp[y] = sqrt(pow((right[y] - left[y]) / (2 * hx), 2.0) + pow((down[y] - up[y]) / (2 * hz), 2.0) + pow((center[y + 1] - center[y - 1]) / (2 * hy), 2.0));
-            }
-
-            // Set as a downsampled gradient maximum from 2x2x2 gradient cubes
-            int64_t z_2 = z / 2;
-            int64_t x_2 = x / 2;
-            for (size_t k = 0; k < y_num_ds; ++k) {
-                size_t k_s = std::min(2 * k + 1, y_num - 1);
-                const size_t idx = z_2 * x_num_ds * y_num_ds + x_2 * y_num_ds + k;
-                grad.mesh[idx] = std::max(temp[2 * k], std::max(temp[k_s], grad.mesh[idx]));
-            }
-
-            // move left, center to current center, right (both +1 to right)
-            std::swap(left, center);
-            std::swap(center, right);
+            calc_bspline_fd_ds_mag_row(input, grad, z, x, temp, hx, hy, hz);
         }
     }
 }
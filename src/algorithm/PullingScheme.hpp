@@ -14,6 +14,8 @@
 #include <cassert>
 #include "../data_structures/APR/APRIterator.hpp"
 #include "../data_structures/Mesh/MeshData.hpp"
+#include "../data_structures/Mesh/BrickMeshData.hpp"
+#include "../data_structures/Mesh/PackedMeshData.hpp"
 #include "../data_structures/APR/APR.hpp"
 
 #ifdef HAVE_OPENMP
@@ -27,6 +29,7 @@
 #define ASCENDANT 8
 #define PROPOGATE 15
 #define ASCENDANTNEIGHBOUR 16
+#define ASCENDANTNEIGHBOUR_PACKED 5 // ASCENDANTNEIGHBOUR in the packed (4 bit) tree
 
 #define NEIGHBOURLOOP(jn,in,kn, boundaries) \
 for(jn = boundaries[0][0]; jn < boundaries[0][1]; jn++) \
@@ -58,14 +61,31 @@ class PullingScheme {
 public:
 
     std::vector<MeshData<uint8_t>> particle_cell_tree;
+
+    // with use_sparse_tree the levels are stored in particle_cell_tree_sparse instead, keeping only the 8x8x8 bricks
+    // with non-empty cells, and the pulling scheme only visits those bricks (and their neighbours), so its time and
+    // memory scale with the number of fine particle cells instead of the volume. The resulting particle cells are the same.
+    std::vector<BrickMeshData<uint8_t>> particle_cell_tree_sparse;
+    bool use_sparse_tree = false;
+
+    // with use_packed_tree (and not use_sparse_tree) the levels are stored in particle_cell_tree_packed instead, with
+    // 4 bits per cell (half the memory of the dense tree), and the pulling scheme works on 16 cells at once
+    std::vector<PackedMeshData> particle_cell_tree_packed;
+    bool use_packed_tree = false;
+
+    // memory used by the particle cell tree at the end of the pulling scheme (its peak), for reporting
+    size_t particle_cell_tree_peak_bytes = 0;
+
     unsigned int l_min;
     unsigned int l_max;
 
     template<typename T>
-    void fill(float k, const MeshData<T> &input);
+    void fill(float k, const MeshData<T> &input, size_t z_offset = 0);
     void pulling_scheme_main();
     template<typename T>
     void initialize_particle_cell_tree(APR<T>& apr);
+    size_t particle_cell_tree_size_in_bytes() const;
+    void release_particle_cell_tree();
 
 private:
 
@@ -73,6 +93,30 @@ private:
     void set_filler(int level);
     void fill_neighbours(int level);
     void fill_parent(size_t j, size_t i, size_t k, size_t x_num, size_t y_num, size_t new_level);
+
+    template<typename T>
+    void fill_sparse(float k, const MeshData<T> &input, size_t z_offset);
+    void set_ascendant_neighbours_sparse(int level);
+    void set_filler_sparse(int level);
+    void fill_neighbours_sparse(int level);
+
+    template<typename IsActive>
+    void allocate_neighbour_bricks(BrickMeshData<uint8_t> &level_tree, IsActive is_active);
+    template<typename Function>
+    void for_each_brick(BrickMeshData<uint8_t> &level_tree, bool alternate_z, Function function);
+    template<typename Function>
+    static void for_each_cell(BrickMeshData<uint8_t> &level_tree, size_t brick, Function function);
+    template<typename Function>
+    static void for_each_neighbour(BrickMeshData<uint8_t> &level_tree, size_t y, size_t x, size_t z, Function function);
+
+    template<typename T>
+    void fill_packed(float k, const MeshData<T> &input, size_t z_offset);
+    void set_ascendant_neighbours_packed(int level);
+    void set_filler_packed(int level);
+    void fill_neighbours_packed(int level);
+
+    template<typename Source>
+    static void neighbour_mask_packed(const PackedMeshData &level_tree, size_t x, size_t z, Source source, std::vector<uint64_t> &sources, std::vector<uint64_t> &mask);
 };
 
 template<typename T>
@@ -85,15 +129,62 @@ void PullingScheme::initialize_particle_cell_tree(APR<T>& apr) {
     l_max = apr.level_max() - 1;
     l_min = apr.level_min();
     //make so you can reference the array as l
-    particle_cell_tree.resize(l_max + 1);
+    if (use_sparse_tree) {
+        particle_cell_tree.clear();
+        particle_cell_tree_packed.clear();
+        particle_cell_tree_sparse.resize(l_max + 1);
+    } else if (use_packed_tree) {
+        particle_cell_tree.clear();
+        particle_cell_tree_sparse.clear();
+        particle_cell_tree_packed.resize(l_max + 1);
+    } else {
+        particle_cell_tree_sparse.clear();
+        particle_cell_tree_packed.clear();
+        particle_cell_tree.resize(l_max + 1);
+    }
 
     for (unsigned int l = l_min; l < (l_max + 1) ;l ++){
-        particle_cell_tree[l].init(ceil((1.0 * apr.apr_access.org_dims[0]) / pow(2.0, 1.0 * l_max - l + 1)),
-                                   ceil((1.0 * apr.apr_access.org_dims[1]) / pow(2.0, 1.0 * l_max - l + 1)),
-                                   ceil((1.0 * apr.apr_access.org_dims[2]) / pow(2.0, 1.0 * l_max - l + 1)), EMPTY);
+        const size_t y_num = ceil((1.0 * apr.apr_access.org_dims[0]) / pow(2.0, 1.0 * l_max - l + 1));
+        const size_t x_num = ceil((1.0 * apr.apr_access.org_dims[1]) / pow(2.0, 1.0 * l_max - l + 1));
+        const size_t z_num = ceil((1.0 * apr.apr_access.org_dims[2]) / pow(2.0, 1.0 * l_max - l + 1));
+        if (use_sparse_tree) {
+            particle_cell_tree_sparse[l].init(y_num, x_num, z_num, EMPTY);
+        } else if (use_packed_tree) {
+            particle_cell_tree_packed[l].init(y_num, x_num, z_num);
+        } else if ((particle_cell_tree[l].y_num == y_num) && (particle_cell_tree[l].x_num == x_num) && (particle_cell_tree[l].z_num == z_num) &&
+                   (particle_cell_tree[l].mesh.size() > 0)) {
+            //same dimensions as in the previous conversion, the memory is kept and only reset
+            particle_cell_tree[l].fill(EMPTY);
+        } else {
+            particle_cell_tree[l].init(y_num, x_num, z_num, EMPTY);
+        }
     }
 }
 
+size_t PullingScheme::particle_cell_tree_size_in_bytes() const {
+    size_t size = 0;
+    for (auto &level_tree : particle_cell_tree) {
+        size += level_tree.mesh.size();
+    }
+    for (auto &level_tree : particle_cell_tree_sparse) {
+        size += level_tree.size_in_bytes();
+    }
+    for (auto &level_tree : particle_cell_tree_packed) {
+        size += level_tree.size_in_bytes();
+    }
+    return size;
+}
+
+void PullingScheme::release_particle_cell_tree() {
+    //frees the memory of the particle cell tree (otherwise kept, and reused by the next initialization with the same dimensions)
+    particle_cell_tree.clear();
+    particle_cell_tree.shrink_to_fit();
+    particle_cell_tree_sparse.clear();
+    particle_cell_tree_sparse.shrink_to_fit();
+    particle_cell_tree_packed.clear();
+    particle_cell_tree_packed.shrink_to_fit();
+}
+
 void PullingScheme::pulling_scheme_main() {
     //
     //  Bevan Cheeseman 2016
@@ -108,21 +199,50 @@ void PullingScheme::pulling_scheme_main() {
 
     //loop over all levels from l_max to l_min
     for (int level = l_max; level >= (int)l_min; --level) {
+        if (use_sparse_tree) {
+            if (level != (int)l_max) {
+                set_ascendant_neighbours_sparse(level);
+                set_filler_sparse(level);
+            }
+            fill_neighbours_sparse(level);
+            continue;
+        }
+        if (use_packed_tree) {
+            if (level != (int)l_max) {
+                set_ascendant_neighbours_packed(level);
+                set_filler_packed(level);
+            }
+            fill_neighbours_packed(level);
+            continue;
+        }
         if (level != (int)l_max) {
             set_ascendant_neighbours(level); //step 1 and step 2.
             set_filler(level); // step 3.
         }
         fill_neighbours(level); // step 4.
     }
+
+    particle_cell_tree_peak_bytes = particle_cell_tree_size_in_bytes();
 }
 
 template<typename T>
-void PullingScheme::fill(const float k, const MeshData<T> &input) {
+void PullingScheme::fill(const float k, const MeshData<T> &input, size_t z_offset) {
     //  Bevan Cheeseman 2016
     //
     //  Updates the hash table from the down sampled images
+    //
+    //  The input can also be a z-slab of the level starting at z_offset (used when converting the image in slabs)
+
+    if (use_sparse_tree) {
+        fill_sparse(k, input, z_offset);
+        return;
+    }
+    if (use_packed_tree) {
+        fill_packed(k, input, z_offset);
+        return;
+    }
 
-    auto &mesh = particle_cell_tree[k].mesh;
+    auto mesh = particle_cell_tree[k].mesh.begin() + z_offset * particle_cell_tree[k].x_num * particle_cell_tree[k].y_num;
 
     if (k == l_max){
         // k_max loop, has to include
@@ -299,4 +419,505 @@ void PullingScheme::fill_parent(size_t j, size_t i, size_t k, size_t x_num, size
     }
 }
 
+template<typename T>
+void PullingScheme::fill_sparse(const float k, const MeshData<T> &input, size_t z_offset) {
+    //
+    //  fill for the sparse tree, allocating the bricks containing seeds
+    //
+
+    BrickMeshData<uint8_t> &level_tree = particle_cell_tree_sparse[k];
+    const size_t y_num = input.y_num;
+    const size_t x_num = input.x_num;
+    const size_t z_end = z_offset + input.z_num;
+
+    auto is_seed = [&](const T value) -> bool {
+        if (k == l_max) return value >= k;
+        if (k == l_min) return value <= k;
+        return value == k;
+    };
+
+    std::vector<uint8_t> flags(level_tree.number_bricks(), 0);
+    const size_t brick_size = level_tree.brick_size;
+    const int64_t bz_begin = z_offset/brick_size;
+    const int64_t bz_end = (z_end + brick_size - 1)/brick_size;
+
+    // each z-slab of bricks is visited by one thread, flagging the bricks with seeds
+    int64_t bz;
+    #ifdef HAVE_OPENMP
+    #pragma omp parallel for schedule(dynamic) private(bz)
+    #endif
+    for (bz = bz_begin; bz < bz_end; ++bz) {
+        for (size_t z = std::max(z_offset, bz*brick_size); z < std::min(z_end, (bz + 1)*brick_size); ++z) {
+            for (size_t x = 0; x < x_num; ++x) {
+                const T *row = input.mesh.begin() + (z - z_offset)*x_num*y_num + x*y_num;
+                for (size_t y = 0; y < y_num; ++y) {
+                    if (is_seed(row[y])) {
+                        flags[level_tree.brick_number(y/brick_size, x/brick_size, bz)] = 1;
+                    }
+                }
+            }
+        }
+    }
+
+    level_tree.allocate_bricks(flags);
+
+    // then only the flagged bricks are visited again to set the seeds
+    #ifdef HAVE_OPENMP
+    #pragma omp parallel for schedule(dynamic) private(bz)
+    #endif
+    for (bz = bz_begin; bz < bz_end; ++bz) {
+        for (size_t bx = 0; bx < level_tree.x_num_bricks; ++bx) {
+            for (size_t by = 0; by < level_tree.y_num_bricks; ++by) {
+                if (!flags[level_tree.brick_number(by, bx, bz)]) {
+                    continue;
+                }
+                for (size_t z = std::max(z_offset, bz*brick_size); z < std::min(z_end, (bz + 1)*brick_size); ++z) {
+                    for (size_t x = bx*brick_size; x < std::min(x_num, (bx + 1)*brick_size); ++x) {
+                        const T *row = input.mesh.begin() + (z - z_offset)*x_num*y_num + x*y_num;
+                        for (size_t y = by*brick_size; y < std::min(y_num, (by + 1)*brick_size); ++y) {
+                            if (is_seed(row[y])) {
+                                level_tree.ref(y, x, z) = SEED_TYPE;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+void PullingScheme::set_ascendant_neighbours_sparse(int level) {
+    BrickMeshData<uint8_t> &level_tree = particle_cell_tree_sparse[level];
+
+    allocate_neighbour_bricks(level_tree, [](const uint8_t status) { return status == ASCENDANT; });
+
+    for_each_brick(level_tree, true, [&](const size_t brick) {
+        for_each_cell(level_tree, brick, [&](const size_t y, const size_t x, const size_t z, uint8_t &status) {
+            if (status == ASCENDANT) {
+                for_each_neighbour(level_tree, y, x, z, [](uint8_t &neighbour_status) {
+                    if (neighbour_status == EMPTY) {
+                        neighbour_status = ASCENDANTNEIGHBOUR;
+                    }
+                    if (neighbour_status == SEED_TYPE) {
+                        neighbour_status = PROPOGATE;
+                    }
+                });
+            }
+        });
+    });
+}
+
+void PullingScheme::set_filler_sparse(int level) {
+    BrickMeshData<uint8_t> &level_tree = particle_cell_tree_sparse[level];
+    BrickMeshData<uint8_t> &children_tree = particle_cell_tree_sparse[level + 1];
+    const size_t brick_size = level_tree.brick_size;
+
+    auto is_active = [](const uint8_t status) { return status == ASCENDANTNEIGHBOUR || status == PROPOGATE; };
+
+    // the children of a cell are in one of the 8 bricks of the next level covering its brick
+    const std::vector<size_t> &bricks = level_tree.allocated();
+    std::vector<uint8_t> children_masks(bricks.size(), 0);
+    int64_t i;
+
+    #ifdef HAVE_OPENMP
+    #pragma omp parallel for schedule(dynamic) private(i)
+    #endif
+    for (i = 0; i < (int64_t)bricks.size(); ++i) {
+        uint8_t mask = 0;
+        for_each_cell(level_tree, bricks[i], [&](const size_t y, const size_t x, const size_t z, uint8_t &status) {
+            if (is_active(status)) {
+                mask |= 1 << ((((z*2/brick_size) & 1) << 2) | (((x*2/brick_size) & 1) << 1) | ((y*2/brick_size) & 1));
+            }
+        });
+        children_masks[i] = mask;
+    }
+
+    std::vector<uint8_t> flags(children_tree.number_bricks(), 0);
+    for (size_t b = 0; b < bricks.size(); ++b) {
+        const size_t by = bricks[b] % level_tree.y_num_bricks;
+        const size_t bx = (bricks[b]/level_tree.y_num_bricks) % level_tree.x_num_bricks;
+        const size_t bz = bricks[b]/(level_tree.y_num_bricks*level_tree.x_num_bricks);
+        for (int c = 0; c < 8; ++c) {
+            if (children_masks[b] & (1 << c)) {
+                flags[children_tree.brick_number(2*by + (c & 1), 2*bx + ((c >> 1) & 1), 2*bz + (c >> 2))] = 1;
+            }
+        }
+    }
+    children_tree.allocate_bricks(flags);
+
+    // go down, and set empty children to FILLER
+    for_each_brick(level_tree, false, [&](const size_t brick) {
+        for_each_cell(level_tree, brick, [&](const size_t y, const size_t x, const size_t z, uint8_t &status) {
+            if (is_active(status)) {
+                for (size_t zc = 2*z; zc < std::min(2*z + 2, children_tree.z_num); ++zc) {
+                    for (size_t xc = 2*x; xc < std::min(2*x + 2, children_tree.x_num); ++xc) {
+                        for (size_t yc = 2*y; yc < std::min(2*y + 2, children_tree.y_num); ++yc) {
+                            uint8_t &children_status = children_tree.ref(yc, xc, zc);
+                            if (children_status == EMPTY) {
+                                children_status = FILLER_TYPE;
+                            }
+                        }
+                    }
+                }
+            }
+        });
+    });
+}
+
+void PullingScheme::fill_neighbours_sparse(int level) {
+    BrickMeshData<uint8_t> &level_tree = particle_cell_tree_sparse[level];
+
+    allocate_neighbour_bricks(level_tree, [](const uint8_t status) { return status == SEED_TYPE || status == PROPOGATE; });
+
+    const bool has_parent = (level - 1) >= (int)l_min;
+    auto is_child = [](const uint8_t status) { return status == SEED_TYPE || status == PROPOGATE || status == ASCENDANT; };
+
+    if (has_parent) {
+        // all cells of a brick have their parents in the same brick of the level above
+        BrickMeshData<uint8_t> &parent_tree = particle_cell_tree_sparse[level - 1];
+        const std::vector<size_t> &bricks = level_tree.allocated();
+        std::vector<uint8_t> has_children(bricks.size(), 0);
+        int64_t i;
+
+        #ifdef HAVE_OPENMP
+        #pragma omp parallel for schedule(dynamic) private(i)
+        #endif
+        for (i = 0; i < (int64_t)bricks.size(); ++i) {
+            const uint8_t *data = level_tree.brick(bricks[i]);
+            has_children[i] = std::any_of(data, data + level_tree.brick_volume, is_child);
+        }
+
+        std::vector<uint8_t> flags(parent_tree.number_bricks(), 0);
+        for (size_t b = 0; b < bricks.size(); ++b) {
+            if (has_children[b]) {
+                const size_t by = bricks[b] % level_tree.y_num_bricks;
+                const size_t bx = (bricks[b]/level_tree.y_num_bricks) % level_tree.x_num_bricks;
+                const size_t bz = bricks[b]/(level_tree.y_num_bricks*level_tree.x_num_bricks);
+                flags[parent_tree.brick_number(by/2, bx/2, bz/2)] = 1;
+            }
+        }
+        parent_tree.allocate_bricks(flags);
+    }
+
+    for_each_brick(level_tree, true, [&](const size_t brick) {
+        for_each_cell(level_tree, brick, [&](const size_t y, const size_t x, const size_t z, uint8_t &status) {
+            if (status == SEED_TYPE || status == PROPOGATE) {
+                for_each_neighbour(level_tree, y, x, z, [](uint8_t &neighbour_status) {
+                    if (neighbour_status == EMPTY) {
+                        neighbour_status = BOUNDARY_TYPE;
+                    }
+                });
+            }
+            if (has_parent && is_child(status)) {
+                uint8_t &parent_status = particle_cell_tree_sparse[level - 1].ref(y/2, x/2, z/2);
+                if (parent_status != SEED_TYPE) {
+                    parent_status = ASCENDANT;
+                }
+            }
+        });
+    });
+}
+
+template<typename IsActive>
+void PullingScheme::allocate_neighbour_bricks(BrickMeshData<uint8_t> &level_tree, IsActive is_active) {
+    //
+    //  Allocates the bricks neighbouring (including diagonally) the active cells of the allocated bricks
+    //
+
+    const std::vector<size_t> &bricks = level_tree.allocated();
+    const size_t brick_size = level_tree.brick_size;
+    std::vector<uint32_t> neighbour_masks(bricks.size(), 0);
+    int64_t i;
+
+    // bit (dz + 1)*9 + (dx + 1)*3 + (dy + 1) is set if the brick in direction (dy, dx, dz) is needed
+    #ifdef HAVE_OPENMP
+    #pragma omp parallel for schedule(dynamic) private(i)
+    #endif
+    for (i = 0; i < (int64_t)bricks.size(); ++i) {
+        uint32_t mask = 0;
+        for_each_cell(level_tree, bricks[i], [&](const size_t y, const size_t x, const size_t z, uint8_t &status) {
+            if (is_active(status) && ((y % brick_size == 0) || (y % brick_size == brick_size - 1) ||
+                                      (x % brick_size == 0) || (x % brick_size == brick_size - 1) ||
+                                      (z % brick_size == 0) || (z % brick_size == brick_size - 1))) {
+                const int y_begin = ((y % brick_size == 0) && (y > 0)) ? -1 : 0;
+                const int y_end = ((y % brick_size == brick_size - 1) && (y + 1 < level_tree.y_num)) ? 1 : 0;
+                const int x_begin = ((x % brick_size == 0) && (x > 0)) ? -1 : 0;
+                const int x_end = ((x % brick_size == brick_size - 1) && (x + 1 < level_tree.x_num)) ? 1 : 0;
+                const int z_begin = ((z % brick_size == 0) && (z > 0)) ? -1 : 0;
+                const int z_end = ((z % brick_size == brick_size - 1) && (z + 1 < level_tree.z_num)) ? 1 : 0;
+                for (int dz = z_begin; dz <= z_end; ++dz) {
+                    for (int dx = x_begin; dx <= x_end; ++dx) {
+                        for (int dy = y_begin; dy <= y_end; ++dy) {
+                            mask |= ((uint32_t) 1) << ((dz + 1)*9 + (dx + 1)*3 + (dy + 1));
+                        }
+                    }
+                }
+            }
+        });
+        neighbour_masks[i] = mask;
+    }
+
+    std::vector<uint8_t> flags(level_tree.number_bricks(), 0);
+    for (size_t b = 0; b < bricks.size(); ++b) {
+        if (neighbour_masks[b] == 0) continue;
+        const int64_t by = bricks[b] % level_tree.y_num_bricks;
+        const int64_t bx = (bricks[b]/level_tree.y_num_bricks) % level_tree.x_num_bricks;
+        const int64_t bz = bricks[b]/(level_tree.y_num_bricks*level_tree.x_num_bricks);
+        for (int direction = 0; direction < 27; ++direction) {
+            if (neighbour_masks[b] & (((uint32_t) 1) << direction)) {
+                flags[level_tree.brick_number(by + direction % 3 - 1, bx + (direction/3) % 3 - 1, bz + direction/9 - 1)] = 1;
+            }
+        }
+    }
+    level_tree.allocate_bricks(flags);
+}
+
+template<typename Function>
+void PullingScheme::for_each_brick(BrickMeshData<uint8_t> &level_tree, const bool alternate_z, Function function) {
+    //
+    //  Visits the allocated bricks, in parallel over the z-slabs of bricks. If the function writes to the neighbouring
+    //  cells (alternate_z) the even and odd slabs are visited in separate passes to avoid concurrent writes
+    //
+
+    const size_t z_num_bricks = level_tree.z_num_bricks;
+    const size_t slab_size = level_tree.x_num_bricks*level_tree.y_num_bricks;
+
+    std::vector<size_t> slab_begin(z_num_bricks + 1, 0);
+    for (size_t brick : level_tree.allocated()) {
+        slab_begin[brick/slab_size + 1]++;
+    }
+    for (size_t bz = 0; bz < z_num_bricks; ++bz) {
+        slab_begin[bz + 1] += slab_begin[bz];
+    }
+    std::vector<size_t> slab_bricks(level_tree.number_allocated_bricks());
+    std::vector<size_t> position(slab_begin.begin(), slab_begin.end() - 1);
+    for (size_t brick : level_tree.allocated()) {
+        slab_bricks[position[brick/slab_size]++] = brick;
+    }
+
+    const int64_t step = alternate_z ? 2 : 1;
+    for (int64_t pass = 0; pass < step; ++pass) {
+        int64_t bz;
+        #ifdef HAVE_OPENMP
+        #pragma omp parallel for schedule(dynamic) private(bz)
+        #endif
+        for (bz = pass; bz < (int64_t)z_num_bricks; bz += step) {
+            for (size_t i = slab_begin[bz]; i < slab_begin[bz + 1]; ++i) {
+                function(slab_bricks[i]);
+            }
+        }
+    }
+}
+
+template<typename Function>
+void PullingScheme::for_each_cell(BrickMeshData<uint8_t> &level_tree, const size_t brick, Function function) {
+    const size_t brick_size = level_tree.brick_size;
+    const size_t y_begin = (brick % level_tree.y_num_bricks)*brick_size;
+    const size_t x_begin = ((brick/level_tree.y_num_bricks) % level_tree.x_num_bricks)*brick_size;
+    const size_t z_begin = (brick/(level_tree.y_num_bricks*level_tree.x_num_bricks))*brick_size;
+    uint8_t *data = level_tree.brick(brick);
+
+    for (size_t z = z_begin; z < std::min(z_begin + brick_size, level_tree.z_num); ++z) {
+        for (size_t x = x_begin; x < std::min(x_begin + brick_size, level_tree.x_num); ++x) {
+            for (size_t y = y_begin; y < std::min(y_begin + brick_size, level_tree.y_num); ++y) {
+                function(y, x, z, data[level_tree.offset_in_brick(y, x, z)]);
+            }
+        }
+    }
+}
+
+template<typename Function>
+void PullingScheme::for_each_neighbour(BrickMeshData<uint8_t> &level_tree, const size_t y, const size_t x, const size_t z, Function function) {
+    //
+    //  The cells of the 3x3x3 neighbourhood (including the cell itself) inside the level, as NEIGHBOURLOOP
+    //
+
+    for (size_t zn = (z > 0 ? z - 1 : 0); zn < std::min(z + 2, level_tree.z_num); ++zn) {
+        for (size_t xn = (x > 0 ? x - 1 : 0); xn < std::min(x + 2, level_tree.x_num); ++xn) {
+            for (size_t yn = (y > 0 ? y - 1 : 0); yn < std::min(y + 2, level_tree.y_num); ++yn) {
+                function(level_tree.ref(yn, xn, zn));
+            }
+        }
+    }
+}
+
+template<typename T>
+void PullingScheme::fill_packed(const float k, const MeshData<T> &input, size_t z_offset) {
+    //
+    //  fill for the packed tree, setting the seeds of a word at once
+    //
+
+    PackedMeshData &level_tree = particle_cell_tree_packed[k];
+    const size_t y_num = input.y_num;
+    const size_t x_num = input.x_num;
+    const size_t z_num = input.z_num;
+
+    auto is_seed = [&](const T value) -> bool {
+        if (k == l_max) return value >= k;
+        if (k == l_min) return value <= k;
+        return value == k;
+    };
+
+    #ifdef HAVE_OPENMP
+    #pragma omp parallel for default(shared)
+    #endif
+    for (size_t z = 0; z < z_num; ++z) {
+        for (size_t x = 0; x < x_num; ++x) {
+            const T *input_row = input.mesh.begin() + z*x_num*y_num + x*y_num;
+            uint64_t *row = level_tree.row(x, z + z_offset);
+            for (size_t w = 0; w < level_tree.words_per_row; ++w) {
+                const size_t y_begin = w*PackedMeshData::values_per_word;
+                const size_t y_end = std::min(y_num, y_begin + PackedMeshData::values_per_word);
+                uint64_t seeds = 0;
+                for (size_t y = y_begin; y < y_end; ++y) {
+                    if (is_seed(input_row[y])) {
+                        seeds |= ((uint64_t) 1) << (4*(y - y_begin));
+                    }
+                }
+                row[w] = PackedMeshData::replace(row[w], seeds, SEED_TYPE);
+            }
+        }
+    }
+}
+
+void PullingScheme::set_ascendant_neighbours_packed(int level) {
+    PackedMeshData &level_tree = particle_cell_tree_packed[level];
+    const size_t x_num = level_tree.x_num;
+    const size_t z_num = level_tree.z_num;
+
+    std::vector<uint64_t> sources(level_tree.words_per_row);
+    std::vector<uint64_t> mask(level_tree.words_per_row);
+
+    // each z plane only writes its own rows, the neighbouring planes (read) are done in the other passes
+    for (size_t out = 0; out < std::min((size_t)3, z_num); ++out) {
+        #ifdef HAVE_OPENMP
+        #pragma omp parallel for default(shared) firstprivate(sources, mask) if(z_num * x_num * level_tree.y_num > 100000) schedule(static)
+        #endif
+        for (size_t z = out; z < z_num; z += 3) {
+            for (size_t x = 0; x < x_num; ++x) {
+                neighbour_mask_packed(level_tree, x, z, [](const uint64_t word) { return PackedMeshData::equal(word, ASCENDANT); }, sources, mask);
+                uint64_t *row = level_tree.row(x, z);
+                for (size_t w = 0; w < level_tree.words_per_row; ++w) {
+                    if (mask[w]) {
+                        const uint64_t word = row[w];
+                        const uint64_t empty = PackedMeshData::equal(word, EMPTY) & mask[w];
+                        const uint64_t seed = PackedMeshData::equal(word, SEED_TYPE) & mask[w];
+                        row[w] = PackedMeshData::replace(PackedMeshData::replace(word, empty, ASCENDANTNEIGHBOUR_PACKED), seed, PROPOGATE);
+                    }
+                }
+            }
+        }
+    }
+}
+
+void PullingScheme::set_filler_packed(int level) {
+    PackedMeshData &level_tree = particle_cell_tree_packed[level];
+    PackedMeshData &children_tree = particle_cell_tree_packed[level + 1];
+    const size_t x_num = children_tree.x_num;
+    const size_t z_num = children_tree.z_num;
+
+    // go down, and set empty children to FILLER (each child row reads the row of its parents)
+    #ifdef HAVE_OPENMP
+    #pragma omp parallel for default(shared) if(z_num * x_num * children_tree.y_num > 10000)
+    #endif
+    for (size_t z = 0; z < z_num; ++z) {
+        for (size_t x = 0; x < x_num; ++x) {
+            const uint64_t *parent_row = level_tree.row(x/2, z/2);
+            uint64_t *row = children_tree.row(x, z);
+            for (size_t w = 0; w < children_tree.words_per_row; ++w) {
+                const uint64_t parent_word = parent_row[w/2];
+                const uint64_t active = PackedMeshData::equal(parent_word, ASCENDANTNEIGHBOUR_PACKED) | PackedMeshData::equal(parent_word, PROPOGATE);
+                if (active) {
+                    const uint64_t filler = PackedMeshData::expand(active, w & 1) & children_tree.valid_mask(w) & PackedMeshData::equal(row[w], EMPTY);
+                    row[w] = PackedMeshData::replace(row[w], filler, FILLER_TYPE);
+                }
+            }
+        }
+    }
+}
+
+void PullingScheme::fill_neighbours_packed(int level) {
+    PackedMeshData &level_tree = particle_cell_tree_packed[level];
+    const size_t x_num = level_tree.x_num;
+    const size_t z_num = level_tree.z_num;
+
+    std::vector<uint64_t> sources(level_tree.words_per_row);
+    std::vector<uint64_t> mask(level_tree.words_per_row);
+
+    for (size_t out = 0; out < std::min((size_t)3, z_num); ++out) {
+        #ifdef HAVE_OPENMP
+        #pragma omp parallel for default(shared) firstprivate(sources, mask) if(z_num * x_num * level_tree.y_num > 100000) schedule(static)
+        #endif
+        for (size_t z = out; z < z_num; z += 3) {
+            for (size_t x = 0; x < x_num; ++x) {
+                neighbour_mask_packed(level_tree, x, z, [](const uint64_t word) { return PackedMeshData::equal(word, SEED_TYPE) | PackedMeshData::equal(word, PROPOGATE); }, sources, mask);
+                uint64_t *row = level_tree.row(x, z);
+                for (size_t w = 0; w < level_tree.words_per_row; ++w) {
+                    if (mask[w]) {
+                        row[w] = PackedMeshData::replace(row[w], PackedMeshData::equal(row[w], EMPTY) & mask[w], BOUNDARY_TYPE);
+                    }
+                }
+            }
+        }
+    }
+
+    if ((level - 1) < (int)l_min) {
+        return;
+    }
+
+    // the parents of SEED, PROPOGATE and ASCENDANT cells become ASCENDANT (if not SEED)
+    PackedMeshData &parent_tree = particle_cell_tree_packed[level - 1];
+    auto is_child = [](const uint64_t word) {
+        return PackedMeshData::equal(word, SEED_TYPE) | PackedMeshData::equal(word, PROPOGATE) | PackedMeshData::equal(word, ASCENDANT);
+    };
+
+    #ifdef HAVE_OPENMP
+    #pragma omp parallel for default(shared) if(parent_tree.z_num * parent_tree.x_num * parent_tree.y_num > 10000)
+    #endif
+    for (size_t z = 0; z < parent_tree.z_num; ++z) {
+        for (size_t x = 0; x < parent_tree.x_num; ++x) {
+            uint64_t *row = parent_tree.row(x, z);
+            for (size_t w = 0; w < parent_tree.words_per_row; ++w) {
+                uint64_t children = 0;
+                for (size_t zc = 2*z; zc < std::min(2*z + 2, z_num); ++zc) {
+                    for (size_t xc = 2*x; xc < std::min(2*x + 2, x_num); ++xc) {
+                        const uint64_t *children_row = level_tree.row(xc, zc);
+                        const uint64_t second = (2*w + 1 < level_tree.words_per_row) ? is_child(children_row[2*w + 1]) : 0;
+                        children |= PackedMeshData::halve(is_child(children_row[2*w]), second);
+                    }
+                }
+                if (children) {
+                    row[w] = PackedMeshData::replace(row[w], children & ~PackedMeshData::equal(row[w], SEED_TYPE), ASCENDANT);
+                }
+            }
+        }
+    }
+}
+
+template<typename Source>
+void PullingScheme::neighbour_mask_packed(const PackedMeshData &level_tree, const size_t x, const size_t z, Source source, std::vector<uint64_t> &sources, std::vector<uint64_t> &mask) {
+    //
+    //  Element masks (mask) of the cells of the row (x, z) with a source cell in their 3x3x3 neighbourhood, the sources
+    //  of the 3x3 neighbouring rows are combined (in sources) and then dilated along y
+    //
+
+    const size_t words = level_tree.words_per_row;
+    std::fill(sources.begin(), sources.end(), 0);
+
+    for (size_t zn = (z > 0 ? z - 1 : 0); zn < std::min(z + 2, level_tree.z_num); ++zn) {
+        for (size_t xn = (x > 0 ? x - 1 : 0); xn < std::min(x + 2, level_tree.x_num); ++xn) {
+            const uint64_t *row = level_tree.row(xn, zn);
+            for (size_t w = 0; w < words; ++w) {
+                sources[w] |= source(row[w]);
+            }
+        }
+    }
+
+    for (size_t w = 0; w < words; ++w) {
+        const uint64_t previous = (w > 0) ? sources[w - 1] : 0;
+        const uint64_t next = (w + 1 < words) ? sources[w + 1] : 0;
+        mask[w] = PackedMeshData::dilate(previous, sources[w], next) & level_tree.valid_mask(w);
+    }
+}
+
 #endif //PARTPLAY_PULLING_SCHEME_HPP
@@ -13,6 +13,9 @@
 #include "../../io/APRWriter.hpp"
 #include "APRAccess.hpp"
 #include "ExtraParticleData.hpp"
+#include "MultiChannelParticleData.hpp"
+#include "MappedParticleData.hpp"
+#include "APRParticleOrder.hpp"
 
 
 template<typename ImageType>
@@ -55,6 +58,21 @@ public:
         apr_writer.read_apr(*this,file_name);
     }
 
+    //open an APR written with write_apr_native (access structure memory mapped, particle intensities copied)
+    bool read_apr_native(std::string file_name){
+        return apr_writer.read_apr_native(*this,file_name);
+    }
+
+    //open an APR written with write_apr_native, the particle intensities stay in the mapping (read only, no copy)
+    bool read_apr_native(std::string file_name,MappedParticleData<ImageType>& particles){
+        return apr_writer.read_apr_native(*this,file_name,particles);
+    }
+
+    //read only the part of the APR in the region of interest (see APRWriter::read_apr_region)
+    bool read_apr_region(std::string file_name,APRRegion& region){
+        return apr_writer.read_apr_region(*this,file_name,region);
+    }
+
     void write_apr(std::string save_loc,std::string file_name){
         apr_writer.write_apr(*this, save_loc,file_name);
     }
@@ -63,6 +81,16 @@ public:
         apr_writer.write_apr((*this),save_loc, file_name, apr_compressor,blosc_comp_type ,blosc_comp_level,blosc_shuffle);
     }
 
+    //write in the native (uncompressed, memory mappable) format
+    void write_apr_native(std::string save_loc,std::string file_name){
+        apr_writer.write_apr_native(*this, save_loc,file_name);
+    }
+
+    //write with an index of z-blocks, allowing regions of interest to be read without reading the full file
+    void write_apr_blocked(std::string save_loc,std::string file_name,uint64_t z_block_size = 16){
+        apr_writer.write_apr_blocked(*this, save_loc,file_name,z_block_size);
+    }
+
     //generate APR that can be read by paraview
     template<typename T>
     void write_apr_paraview(std::string save_loc,std::string file_name,ExtraParticleData<T>& parts){
@@ -81,6 +109,30 @@ public:
         apr_writer.read_parts_only(file_name,extra_parts);
     }
 
+    //write out ExtraPartCellData given in a particle ordering (written in the canonical order)
+    template< typename S>
+    void write_particles_only( std::string save_loc,std::string file_name,const ExtraParticleData<S>& parts_extra,const APRParticleOrder& particle_order){
+        apr_writer.write_particles_only(save_loc, file_name, parts_extra, particle_order);
+    }
+
+    //read in ExtraPartCellData into a particle ordering
+    template<typename T>
+    void read_parts_only(std::string file_name,ExtraParticleData<T>& extra_parts,const APRParticleOrder& particle_order){
+        apr_writer.read_parts_only(file_name,extra_parts,particle_order);
+    }
+
+    //write out MultiChannelParticleData
+    template< typename S>
+    void write_particles_only( std::string save_loc,std::string file_name,const MultiChannelParticleData<S>& parts_extra){
+        apr_writer.write_particles_only(save_loc, file_name, parts_extra);
+    }
+
+    //read in MultiChannelParticleData
+    template<typename T>
+    void read_parts_only(std::string file_name,MultiChannelParticleData<T>& extra_parts){
+        apr_writer.read_parts_only(file_name,extra_parts);
+    }
+
     ////////////////////////
     ///
     ///  APR Reconstruction Methods (Calls APRReconstruction methods)
@@ -141,17 +193,156 @@ public:
         //
         //  Samples particles from an image using an image tree (img_by_level is a vector of images)
 
+        parts.data.resize(total_number_particles());
+        get_parts_from_img(img_by_level,parts,0);
+    }
+
+    template<typename U,typename V>
+    void get_parts_from_img(std::vector<MeshData<U>>& img_by_level,ExtraParticleData<V>& parts,const uint64_t z_begin){
+        //
+        //  Samples the particles lying in a z-slab of the image, img_by_level[level_max()] holds the original image
+        //  slices [z_begin,z_begin + z_num) and z_begin has to be a multiple of 2^(level_max - level_min), parts has to be allocated.
+        //
+
         //initialization of the iteration structures
         APRIterator<ImageType> apr_iterator(*this); //this is required for parallel access
-        parts.data.resize(apr_iterator.total_number_particles());
-
-        #ifdef HAVE_OPENMP
-	    #pragma omp parallel for schedule(static) firstprivate(apr_iterator)
-        #endif
-        for (uint64_t particle_number = 0; particle_number < apr_iterator.total_number_particles(); ++particle_number) {
-            //needed step for any parallel loop (update to the next part)
-            apr_iterator.set_iterator_to_particle_by_number(particle_number);
-            parts[apr_iterator] = img_by_level[apr_iterator.level()].at(apr_iterator.y(),apr_iterator.x(),apr_iterator.z());
+
+        //each gap of a row is contiguous in y in the image and in the particle data
+        for (unsigned int level = apr_iterator.level_min(); level <= apr_iterator.level_max(); ++level) {
+            const uint64_t z_offset = z_begin >> (apr_iterator.level_max() - level);
+            const uint64_t z_num = std::min((uint64_t)img_by_level[level].z_num,apr_iterator.spatial_index_z_max(level) - z_offset);
+            const uint64_t x_num = apr_iterator.spatial_index_x_max(level);
+
+            #ifdef HAVE_OPENMP
+            #pragma omp parallel for schedule(dynamic) firstprivate(apr_iterator)
+            #endif
+            for (uint64_t z = 0; z < z_num; ++z) {
+                for (uint64_t x = 0; x < x_num; ++x) {
+                    if (apr_iterator.set_iterator_to_row(level, z + z_offset, x)) {
+                        do {
+                            const U* img_row = &img_by_level[level].at(apr_iterator.gap_y_begin(), x, z);
+                            std::copy(img_row, img_row + (apr_iterator.gap_particles_end() - apr_iterator.gap_particles_begin()),
+                                      parts.data.begin() + apr_iterator.gap_particles_begin());
+                        } while (apr_iterator.move_to_next_gap_in_row());
+                    }
+                }
+            }
+        }
+    }
+
+    template<typename U,typename V>
+    void get_parts_from_img(MeshData<U>& img,ExtraParticleData<V>& parts){
+        //
+        //  Samples the particles directly from the image, without the down-sampled images of the pyramid, giving the
+        //  same intensities as from downsamplePyrmaid (the mean over the Particle Cell, computed level by level)
+        //
+
+        parts.data.resize(total_number_particles());
+        get_parts_from_img(img,parts,[](const float x, const float y) -> float { return x + y; },
+                           [](const float x) -> float { return x/8.0; });
+    }
+
+    template<typename U,typename V,typename R,typename C>
+    void get_parts_from_img(const MeshData<U>& img,ExtraParticleData<V>& parts,R reduce,C constant_operator,const uint64_t z_begin = 0){
+        //
+        //  Samples the particles from the image (or a z-slab of it starting at z_begin, as above), the value of a Particle
+        //  Cell is computed from its 8 children with reduce and constant_operator as by downsample (for example the maximum
+        //  with std::max and the identity), recursively down to the pixels. parts has to be allocated.
+        //
+
+        APRIterator<ImageType> apr_iterator(*this);
+
+        //per level, the down-sampled rows of the children (4 rows) being reduced
+        std::vector<std::vector<U>> child_rows(apr_iterator.level_max() + 1);
+
+        for (unsigned int level = apr_iterator.level_min(); level <= apr_iterator.level_max(); ++level) {
+            const uint64_t z_offset = z_begin >> (apr_iterator.level_max() - level);
+            const uint64_t z_num = std::min(slab_size(img, level), apr_iterator.spatial_index_z_max(level) - z_offset);
+            const uint64_t x_num = apr_iterator.spatial_index_x_max(level);
+
+            #ifdef HAVE_OPENMP
+            #pragma omp parallel for schedule(dynamic) firstprivate(apr_iterator, child_rows)
+            #endif
+            for (uint64_t z = 0; z < z_num; ++z) {
+                for (uint64_t x = 0; x < x_num; ++x) {
+                    if (apr_iterator.set_iterator_to_row(level, z + z_offset, x)) {
+                        do {
+                            V* parts_row = &parts.data[apr_iterator.gap_particles_begin()];
+                            sample_row(img, level, x, z, apr_iterator.gap_y_begin(), apr_iterator.gap_y_end(), reduce, constant_operator, child_rows, parts_row);
+                        } while (apr_iterator.move_to_next_gap_in_row());
+                    }
+                }
+            }
+        }
+    }
+
+private:
+
+    template<typename U>
+    uint64_t slab_size(const MeshData<U>& img, const unsigned int level) const {
+        //number of slices of the slab at the level, as for the down-sampled images of the slab (rounded up)
+        const uint64_t factor = ((uint64_t) 1) << (level_max() - level);
+        return (img.z_num + factor - 1)/factor;
+    }
+
+    template<typename U,typename V,typename R,typename C>
+    void sample_row(const MeshData<U>& img,const unsigned int level,const uint64_t x,const uint64_t z,const uint64_t y_begin,const uint64_t y_end,
+                    R reduce,C constant_operator,std::vector<std::vector<U>>& child_rows,V* out){
+        //
+        //  Values of the cells [y_begin, y_end] of the row (x, z) of the level (z in the slab) as in the down-sampled image,
+        //  computed from the rows of the children at level + 1 in the same order and with the same clamping at the end of
+        //  the image as downsample
+        //
+
+        if (level == level_max()) {
+            const U* img_row = &img.at(y_begin, x, z);
+            std::copy(img_row, img_row + (y_end - y_begin + 1), out);
+            return;
+        }
+
+        const unsigned int child_level = level + 1;
+        const uint64_t y_num = spatial_index_y_max(child_level);
+        const uint64_t x_num = spatial_index_x_max(child_level);
+        const uint64_t z_num = slab_size(img, child_level);
+
+        const uint64_t child_x[2] = {2*x, std::min(2*x + 1, x_num - 1)};
+        const uint64_t child_z[2] = {2*z, std::min(2*z + 1, z_num - 1)};
+        const uint64_t child_y_begin = 2*y_begin;
+        const uint64_t child_y_end = std::min(2*y_end + 1, y_num - 1);
+        const uint64_t child_length = child_y_end - child_y_begin + 1;
+
+        //children rows (z, x), (z, x + 1), (z + 1, x), (z + 1, x + 1), read from the image at level max
+        const U* rows[4];
+        if (child_level == level_max()) {
+            for (int i = 0; i < 4; ++i) {
+                rows[i] = &img.at(child_y_begin, child_x[i & 1], child_z[i >> 1]);
+            }
+        } else {
+            std::vector<U>& buffer = child_rows[child_level];
+            if (buffer.size() < 4*child_length) {
+                buffer.resize(4*child_length);
+            }
+            for (int i = 0; i < 4; ++i) {
+                sample_row(img, child_level, child_x[i & 1], child_z[i >> 1], child_y_begin, child_y_end, reduce, constant_operator, child_rows, buffer.data() + i*child_length);
+                rows[i] = buffer.data() + i*child_length;
+            }
+        }
+
+        for (uint64_t y = y_begin; y <= y_end; ++y) {
+            const uint64_t y0 = 2*y - child_y_begin;
+            const uint64_t y1 = std::min(2*y + 1, y_num - 1) - child_y_begin;
+            const U value = constant_operator(
+                    reduce(reduce(reduce(reduce(reduce(reduce(reduce(
+                           rows[0][y0],
+                           rows[0][y1]),
+                           rows[1][y0]),
+                           rows[1][y1]),
+                           rows[2][y0]),
+                           rows[2][y1]),
+                           rows[3][y0]),
+                           rows[3][y1])
+            );
+            out[y - y_begin] = value;
         }
     }
 };
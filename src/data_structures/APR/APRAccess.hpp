@@ -9,7 +9,12 @@
 
 #include <map>
 #include <utility>
+#include <numeric>
+#include <algorithm>
 #include "../../data_structures/Mesh/MeshData.hpp"
+#include "../../data_structures/Mesh/BrickMeshData.hpp"
+#include "../../data_structures/Mesh/PackedMeshData.hpp"
+#include "MappedVector.hpp"
 
 //TODO: IT SHOULD NOT BE DEFINDED HERE SINCE IT DUPLICATES FROM PullingScheme
 #define SEED_TYPE 1
@@ -57,10 +62,19 @@ struct ParticleCellGapMap{
     std::map<uint16_t,YGap_map> map;
 };
 
+struct FlatGapMap{
+    //CSR style storage of the gaps on one level, the gaps of row (x_num*z + x) are [row_begin[row],row_begin[row+1])
+    MappedVector<uint64_t> row_begin;
+    MappedVector<uint16_t> y_begin;
+    MappedVector<uint16_t> y_end;
+    MappedVector<uint64_t> global_index_begin;
+};
+
 struct MapIterator{
-    std::map<uint16_t,YGap_map>::iterator iterator;
-    uint64_t pc_offset;
-    uint16_t level;
+    std::map<uint16_t,YGap_map>::const_iterator iterator;
+    uint64_t flat_index = 0; //index of the gap in FlatGapMap, used instead of iterator when use_flat_map is set
+    uint64_t pc_offset = UINT64_MAX;
+    uint16_t level = UINT16_MAX;
 };
 
 struct LocalMapIterators{
@@ -102,6 +116,11 @@ public:
     ExtraPartCellData<ParticleCellGapMap> gap_map;
     //ExtraPartCellData<std::map<uint16_t,YGap_map>::iterator> gap_map_it;
 
+    //flat (CSR) storage of the gaps indexed by level, built in bulk when converting and loading, used when use_flat_map
+    //is set (the default), otherwise the gaps are stored as std::map rows in gap_map (see build_flat_map and build_gap_map)
+    std::vector<FlatGapMap> flat_map;
+    bool use_flat_map = true;
+
     ExtraParticleData<uint8_t> particle_cell_type;
 
     uint64_t level_max;
@@ -126,7 +145,11 @@ public:
     std::vector<std::vector<uint64_t>> global_index_by_level_and_z_begin;
     std::vector<std::vector<uint64_t>> global_index_by_level_and_z_end;
 
-    MapIterator& get_local_iterator(LocalMapIterators& local_iterators,const uint16_t& level_delta,const uint16_t& face,const uint16_t& index){
+    //prefix index of the (exclusive) last particle of each zx row (offset = x_num*z + x), used to locate particles by number in O(log n),
+    //views the mapped file when opened by APRWriter::read_apr_native (like the flat_map)
+    std::vector<MappedVector<uint64_t>> global_index_by_level_and_zx_end;
+
+    MapIterator& get_local_iterator(LocalMapIterators& local_iterators,const uint16_t& level_delta,const uint16_t& face,const uint16_t& index) const {
         //
         //  Chooses the local iterator required
         //
@@ -146,7 +169,7 @@ public:
     }
 
 
-    inline bool get_neighbour_coordinate(const ParticleCell& input,ParticleCell& neigh,const unsigned int& face,const uint16_t& level_delta,const uint16_t& index){
+    inline bool get_neighbour_coordinate(const ParticleCell& input,ParticleCell& neigh,const unsigned int& face,const uint16_t& level_delta,const uint16_t& index) const {
 
         static constexpr int8_t dir_y[6] = { 1, -1, 0, 0, 0, 0};
         static constexpr int8_t dir_x[6] = { 0, 0, 1, -1, 0, 0};
@@ -219,35 +242,129 @@ public:
         return false;
     }
 
-    inline uint64_t get_parts_start(const uint16_t& x,const uint16_t& z,const uint16_t& level){
+    inline bool row_non_empty(const uint64_t& level,const uint64_t& offset) const {
+        if(use_flat_map){
+            return flat_map[level].row_begin[offset+1] > flat_map[level].row_begin[offset];
+        }
+        return gap_map.data[level][offset].size() > 0;
+    }
+
+    inline uint64_t number_gaps_in_row(const uint64_t& level,const uint64_t& offset) const {
+        if(use_flat_map){
+            return flat_map[level].row_begin[offset+1] - flat_map[level].row_begin[offset];
+        }
+        return (gap_map.data[level][offset].size() > 0) ? gap_map.data[level][offset][0].map.size() : 0;
+    }
+
+    /**
+     * Sets the gap iterator to the first gap of a (non-empty) row
+     */
+    inline void set_gap_to_row_begin(MapIterator& it,const uint64_t& level,const uint64_t& offset) const {
+        it.level = level;
+        it.pc_offset = offset;
+        if(use_flat_map){
+            it.flat_index = flat_map[level].row_begin[offset];
+        } else {
+            it.iterator = gap_map.data[level][offset][0].map.begin();
+        }
+    }
+
+    /**
+     * Sets the gap iterator to the last gap of a (non-empty) row
+     */
+    inline void set_gap_to_row_end(MapIterator& it,const uint64_t& level,const uint64_t& offset) const {
+        it.level = level;
+        it.pc_offset = offset;
+        if(use_flat_map){
+            it.flat_index = flat_map[level].row_begin[offset+1] - 1;
+        } else {
+            it.iterator = std::prev(gap_map.data[level][offset][0].map.end());
+        }
+    }
+
+    /**
+     * Moves the gap iterator to the next gap in the row, returns false if the end of the row has been reached
+     */
+    inline bool next_gap_in_row(MapIterator& it) const {
+        if(use_flat_map){
+            it.flat_index++;
+            return it.flat_index < flat_map[it.level].row_begin[it.pc_offset+1];
+        }
+        it.iterator++;
+        return it.iterator != gap_map.data[it.level][it.pc_offset][0].map.end();
+    }
+
+    inline uint16_t gap_y_begin(const MapIterator& it) const {
+        return use_flat_map ? flat_map[it.level].y_begin[it.flat_index] : it.iterator->first;
+    }
+
+    inline uint16_t gap_y_end(const MapIterator& it) const {
+        return use_flat_map ? flat_map[it.level].y_end[it.flat_index] : it.iterator->second.y_end;
+    }
+
+    inline uint64_t gap_global_index_begin(const MapIterator& it) const {
+        return use_flat_map ? flat_map[it.level].global_index_begin[it.flat_index] : it.iterator->second.global_index_begin;
+    }
+
+    inline uint64_t find_row_by_global_index(const uint64_t& level,const uint64_t& particle_number) const {
+        //
+        //  Binary search for the zx row (offset) containing the particle number, the particle has to be on the level
+        //
+        const MappedVector<uint64_t>& row_end = global_index_by_level_and_zx_end[level];
+        return std::upper_bound(row_end.begin(),row_end.end(),particle_number) - row_end.begin();
+    }
+
+    /**
+     * Sets the gap iterator to the gap in the row containing the particle number
+     */
+    inline void set_gap_by_global_index(MapIterator& it,const uint64_t& level,const uint64_t& offset,const uint64_t& particle_number) const {
+        set_gap_to_row_begin(it,level,offset);
+        if(use_flat_map){
+            const FlatGapMap& level_map = flat_map[level];
+            auto gap_it = std::upper_bound(level_map.global_index_begin.begin() + level_map.row_begin[offset],level_map.global_index_begin.begin() + level_map.row_begin[offset+1],particle_number);
+            it.flat_index = (gap_it - level_map.global_index_begin.begin()) - 1;
+        } else {
+            while(particle_number > global_index_end(it)){
+                next_gap_in_row(it);
+            }
+        }
+    }
+
+    inline uint64_t get_parts_start(const uint16_t& x,const uint16_t& z,const uint16_t& level) const {
         const uint64_t offset = x_num[level] * z + x;
-        if(gap_map.data[level][offset].size() > 0){
-            auto it = (gap_map.data[level][offset][0].map.begin());
-            return it->second.global_index_begin;
+        if(row_non_empty(level,offset)){
+            MapIterator it;
+            set_gap_to_row_begin(it,level,offset);
+            return gap_global_index_begin(it);
         } else {
             return (-1);
         }
     }
 
-    inline uint64_t get_parts_end(const uint16_t& x,const uint16_t& z,const uint16_t& level){
+    inline uint64_t get_parts_end(const uint16_t& x,const uint16_t& z,const uint16_t& level) const {
         const uint64_t offset = x_num[level] * z + x;
-        if(gap_map.data[level][offset].size() > 0){
-            auto it = (gap_map.data[level][offset][0].map.rbegin());
-            return (it->second.global_index_begin + (it->second.y_end-it->first));
+        return get_parts_end_by_offset(level,offset);
+    }
+
+    inline uint64_t get_parts_end_by_offset(const uint64_t& level,const uint64_t& offset) const {
+        if(row_non_empty(level,offset)){
+            MapIterator it;
+            set_gap_to_row_end(it,level,offset);
+            return global_index_end(it);
         } else {
             return (0);
         }
     }
 
-    inline uint64_t global_index_end(MapIterator& it){
-        return (it.iterator->second.global_index_begin + (it.iterator->second.y_end-it.iterator->first));
+    inline uint64_t global_index_end(const MapIterator& it) const {
+        return (gap_global_index_begin(it) + (gap_y_end(it) - gap_y_begin(it)));
     }
 
-    inline bool check_neighbours_flag(const uint16_t& x,const uint16_t& z,const uint16_t& level){
+    inline bool check_neighbours_flag(const uint16_t& x,const uint16_t& z,const uint16_t& level) const {
         return ((uint16_t)(x-1)>(x_num[level]-3)) | ((uint16_t)(z-1)>(z_num[level]-3));
     }
 
-    inline uint8_t number_neighbours_in_direction(const uint8_t& level_delta){
+    inline uint8_t number_neighbours_in_direction(const uint8_t& level_delta) const {
         //
         //  Gives the maximum number of neighbours in a direction given the level_delta.
         //
@@ -261,10 +378,14 @@ public:
         return 1;
     }
 
-    bool find_particle_cell(ParticleCell& part_cell,MapIterator& map_iterator){
+    bool find_particle_cell(ParticleCell& part_cell,MapIterator& map_iterator) const {
+        if(use_flat_map){
+            return find_particle_cell_flat(part_cell,map_iterator);
+        }
+
         if(gap_map.data[part_cell.level][part_cell.pc_offset].size() > 0) {
 
-            ParticleCellGapMap& current_pc_map = gap_map.data[part_cell.level][part_cell.pc_offset][0];
+            const ParticleCellGapMap& current_pc_map = gap_map.data[part_cell.level][part_cell.pc_offset][0];
 
             if((map_iterator.pc_offset != part_cell.pc_offset) || (map_iterator.level != part_cell.level) ){
                 map_iterator.iterator = gap_map.data[part_cell.level][part_cell.pc_offset][0].map.begin();
@@ -324,6 +445,51 @@ public:
         return false;
     }
 
+    bool find_particle_cell_flat(ParticleCell& part_cell,MapIterator& map_iterator) const {
+        //
+        //  Same as find_particle_cell, but using the flat gap storage (first checks the current and next gap, then does a binary search in the row)
+        //
+
+        const FlatGapMap& level_map = flat_map[part_cell.level];
+        const uint64_t row_begin = level_map.row_begin[part_cell.pc_offset];
+        const uint64_t row_end = level_map.row_begin[part_cell.pc_offset+1];
+
+        if(row_begin == row_end){
+            return false;
+        }
+
+        if((map_iterator.pc_offset != part_cell.pc_offset) || (map_iterator.level != part_cell.level) || (map_iterator.flat_index < row_begin) || (map_iterator.flat_index >= row_end)){
+            map_iterator.flat_index = row_begin;
+            map_iterator.pc_offset = part_cell.pc_offset;
+            map_iterator.level = part_cell.level;
+        }
+
+        uint64_t gap = map_iterator.flat_index;
+
+        if((part_cell.y < level_map.y_begin[gap]) || (part_cell.y > level_map.y_end[gap])){
+            //first try next element
+            gap++;
+            if((gap >= row_end) || (part_cell.y < level_map.y_begin[gap]) || (part_cell.y > level_map.y_end[gap])){
+                //otherwise search for it (points to first gap that begins after the y value)
+                auto it = std::upper_bound(level_map.y_begin.begin() + row_begin,level_map.y_begin.begin() + row_end,part_cell.y);
+                if(it == (level_map.y_begin.begin() + row_begin)){
+                    //less then the first value
+                    map_iterator.flat_index = row_begin;
+                    return false;
+                }
+                gap = (it - level_map.y_begin.begin()) - 1;
+                map_iterator.flat_index = gap;
+                if(part_cell.y > level_map.y_end[gap]){
+                    return false;
+                }
+            }
+        }
+
+        map_iterator.flat_index = gap;
+        part_cell.global_index = level_map.global_index_begin[gap] + (part_cell.y - level_map.y_begin[gap]);
+        return true;
+    }
+
     template<typename T>
     void initialize_structure_from_particle_cell_tree(APR<T>& apr,std::vector<MeshData<uint8_t>>& layers){
        x_num.resize(level_max+1);
@@ -346,6 +512,11 @@ public:
         }
 
         initialize_structure_from_particle_cell_tree(apr, p_map);
+
+        //give the data back, so the tree can be reused for the next image
+        for (size_t k = 0; k < level_max; ++k) {
+            p_map[k].swap(layers[k].mesh);
+        }
     }
 
 
@@ -379,7 +550,9 @@ public:
                         uint8_t status = p_map[i - 1][offset_part_map_ds + y];
                         if (status == SEED_TYPE) {
                             p_map[i][offset_part_map + 2 * y] = seed_us;
-                            p_map[i][offset_part_map + 2 * y + 1] = seed_us;
+                            if (2 * y + 1 < y_num_) {
+                                p_map[i][offset_part_map + 2 * y + 1] = seed_us;
+                            }
                         }
                     }
                 }
@@ -485,30 +658,329 @@ public:
             }
         }
 
-        #ifdef HAVE_OPENMP
-        #pragma omp parallel for default(shared)  if(z_num_*x_num_ > 100)
-        #endif
-        for (size_t z_ = 0; z_ < z_num_; ++z_) {
-            for (size_t x_ = 0; x_ < x_num_; ++x_) {
-                const size_t offset_pc_data1 = std::min(x_num_us*(2*z_) + (2*x_), x_num_us*z_num_us - 1);
-                const size_t offset_pc_data2 = std::min(x_num_us*(2*z_) + (2*x_+1), x_num_us*z_num_us - 1);
-                const size_t offset_pc_data3 = std::min(x_num_us*(2*z_+1) + (2*x_), x_num_us*z_num_us - 1);
-                const size_t offset_pc_data4 = std::min(x_num_us*(2*z_+1) + (2*x_+1), x_num_us*z_num_us - 1);
+        copy_level_max_rows(apr, y_begin);
+        apr_timer.stop_timer();
+
+        initialize_structure_from_gaps(apr, y_begin);
+
+        set_particle_cell_types(apr, [&](const size_t level, const size_t y, const size_t x, const size_t z) {
+            return p_map[level][z * y_num[level] * x_num[level] + x * y_num[level] + y];
+        });
+    }
+
+    template<typename T>
+    void initialize_structure_from_particle_cell_tree(APR<T>& apr,std::vector<BrickMeshData<uint8_t>>& layers){
+        //
+        //  Initialize the structure from the sparse particle cell tree (PullingScheme::use_sparse_tree), giving the
+        //  same particle cells as from the dense tree. Only the rows of bricks allocated at a level (or its parent
+        //  level) are scanned
+        //
 
-                size_t size_v = y_begin.data[i+1][offset_pc_data1].size();
+        x_num.resize(level_max+1);
+        y_num.resize(level_max+1);
+        z_num.resize(level_max+1);
 
-                y_begin.data[i+1][offset_pc_data2].resize(size_v);
-                std::copy(y_begin.data[i+1][offset_pc_data1].begin(),y_begin.data[i+1][offset_pc_data1].end(),y_begin.data[i+1][offset_pc_data2].begin());
+        for(size_t i = level_min;i < level_max; ++i) {
+            x_num[i] = layers[i].x_num;
+            y_num[i] = layers[i].y_num;
+            z_num[i] = layers[i].z_num;
+        }
+        y_num[level_max] = org_dims[0];
+        x_num[level_max] = org_dims[1];
+        z_num[level_max] = org_dims[2];
+
+        std::vector<BrickMeshData<uint8_t>> p_map;
+        p_map.swap(layers);
 
-                y_begin.data[i+1][offset_pc_data3].resize(size_v);
-                std::copy(y_begin.data[i+1][offset_pc_data1].begin(),y_begin.data[i+1][offset_pc_data1].end(),y_begin.data[i+1][offset_pc_data3].begin());
+        APRTimer apr_timer;
+        apr_timer.verbose_flag = false;
 
-                y_begin.data[i+1][offset_pc_data4].resize(size_v);
-                std::copy(y_begin.data[i+1][offset_pc_data1].begin(),y_begin.data[i+1][offset_pc_data1].end(),y_begin.data[i+1][offset_pc_data4].begin());
+        //the children of seeds are particle cells (seed_us in the dense version)
+        const uint8_t seed_us = 4;
+        const size_t tree_level_min = apr.level_min();
+        auto status = [&](const size_t level, const size_t y, const size_t x, const size_t z) -> uint8_t {
+            if ((level > tree_level_min) && (p_map[level - 1].at(y/2, x/2, z/2) == SEED_TYPE)) {
+                return seed_us;
+            }
+            return p_map[level].at(y, x, z);
+        };
+
+        //calls add_run(y_begin, y_end) for the runs of cells of a row with in_run(status), skipping the bricks that are empty at the level and its parent level
+        const size_t brick_size = BrickMeshData<uint8_t>::brick_size;
+        auto find_runs = [&](const size_t level, const size_t x, const size_t z, auto in_run, auto add_run) {
+            const BrickMeshData<uint8_t> &level_tree = p_map[level];
+            bool previous = false;
+            size_t run_begin = 0;
+            for (size_t by = 0; by < level_tree.y_num_bricks; ++by) {
+                const size_t y_end = std::min((by + 1)*brick_size, level_tree.y_num);
+                bool empty = !level_tree.is_allocated(level_tree.brick_number(by, x/brick_size, z/brick_size));
+                if (empty && (level > tree_level_min)) {
+                    const BrickMeshData<uint8_t> &parent_tree = p_map[level - 1];
+                    empty = !parent_tree.is_allocated(parent_tree.brick_number(by/2, (x/2)/brick_size, (z/2)/brick_size));
+                }
+                if (empty) {
+                    if (previous) {
+                        add_run(run_begin, by*brick_size - 1);
+                        previous = false;
+                    }
+                    continue;
+                }
+                for (size_t y = by*brick_size; y < y_end; ++y) {
+                    const bool current = in_run(status(level, y, x, z));
+                    if (current && !previous) {
+                        run_begin = y;
+                    } else if (!current && previous) {
+                        add_run(run_begin, y - 1);
+                    }
+                    previous = current;
+                }
+            }
+            if (previous) {
+                add_run(run_begin, level_tree.y_num - 1);
+            }
+        };
+
+        apr_timer.start_timer("tree levels");
+        ExtraPartCellData<std::pair<uint16_t, YGap_map>> y_begin(apr);
+        for(size_t i = (apr.level_min());i < apr.level_max();i++) {
+            const size_t x_num_ = x_num[i];
+            const size_t z_num_ = z_num[i];
+
+            #ifdef HAVE_OPENMP
+            #pragma omp parallel for default(shared) if(z_num_*x_num_ > 100)
+            #endif
+            for (size_t z = 0; z < z_num_; ++z) {
+                for (size_t x = 0; x < x_num_; ++x) {
+                    std::vector<std::pair<uint16_t, YGap_map>> &row = y_begin.data[i][x_num_ * z + x];
+                    find_runs(i, x, z, [](const uint8_t s) { return (s > 1) && (s < 5); }, [&](const size_t begin, const size_t end) {
+                        YGap_map gap;
+                        gap.global_index_begin = 0;
+                        gap.y_end = end;
+                        row.push_back({begin, gap});
+                    });
+                }
+            }
+        }
+        apr_timer.stop_timer();
+
+        apr_timer.start_timer("level max");
+        {
+            //seeds of the finest tree level are the particles of level max
+            const size_t i = apr.level_max()-1;
+            const size_t x_num_ = x_num[i];
+            const size_t z_num_ = z_num[i];
+            const size_t x_num_us = x_num[i + 1];
+            const size_t z_num_us = z_num[i + 1];
+            const size_t y_num_us = y_num[i + 1];
+
+            #ifdef HAVE_OPENMP
+            #pragma omp parallel for default(shared) if(z_num_*x_num_ > 100)
+            #endif
+            for (size_t z_ = 0; z_ < z_num_; ++z_) {
+                for (size_t x_ = 0; x_ < x_num_; x_++) {
+                    std::vector<std::pair<uint16_t, YGap_map>> &row = y_begin.data[i+1][std::min(x_num_us*(2*z_) + (2*x_), x_num_us*z_num_us - 1)];
+                    find_runs(i, x_, z_, [](const uint8_t s) { return s == SEED_TYPE; }, [&](const size_t begin, const size_t end) {
+                        YGap_map gap;
+                        gap.global_index_begin = 0;
+                        gap.y_end = std::min(2*end + 1, y_num_us - 1);
+                        row.push_back({2*begin, gap});
+                    });
+                }
+            }
+        }
+        copy_level_max_rows(apr, y_begin);
+        apr_timer.stop_timer();
+
+        initialize_structure_from_gaps(apr, y_begin);
+
+        set_particle_cell_types(apr, status);
+    }
+
+    template<typename T>
+    void initialize_structure_from_particle_cell_tree(APR<T>& apr,std::vector<PackedMeshData>& layers){
+        //
+        //  Initialize the structure from the packed particle cell tree (PullingScheme::use_packed_tree), as for the
+        //  dense tree but working on the 16 cells of a word at once
+        //
+
+        x_num.resize(level_max+1);
+        y_num.resize(level_max+1);
+        z_num.resize(level_max+1);
+
+        for(size_t i = level_min;i < level_max; ++i) {
+            x_num[i] = layers[i].x_num;
+            y_num[i] = layers[i].y_num;
+            z_num[i] = layers[i].z_num;
+        }
+        y_num[level_max] = org_dims[0];
+        x_num[level_max] = org_dims[1];
+        z_num[level_max] = org_dims[2];
+
+        std::vector<PackedMeshData> p_map;
+        p_map.swap(layers);
+
+        APRTimer apr_timer;
+        apr_timer.verbose_flag = false;
+
+        apr_timer.start_timer("first_step");
+        const uint8_t seed_us = 4; //deal with the equivalence optimization
+        for (size_t i = apr.level_min()+1; i < apr.level_max(); ++i) {
+            PackedMeshData &level_tree = p_map[i];
+            const PackedMeshData &parent_tree = p_map[i - 1];
+
+            #ifdef HAVE_OPENMP
+            #pragma omp parallel for default(shared) if(level_tree.z_num*level_tree.x_num > 100)
+            #endif
+            for (size_t z = 0; z < level_tree.z_num; ++z) {
+                for (size_t x = 0; x < level_tree.x_num; ++x) {
+                    const uint64_t *parent_row = parent_tree.row(x/2, z/2);
+                    uint64_t *row = level_tree.row(x, z);
+                    for (size_t w = 0; w < level_tree.words_per_row; ++w) {
+                        const uint64_t seeds = PackedMeshData::equal(parent_row[w/2], SEED_TYPE);
+                        if (seeds) {
+                            row[w] = PackedMeshData::replace(row[w], PackedMeshData::expand(seeds, w & 1) & level_tree.valid_mask(w), seed_us);
+                        }
+                    }
+                }
+            }
+        }
+        apr_timer.stop_timer();
+
+        //calls add_run(y_begin, y_end) for the runs of cells of the row in the element masks given by in_run(word)
+        auto find_runs = [](const PackedMeshData &level_tree, const size_t x, const size_t z, auto in_run, auto add_run) {
+            const uint64_t *row = level_tree.row(x, z);
+            bool previous = false;
+            size_t run_begin = 0;
+            for (size_t w = 0; w < level_tree.words_per_row; ++w) {
+                const uint64_t current = in_run(row[w]);
+                //cells differing from the cell before
+                uint64_t changes = current ^ ((current << 4) | (previous ? 1 : 0));
+                while (changes) {
+                    const size_t y = w*PackedMeshData::values_per_word + __builtin_ctzll(changes)/4;
+                    if (previous) {
+                        add_run(run_begin, y - 1);
+                    } else {
+                        run_begin = y;
+                    }
+                    previous = !previous;
+                    changes &= changes - 1;
+                }
+            }
+            if (previous) {
+                add_run(run_begin, level_tree.y_num - 1);
+            }
+        };
+
+        apr_timer.start_timer("second_step");
+        ExtraPartCellData<std::pair<uint16_t, YGap_map>> y_begin(apr);
+        for(size_t i = (apr.level_min());i < apr.level_max();i++) {
+            const size_t x_num_ = x_num[i];
+            const size_t z_num_ = z_num[i];
+
+            #ifdef HAVE_OPENMP
+            #pragma omp parallel for default(shared) if(z_num_*x_num_ > 100)
+            #endif
+            for (size_t z = 0; z < z_num_; ++z) {
+                for (size_t x = 0; x < x_num_; ++x) {
+                    std::vector<std::pair<uint16_t, YGap_map>> &row = y_begin.data[i][x_num_ * z + x];
+                    //status 2, 3 or 4 (boundary, filler or seed_us) as for the dense tree
+                    find_runs(p_map[i], x, z, [](const uint64_t word) {
+                        return PackedMeshData::equal(word, 2) | PackedMeshData::equal(word, 3) | PackedMeshData::equal(word, seed_us);
+                    }, [&](const size_t begin, const size_t end) {
+                        YGap_map gap;
+                        gap.global_index_begin = 0;
+                        gap.y_end = end;
+                        row.push_back({begin, gap});
+                    });
+                }
             }
         }
         apr_timer.stop_timer();
 
+        apr_timer.start_timer("third loop");
+        {
+            //seeds of the finest tree level are the particles of level max
+            const size_t i = apr.level_max()-1;
+            const size_t x_num_ = x_num[i];
+            const size_t z_num_ = z_num[i];
+            const size_t x_num_us = x_num[i + 1];
+            const size_t z_num_us = z_num[i + 1];
+            const size_t y_num_us = y_num[i + 1];
+
+            #ifdef HAVE_OPENMP
+            #pragma omp parallel for default(shared) if(z_num_*x_num_ > 100)
+            #endif
+            for (size_t z_ = 0; z_ < z_num_; ++z_) {
+                for (size_t x_ = 0; x_ < x_num_; x_++) {
+                    std::vector<std::pair<uint16_t, YGap_map>> &row = y_begin.data[i+1][std::min(x_num_us*(2*z_) + (2*x_), x_num_us*z_num_us - 1)];
+                    find_runs(p_map[i], x_, z_, [](const uint64_t word) { return PackedMeshData::equal(word, SEED_TYPE); }, [&](const size_t begin, const size_t end) {
+                        YGap_map gap;
+                        gap.global_index_begin = 0;
+                        gap.y_end = std::min(2*end + 1, y_num_us - 1);
+                        row.push_back({2*begin, gap});
+                    });
+                }
+            }
+        }
+        copy_level_max_rows(apr, y_begin);
+        apr_timer.stop_timer();
+
+        initialize_structure_from_gaps(apr, y_begin);
+
+        set_particle_cell_types(apr, [&](const size_t level, const size_t y, const size_t x, const size_t z) {
+            return p_map[level].at(y, x, z);
+        });
+
+        //give the tree back, so it can be reused for the next image
+        p_map.swap(layers);
+    }
+
+    template<typename T>
+    void copy_level_max_rows(const APR<T> &apr, ExtraPartCellData<std::pair<uint16_t,YGap_map>>& y_begin) {
+        //
+        //  The rows of level max are found for every second x and z (from the finest tree level), copies them to the other rows
+        //
+
+        size_t i = apr.level_max()-1;
+
+        const size_t x_num_ = x_num[i];
+        const size_t z_num_ = z_num[i];
+        const size_t x_num_us = x_num[i + 1];
+        const size_t z_num_us = z_num[i + 1];
+
+        #ifdef HAVE_OPENMP
+        #pragma omp parallel for default(shared)  if(z_num_*x_num_ > 100)
+        #endif
+        for (size_t z_ = 0; z_ < z_num_; ++z_) {
+            for (size_t x_ = 0; x_ < x_num_; ++x_) {
+                //the rows of the other children (if inside the level)
+                const size_t offset_pc_data1 = x_num_us*(2*z_) + (2*x_);
+                const std::vector<std::pair<uint16_t,YGap_map>> &row = y_begin.data[i+1][offset_pc_data1];
+                const bool x_inside = (2*x_ + 1) < x_num_us;
+                const bool z_inside = (2*z_ + 1) < z_num_us;
+
+                if (x_inside) {
+                    y_begin.data[i+1][offset_pc_data1 + 1] = row;
+                }
+                if (z_inside) {
+                    y_begin.data[i+1][offset_pc_data1 + x_num_us] = row;
+                }
+                if (x_inside && z_inside) {
+                    y_begin.data[i+1][offset_pc_data1 + x_num_us + 1] = row;
+                }
+            }
+        }
+    }
+
+    template<typename T>
+    void initialize_structure_from_gaps(const APR<T> &apr, ExtraPartCellData<std::pair<uint16_t,YGap_map>>& y_begin) {
+        //
+        //  Sets the global indices of the gaps (y_begin, per level and row) and the iteration helpers, and builds the access structure
+        //
+
+        APRTimer apr_timer;
+        apr_timer.verbose_flag = false;
+
         apr_timer.start_timer("forth loop");
         //iteration helpers for by level
         global_index_by_level_begin.resize(apr.level_max()+1,1);
@@ -523,6 +995,7 @@ public:
         //set up the iteration helpers for by zslice
         global_index_by_level_and_z_begin.resize(apr.level_max()+1);
         global_index_by_level_and_z_end.resize(apr.level_max()+1);
+        global_index_by_level_and_zx_end.resize(apr.level_max()+1);
 
         for (size_t i = apr.level_min(); i <= apr.level_max(); ++i) {
 
@@ -534,6 +1007,7 @@ public:
 
             global_index_by_level_and_z_begin[i].resize(z_num_, (-1)); // TODO: -1 sets it to max UINT64, is it correct?
             global_index_by_level_and_z_end[i].resize(z_num_, 0);
+            global_index_by_level_and_zx_end[i].resize(z_num_*x_num_, 0);
 
             for (size_t z_ = 0; z_ < z_num_; z_++) {
                 size_t cumsum_begin_z = cumsum;
@@ -548,6 +1022,7 @@ public:
                         cumsum+=(y_begin.data[i][offset_pc_data][j].second.y_end-y_begin.data[i][offset_pc_data][j].first)+1;
                         total_number_gaps++;
                     }
+                    global_index_by_level_and_zx_end[i][offset_pc_data] = cumsum;
                 }
                 if (cumsum!=cumsum_begin_z) {
                     global_index_by_level_and_z_end[i][z_] = cumsum - 1;
@@ -570,7 +1045,19 @@ public:
         level_max = max_level_find;
         total_number_non_empty_rows=0;
 
-        allocate_map_insert(apr,y_begin);
+        if(use_flat_map) {
+            allocate_flat_map_insert(apr,y_begin);
+        } else {
+            allocate_map_insert(apr,y_begin);
+        }
+    }
+
+    template<typename T, typename Status>
+    void set_particle_cell_types(const APR<T> &apr, Status status) {
+        //
+        //  Type of the particle cells below level max, status(level, y, x, z) being the type in the particle cell tree
+        //
+
         APRIterator<T> apr_iterator(*this);
 
         particle_cell_type.data.resize(global_index_by_level_end[level_max-1]+1,0);
@@ -581,8 +1068,7 @@ public:
             #endif
             for (size_t particle_number = apr_iterator.particles_level_begin(level); particle_number <  apr_iterator.particles_level_end(level); ++particle_number) {
                 apr_iterator.set_iterator_to_particle_by_number(particle_number);
-                const size_t offset_part_map = apr_iterator.x() * apr_iterator.spatial_index_y_max(apr_iterator.level()) + apr_iterator.z() * apr_iterator.spatial_index_y_max(apr_iterator.level()) * apr_iterator.spatial_index_x_max(apr_iterator.level());
-                particle_cell_type[apr_iterator] = p_map[apr_iterator.level()][offset_part_map + apr_iterator.y()];
+                particle_cell_type[apr_iterator] = status(apr_iterator.level(), apr_iterator.y(), apr_iterator.x(), apr_iterator.z());
             }
         }
     }
@@ -626,7 +1112,107 @@ public:
     }
 
     template<typename T>
-    void allocate_map(APR<T>& apr,MapStorageData& map_data,std::vector<uint64_t>& cumsum){
+    void allocate_flat_map_insert(const APR<T> &apr, ExtraPartCellData<std::pair<uint16_t,YGap_map>>& y_begin) {
+        //
+        //  Flat (CSR) equivalent of allocate_map_insert
+        //
+
+        APRTimer apr_timer;
+        apr_timer.start_timer("initialize flat map");
+
+        flat_map.clear();
+        flat_map.resize(apr.level_max()+1);
+        uint64_t counter_rows = 0;
+
+        for (uint64_t i = (apr.level_min()); i <= apr.level_max(); i++) {
+            auto& row_data = y_begin.data[i];
+            counter_rows += allocate_flat_map_level(i,
+                    [&](const uint64_t offset){ return row_data[offset].size(); },
+                    [&](const uint64_t offset,uint16_t* y_b,uint16_t* y_e,uint64_t* g_b){
+                        for (const auto& gap : row_data[offset]) {
+                            *(y_b++) = gap.first;
+                            *(y_e++) = gap.second.y_end;
+                            *(g_b++) = gap.second.global_index_begin;
+                        }
+                    });
+        }
+        total_number_non_empty_rows = counter_rows;
+        apr_timer.stop_timer();
+    }
+
+    /**
+     * Builds the flat (CSR) gap storage from the std::map based gap_map, and then releases the maps.
+     */
+    void build_flat_map(){
+        if(use_flat_map){
+            return;
+        }
+
+        flat_map.clear();
+        flat_map.resize(level_max+1);
+
+        for (uint64_t i = level_min; i <= level_max; i++) {
+            auto& row_data = gap_map.data[i];
+            allocate_flat_map_level(i,
+                    [&](const uint64_t offset){ return (row_data[offset].size() > 0) ? row_data[offset][0].map.size() : 0; },
+                    [&](const uint64_t offset,uint16_t* y_b,uint16_t* y_e,uint64_t* g_b){
+                        for (const auto& gap : row_data[offset][0].map) {
+                            *(y_b++) = gap.first;
+                            *(y_e++) = gap.second.y_end;
+                            *(g_b++) = gap.second.global_index_begin;
+                        }
+                    });
+        }
+
+        use_flat_map = true;
+        gap_map = ExtraPartCellData<ParticleCellGapMap>();
+    }
+
+    template<typename RowSize,typename FillRow>
+    uint64_t allocate_flat_map_level(const uint64_t level,RowSize row_size,FillRow fill_row){
+        //
+        //  Fills the FlatGapMap of a level, row_size(offset) gives the number of gaps in a row and fill_row(offset,y_begin,y_end,global_index_begin) writes them (sorted in y)
+        //
+
+        FlatGapMap& level_map = flat_map[level];
+        const uint64_t number_rows = x_num[level]*z_num[level];
+        uint64_t counter_rows = 0;
+
+        level_map.row_begin.resize(number_rows+1);
+        level_map.row_begin[0] = 0;
+
+        int64_t r;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for default(shared) reduction(+:counter_rows) if(number_rows > 100)
+#endif
+        for (r = 0; r < (int64_t)number_rows; ++r) {
+            const uint64_t size = row_size(r);
+            level_map.row_begin[r+1] = size;
+            counter_rows += (size > 0);
+        }
+
+        std::partial_sum(level_map.row_begin.begin(),level_map.row_begin.end(),level_map.row_begin.begin());
+
+        const uint64_t number_gaps = level_map.row_begin.back();
+        level_map.y_begin.resize(number_gaps);
+        level_map.y_end.resize(number_gaps);
+        level_map.global_index_begin.resize(number_gaps);
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel for default(shared) schedule(dynamic,64) if(number_rows > 100)
+#endif
+        for (r = 0; r < (int64_t)number_rows; ++r) {
+            const uint64_t begin = level_map.row_begin[r];
+            if(level_map.row_begin[r+1] > begin) {
+                fill_row(r,&level_map.y_begin[begin],&level_map.y_end[begin],&level_map.global_index_begin[begin]);
+            }
+        }
+
+        return counter_rows;
+    }
+
+    template<typename T>
+    void allocate_map(const APR<T>& apr,MapStorageData& map_data,std::vector<uint64_t>& cumsum){
 
         //first add the layers
         gap_map.depth_max = level_max;
@@ -667,29 +1253,115 @@ public:
         }
     }
 
-    template<typename T>
-    void rebuild_map(APR<T>& apr,MapStorageData& map_data){
+    /**
+     * Builds the std::map based gap_map from the flat (CSR) gap storage, and then releases the flat storage. The gaps of
+     * a row are sorted, so each is inserted at the end of the map.
+     */
+    void build_gap_map(){
+        if(!use_flat_map){
+            return;
+        }
 
-        uint64_t z_;
-        uint64_t x_;
-        APRTimer apr_timer;
-        apr_timer.verbose_flag = false;
-        apr_timer.start_timer("rebuild map");
+        gap_map.depth_max = level_max;
+        gap_map.depth_min = level_min;
 
+        gap_map.z_num.resize(gap_map.depth_max+1);
+        gap_map.x_num.resize(gap_map.depth_max+1);
+        gap_map.data.resize(gap_map.depth_max+1);
 
+        for (uint64_t i = level_min; i <= level_max; i++) {
+            gap_map.z_num[i] = z_num[i];
+            gap_map.x_num[i] = x_num[i];
+            gap_map.data[i].resize(z_num[i]*x_num[i]);
 
-        std::vector<uint64_t> cumsum;
-        cumsum.reserve(total_number_non_empty_rows);
-        uint64_t counter=0;
+            const FlatGapMap& level_map = flat_map[i];
+            const int64_t number_rows = x_num[i]*z_num[i];
 
-        uint64_t j;
+            int64_t r;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for default(shared) schedule(dynamic,64) if(number_rows > 100)
+#endif
+            for (r = 0; r < number_rows; ++r) {
+                if(level_map.row_begin[r+1] > level_map.row_begin[r]) {
+                    gap_map.data[i][r].resize(1);
+                    auto& row_map = gap_map.data[i][r][0].map;
+                    for (uint64_t g = level_map.row_begin[r]; g < level_map.row_begin[r+1]; ++g) {
+                        YGap_map gap;
+                        gap.y_end = level_map.y_end[g];
+                        gap.global_index_begin = level_map.global_index_begin[g];
+                        row_map.insert(row_map.end(),{level_map.y_begin[g],gap});
+                    }
+                }
+            }
+        }
 
-        for (j = 0; j < total_number_non_empty_rows; ++j) {
-            cumsum.push_back(counter);
-            counter+=(map_data.number_gaps[j]);
+        use_flat_map = false;
+        flat_map.clear();
+    }
+
+    /**
+     * Builds the flat (CSR) gap storage directly from the flattened structure (rows ordered by level, z and x as written
+     * by flatten_structure), the gaps of a level are contiguous there and are copied in bulk. row_gap_begin[j] is the
+     * index of the first gap of row j (with the total number of gaps appended).
+     */
+    void build_flat_map(const MapStorageData& map_data,const std::vector<uint64_t>& row_gap_begin){
+
+        flat_map.clear();
+        flat_map.resize(level_max+1);
+
+        uint64_t row_end = 0;
+
+        for (uint64_t i = level_min; i <= level_max; i++) {
+            const uint64_t row_begin = row_end;
+            while((row_end < total_number_non_empty_rows) && (map_data.level[row_end] == i)){
+                row_end++;
+            }
+
+            FlatGapMap& level_map = flat_map[i];
+            const uint64_t x_num_ = x_num[i];
+
+            level_map.row_begin.resize(x_num_*z_num[i]+1,0);
+
+            int64_t j;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for default(shared) schedule(static) if((row_end - row_begin) > 1000)
+#endif
+            for (j = row_begin; j < (int64_t)row_end; ++j) {
+                level_map.row_begin[x_num_*map_data.z[j] + map_data.x[j] + 1] = map_data.number_gaps[j];
+            }
+
+            std::partial_sum(level_map.row_begin.begin(),level_map.row_begin.end(),level_map.row_begin.begin());
+
+            const uint64_t gap_begin = row_gap_begin[row_begin];
+            const uint64_t gap_end = row_gap_begin[row_end];
+            level_map.y_begin.assign(map_data.y_begin.begin() + gap_begin,map_data.y_begin.begin() + gap_end);
+            level_map.y_end.assign(map_data.y_end.begin() + gap_begin,map_data.y_end.begin() + gap_end);
+            level_map.global_index_begin.assign(map_data.global_index.begin() + gap_begin,map_data.global_index.begin() + gap_end);
+        }
+
+        use_flat_map = true;
+        gap_map = ExtraPartCellData<ParticleCellGapMap>();
+    }
+
+    template<typename T>
+    void rebuild_map(const APR<T>& apr,MapStorageData& map_data){
+
+        APRTimer apr_timer;
+        apr_timer.verbose_flag = false;
+        apr_timer.start_timer("rebuild map");
+
+        //index of the first gap of each row (run lengths given by number_gaps)
+        std::vector<uint64_t> cumsum(total_number_non_empty_rows+1,0);
+        for (uint64_t j = 0; j < total_number_non_empty_rows; ++j) {
+            cumsum[j+1] = cumsum[j] + map_data.number_gaps[j];
         }
 
-        allocate_map(apr,map_data,cumsum);
+        if(use_flat_map){
+            //bulk construction, no std::map is built
+            build_flat_map(map_data,cumsum);
+        } else {
+            allocate_map(apr,map_data,cumsum);
+        }
 
         apr_timer.start_timer("forth loop");
         //////////////////
@@ -698,38 +1370,66 @@ public:
         ///
         //////////////////////
 
-        //iteration helpers for by level
-        global_index_by_level_begin.resize(level_max+1,0);
-        global_index_by_level_end.resize(level_max+1,0);
+        //number of particles in each row, then the cumulative sum gives the end of each row
+        global_index_by_level_and_zx_end.resize(level_max+1);
+
+        for(uint64_t i = level_min;i <= level_max;i++) {
+            global_index_by_level_and_zx_end[i].assign(x_num[i]*z_num[i],0);
+        }
 
-        uint64_t cumsum_parts= 0;
+        int64_t j;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for default(shared) schedule(static)
+#endif
+        for (j = 0; j < (int64_t)total_number_non_empty_rows; ++j) {
+            const uint64_t level = map_data.level[j];
+            uint64_t number_particles = 0;
+            for (uint64_t g = cumsum[j]; g < cumsum[j+1]; ++g) {
+                number_particles += (map_data.y_end[g] - map_data.y_begin[g]) + 1;
+            }
+            global_index_by_level_and_zx_end[level][x_num[level]*map_data.z[j] + map_data.x[j]] = number_particles;
+        }
 
-        //set up the iteration helpers for by zslice
+        uint64_t cumsum_parts = 0;
+        for(uint64_t i = level_min;i <= level_max;i++) {
+            for (uint64_t& row_end : global_index_by_level_and_zx_end[i]) {
+                cumsum_parts += row_end;
+                row_end = cumsum_parts;
+            }
+        }
+
+        set_iteration_helpers_from_row_ends();
+
+        apr_timer.stop_timer();
+    }
+
+
+    /**
+     * Sets the per level and per z-slice iteration helpers from the row ends (global_index_by_level_and_zx_end)
+     */
+    void set_iteration_helpers_from_row_ends(){
+        global_index_by_level_begin.assign(level_max+1,0);
+        global_index_by_level_end.assign(level_max+1,0);
         global_index_by_level_and_z_begin.resize(level_max+1);
         global_index_by_level_and_z_end.resize(level_max+1);
 
+        uint64_t cumsum_parts = 0;
+
         for(uint64_t i = level_min;i <= level_max;i++) {
 
-            const unsigned int x_num_ = x_num[i];
-            const unsigned int z_num_ = z_num[i];
+            const uint64_t x_num_ = x_num[i];
+            const uint64_t z_num_ = z_num[i];
 
-            //set up the levels here.
             uint64_t cumsum_begin = cumsum_parts;
+            const MappedVector<uint64_t>& row_end = global_index_by_level_and_zx_end[i];
 
-            global_index_by_level_and_z_begin[i].resize(z_num_,(-1));
-            global_index_by_level_and_z_end[i].resize(z_num_,0);
+            global_index_by_level_and_z_begin[i].assign(z_num_,(-1));
+            global_index_by_level_and_z_end[i].assign(z_num_,0);
 
-            for (z_ = 0; z_ < z_num_; z_++) {
+            for (uint64_t z_ = 0; z_ < z_num_; z_++) {
                 uint64_t cumsum_begin_z = cumsum_parts;
-
-                for (x_ = 0; x_ < x_num_; x_++) {
-                    const size_t offset_pc_data = x_num_ * z_ + x_;
-                    if(gap_map.data[i][offset_pc_data].size() > 0) {
-                        for (auto const &element : gap_map.data[i][offset_pc_data][0].map) {
-                            //count the number of particles in each gap
-                            cumsum_parts += (element.second.y_end - element.first) + 1;
-                        }
-                    }
+                if(x_num_ > 0) {
+                    cumsum_parts = row_end[x_num_ * z_ + x_num_ - 1];
                 }
                 if(cumsum_parts!=cumsum_begin_z) {
                     global_index_by_level_and_z_end[i][z_] = cumsum_parts - 1;
@@ -738,18 +1438,12 @@ public:
             }
 
             if(cumsum_parts!=cumsum_begin){
-                //cumsum_begin++;
                 global_index_by_level_begin[i] = cumsum_begin;
-            }
-
-            if(cumsum_parts!=cumsum_begin){
                 global_index_by_level_end[i] = cumsum_parts-1;
             }
         }
-        apr_timer.stop_timer();
     }
 
-
     template<typename T>
     void flatten_structure(const APR<T> &apr, MapStorageData &map_data)  {
         //
@@ -777,17 +1471,19 @@ public:
             for (z_ = 0; z_ < z_num_; z_++) {
                 for (x_ = 0; x_ < x_num_; x_++) {
                     const uint64_t offset_pc_data = x_num_ * z_ + x_;
-                    if(gap_map.data[i][offset_pc_data].size()>0) {
+                    if(row_non_empty(i,offset_pc_data)) {
                         map_data.x.push_back(x_);
                         map_data.z.push_back(z_);
                         map_data.level.push_back(i);
-                        map_data.number_gaps.push_back(gap_map.data[i][offset_pc_data][0].map.size());
-
-                        for (auto const &element : gap_map.data[i][offset_pc_data][0].map) {
-                            map_data.y_begin.push_back(element.first);
-                            map_data.y_end.push_back(element.second.y_end);
-                            map_data.global_index.push_back(element.second.global_index_begin);
-                        }
+                        map_data.number_gaps.push_back(number_gaps_in_row(i,offset_pc_data));
+
+                        MapIterator it;
+                        set_gap_to_row_begin(it,i,offset_pc_data);
+                        do {
+                            map_data.y_begin.push_back(gap_y_begin(it));
+                            map_data.y_end.push_back(gap_y_end(it));
+                            map_data.global_index.push_back(gap_global_index_begin(it));
+                        } while(next_gap_in_row(it));
                     }
 
                 }
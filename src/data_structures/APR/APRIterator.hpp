@@ -7,6 +7,8 @@
 
 #include "APR.hpp"
 #include "APRAccess.hpp"
+#include <numeric>
+#include <algorithm>
 
 template<typename ImageType>
 class APRIterator {
@@ -25,8 +27,8 @@ private:
 
     ParticleCell current_particle_cell{0, 0, 0, 0, 0, UINT64_MAX, UINT64_MAX };
 
-    APR<ImageType>* aprOwn;
-    APRAccess* apr_access;
+    const APR<ImageType>* aprOwn;
+    const APRAccess* apr_access;
 
     uint16_t level_delta{};
 
@@ -34,6 +36,9 @@ private:
 
     bool check_neigh_flag = false;
 
+    const uint64_t* ordered_by_canonical = nullptr; // set by set_particle_order (nullptr for the canonical order)
+    const uint64_t* canonical_by_ordered = nullptr;
+
     const uint16_t shift[6] = {YP_LEVEL_SHIFT,YM_LEVEL_SHIFT,XP_LEVEL_SHIFT,XM_LEVEL_SHIFT,ZP_LEVEL_SHIFT,ZM_LEVEL_SHIFT};
     const uint16_t mask[6] = {YP_LEVEL_MASK,YM_LEVEL_MASK,XP_LEVEL_MASK,XM_LEVEL_MASK,ZP_LEVEL_MASK,ZM_LEVEL_MASK};
 
@@ -42,18 +47,21 @@ private:
 public:
 
 
-    explicit APRIterator(APR<ImageType>& apr){
-        aprOwn = &apr;
-        apr_access = &apr.apr_access;
-        current_particle_cell.global_index = UINT64_MAX;
+    /**
+     * The iterator only reads the APR, all the iteration state (current particle cell, gap and neighbour iterators) is
+     * held by the iterator. Any number of iterators (e.g. one per thread) can therefore read the same APR concurrently,
+     * as long as nothing modifies the APR at the same time.
+     */
+    explicit APRIterator(const APR<ImageType>& apr){
+        initialize_from_apr(apr);
     }
 
-    explicit APRIterator(APRAccess& apr_access_){
+    explicit APRIterator(const APRAccess& apr_access_){
        apr_access = &apr_access_;
         current_particle_cell.global_index = UINT64_MAX;
     }
 
-    void initialize_from_apr(APR<ImageType>& apr){
+    void initialize_from_apr(const APR<ImageType>& apr){
         aprOwn = &apr;
         apr_access = &apr.apr_access;
         current_particle_cell.global_index = UINT64_MAX;
@@ -98,23 +106,16 @@ public:
             }
 
             //then find the offset (zx row)
-            current_particle_cell.pc_offset=0;
-
-            while(particle_number > particles_offset_end(current_particle_cell.level,current_particle_cell.pc_offset)){
-                current_particle_cell.pc_offset++;
-            }
+            current_particle_cell.pc_offset = apr_access->find_row_by_global_index(current_particle_cell.level,particle_number);
 
             //back out your xz from the offset
             current_particle_cell.z = (current_particle_cell.pc_offset)/spatial_index_x_max(current_particle_cell.level);
             current_particle_cell.x = (current_particle_cell.pc_offset) - current_particle_cell.z*(spatial_index_x_max(current_particle_cell.level));
 
-            current_gap.iterator = apr_access->gap_map.data[current_particle_cell.level][current_particle_cell.pc_offset][0].map.begin();
             //then find the gap.
-            while((particle_number > apr_access->global_index_end(current_gap))){
-                current_gap.iterator++;
-            }
+            apr_access->set_gap_by_global_index(current_gap,current_particle_cell.level,current_particle_cell.pc_offset,particle_number);
 
-            current_particle_cell.y = (current_gap.iterator->first) + (particle_number - current_gap.iterator->second.global_index_begin);
+            current_particle_cell.y = apr_access->gap_y_begin(current_gap) + (particle_number - apr_access->gap_global_index_begin(current_gap));
             current_particle_cell.global_index = particle_number;
             set_neighbour_flag();
             return true;
@@ -170,17 +171,69 @@ public:
         return apr_access->get_parts_end(x_,z_,level_)+1l;
     }
 
+    bool set_iterator_to_row(const uint16_t& level,const uint64_t& z,const uint64_t& x){
+        //
+        //  Sets the iterator to the first particle of the (level,z,x) row, returns false if the row is empty.
+        //
+        //  The particles of a row are contiguous [particles_zx_begin,particles_zx_end), and are split into gaps (runs of
+        //  consecutive y) [gap_y_begin,gap_y_end] with particles [gap_particles_begin,gap_particles_end), which can be
+        //  visited using move_to_next_gap_in_row. Rows are independent so can be distributed over threads.
+        //
+
+        current_particle_cell.level = level;
+        current_particle_cell.z = z;
+        current_particle_cell.x = x;
+        current_particle_cell.pc_offset = spatial_index_x_max(level)*z + x;
+
+        if(!apr_access->row_non_empty(level,current_particle_cell.pc_offset)){
+            current_particle_cell.global_index = UINT64_MAX;
+            return false;
+        }
+
+        apr_access->set_gap_to_row_begin(current_gap,level,current_particle_cell.pc_offset);
+        current_particle_cell.y = apr_access->gap_y_begin(current_gap);
+        current_particle_cell.global_index = apr_access->gap_global_index_begin(current_gap);
+        set_neighbour_flag();
+        return true;
+    }
+
+    bool move_to_next_gap_in_row(){
+        //
+        //  Moves the iterator to the first particle of the next gap in the current row, returns false at the end of the row
+        //
+
+        if(apr_access->next_gap_in_row(current_gap)){
+            current_particle_cell.y = apr_access->gap_y_begin(current_gap);
+            current_particle_cell.global_index = apr_access->gap_global_index_begin(current_gap);
+            set_neighbour_flag();
+            return true;
+        }
+        return false;
+    }
+
+    inline uint16_t gap_y_begin(){
+        return apr_access->gap_y_begin(current_gap);
+    }
+
+    inline uint16_t gap_y_end(){
+        //last y of the gap (inclusive)
+        return apr_access->gap_y_end(current_gap);
+    }
+
+    inline uint64_t gap_particles_begin(){
+        return apr_access->gap_global_index_begin(current_gap);
+    }
+
+    inline uint64_t gap_particles_end(){
+        return apr_access->global_index_end(current_gap)+1l;
+    }
+
     inline uint64_t particles_offset_end(const uint16_t& level,const uint64_t& offset){
         //
         //  Used for finding the starting particle on a given level
         //
 
-        if(apr_access->gap_map.data[level][offset].size() > 0){
-            auto it = apr_access->gap_map.data[level][offset][0].map.rbegin();
-            return (it->second.global_index_begin + (it->second.y_end-it->first));
-        } else {
-            return 0;
-        }
+        return apr_access->get_parts_end_by_offset(level,offset);
 
     }
 
@@ -221,6 +274,24 @@ public:
         return current_particle_cell.global_index;
     }
 
+    /**
+     * Index of the current particle in the particle ordering set with set_particle_order (global_index() for the
+     * canonical order), the order has to outlive the iterator
+     */
+    template<typename ParticleOrder>
+    void set_particle_order(const ParticleOrder& particle_order){
+        ordered_by_canonical = particle_order.is_canonical() ? nullptr : particle_order.ordered_by_canonical.data();
+        canonical_by_ordered = particle_order.is_canonical() ? nullptr : particle_order.canonical_by_ordered.data();
+    }
+
+    inline uint64_t particle_index() const {
+        return ordered_by_canonical ? ordered_by_canonical[current_particle_cell.global_index] : current_particle_cell.global_index;
+    }
+
+    bool set_iterator_to_particle_by_index(const uint64_t particle_index){
+        return set_iterator_to_particle_by_number(canonical_by_ordered ? canonical_by_ordered[particle_index] : particle_index);
+    }
+
     inline ParticleCell get_current_particle_cell(){
         return current_particle_cell;
     }
@@ -443,16 +514,13 @@ public:
         //
 
         //check in bounds
-        if(((uint16_t)(x)>(apr_access->org_dims[1]-1)) | ((uint16_t)(z)>(apr_access->org_dims[2]-1)) | ((uint16_t)(y)>(apr_access->org_dims[0]-1))){
+        ParticleCell particle_cell;
+        if(!global_coordinate_to_pixel(x,y,z,particle_cell)){
             //out of bounds
             return false;
         }
 
         //Then check from the highest level to lowest.
-        ParticleCell particle_cell;
-        particle_cell.y = round(y);
-        particle_cell.x = round(x);
-        particle_cell.z = round(z);
         particle_cell.level = level_max();
 
         particle_cell.pc_offset =  apr_access->x_num[particle_cell.level] * particle_cell.z + particle_cell.x;
@@ -471,10 +539,123 @@ public:
         return true;
     }
 
+    /**
+     * Batched set_iterator_by_global_coordinate: finds the particle cells containing the points (x[i],y[i],z[i]) and
+     * returns their global index and level (UINT64_MAX and 0 for points out of bounds), the same as the single point
+     * version. The points are bucketed by row and sorted in y, then the rows are searched in parallel, reusing a gap
+     * cursor per level. Returns the number of points found.
+     */
+    uint64_t find_particles_by_global_coordinates(const std::vector<float>& x,const std::vector<float>& y,const std::vector<float>& z,std::vector<uint64_t>& global_index,std::vector<uint16_t>& level){
+
+        const int64_t number_points = x.size();
+        global_index.assign(number_points,UINT64_MAX);
+        level.assign(number_points,0);
+
+        const uint64_t x_num = apr_access->x_num[level_max()];
+        const uint64_t number_rows = x_num*apr_access->z_num[level_max()];
+
+        //pixel of each point, and its row (number_rows if out of bounds)
+        std::vector<ParticleCell> cells(number_points);
+        std::vector<uint64_t> row(number_points);
+
+        int64_t i;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static) private(i)
+#endif
+        for (i = 0; i < number_points; ++i) {
+            if(global_coordinate_to_pixel(x[i],y[i],z[i],cells[i])){
+                row[i] = x_num*cells[i].z + cells[i].x;
+            } else {
+                row[i] = number_rows;
+            }
+        }
+
+        //bucket the points in bounds by row (counting sort), the points out of bounds stay not found
+        std::vector<uint64_t> row_begin(number_rows+2,0);
+        for (i = 0; i < number_points; ++i) {
+            if(row[i] < number_rows){
+                row_begin[row[i]+2]++;
+            }
+        }
+        std::partial_sum(row_begin.begin(),row_begin.end(),row_begin.begin());
+
+        std::vector<uint64_t> sorted_points(row_begin[number_rows+1]);
+        for (i = 0; i < number_points; ++i) {
+            if(row[i] < number_rows){
+                sorted_points[row_begin[row[i]+1]++] = i;
+            }
+        }
+
+        std::vector<uint64_t> non_empty_rows;
+        for (uint64_t r = 0; r < number_rows; ++r) {
+            if(row_begin[r+1] > row_begin[r]){
+                non_empty_rows.push_back(r);
+            }
+        }
+
+        const uint64_t level_max_ = level_max();
+        const uint64_t level_min_ = level_min();
+        std::vector<MapIterator> cursors(level_max_+1);
+        uint64_t number_found = 0;
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(dynamic,64) private(i) firstprivate(cursors) reduction(+:number_found)
+#endif
+        for (i = 0; i < (int64_t)non_empty_rows.size(); ++i) {
+            const uint64_t r = non_empty_rows[i];
+            const auto begin = sorted_points.begin() + row_begin[r];
+            const auto end = sorted_points.begin() + row_begin[r+1];
+            std::sort(begin,end,[&cells](const uint64_t a,const uint64_t b){ return cells[a].y < cells[b].y; });
+
+            for (auto point = begin; point != end; ++point) {
+                ParticleCell particle_cell = cells[*point];
+                particle_cell.level = level_max_;
+                particle_cell.pc_offset = r;
+
+                //from the highest level to the lowest, as set_iterator_by_global_coordinate
+                while((particle_cell.level >= level_min_) && !(apr_access->find_particle_cell(particle_cell,cursors[particle_cell.level]))){
+                    particle_cell.y = particle_cell.y/2;
+                    particle_cell.x = particle_cell.x/2;
+                    particle_cell.z = particle_cell.z/2;
+                    particle_cell.level--;
+
+                    particle_cell.pc_offset = apr_access->x_num[particle_cell.level] * particle_cell.z + particle_cell.x;
+                }
+
+                if(particle_cell.level >= level_min_){
+                    global_index[*point] = particle_cell.global_index;
+                    level[*point] = particle_cell.level;
+                    number_found++;
+                }
+            }
+        }
+
+        return number_found;
+    }
+
 
 private:
     //private methods
 
+    inline bool global_coordinate_to_pixel(const float x,const float y,const float z,ParticleCell& particle_cell){
+        //
+        //  Rounds the point to the pixel containing it, returns false if it is outside the image
+        //
+
+        const float y_pixel = round(y);
+        const float x_pixel = round(x);
+        const float z_pixel = round(z);
+
+        if(!((y_pixel >= 0) & (y_pixel <= (apr_access->org_dims[0]-1)) & (x_pixel >= 0) & (x_pixel <= (apr_access->org_dims[1]-1)) & (z_pixel >= 0) & (z_pixel <= (apr_access->org_dims[2]-1)))){
+            return false;
+        }
+
+        particle_cell.y = y_pixel;
+        particle_cell.x = x_pixel;
+        particle_cell.z = z_pixel;
+        return true;
+    }
+
     bool find_next_child(const uint8_t& direction,const uint8_t& index){
 
         level_delta = _LEVEL_INCREASE;
@@ -504,7 +685,7 @@ private:
         uint64_t offset_max = apr_access->x_num[current_particle_cell.level]*apr_access->z_num[current_particle_cell.level];
 
         //iterate until you find the next row or hit the end of the level
-        while((current_particle_cell.pc_offset < offset_max) && (apr_access->gap_map.data[current_particle_cell.level][current_particle_cell.pc_offset].size()==0)){
+        while((current_particle_cell.pc_offset < offset_max) && !apr_access->row_non_empty(current_particle_cell.level,current_particle_cell.pc_offset)){
             current_particle_cell.pc_offset++;
         }
 
@@ -519,9 +700,9 @@ private:
                 return false;
             }
         } else {
-            current_gap.iterator = apr_access->gap_map.data[current_particle_cell.level][current_particle_cell.pc_offset][0].map.begin();
-            current_particle_cell.global_index=current_gap.iterator->second.global_index_begin;
-            current_particle_cell.y = current_gap.iterator->first;
+            apr_access->set_gap_to_row_begin(current_gap,current_particle_cell.level,current_particle_cell.pc_offset);
+            current_particle_cell.global_index = apr_access->gap_global_index_begin(current_gap);
+            current_particle_cell.y = apr_access->gap_y_begin(current_gap);
 
             //compute x and z
             current_particle_cell.z = (current_particle_cell.pc_offset)/spatial_index_x_max(current_particle_cell.level);
@@ -539,7 +720,7 @@ private:
         //  moves particles cell in y direction if possible on same level
         //
 
-        if( (current_particle_cell.y+1) <= current_gap.iterator->second.y_end){
+        if( (current_particle_cell.y+1) <= apr_access->gap_y_end(current_gap)){
             //  Still in same y gap
 
             current_particle_cell.global_index++;
@@ -548,12 +729,11 @@ private:
 
         } else {
             //not in the same gap
-            current_gap.iterator++;//move the iterator forward.
-
-            if(current_gap.iterator!=(apr_access->gap_map.data[current_particle_cell.level][current_particle_cell.pc_offset][0].map.end())){
+            //move the iterator forward.
+            if(apr_access->next_gap_in_row(current_gap)){
                 //I am in the next gap
                 current_particle_cell.global_index++;
-                current_particle_cell.y = current_gap.iterator->first; // the key is the first y value for the gap
+                current_particle_cell.y = apr_access->gap_y_begin(current_gap); // the key is the first y value for the gap
                 return true;
             } else {
                 current_particle_cell.pc_offset++;
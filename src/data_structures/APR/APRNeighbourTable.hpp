@@ -0,0 +1,261 @@
+//  Precomputed face neighbours of all particles, for operations visiting the neighbours many times (e.g. repeated
+//  filters). The neighbours of all faces [+y,-y,+x,-x,+z,-z] = [0,1,2,3,4,5] of particle p are stored contiguously,
+//  face after face, from neighbour_begin[p], with neighbour_count[6*p + face] the 0, 1 (same or parent level) or up
+//  to 4 (child level) neighbours of a face, in the order given by APRIterator::set_neighbour_iterator. The global
+//  indices are stored in 32 bits unless the APR has more than 2^32 particles. face_neighbours(face, p) gives the
+//  neighbours of a face as a range. Built with an APRParticleOrder both the particles p and the neighbour indices are
+//  in that ordering (for particle data in that ordering).
+//
+
+#ifndef PARTPLAY_APRNEIGHBOURTABLE_HPP
+#define PARTPLAY_APRNEIGHBOURTABLE_HPP
+
+#include <vector>
+#include <cstdint>
+#include <iterator>
+
+#include "APRIterator.hpp"
+#include "APRParticleOrder.hpp"
+
+class APRNeighbourTable {
+
+public:
+
+    /**
+     * The global indices of the neighbours of a particle in a face
+     */
+    class FaceNeighbours {
+    public:
+
+        class const_iterator {
+        public:
+            typedef std::input_iterator_tag iterator_category;
+            typedef uint64_t value_type;
+            typedef std::ptrdiff_t difference_type;
+            typedef const uint64_t* pointer;
+            typedef uint64_t reference;
+
+            const_iterator(const FaceNeighbours &aNeighbours, uint8_t aIndex) : neighbours(&aNeighbours), index(aIndex) {}
+
+            inline uint64_t operator*() const { return (*neighbours)[index]; }
+            inline const_iterator& operator++() { ++index; return *this; }
+            inline bool operator==(const const_iterator &other) const { return index == other.index; }
+            inline bool operator!=(const const_iterator &other) const { return index != other.index; }
+
+        private:
+            const FaceNeighbours *neighbours;
+            uint8_t index;
+        };
+
+        FaceNeighbours(const uint32_t *aNarrow, const uint64_t *aWide, uint8_t aCount) : narrow(aNarrow), wide(aWide), count(aCount) {}
+
+        inline uint64_t operator[](const uint8_t index) const { return (narrow != nullptr) ? narrow[index] : wide[index]; }
+        inline uint8_t size() const { return count; }
+        inline bool empty() const { return count == 0; }
+        inline uint64_t back() const { return (*this)[count - 1]; }
+
+        inline const_iterator begin() const { return const_iterator(*this, 0); }
+        inline const_iterator end() const { return const_iterator(*this, count); }
+
+    private:
+        const uint32_t *narrow;
+        const uint64_t *wide;
+        uint8_t count;
+    };
+
+    std::vector<uint64_t> neighbour_begin; // total_number_particles + 1 offsets of the neighbours of each particle
+    std::vector<uint8_t> neighbour_count; // 6 per particle, the number of neighbours of each face
+    std::vector<uint8_t> particle_level; // level of each particle
+
+    uint64_t total_number_particles = 0;
+    uint16_t level_min = 0;
+    uint16_t level_max = 0;
+    ParticleOrdering ordering = ParticleOrdering::Canonical;
+
+    APRNeighbourTable() {}
+
+    template<typename ImageType>
+    explicit APRNeighbourTable(const APR<ImageType> &apr) {
+        init(apr);
+    }
+
+    template<typename ImageType>
+    APRNeighbourTable(const APR<ImageType> &apr, const APRParticleOrder &particle_order) {
+        init(apr, particle_order);
+    }
+
+    /**
+     * Finds the neighbours of all particles (in parallel), the table has to be rebuilt if the APR changes
+     */
+    template<typename ImageType>
+    void init(const APR<ImageType> &apr) {
+
+        total_number_particles = apr.total_number_particles();
+        level_min = apr.level_min();
+        level_max = apr.level_max();
+        ordering = ParticleOrdering::Canonical;
+
+        particle_level.resize(total_number_particles);
+        neighbour_count.assign(6*total_number_particles, 0);
+
+        APRTimer timer;
+        timer.verbose_flag = false;
+
+        timer.start_timer("count neighbours");
+        for_each_neighbour(apr, [this](uint64_t particle_number, uint16_t level) {
+            particle_level[particle_number] = level;
+        }, [this](uint64_t particle_number, uint8_t face, uint8_t, uint64_t) {
+            neighbour_count[6*particle_number + face]++;
+        });
+        timer.stop_timer();
+
+        init_neighbour_begin();
+
+        timer.start_timer("fill neighbours");
+        for_each_neighbour(apr, [](uint64_t, uint16_t) {}, [this](uint64_t particle_number, uint8_t face, uint8_t index, uint64_t neighbour) {
+            set_neighbour_index(face_begin(face, particle_number) + index, neighbour);
+        });
+        timer.stop_timer();
+    }
+
+    /**
+     * Finds the neighbours of all particles, indexed in the given particle ordering
+     */
+    template<typename ImageType>
+    void init(const APR<ImageType> &apr, const APRParticleOrder &particle_order) {
+        init(apr);
+        if (particle_order.is_canonical()) return;
+
+        ordering = particle_order.ordering;
+
+        std::vector<uint8_t> ordered_level(total_number_particles);
+        std::vector<uint8_t> ordered_count(6*total_number_particles);
+        for (uint64_t p = 0; p < total_number_particles; ++p) {
+            const uint64_t canonical = particle_order.canonical_index(p);
+            ordered_level[p] = particle_level[canonical];
+            std::copy(neighbour_count.begin() + 6*canonical, neighbour_count.begin() + 6*(canonical + 1), ordered_count.begin() + 6*p);
+        }
+        std::swap(particle_level, ordered_level);
+
+        //the neighbours of a particle (all faces) are moved as a block, with their indices in the ordering
+        const std::vector<uint64_t> canonical_begin = std::move(neighbour_begin);
+        const std::vector<uint32_t> canonical_narrow = std::move(neighbour_index_narrow);
+        const std::vector<uint64_t> canonical_wide = std::move(neighbour_index_wide);
+        std::swap(neighbour_count, ordered_count);
+        init_neighbour_begin();
+
+        int64_t particle_number;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static) private(particle_number)
+#endif
+        for (particle_number = 0; particle_number < (int64_t)total_number_particles; ++particle_number) {
+            const uint64_t canonical = particle_order.canonical_index(particle_number);
+            uint64_t position = neighbour_begin[particle_number];
+            for (uint64_t i = canonical_begin[canonical]; i < canonical_begin[canonical + 1]; ++i) {
+                const uint64_t neighbour = wide_index ? canonical_wide[i] : canonical_narrow[i];
+                set_neighbour_index(position++, particle_order.ordered_index(neighbour));
+            }
+        }
+    }
+
+    inline uint8_t number_neighbours(const uint8_t face, const uint64_t particle_number) const {
+        return neighbour_count[6*particle_number + face];
+    }
+
+    inline FaceNeighbours face_neighbours(const uint8_t face, const uint64_t particle_number) const {
+        const uint64_t begin = face_begin(face, particle_number);
+        const uint8_t count = neighbour_count[6*particle_number + face];
+        if (wide_index) {
+            return FaceNeighbours(nullptr, neighbour_index_wide.data() + begin, count);
+        }
+        return FaceNeighbours(neighbour_index_narrow.data() + begin, nullptr, count);
+    }
+
+    /**
+     * Memory used by the table in bytes
+     */
+    uint64_t size_in_bytes() const {
+        return particle_level.size() + neighbour_count.size() + neighbour_begin.size()*sizeof(uint64_t) +
+               neighbour_index_narrow.size()*sizeof(uint32_t) + neighbour_index_wide.size()*sizeof(uint64_t);
+    }
+
+private:
+
+    //global indices of the neighbours, in 32 bits (narrow) unless there are more than 2^32 particles (wide)
+    std::vector<uint32_t> neighbour_index_narrow;
+    std::vector<uint64_t> neighbour_index_wide;
+    bool wide_index = false;
+
+    inline uint64_t face_begin(const uint8_t face, const uint64_t particle_number) const {
+        const uint8_t *count = neighbour_count.data() + 6*particle_number;
+        uint64_t begin = neighbour_begin[particle_number];
+        for (uint8_t f = 0; f < face; ++f) {
+            begin += count[f];
+        }
+        return begin;
+    }
+
+    inline void set_neighbour_index(const uint64_t position, const uint64_t neighbour) {
+        if (wide_index) {
+            neighbour_index_wide[position] = neighbour;
+        } else {
+            neighbour_index_narrow[position] = (uint32_t) neighbour;
+        }
+    }
+
+    /**
+     * Computes the offsets of the particles from the counts and allocates the neighbour indices
+     */
+    void init_neighbour_begin() {
+        neighbour_begin.assign(total_number_particles + 1, 0);
+        for (uint64_t p = 0; p < total_number_particles; ++p) {
+            const uint8_t *count = neighbour_count.data() + 6*p;
+            neighbour_begin[p + 1] = neighbour_begin[p] + count[0] + count[1] + count[2] + count[3] + count[4] + count[5];
+        }
+
+        wide_index = (total_number_particles > UINT32_MAX);
+        neighbour_index_narrow.clear();
+        neighbour_index_wide.clear();
+        if (wide_index) {
+            neighbour_index_wide.resize(neighbour_begin[total_number_particles]);
+        } else {
+            neighbour_index_narrow.resize(neighbour_begin[total_number_particles]);
+        }
+    }
+
+    /**
+     * Calls particle_function(particle_number, level) for all particles and neighbour_function(particle_number, face,
+     * index, neighbour_global_index) for their existing neighbours (index counts the existing neighbours of the face)
+     */
+    template<typename ImageType, typename ParticleFunction, typename NeighbourFunction>
+    void for_each_neighbour(const APR<ImageType> &apr, ParticleFunction particle_function, NeighbourFunction neighbour_function) {
+
+        APRIterator<ImageType> apr_iterator(apr);
+        APRIterator<ImageType> neighbour_iterator(apr);
+
+        uint64_t particle_number;
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static) private(particle_number) firstprivate(apr_iterator, neighbour_iterator)
+#endif
+        for (particle_number = 0; particle_number < apr_iterator.total_number_particles(); ++particle_number) {
+
+            apr_iterator.set_iterator_to_particle_by_number(particle_number);
+            particle_function(particle_number, apr_iterator.level());
+
+            for (uint8_t face = 0; face < 6; ++face) {
+                apr_iterator.find_neighbours_in_direction(face);
+
+                uint8_t found = 0;
+                for (int index = 0; index < apr_iterator.number_neighbours_in_direction(face); ++index) {
+                    if (neighbour_iterator.set_neighbour_iterator(apr_iterator, face, index)) {
+                        neighbour_function(particle_number, face, found++, neighbour_iterator.global_index());
+                    }
+                }
+            }
+        }
+    }
+};
+
+
+#endif //PARTPLAY_APRNEIGHBOURTABLE_HPP
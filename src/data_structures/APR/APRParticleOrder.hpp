@@ -0,0 +1,217 @@
+//  Alternative orderings of the particles. In the canonical order (the order of ExtraParticleData and of the APR files)
+//  particles are sorted by level, z, x and y, so that particles close in space but at different levels, or in
+//  neighbouring z-planes, are far apart in memory. The Morton order instead sorts the particles of all levels along a
+//  Morton (Z-order) curve through the position of their first pixel, so that the particles of each spatial block (of
+//  size 2^(level_max - block_level) pixels, given by block_begin) are contiguous. It is computed by a counting sort
+//  into the blocks followed by sorting each block.
+//
+//  Data in an ordering is accessed with APRIterator::particle_index() (after APRIterator::set_particle_order), the
+//  neighbours with an APRNeighbourTable built for the ordering, and converted with to_ordered/to_canonical.
+//
+
+#ifndef PARTPLAY_APRPARTICLEORDER_HPP
+#define PARTPLAY_APRPARTICLEORDER_HPP
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include "ExtraParticleData.hpp"
+
+template<typename V> class APR;
+template<typename V> class APRIterator;
+
+enum class ParticleOrdering : uint64_t {
+    Canonical = 0,
+    Morton = 1
+};
+
+class APRParticleOrder {
+
+public:
+
+    ParticleOrdering ordering = ParticleOrdering::Canonical;
+    uint16_t block_level = 0;
+
+    std::vector<uint64_t> ordered_by_canonical; // ordered index of each particle (by canonical index), empty if canonical
+    std::vector<uint64_t> canonical_by_ordered; // canonical index of each particle (by ordered index), empty if canonical
+    std::vector<uint64_t> block_begin; // particles of the i-th block on the curve are ordered [block_begin[i], block_begin[i + 1])
+
+    APRParticleOrder() {}
+
+    template<typename ImageType>
+    APRParticleOrder(const APR<ImageType> &apr, ParticleOrdering aOrdering, int aBlockLevel = -1) {
+        init(apr, aOrdering, aBlockLevel);
+    }
+
+    /**
+     * Computes the ordering, by default with blocks of 16 pixels (block_level = level_max - 4), the ordering has to be
+     * recomputed if the APR changes
+     */
+    template<typename ImageType>
+    void init(const APR<ImageType> &apr, ParticleOrdering aOrdering, int aBlockLevel = -1) {
+        ordering = aOrdering;
+        ordered_by_canonical.clear();
+        canonical_by_ordered.clear();
+        block_begin.clear();
+
+        if (aBlockLevel < 0) aBlockLevel = (int) apr.level_max() - 4;
+        block_level = std::max((int) apr.level_min(), std::min(aBlockLevel, (int) apr.level_max()));
+
+        if (ordering == ParticleOrdering::Canonical) return;
+
+        const uint64_t y_num = apr.spatial_index_y_max(block_level);
+        const uint64_t x_num = apr.spatial_index_x_max(block_level);
+        const uint64_t z_num = apr.spatial_index_z_max(block_level);
+        const uint64_t number_blocks = x_num*y_num*z_num;
+
+        // rank of each block on the curve (blocks indexed as the pixels of a MeshData)
+        std::vector<uint64_t> block_rank(number_blocks);
+        {
+            std::vector<std::pair<uint64_t, uint64_t>> keys(number_blocks);
+            for (uint64_t z = 0; z < z_num; ++z) {
+                for (uint64_t x = 0; x < x_num; ++x) {
+                    for (uint64_t y = 0; y < y_num; ++y) {
+                        const uint64_t block = z*x_num*y_num + x*y_num + y;
+                        keys[block] = {morton_key(y, x, z), block};
+                    }
+                }
+            }
+            std::sort(keys.begin(), keys.end());
+            for (uint64_t rank = 0; rank < number_blocks; ++rank) {
+                block_rank[keys[rank].second] = rank;
+            }
+        }
+
+        // block rank and Morton key of each particle (the rank stored in canonical_by_ordered until the counting sort)
+        const uint64_t total_number_particles = apr.total_number_particles();
+        std::vector<uint64_t> &particle_rank = canonical_by_ordered;
+        particle_rank.resize(total_number_particles);
+        std::vector<uint64_t> particle_key(total_number_particles);
+
+        APRIterator<ImageType> apr_iterator(apr);
+        uint64_t particle_number;
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static) private(particle_number) firstprivate(apr_iterator)
+#endif
+        for (particle_number = 0; particle_number < total_number_particles; ++particle_number) {
+            apr_iterator.set_iterator_to_particle_by_number(particle_number);
+
+            const int level_difference = apr_iterator.level() - block_level;
+            uint64_t y = apr_iterator.y();
+            uint64_t x = apr_iterator.x();
+            uint64_t z = apr_iterator.z();
+            if (level_difference >= 0) {
+                y >>= level_difference; x >>= level_difference; z >>= level_difference;
+            } else {
+                // coarser particles go to the block of their first pixel
+                y <<= -level_difference; x <<= -level_difference; z <<= -level_difference;
+            }
+            particle_rank[particle_number] = block_rank[z*x_num*y_num + x*y_num + y];
+
+            // position of the first pixel of the particle cell
+            const int shift = apr_iterator.level_max() - apr_iterator.level();
+            particle_key[particle_number] = morton_key(((uint64_t) apr_iterator.y()) << shift, ((uint64_t) apr_iterator.x()) << shift, ((uint64_t) apr_iterator.z()) << shift);
+        }
+
+        // stable counting sort by block rank
+        block_begin.assign(number_blocks + 1, 0);
+        for (uint64_t p = 0; p < total_number_particles; ++p) {
+            block_begin[particle_rank[p] + 1]++;
+        }
+        for (uint64_t b = 0; b < number_blocks; ++b) {
+            block_begin[b + 1] += block_begin[b];
+        }
+
+        ordered_by_canonical.resize(total_number_particles);
+        std::vector<uint64_t> block_position(block_begin.begin(), block_begin.end() - 1);
+        for (uint64_t p = 0; p < total_number_particles; ++p) {
+            ordered_by_canonical[p] = block_position[particle_rank[p]]++;
+        }
+        for (uint64_t p = 0; p < total_number_particles; ++p) {
+            canonical_by_ordered[ordered_by_canonical[p]] = p;
+        }
+
+        // Morton order inside the blocks (stable, so coarser particles go before the finer ones at the same position)
+        int64_t block;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(dynamic) private(block)
+#endif
+        for (block = 0; block < (int64_t)number_blocks; ++block) {
+            std::stable_sort(canonical_by_ordered.begin() + block_begin[block], canonical_by_ordered.begin() + block_begin[block + 1],
+                             [&particle_key](const uint64_t a, const uint64_t b) { return particle_key[a] < particle_key[b]; });
+        }
+        for (uint64_t p = 0; p < total_number_particles; ++p) {
+            ordered_by_canonical[canonical_by_ordered[p]] = p;
+        }
+    }
+
+    inline bool is_canonical() const { return ordering == ParticleOrdering::Canonical; }
+
+    inline uint64_t ordered_index(const uint64_t canonical_index) const {
+        return is_canonical() ? canonical_index : ordered_by_canonical[canonical_index];
+    }
+
+    inline uint64_t canonical_index(const uint64_t ordered_index) const {
+        return is_canonical() ? ordered_index : canonical_by_ordered[ordered_index];
+    }
+
+    /**
+     * Reorders particle data from the canonical order to this ordering
+     */
+    template<typename S>
+    void to_ordered(const ExtraParticleData<S> &canonical_data, ExtraParticleData<S> &ordered_data) const {
+        permute(canonical_data, ordered_data, canonical_by_ordered);
+    }
+
+    /**
+     * Reorders particle data from this ordering to the canonical order
+     */
+    template<typename S>
+    void to_canonical(const ExtraParticleData<S> &ordered_data, ExtraParticleData<S> &canonical_data) const {
+        permute(ordered_data, canonical_data, ordered_by_canonical);
+    }
+
+    /**
+     * Interleaves the bits of y, x and z (21 bits each)
+     */
+    static inline uint64_t morton_key(const uint64_t y, const uint64_t x, const uint64_t z) {
+        return spread_bits(y) | (spread_bits(x) << 1) | (spread_bits(z) << 2);
+    }
+
+private:
+
+    static inline uint64_t spread_bits(uint64_t v) {
+        v &= 0x1fffff;
+        v = (v | (v << 32)) & 0x1f00000000ffffull;
+        v = (v | (v << 16)) & 0x1f0000ff0000ffull;
+        v = (v | (v << 8)) & 0x100f00f00f00f00full;
+        v = (v | (v << 4)) & 0x10c30c30c30c30c3ull;
+        v = (v | (v << 2)) & 0x1249249249249249ull;
+        return v;
+    }
+
+    // output.data[i] = input.data[source[i]]
+    template<typename S>
+    void permute(const ExtraParticleData<S> &input, ExtraParticleData<S> &output, const std::vector<uint64_t> &source) const {
+        if (is_canonical()) {
+            output.data = input.data;
+            return;
+        }
+
+        const int64_t total_number_particles = source.size();
+        output.data.resize(total_number_particles);
+
+        int64_t i;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static) private(i)
+#endif
+        for (i = 0; i < total_number_particles; ++i) {
+            output.data[i] = input.data[source[i]];
+        }
+    }
+};
+
+
+#endif //PARTPLAY_APRPARTICLEORDER_HPP
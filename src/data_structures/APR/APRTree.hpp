@@ -0,0 +1,322 @@
+//  Tree of the interior (parent) particle cells of an APR, the cells at levels level_min ... level_max - 1 containing
+//  particles of a higher level. Every interior cell is covered exactly by its children (particles or interior cells of
+//  the next level), so a value per interior cell (e.g. the mean or max of the particles in it, fill_tree_mean and
+//  fill_tree_max) gives a coarse view of the APR at any level without reconstructing the image (get_level_image).
+//
+//  The cells are stored with the same row based access structure as the particles (an APRAccess) and are visited with
+//  an APRIterator (tree_iterator()), data of the cells is held in ExtraParticleData indexed by it.
+//
+
+#ifndef PARTPLAY_APRTREE_HPP
+#define PARTPLAY_APRTREE_HPP
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+#include "APRIterator.hpp"
+
+template<typename ImageType>
+class APRTree {
+
+public:
+
+    APRAccess tree_access;
+
+    APRTree() {}
+
+    explicit APRTree(const APR<ImageType> &apr) {
+        init(apr);
+    }
+
+    uint64_t total_number_parent_cells() const { return tree_access.total_number_particles; }
+    uint64_t level_min() const { return tree_access.level_min; }
+    uint64_t level_max() const { return tree_access.level_max; }
+
+    APRIterator<ImageType> tree_iterator() { return APRIterator<ImageType>(tree_access); }
+
+    /**
+     * Finds the interior cells bottom-up (in parallel over the rows of each level), using the same gap storage
+     * (std::map or flat) as the APR. The tree has to be rebuilt if the APR changes.
+     */
+    void init(const APR<ImageType> &apr) {
+
+        APRTimer timer;
+        timer.verbose_flag = false;
+
+        const uint64_t apr_level_min = apr.level_min();
+        const uint64_t apr_level_max = apr.level_max();
+
+        tree_access = APRAccess();
+        tree_access.level_min = apr_level_min;
+        tree_access.level_max = std::max(apr_level_min, apr_level_max - 1);
+        tree_access.x_num = apr.apr_access.x_num;
+        tree_access.y_num = apr.apr_access.y_num;
+        tree_access.z_num = apr.apr_access.z_num;
+        std::copy(apr.apr_access.org_dims, apr.apr_access.org_dims + 3, tree_access.org_dims);
+        tree_access.use_flat_map = apr.apr_access.use_flat_map;
+
+        // gaps [y_begin, y_end] of each row of each level
+        std::vector<std::vector<std::vector<std::pair<uint16_t, uint16_t>>>> row_gaps(apr_level_max + 1);
+
+        timer.start_timer("find parent cells");
+
+        APRIterator<ImageType> apr_iterator(apr);
+
+        for (int64_t level = (int64_t) apr_level_max - 1; level >= (int64_t) apr_level_min; --level) {
+            const uint64_t x_num = tree_access.x_num[level];
+            const uint64_t z_num = tree_access.z_num[level];
+            const uint64_t x_num_us = tree_access.x_num[level + 1];
+            const uint64_t z_num_us = tree_access.z_num[level + 1];
+            const bool children_in_tree = (level + 1) < (int64_t) apr_level_max;
+
+            row_gaps[level].resize(x_num*z_num);
+
+            std::vector<std::pair<uint16_t, uint16_t>> parents;
+            int64_t z;
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(dynamic) private(z) firstprivate(apr_iterator, parents)
+#endif
+            for (z = 0; z < (int64_t) z_num; ++z) {
+                for (uint64_t x = 0; x < x_num; ++x) {
+                    parents.clear();
+
+                    for (uint64_t z_us = 2*z; z_us < std::min((uint64_t) (2*z + 2), z_num_us); ++z_us) {
+                        for (uint64_t x_us = 2*x; x_us < std::min(2*x + 2, x_num_us); ++x_us) {
+                            if (apr_iterator.set_iterator_to_row(level + 1, z_us, x_us)) {
+                                do {
+                                    parents.push_back({apr_iterator.gap_y_begin()/2, apr_iterator.gap_y_end()/2});
+                                } while (apr_iterator.move_to_next_gap_in_row());
+                            }
+                            if (children_in_tree) {
+                                for (const auto &gap : row_gaps[level + 1][x_num_us*z_us + x_us]) {
+                                    parents.push_back({gap.first/2, gap.second/2});
+                                }
+                            }
+                        }
+                    }
+
+                    // merge the overlapping and adjacent gaps
+                    std::sort(parents.begin(), parents.end());
+                    std::vector<std::pair<uint16_t, uint16_t>> &gaps = row_gaps[level][x_num*z + x];
+                    for (const auto &gap : parents) {
+                        if (!gaps.empty() && (gap.first <= gaps.back().second + 1)) {
+                            gaps.back().second = std::max(gaps.back().second, gap.second);
+                        } else {
+                            gaps.push_back(gap);
+                        }
+                    }
+                }
+            }
+        }
+
+        timer.stop_timer();
+
+        // flattened structure (rows ordered by level, z and x) as read from a file
+        timer.start_timer("build tree access");
+
+        MapStorageData map_data;
+        uint64_t number_cells = 0;
+        uint64_t number_rows = 0;
+
+        for (uint64_t level = apr_level_min; level < apr_level_max; ++level) {
+            const uint64_t x_num = tree_access.x_num[level];
+            const uint64_t z_num = tree_access.z_num[level];
+            for (uint64_t z = 0; z < z_num; ++z) {
+                for (uint64_t x = 0; x < x_num; ++x) {
+                    const std::vector<std::pair<uint16_t, uint16_t>> &gaps = row_gaps[level][x_num*z + x];
+                    if (gaps.empty()) continue;
+
+                    map_data.x.push_back(x);
+                    map_data.z.push_back(z);
+                    map_data.level.push_back(level);
+                    map_data.number_gaps.push_back(gaps.size());
+                    for (const auto &gap : gaps) {
+                        map_data.y_begin.push_back(gap.first);
+                        map_data.y_end.push_back(gap.second);
+                        map_data.global_index.push_back(number_cells);
+                        number_cells += gap.second - gap.first + 1;
+                    }
+                    number_rows++;
+                }
+            }
+            std::vector<std::vector<std::pair<uint16_t, uint16_t>>>().swap(row_gaps[level]);
+        }
+
+        tree_access.total_number_particles = number_cells;
+        tree_access.total_number_gaps = map_data.y_begin.size();
+        tree_access.total_number_non_empty_rows = number_rows;
+        tree_access.rebuild_map(apr, map_data);
+
+        timer.stop_timer();
+    }
+
+    /**
+     * Mean of the particle values in each interior cell (the mean over its children)
+     */
+    template<typename S, typename U>
+    void fill_tree_mean(const APR<ImageType> &apr, const ExtraParticleData<S> &particle_data, ExtraParticleData<U> &tree_data) {
+        fill_tree(apr, particle_data, tree_data, 0.0f,
+                  [](const float a, const float b) { return a + b; },
+                  [](const float sum, const uint8_t count) { return sum/count; });
+    }
+
+    /**
+     * Maximum of the particle values in each interior cell
+     */
+    template<typename S, typename U>
+    void fill_tree_max(const APR<ImageType> &apr, const ExtraParticleData<S> &particle_data, ExtraParticleData<U> &tree_data) {
+        fill_tree(apr, particle_data, tree_data, std::numeric_limits<float>::lowest(),
+                  [](const float a, const float b) { return std::max(a, b); },
+                  [](const float max, const uint8_t) { return max; });
+    }
+
+    /**
+     * Image of the APR at a level (e.g. a thumbnail), each pixel taking the value of the interior cell or the particle
+     * (of the same or a lower level) covering it. Only the particles up to the level and the interior cells of the level
+     * are visited.
+     */
+    template<typename S, typename U, typename V>
+    void get_level_image(const APR<ImageType> &apr, const ExtraParticleData<S> &particle_data, const ExtraParticleData<U> &tree_data, const uint64_t level, MeshData<V> &level_image) {
+
+        const uint64_t y_num = tree_access.y_num[level];
+        const uint64_t x_num = tree_access.x_num[level];
+        const uint64_t z_num = tree_access.z_num[level];
+        level_image.init(y_num, x_num, z_num, 0);
+
+        // interior cells of the level
+        if ((level >= level_min()) && (level < apr.level_max())) {
+            APRIterator<ImageType> tree_it = tree_iterator();
+            int64_t z;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(dynamic) private(z) firstprivate(tree_it)
+#endif
+            for (z = 0; z < (int64_t) z_num; ++z) {
+                for (uint64_t x = 0; x < x_num; ++x) {
+                    if (!tree_it.set_iterator_to_row(level, z, x)) continue;
+                    do {
+                        const uint64_t index_begin = tree_it.gap_particles_begin();
+                        for (uint64_t y = tree_it.gap_y_begin(); y <= tree_it.gap_y_end(); ++y) {
+                            level_image.at(y, x, z) = tree_data.data[index_begin + y - tree_it.gap_y_begin()];
+                        }
+                    } while (tree_it.move_to_next_gap_in_row());
+                }
+            }
+        }
+
+        // particles of the level and below, covering 2^(level - particle level) pixels in each direction
+        APRIterator<ImageType> apr_iterator(apr);
+        for (uint64_t particle_level = apr.level_min(); particle_level <= std::min(level, (uint64_t) apr.level_max()); ++particle_level) {
+            const uint64_t shift = level - particle_level;
+            const uint64_t x_num_level = apr.spatial_index_x_max(particle_level);
+            const uint64_t z_num_level = apr.spatial_index_z_max(particle_level);
+
+            int64_t z;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(dynamic) private(z) firstprivate(apr_iterator)
+#endif
+            for (z = 0; z < (int64_t) z_num_level; ++z) {
+                for (uint64_t x = 0; x < x_num_level; ++x) {
+                    if (!apr_iterator.set_iterator_to_row(particle_level, z, x)) continue;
+                    do {
+                        const uint64_t index_begin = apr_iterator.gap_particles_begin();
+                        for (uint64_t y = apr_iterator.gap_y_begin(); y <= apr_iterator.gap_y_end(); ++y) {
+                            const V value = particle_data.data[index_begin + y - apr_iterator.gap_y_begin()];
+                            for (uint64_t zi = (z << shift); zi < std::min((uint64_t) (z + 1) << shift, z_num); ++zi) {
+                                for (uint64_t xi = (x << shift); xi < std::min((x + 1) << shift, x_num); ++xi) {
+                                    for (uint64_t yi = (y << shift); yi < std::min((y + 1) << shift, y_num); ++yi) {
+                                        level_image.at(yi, xi, zi) = value;
+                                    }
+                                }
+                            }
+                        }
+                    } while (apr_iterator.move_to_next_gap_in_row());
+                }
+            }
+        }
+    }
+
+private:
+
+    /**
+     * Fills the interior cells bottom-up, each cell combining the values of its children (particles and interior cells
+     * of the next level), in parallel over the rows of each level.
+     */
+    template<typename S, typename U, typename Combine, typename Finish>
+    void fill_tree(const APR<ImageType> &apr, const ExtraParticleData<S> &particle_data, ExtraParticleData<U> &tree_data, const float initial_value, Combine combine, Finish finish) {
+
+        tree_data.data.resize(total_number_parent_cells());
+
+        APRIterator<ImageType> apr_iterator(apr);
+        APRIterator<ImageType> parent_iterator = tree_iterator();
+        APRIterator<ImageType> child_iterator = tree_iterator();
+
+        struct Gap { uint64_t y_begin, y_end, index_begin; };
+
+        for (int64_t level = (int64_t) apr.level_max() - 1; level >= (int64_t) apr.level_min(); --level) {
+            const uint64_t x_num = tree_access.x_num[level];
+            const uint64_t z_num = tree_access.z_num[level];
+            const uint64_t x_num_us = tree_access.x_num[level + 1];
+            const uint64_t z_num_us = tree_access.z_num[level + 1];
+            const bool children_in_tree = (level + 1) < (int64_t) apr.level_max();
+
+            std::vector<Gap> parent_gaps;
+            std::vector<float> values;
+            std::vector<uint8_t> counts;
+            int64_t z;
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(dynamic) private(z) firstprivate(apr_iterator, parent_iterator, child_iterator, parent_gaps, values, counts)
+#endif
+            for (z = 0; z < (int64_t) z_num; ++z) {
+                for (uint64_t x = 0; x < x_num; ++x) {
+                    if (!parent_iterator.set_iterator_to_row(level, z, x)) continue;
+
+                    parent_gaps.clear();
+                    do {
+                        parent_gaps.push_back({parent_iterator.gap_y_begin(), parent_iterator.gap_y_end(), parent_iterator.gap_particles_begin()});
+                    } while (parent_iterator.move_to_next_gap_in_row());
+
+                    const uint64_t row_begin = parent_gaps.front().index_begin;
+                    const uint64_t row_size = parent_gaps.back().index_begin + parent_gaps.back().y_end - parent_gaps.back().y_begin + 1 - row_begin;
+                    values.assign(row_size, initial_value);
+                    counts.assign(row_size, 0);
+
+                    // adds the children of a child row (both in increasing y) to their parents
+                    auto add_children = [&](APRIterator<ImageType> &iterator, const uint64_t z_us, const uint64_t x_us, auto child_value) {
+                        if (!iterator.set_iterator_to_row(level + 1, z_us, x_us)) return;
+                        auto parent_gap = parent_gaps.begin();
+                        do {
+                            const uint64_t y_begin = iterator.gap_y_begin();
+                            const uint64_t index_begin = iterator.gap_particles_begin();
+                            for (uint64_t y = y_begin; y <= iterator.gap_y_end(); ++y) {
+                                const uint64_t y_parent = y/2;
+                                while (parent_gap->y_end < y_parent) ++parent_gap;
+                                const uint64_t i = parent_gap->index_begin + (y_parent - parent_gap->y_begin) - row_begin;
+                                values[i] = combine(values[i], child_value(index_begin + y - y_begin));
+                                counts[i]++;
+                            }
+                        } while (iterator.move_to_next_gap_in_row());
+                    };
+
+                    for (uint64_t z_us = 2*z; z_us < std::min((uint64_t) (2*z + 2), z_num_us); ++z_us) {
+                        for (uint64_t x_us = 2*x; x_us < std::min(2*x + 2, x_num_us); ++x_us) {
+                            add_children(apr_iterator, z_us, x_us, [&](const uint64_t index) { return (float) particle_data.data[index]; });
+                            if (children_in_tree) {
+                                add_children(child_iterator, z_us, x_us, [&](const uint64_t index) { return (float) tree_data.data[index]; });
+                            }
+                        }
+                    }
+
+                    for (uint64_t i = 0; i < row_size; ++i) {
+                        tree_data.data[row_begin + i] = finish(values[i], counts[i]);
+                    }
+                }
+            }
+        }
+    }
+};
+
+
+#endif //PARTPLAY_APRTREE_HPP
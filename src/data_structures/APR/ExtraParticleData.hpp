@@ -47,6 +47,11 @@ public:
         return data[apr_iterator.global_index()];
     }
 
+    template<typename S>
+    const DataType& operator[](const APRIterator<S>& apr_iterator) const {
+        return data[apr_iterator.global_index()];
+    }
+
     template<typename S>
     DataType get_particle(const APRIterator<S>& apr_iterator) const {
         return data[apr_iterator.global_index()];
@@ -61,7 +66,7 @@ public:
      * Copy's the data from one particle dataset to another
      */
     template<typename S,typename T>
-    void copy_parts(APR<T> &apr, const ExtraParticleData<S> &particlesToCopy, uint64_t level = 0, unsigned int aNumberOfBlocks = 10) {
+    void copy_parts(const APR<T> &apr, const ExtraParticleData<S> &particlesToCopy, uint64_t level = 0, unsigned int aNumberOfBlocks = 10) {
         const uint64_t total_number_of_particles = particlesToCopy.data.size();
 
         //checking if its the right size, if it is, this should do nothing.
@@ -110,7 +115,7 @@ public:
      * TODO: zip and zip_inplace are doing technicaly same thing - merge them
      */
     template<typename V,class BinaryOperation,typename T>
-    void zip_inplace(APR<T> &apr, const ExtraParticleData<V> &parts2, BinaryOperation op, uint64_t level = 0, unsigned int aNumberOfBlocks = 10) {
+    void zip_inplace(const APR<T> &apr, const ExtraParticleData<V> &parts2, BinaryOperation op, uint64_t level = 0, unsigned int aNumberOfBlocks = 10) {
         APRIterator<T> apr_iterator(apr);
 
         size_t particle_number_start;
@@ -152,7 +157,7 @@ public:
      * Bevan Cheeseman 2017
      */
     template<typename V,class BinaryOperation,typename T>
-    void zip(APR<T>& apr, const ExtraParticleData<V> &parts2, ExtraParticleData<V>& output, BinaryOperation op, uint64_t level = 0, unsigned int aNumberOfBlocks = 10) {
+    void zip(const APR<T>& apr, const ExtraParticleData<V> &parts2, ExtraParticleData<V>& output, BinaryOperation op, uint64_t level = 0, unsigned int aNumberOfBlocks = 10) {
         output.data.resize(data.size());
 
         APRIterator<T> apr_iterator(apr);
@@ -197,7 +202,7 @@ public:
      * TODO: map and map_inplace are doing technicaly same thing - merge them
      */
     template<typename T,typename U,class UnaryOperator>
-    void map(APR<T>& apr,ExtraParticleData<U>& output,UnaryOperator op,const uint64_t level = 0,unsigned int aNumberOfBlocks = 10){
+    void map(const APR<T>& apr,ExtraParticleData<U>& output,UnaryOperator op,const uint64_t level = 0,unsigned int aNumberOfBlocks = 10){
         output.data.resize(data.size());
 
         APRIterator<T> apr_iterator(apr);
@@ -241,7 +246,7 @@ public:
      * Bevan Cheeseman 2018
      */
     template<class UnaryOperator,typename T>
-    void map_inplace(APR<T>& apr,UnaryOperator op,const uint64_t level = 0,unsigned int aNumberOfBlocks = 10){
+    void map_inplace(const APR<T>& apr,UnaryOperator op,const uint64_t level = 0,unsigned int aNumberOfBlocks = 10){
         APRIterator<T> apr_iterator(apr);
 
         size_t particle_number_start;
@@ -0,0 +1,45 @@
+#ifndef PARTPLAY_MAPPEDPARTICLEDATA_HPP
+#define PARTPLAY_MAPPEDPARTICLEDATA_HPP
+
+#include <cstdint>
+#include "MappedVector.hpp"
+#include "ExtraParticleData.hpp"
+
+template<typename V> class APRIterator;
+
+/**
+ * Read only particle data viewing a memory mapped APR file without copying it (filled by APRWriter::read_apr_native),
+ * the mapping is kept alive as long as the data. copy_to gives modifiable particle data.
+ */
+template<typename DataType>
+class MappedParticleData {
+
+public:
+
+    MappedVector<DataType> data;
+
+    uint64_t total_number_particles() const {
+        return data.size();
+    }
+
+    template<typename S>
+    const DataType& operator[](const APRIterator<S>& apr_iterator) const {
+        return data[apr_iterator.global_index()];
+    }
+
+    template<typename S>
+    DataType get_particle(const APRIterator<S>& apr_iterator) const {
+        return data[apr_iterator.global_index()];
+    }
+
+    /**
+     * Copies the particles to (owning) particle data
+     */
+    void copy_to(ExtraParticleData<DataType> &particles) const {
+        const MappedVector<DataType> &mapped = data;
+        particles.data.assign(mapped.begin(), mapped.end());
+    }
+};
+
+
+#endif //PARTPLAY_MAPPEDPARTICLEDATA_HPP
@@ -0,0 +1,174 @@
+#ifndef PARTPLAY_MAPPEDVECTOR_HPP
+#define PARTPLAY_MAPPEDVECTOR_HPP
+
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include <utility>
+#include <algorithm>
+#include <cassert>
+
+/**
+ * std::vector like container which either owns its elements or views read only memory owned by someone else (e.g. a
+ * memory mapped APR file, see APRWriter::read_apr_native). The view keeps its owner alive through a shared_ptr.
+ *
+ * A view is only accessed through the const accessors, the non-const element accessors (operator[], data, begin, end,
+ * front, back) assert that the container owns its elements. detach() explicitly copies a view to owned storage, changing
+ * the size (resize, reserve, push_back, assign, clear) and copying the container also give owned storage. Concurrent
+ * const access is safe, detach() and the size changing methods must not run concurrently with any other access.
+ */
+template<typename T>
+class MappedVector {
+
+    std::vector<T> storage;
+    const T *array = nullptr;
+    size_t number_elements = 0;
+    std::shared_ptr<const void> owner; //empty unless viewing
+
+    inline void sync() { array = storage.data(); number_elements = storage.size(); }
+
+    //array is storage.data() when owning, a view is read only (writing to a read only mapping faults)
+    inline T* writable() const { assert(!owner && "non-const access to a read only view, call detach() first"); return const_cast<T*>(array); }
+
+public:
+    typedef T value_type;
+    typedef T* iterator;
+    typedef const T* const_iterator;
+
+    MappedVector() {}
+    explicit MappedVector(size_t aSize) : storage(aSize) { sync(); }
+    MappedVector(size_t aSize, const T &aValue) : storage(aSize, aValue) { sync(); }
+    MappedVector(const MappedVector &aObj) : storage(aObj.begin(), aObj.end()) { sync(); }
+    MappedVector(MappedVector &&aObj) { *this = std::move(aObj); }
+
+    MappedVector& operator=(const MappedVector &aObj) {
+        if (this != &aObj) {
+            storage.assign(aObj.begin(), aObj.end());
+            owner.reset();
+            sync();
+        }
+        return *this;
+    }
+
+    MappedVector& operator=(MappedVector &&aObj) {
+        if (this != &aObj) {
+            storage = std::move(aObj.storage);
+            owner = std::move(aObj.owner);
+            array = aObj.array;
+            number_elements = aObj.number_elements;
+            if (!owner) sync();
+            aObj.storage.clear();
+            aObj.owner.reset();
+            aObj.sync();
+        }
+        return *this;
+    }
+
+    /**
+     * Views aSize elements at aArray (not copied), aOwner has to keep the memory valid
+     */
+    void view(const T *aArray, size_t aSize, std::shared_ptr<const void> aOwner) {
+        std::vector<T>().swap(storage);
+        array = aArray;
+        number_elements = aSize;
+        owner = std::move(aOwner);
+    }
+
+    inline bool is_view() const { return (bool)owner; }
+
+    /**
+     * Copies a view to owned (writable) storage, does nothing if the elements are already owned
+     */
+    void detach() {
+        if (owner) {
+            storage.assign(array, array + number_elements);
+            owner.reset();
+            sync();
+        }
+    }
+
+    inline size_t size() const { return number_elements; }
+    inline bool empty() const { return number_elements == 0; }
+    inline size_t capacity() const { return owner ? number_elements : storage.capacity(); }
+
+    inline T* data() { return writable(); }
+    inline const T* data() const { return array; }
+    inline T* begin() { return writable(); }
+    inline T* end() { return writable() + number_elements; }
+    inline const T* begin() const { return array; }
+    inline const T* end() const { return array + number_elements; }
+    inline T& operator[](size_t idx) { return writable()[idx]; }
+    inline const T& operator[](size_t idx) const { return array[idx]; }
+    inline T& front() { return writable()[0]; }
+    inline T& back() { return writable()[number_elements - 1]; }
+    inline const T& front() const { return array[0]; }
+    inline const T& back() const { return array[number_elements - 1]; }
+
+    void resize(size_t aSize) {
+        detach();
+        storage.resize(aSize);
+        sync();
+    }
+
+    void resize(size_t aSize, const T &aValue) {
+        detach();
+        storage.resize(aSize, aValue);
+        sync();
+    }
+
+    void assign(size_t aSize, const T &aValue) {
+        storage.assign(aSize, aValue);
+        owner.reset();
+        sync();
+    }
+
+    void reserve(size_t aSize) {
+        detach();
+        storage.reserve(aSize);
+        sync();
+    }
+
+    template<typename InputIterator>
+    void assign(InputIterator aFirst, InputIterator aLast) {
+        std::vector<T> elements(aFirst, aLast); //the range may be in the viewed memory
+        storage.swap(elements);
+        owner.reset();
+        sync();
+    }
+
+    void push_back(const T &aValue) {
+        detach();
+        storage.push_back(aValue);
+        sync();
+    }
+
+    void clear() {
+        owner.reset();
+        storage.clear();
+        sync();
+    }
+
+    void swap(MappedVector &aObj) {
+        storage.swap(aObj.storage);
+        owner.swap(aObj.owner);
+        std::swap(array, aObj.array);
+        std::swap(number_elements, aObj.number_elements);
+    }
+
+    void swap(std::vector<T> &aVector) {
+        detach();
+        storage.swap(aVector);
+        sync();
+    }
+
+    friend bool operator==(const MappedVector &aLhs, const MappedVector &aRhs) {
+        return (aLhs.size() == aRhs.size()) && std::equal(aLhs.begin(), aLhs.end(), aRhs.begin());
+    }
+
+    friend bool operator!=(const MappedVector &aLhs, const MappedVector &aRhs) {
+        return !(aLhs == aRhs);
+    }
+};
+
+
+#endif //PARTPLAY_MAPPEDVECTOR_HPP
@@ -0,0 +1,272 @@
+#ifndef PARTPLAY_MULTICHANNELPARTICLEDATA_HPP
+#define PARTPLAY_MULTICHANNELPARTICLEDATA_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include <iostream>
+#include "ExtraParticleData.hpp"
+
+template<typename V> class APR;
+template<typename V> class APRIterator;
+
+/**
+ * Channel layout of multi-channel particle data:
+ * Interleaved - the channels of a particle are contiguous (data[particle*number_channels + channel])
+ * Planar      - each channel is contiguous (data[channel*number_particles + particle])
+ */
+enum class ChannelLayout : uint64_t {
+    Interleaved = 0,
+    Planar = 1
+};
+
+/**
+ * The channels of one particle (valid as long as the data is not resized)
+ */
+template<typename T>
+struct ParticleChannels {
+    T *first;
+    uint64_t stride;
+    uint64_t number_channels;
+
+    inline T &operator[](uint64_t channel) const { return first[channel*stride]; }
+    inline uint64_t size() const { return number_channels; }
+};
+
+/**
+ * Fixed number of values (channels) per particle, stored in one contiguous array (e.g. vector valued outputs such as
+ * the gradient). Replaces ExtraParticleData<std::vector<T>>, which allocates every particle separately.
+ */
+template<typename T>
+class MultiChannelParticleData {
+
+private:
+
+    static const uint64_t parallel_particle_number_threshold = 5000000l;
+
+    uint64_t number_particles = 0;
+    uint64_t number_channels = 0;
+    ChannelLayout channel_layout = ChannelLayout::Interleaved;
+
+public:
+
+    std::vector<T> data;
+
+    MultiChannelParticleData() {};
+
+    template<typename S>
+    MultiChannelParticleData(const APR<S> &apr, uint64_t aNumberChannels, ChannelLayout aLayout = ChannelLayout::Interleaved) {
+        init(apr, aNumberChannels, aLayout);
+    }
+
+    template<typename S>
+    void init(const APR<S> &apr, uint64_t aNumberChannels, ChannelLayout aLayout = ChannelLayout::Interleaved) {
+        init(apr.total_number_particles(), aNumberChannels, aLayout);
+    }
+
+    void init(uint64_t aNumberParticles, uint64_t aNumberChannels, ChannelLayout aLayout = ChannelLayout::Interleaved) {
+        number_particles = aNumberParticles;
+        number_channels = aNumberChannels;
+        channel_layout = aLayout;
+        data.resize(number_particles*number_channels);
+    }
+
+    uint64_t total_number_particles() const { return number_particles; }
+    uint64_t total_number_channels() const { return number_channels; }
+    ChannelLayout layout() const { return channel_layout; }
+
+    // distance in data between consecutive particles of a channel, and between consecutive channels of a particle
+    inline uint64_t particle_stride() const { return (channel_layout == ChannelLayout::Interleaved) ? number_channels : 1; }
+    inline uint64_t channel_stride() const { return (channel_layout == ChannelLayout::Interleaved) ? 1 : number_particles; }
+
+    inline T &operator()(uint64_t particle_number, uint64_t channel) {
+        return data[particle_number*particle_stride() + channel*channel_stride()];
+    }
+
+    inline const T &operator()(uint64_t particle_number, uint64_t channel) const {
+        return data[particle_number*particle_stride() + channel*channel_stride()];
+    }
+
+    template<typename S>
+    inline T &operator()(const APRIterator<S> &apr_iterator, uint64_t channel) {
+        return (*this)(apr_iterator.global_index(), channel);
+    }
+
+    template<typename S>
+    inline const T &operator()(const APRIterator<S> &apr_iterator, uint64_t channel) const {
+        return (*this)(apr_iterator.global_index(), channel);
+    }
+
+    inline ParticleChannels<T> operator[](uint64_t particle_number) {
+        return {data.data() + particle_number*particle_stride(), channel_stride(), number_channels};
+    }
+
+    inline ParticleChannels<const T> operator[](uint64_t particle_number) const {
+        return {data.data() + particle_number*particle_stride(), channel_stride(), number_channels};
+    }
+
+    /**
+     * Reorders the data to the given layout
+     */
+    void set_layout(ChannelLayout aLayout) {
+        if (aLayout == channel_layout) return;
+
+        MultiChannelParticleData<T> reordered;
+        reordered.init(number_particles, number_channels, aLayout);
+        copy_values(reordered, [](const T &a) { return a; });
+        std::swap(data, reordered.data);
+        channel_layout = aLayout;
+    }
+
+    /**
+     * Copies one channel to (single channel) particle data
+     */
+    template<typename U>
+    bool get_channel(uint64_t channel, ExtraParticleData<U> &output) const {
+        if (channel >= number_channels) {
+            std::cerr << "Channel " << channel << " does not exist (" << number_channels << " channels)" << std::endl;
+            return false;
+        }
+        output.data.resize(number_particles);
+        for_each_block([&](uint64_t begin, uint64_t end) {
+            for (uint64_t p = begin; p < end; ++p) {
+                output.data[p] = (*this)(p, channel);
+            }
+        });
+        return true;
+    }
+
+    /**
+     * Sets one channel from (single channel) particle data
+     */
+    template<typename U>
+    bool set_channel(uint64_t channel, const ExtraParticleData<U> &input) {
+        if (channel >= number_channels) {
+            std::cerr << "Channel " << channel << " does not exist (" << number_channels << " channels)" << std::endl;
+            return false;
+        }
+        if (input.data.size() != number_particles) {
+            std::cerr << "Number of particles does not match (" << input.data.size() << " != " << number_particles << ")" << std::endl;
+            return false;
+        }
+        for_each_block([&](uint64_t begin, uint64_t end) {
+            for (uint64_t p = begin; p < end; ++p) {
+                (*this)(p, channel) = input.data[p];
+            }
+        });
+        return true;
+    }
+
+    /**
+     * Computes one value per particle from its channels, op(ParticleChannels<const T>) -> U
+     */
+    template<typename U, class ParticleOperator>
+    void map(ExtraParticleData<U> &output, ParticleOperator op) const {
+        output.data.resize(number_particles);
+        for_each_block([&](uint64_t begin, uint64_t end) {
+            for (uint64_t p = begin; p < end; ++p) {
+                output.data[p] = op((*this)[p]);
+            }
+        });
+    }
+
+    /**
+     * Applies op(T) -> U to every value, output gets the same number of channels and layout
+     */
+    template<typename U, class UnaryOperator>
+    void map(MultiChannelParticleData<U> &output, UnaryOperator op) const {
+        output.init(number_particles, number_channels, channel_layout);
+        copy_values(output, op);
+    }
+
+    template<class UnaryOperator>
+    void map_inplace(UnaryOperator op) {
+        for_each_block([&](uint64_t begin, uint64_t end) {
+            const uint64_t number_values = number_channels*(end - begin);
+            const uint64_t offset = number_channels*begin;
+            if (channel_layout == ChannelLayout::Interleaved) {
+                std::transform(data.begin() + offset, data.begin() + offset + number_values, data.begin() + offset, op);
+            } else {
+                for (uint64_t c = 0; c < number_channels; ++c) {
+                    T *channel = data.data() + c*number_particles;
+                    std::transform(channel + begin, channel + end, channel + begin, op);
+                }
+            }
+        });
+    }
+
+    /**
+     * Applies op(T, V) -> U to the values of this and parts2 (same number of particles and channels, any layout),
+     * output gets the layout of this. Returns false (output unchanged) if the sizes do not match.
+     */
+    template<typename V, typename U, class BinaryOperation>
+    bool zip(const MultiChannelParticleData<V> &parts2, MultiChannelParticleData<U> &output, BinaryOperation op) const {
+        if (!same_size(parts2)) return false;
+        output.init(number_particles, number_channels, channel_layout);
+        for_each_block([&](uint64_t begin, uint64_t end) {
+            for (uint64_t p = begin; p < end; ++p) {
+                for (uint64_t c = 0; c < number_channels; ++c) {
+                    output(p, c) = op((*this)(p, c), parts2(p, c));
+                }
+            }
+        });
+        return true;
+    }
+
+    template<typename V, class BinaryOperation>
+    bool zip_inplace(const MultiChannelParticleData<V> &parts2, BinaryOperation op) {
+        if (!same_size(parts2)) return false;
+        for_each_block([&](uint64_t begin, uint64_t end) {
+            for (uint64_t p = begin; p < end; ++p) {
+                for (uint64_t c = 0; c < number_channels; ++c) {
+                    (*this)(p, c) = op((*this)(p, c), parts2(p, c));
+                }
+            }
+        });
+        return true;
+    }
+
+private:
+
+    template<typename V>
+    bool same_size(const MultiChannelParticleData<V> &parts2) const {
+        if ((parts2.total_number_particles() != number_particles) || (parts2.total_number_channels() != number_channels)) {
+            std::cerr << "Particle data sizes do not match (" << parts2.total_number_particles() << "x" << parts2.total_number_channels() <<
+                      " != " << number_particles << "x" << number_channels << ")" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    template<typename U, class UnaryOperator>
+    void copy_values(MultiChannelParticleData<U> &output, UnaryOperator op) const {
+        for_each_block([&](uint64_t begin, uint64_t end) {
+            for (uint64_t p = begin; p < end; ++p) {
+                for (uint64_t c = 0; c < number_channels; ++c) {
+                    output(p, c) = op((*this)(p, c));
+                }
+            }
+        });
+    }
+
+    /**
+     * Calls f(begin, end) for blocks of particles, in parallel for large data
+     */
+    template<class BlockFunction>
+    void for_each_block(BlockFunction f) const {
+        unsigned int number_blocks = (number_particles < parallel_particle_number_threshold) ? 1 : 10;
+        const uint64_t block_size = number_particles/number_blocks;
+
+        #ifdef HAVE_OPENMP
+        #pragma omp parallel for schedule(static)
+        #endif
+        for (unsigned int block = 0; block < number_blocks; ++block) {
+            const uint64_t begin = block*block_size;
+            const uint64_t end = (block == number_blocks - 1) ? number_particles : begin + block_size;
+            f(begin, end);
+        }
+    }
+};
+
+
+#endif //PARTPLAY_MULTICHANNELPARTICLEDATA_HPP
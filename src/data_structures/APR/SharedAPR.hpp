@@ -0,0 +1,69 @@
+#ifndef PARTPLAY_SHAREDAPR_HPP
+#define PARTPLAY_SHAREDAPR_HPP
+
+#include <memory>
+#include <string>
+
+#include "APR.hpp"
+#include "APRIterator.hpp"
+
+/**
+ * Shared, read-only handle to an APR. Copying the handle only copies a reference counted pointer (the APR is released
+ * with the last handle), so it can be passed around and stored freely instead of copying the APR.
+ *
+ * The numerics (APRNumerics), reconstruction (APRReconstruction) and raycasting (APRRaycaster) take a const APR
+ * reference, given by *shared_apr.
+ *
+ * Thread-safety: the APR can not be modified through the handle, and reading it (iterators, particle data, numerics)
+ * from any number of threads at the same time is safe, each thread using its own APRIterator. The handle itself has
+ * the guarantees of std::shared_ptr (copies can be made and destroyed concurrently).
+ */
+template<typename ImageType>
+class SharedAPR {
+
+    std::shared_ptr<const APR<ImageType>> apr;
+
+public:
+
+    SharedAPR() {}
+
+    /**
+     * Takes over the APR (moved, not copied)
+     */
+    explicit SharedAPR(APR<ImageType> &&aApr) : apr(std::make_shared<const APR<ImageType>>(std::move(aApr))) {}
+
+    explicit SharedAPR(std::shared_ptr<const APR<ImageType>> aApr) : apr(std::move(aApr)) {}
+
+    /**
+     * Reads an APR file (written with write_apr)
+     */
+    static SharedAPR read(const std::string &file_name) {
+        APR<ImageType> read_apr;
+        read_apr.read_apr(file_name);
+        return SharedAPR(std::move(read_apr));
+    }
+
+    /**
+     * Opens a native APR file (written with write_apr_native, memory mapped), returns an empty handle if it fails
+     */
+    static SharedAPR read_native(const std::string &file_name) {
+        APR<ImageType> read_apr;
+        if (!read_apr.read_apr_native(file_name)) {
+            return SharedAPR();
+        }
+        return SharedAPR(std::move(read_apr));
+    }
+
+    const APR<ImageType> &operator*() const { return *apr; }
+    const APR<ImageType> *operator->() const { return apr.get(); }
+    const APR<ImageType> *get() const { return apr.get(); }
+
+    explicit operator bool() const { return (bool) apr; }
+
+    long use_count() const { return apr.use_count(); }
+
+    APRIterator<ImageType> iterator() const { return APRIterator<ImageType>(*apr); }
+};
+
+
+#endif //PARTPLAY_SHAREDAPR_HPP
@@ -0,0 +1,119 @@
+//  Sparse 3D array (same y, x, z indexing as MeshData) storing only the allocated 8x8x8 bricks, the other elements
+//  have the empty value. Memory is proportional to the number of allocated bricks (plus a 4 byte index per brick of
+//  the volume). Bricks are only allocated in batches (allocate_bricks), so the data can be read and written in
+//  parallel between allocations.
+//
+
+#ifndef PARTPLAY_BRICKMESHDATA_HPP
+#define PARTPLAY_BRICKMESHDATA_HPP
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+template<typename T>
+class BrickMeshData {
+public:
+
+    static constexpr unsigned int brick_bits = 3;
+    static constexpr size_t brick_size = ((size_t) 1) << brick_bits;
+    static constexpr size_t brick_volume = brick_size*brick_size*brick_size;
+
+    size_t y_num = 0;
+    size_t x_num = 0;
+    size_t z_num = 0;
+
+    size_t y_num_bricks = 0;
+    size_t x_num_bricks = 0;
+    size_t z_num_bricks = 0;
+
+    T empty_value = 0;
+
+    BrickMeshData() {}
+
+    BrickMeshData(size_t aY_num, size_t aX_num, size_t aZ_num, T aEmptyValue = 0) {
+        init(aY_num, aX_num, aZ_num, aEmptyValue);
+    }
+
+    void init(size_t aY_num, size_t aX_num, size_t aZ_num, T aEmptyValue = 0) {
+        y_num = aY_num;
+        x_num = aX_num;
+        z_num = aZ_num;
+        y_num_bricks = (y_num + brick_size - 1) >> brick_bits;
+        x_num_bricks = (x_num + brick_size - 1) >> brick_bits;
+        z_num_bricks = (z_num + brick_size - 1) >> brick_bits;
+        empty_value = aEmptyValue;
+
+        brick_index.assign(number_bricks(), 0);
+        brick_data.clear();
+        brick_data.shrink_to_fit();
+        allocated_bricks.clear();
+    }
+
+    inline size_t number_bricks() const { return y_num_bricks*x_num_bricks*z_num_bricks; }
+    inline size_t number_allocated_bricks() const { return allocated_bricks.size(); }
+
+    inline size_t brick_number(size_t by, size_t bx, size_t bz) const {
+        return bz*x_num_bricks*y_num_bricks + bx*y_num_bricks + by;
+    }
+
+    /**
+     * Brick numbers of the allocated bricks, in the order of allocation
+     */
+    inline const std::vector<size_t>& allocated() const { return allocated_bricks; }
+
+    inline bool is_allocated(size_t brick) const { return brick_index[brick] != 0; }
+
+    inline T* brick(size_t brick) { return brick_data.data() + (brick_index[brick] - 1)*brick_volume; }
+    inline const T* brick(size_t brick) const { return brick_data.data() + (brick_index[brick] - 1)*brick_volume; }
+
+    /**
+     * Offset of the element (y, x, z) in its brick
+     */
+    static inline size_t offset_in_brick(size_t y, size_t x, size_t z) {
+        const size_t mask = brick_size - 1;
+        return ((z & mask) << (2*brick_bits)) | ((x & mask) << brick_bits) | (y & mask);
+    }
+
+    inline T at(size_t y, size_t x, size_t z) const {
+        const uint32_t index = brick_index[brick_number(y >> brick_bits, x >> brick_bits, z >> brick_bits)];
+        return index ? brick_data[(index - 1)*brick_volume + offset_in_brick(y, x, z)] : empty_value;
+    }
+
+    /**
+     * Reference to the element (y, x, z), its brick has to be allocated
+     */
+    inline T& ref(size_t y, size_t x, size_t z) {
+        const uint32_t index = brick_index[brick_number(y >> brick_bits, x >> brick_bits, z >> brick_bits)];
+        return brick_data[(index - 1)*brick_volume + offset_in_brick(y, x, z)];
+    }
+
+    /**
+     * Allocates (filled with the empty value) the bricks with a non zero flag that are not allocated yet
+     */
+    void allocate_bricks(const std::vector<uint8_t> &flags) {
+        for (size_t b = 0; b < flags.size(); ++b) {
+            if (flags[b] && !brick_index[b]) {
+                allocated_bricks.push_back(b);
+                brick_index[b] = (uint32_t) allocated_bricks.size();
+            }
+        }
+        brick_data.resize(allocated_bricks.size()*brick_volume, empty_value);
+    }
+
+    /**
+     * Memory used in bytes
+     */
+    size_t size_in_bytes() const {
+        return brick_index.capacity()*sizeof(uint32_t) + brick_data.capacity()*sizeof(T) + allocated_bricks.capacity()*sizeof(size_t);
+    }
+
+private:
+
+    std::vector<uint32_t> brick_index; // per brick, 0 if not allocated otherwise 1 + position in brick_data
+    std::vector<T> brick_data;
+    std::vector<size_t> allocated_bricks;
+};
+
+
+#endif //PARTPLAY_BRICKMESHDATA_HPP
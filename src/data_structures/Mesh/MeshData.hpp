@@ -238,6 +238,17 @@ public :
         mesh.set(array, size);
 
         // Fill values of new buffer in parallel
+        fill(aInitVal);
+    }
+
+    /**
+     * Sets all elements to aValue in parallel, each thread filling the same chunk as when the mesh was
+     * initialized with a value (so on reuse the pages are touched by the threads that first touched them)
+     * @param aValue
+     */
+    void fill(T aValue) {
+        T *array = mesh.get();
+        const size_t size = mesh.size();
         #ifdef HAVE_OPENMP
         #pragma omp parallel
         {
@@ -246,10 +257,10 @@ public :
             auto chunkSize = size / numOfThreads;
             auto begin = array + chunkSize * threadNum;
             auto end = (threadNum == numOfThreads - 1) ? array + size : begin + chunkSize;
-            std::fill(begin, end, aInitVal);
+            std::fill(begin, end, aValue);
         }
         #else
-        std::fill(array, array + size, aInitVal);
+        std::fill(array, array + size, aValue);
         #endif
     }
 
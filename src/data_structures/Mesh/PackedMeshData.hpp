@@ -0,0 +1,127 @@
+//  3D array (same y, x, z indexing as MeshData) of 4 bit values, packed 16 per 64 bit word along y. Each row (x, z)
+//  starts at a new word, the unused elements at the end of the last word of a row are 0. The static functions work on
+//  all 16 elements of a word at once, with masks having the lowest bit of each element set (element masks).
+//
+
+#ifndef PARTPLAY_PACKEDMESHDATA_HPP
+#define PARTPLAY_PACKEDMESHDATA_HPP
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+class PackedMeshData {
+public:
+
+    static constexpr size_t values_per_word = 16;
+    static constexpr uint64_t low_bits = 0x1111111111111111ULL;
+
+    size_t y_num = 0;
+    size_t x_num = 0;
+    size_t z_num = 0;
+
+    size_t words_per_row = 0;
+
+    PackedMeshData() {}
+
+    PackedMeshData(size_t aY_num, size_t aX_num, size_t aZ_num) {
+        init(aY_num, aX_num, aZ_num);
+    }
+
+    void init(size_t aY_num, size_t aX_num, size_t aZ_num) {
+        y_num = aY_num;
+        x_num = aX_num;
+        z_num = aZ_num;
+        words_per_row = (y_num + values_per_word - 1)/values_per_word;
+        data.assign(words_per_row*x_num*z_num, 0);
+    }
+
+    inline uint64_t* row(size_t x, size_t z) { return data.data() + (z*x_num + x)*words_per_row; }
+    inline const uint64_t* row(size_t x, size_t z) const { return data.data() + (z*x_num + x)*words_per_row; }
+
+    inline uint8_t at(size_t y, size_t x, size_t z) const {
+        return (row(x, z)[y/values_per_word] >> (4*(y % values_per_word))) & 0xF;
+    }
+
+    inline void set(size_t y, size_t x, size_t z, uint8_t value) {
+        uint64_t &word = row(x, z)[y/values_per_word];
+        const size_t shift = 4*(y % values_per_word);
+        word = (word & ~(((uint64_t) 0xF) << shift)) | (((uint64_t) value) << shift);
+    }
+
+    /**
+     * Element mask of the elements of word w of a row that are inside the array
+     */
+    inline uint64_t valid_mask(size_t w) const {
+        const size_t remainder = y_num % values_per_word;
+        if ((w + 1 < words_per_row) || (remainder == 0)) {
+            return low_bits;
+        }
+        return low_bits & ((((uint64_t) 1) << (4*remainder)) - 1);
+    }
+
+    /**
+     * Element mask of the elements of the word equal to value
+     */
+    static inline uint64_t equal(uint64_t word, uint8_t value) {
+        const uint64_t x = word ^ (low_bits*value);
+        return ~(x | (x >> 1) | (x >> 2) | (x >> 3)) & low_bits;
+    }
+
+    /**
+     * Sets the elements of the word in the element mask to value
+     */
+    static inline uint64_t replace(uint64_t word, uint64_t mask, uint8_t value) {
+        return (word & ~(mask*0xF)) | (mask*value);
+    }
+
+    /**
+     * Element mask of each element or one of its two neighbours along y being set in the row of element masks
+     * (previous and next are the masks of the neighbouring words of the row, 0 if none)
+     */
+    static inline uint64_t dilate(uint64_t previous, uint64_t mask, uint64_t next) {
+        return mask | (mask << 4) | (mask >> 4) | (previous >> 60) | (next << 60);
+    }
+
+    /**
+     * Element mask of the 16 elements (of the array with half the size along y) covering two consecutive words,
+     * an element being set if one of its two elements is set
+     */
+    static inline uint64_t halve(uint64_t first, uint64_t second) {
+        return compress(first | (first >> 4)) | (compress(second | (second >> 4)) << 32);
+    }
+
+    /**
+     * Element mask of the 16 elements (of the array with twice the size along y) covered by the first (half = 0) or
+     * second (half = 1) half of the element mask
+     */
+    static inline uint64_t expand(uint64_t mask, size_t half) {
+        uint64_t x = (mask >> (32*half)) & 0xFFFFFFFFULL;
+        x = (x | (x << 16)) & 0x0000111100001111ULL;
+        x = (x | (x << 8)) & 0x0011001100110011ULL;
+        x = (x | (x << 4)) & 0x0101010101010101ULL;
+        return x | (x << 4);
+    }
+
+    /**
+     * Memory used in bytes
+     */
+    size_t size_in_bytes() const {
+        return data.capacity()*sizeof(uint64_t);
+    }
+
+private:
+
+    // moves the bits 0, 8, .., 56 to 0, 4, .., 28
+    static inline uint64_t compress(uint64_t mask) {
+        uint64_t x = mask & 0x0101010101010101ULL;
+        x = (x | (x >> 4)) & 0x0011001100110011ULL;
+        x = (x | (x >> 8)) & 0x0000111100001111ULL;
+        return (x | (x >> 16)) & 0x0000000011111111ULL;
+    }
+
+    std::vector<uint64_t> data;
+};
+
+
+#endif //PARTPLAY_PACKEDMESHDATA_HPP
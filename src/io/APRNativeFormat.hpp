@@ -0,0 +1,149 @@
+//  Native (uncompressed) APR file format, designed to be memory mapped. The file consists of a fixed size header,
+//  a table of sections and the section data, each section starting at an offset aligned to NativeAlignment bytes:
+//
+//  [NativeHeader][NativeSection x number_sections][padding][section 0][padding][section 1]...
+//
+//  All values are stored in the byte order of the machine writing the file (checked on reading).
+//
+
+#ifndef PARTPLAY_APRNATIVEFORMAT_HPP
+#define PARTPLAY_APRNATIVEFORMAT_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <fstream>
+#include <iostream>
+
+#ifndef _WIN32
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+namespace AprNative {
+
+    const char Magic[8] = {'A', 'P', 'R', 'N', 'A', 'T', 'V', '\0'};
+    const uint32_t Version = 1;
+    const uint32_t ByteOrderMark = 0x01020304;
+    const uint64_t NativeAlignment = 64;
+
+    enum SectionType : uint32_t {
+        ParticleIntensities = 0,
+        ParticleCellType = 1,
+        LevelXNum = 2,
+        LevelYNum = 3,
+        LevelZNum = 4,
+        RowBegin = 5,       // per level, FlatGapMap::row_begin
+        GapYBegin = 6,      // per level, FlatGapMap::y_begin
+        GapYEnd = 7,        // per level, FlatGapMap::y_end
+        GapGlobalIndex = 8, // per level, FlatGapMap::global_index_begin
+        RowEnd = 9          // per level, APRAccess::global_index_by_level_and_zx_end
+    };
+
+    struct NativeHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order;
+        uint64_t header_size;
+        uint64_t number_sections;
+
+        uint64_t org_dims[3];
+        uint64_t level_min;
+        uint64_t level_max;
+        uint64_t total_number_particles;
+        uint64_t total_number_gaps;
+        uint64_t total_number_non_empty_rows;
+
+        uint32_t intensity_type;
+        int32_t compress_type;
+        float quantization_factor;
+        float lambda;
+        float sigma_th;
+        float sigma_th_max;
+        float Ip_th;
+        float dx;
+        float dy;
+        float dz;
+        float psfx;
+        float psfy;
+        float psfz;
+        float rel_error;
+        float background_intensity_estimate;
+        float noise_sd_estimate;
+
+        char name[256];
+    };
+    static_assert(sizeof(NativeHeader) == 416, "NativeHeader must not contain padding");
+
+    struct NativeSection {
+        uint32_t type;
+        uint32_t level;
+        uint64_t element_size;
+        uint64_t number_elements;
+        uint64_t offset;
+    };
+    static_assert(sizeof(NativeSection) == 32, "NativeSection must not contain padding");
+
+    // identifies the particle intensity type stored in the file
+    template<typename T> struct NativeType {static uint32_t id() {return T::CANNOT_DETECT_TYPE_AND_WILL_NOT_COMPILE;}};
+    template<> struct NativeType<uint8_t> {static uint32_t id() {return 1;}};
+    template<> struct NativeType<int8_t> {static uint32_t id() {return 2;}};
+    template<> struct NativeType<uint16_t> {static uint32_t id() {return 3;}};
+    template<> struct NativeType<int16_t> {static uint32_t id() {return 4;}};
+    template<> struct NativeType<uint32_t> {static uint32_t id() {return 5;}};
+    template<> struct NativeType<int32_t> {static uint32_t id() {return 6;}};
+    template<> struct NativeType<uint64_t> {static uint32_t id() {return 7;}};
+    template<> struct NativeType<int64_t> {static uint32_t id() {return 8;}};
+    template<> struct NativeType<float> {static uint32_t id() {return 9;}};
+    template<> struct NativeType<double> {static uint32_t id() {return 10;}};
+
+    inline uint64_t align(uint64_t aOffset) {
+        return ((aOffset + NativeAlignment - 1)/NativeAlignment)*NativeAlignment;
+    }
+
+    /**
+     * Maps the file read only and returns the mapping, which is unmapped when the last reference is released. Without
+     * mmap support the file is read into memory instead.
+     */
+    inline std::shared_ptr<const char> map_file(const std::string &aFileName, uint64_t &aFileSize) {
+        aFileSize = 0;
+#ifndef _WIN32
+        int fd = open(aFileName.c_str(), O_RDONLY);
+        if (fd == -1) {
+            return nullptr;
+        }
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+            close(fd);
+            return nullptr;
+        }
+        const uint64_t file_size = file_stat.st_size;
+        void *mapping = mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED) {
+            return nullptr;
+        }
+        aFileSize = file_size;
+        return std::shared_ptr<const char>((const char*)mapping, [file_size](const char *aMapping) { munmap((void*)aMapping, file_size); });
+#else
+        std::ifstream file(aFileName, std::ios::binary | std::ios::ate);
+        if (!file) {
+            return nullptr;
+        }
+        const uint64_t file_size = file.tellg();
+        std::shared_ptr<char> buffer(new char[file_size], std::default_delete<char[]>());
+        file.seekg(0);
+        if (!file.read(buffer.get(), file_size)) {
+            return nullptr;
+        }
+        aFileSize = file_size;
+        return buffer;
+#endif
+    }
+}
+
+
+#endif //PARTPLAY_APRNATIVEFORMAT_HPP
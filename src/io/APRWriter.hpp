@@ -6,8 +6,12 @@
 #define APRWRITER_HPP
 
 #include "hdf5functions_blosc.h"
+#include "APRNativeFormat.hpp"
 #include "../data_structures/APR/APR.hpp"
 #include "../data_structures/APR/APRAccess.hpp"
+#include "../data_structures/APR/MultiChannelParticleData.hpp"
+#include "../data_structures/APR/MappedParticleData.hpp"
+#include "../data_structures/APR/APRParticleOrder.hpp"
 #include "ConfigAPR.h"
 #include <numeric>
 #include <memory>
@@ -51,6 +55,12 @@ namespace AprTypes  {
     const AprType MapXType = {H5T_NATIVE_INT16, "map_x"};
     const AprType MapZType = {H5T_NATIVE_INT16, "map_z"};
     const AprType ParticleCellType = {H5T_NATIVE_UINT8, "particle_cell_type"};
+    const AprType BlockZSizeType = {H5T_NATIVE_UINT64, "z_block_size"};
+    const AprType BlockRowBeginType = {H5T_NATIVE_UINT64, "block_row_begin"};
+    const AprType BlockGapBeginType = {H5T_NATIVE_UINT64, "block_gap_begin"};
+    const AprType BlockParticleBeginType = {H5T_NATIVE_UINT64, "block_particle_begin"};
+    const AprType NumberOfChannelsType = {H5T_NATIVE_UINT64, "number_channels"};
+    const AprType ChannelLayoutType = {H5T_NATIVE_UINT64, "channel_layout"};
     const AprType NameType = {H5T_C_S1, "name"};
     const AprType GitType = {H5T_C_S1, "githash"};
 
@@ -67,98 +77,50 @@ namespace AprTypes  {
 }
 
 
+/**
+ * Region of interest for APRWriter::read_apr_region, given as [begin, end) in pixels of the original image and as an
+ * (inclusive) range of levels.
+ */
+struct APRRegion {
+    uint64_t y_begin = 0;
+    uint64_t y_end = UINT64_MAX;
+    uint64_t x_begin = 0;
+    uint64_t x_end = UINT64_MAX;
+    uint64_t z_begin = 0;
+    uint64_t z_end = UINT64_MAX;
+    uint64_t level_begin = 0;
+    uint64_t level_end = UINT64_MAX;
+};
+
+
 class APRWriter {
 public:
 
+    // blosc compressed datasets are (de)compressed in parallel and their chunks read/written directly, bypassing the serial
+    // HDF5 filter pipeline (requires HDF5 >= 1.10.3), applies to the files read and written by this writer
+    bool direct_chunk_io = true;
+
     template<typename ImageType>
     void read_apr(APR<ImageType>& apr, const std::string &file_name) {
         AprFile f(file_name, AprFile::Operation::READ);
         if (!f.isOpened()) return;
 
         // ------------- read metadata --------------------------
-        char string_out[100] = {0};
-        hid_t attr_id = H5Aopen(f.groupId,"name",H5P_DEFAULT);
-        hid_t atype = H5Aget_type(attr_id);
-        hid_t atype_mem = H5Tget_native_type(atype, H5T_DIR_ASCEND);
-        H5Aread(attr_id, atype_mem, string_out) ;
-        H5Aclose(attr_id);
-        apr.name= string_out;
-
-        readAttr(AprTypes::TotalNumberOfParticlesType, f.groupId, &apr.apr_access.total_number_particles);
-        readAttr(AprTypes::TotalNumberOfGapsType, f.groupId, &apr.apr_access.total_number_gaps);
-        readAttr(AprTypes::TotalNumberOfNonEmptyRowsType, f.groupId, &apr.apr_access.total_number_non_empty_rows);
         uint64_t type_size;
-        readAttr(AprTypes::VectorSizeType, f.groupId, &type_size);
-        readAttr(AprTypes::NumberOfYType, f.groupId, &apr.apr_access.org_dims[0]);
-        readAttr(AprTypes::NumberOfXType, f.groupId, &apr.apr_access.org_dims[1]);
-        readAttr(AprTypes::NumberOfZType, f.groupId, &apr.apr_access.org_dims[2]);
-        readAttr(AprTypes::MaxLevelType, f.groupId, &apr.apr_access.level_max);
-        readAttr(AprTypes::MinLevelType, f.groupId, &apr.apr_access.level_min);
-        readAttr(AprTypes::LambdaType, f.groupId, &apr.parameters.lambda);
         int compress_type;
-        readAttr(AprTypes::CompressionType, f.groupId, &compress_type);
         float quantization_factor;
-        readAttr(AprTypes::QuantizationFactorType, f.groupId, &quantization_factor);
-        readAttr(AprTypes::SigmaThType, f.groupId, &apr.parameters.sigma_th);
-        readAttr(AprTypes::SigmaThMaxType, f.groupId, &apr.parameters.sigma_th_max);
-        readAttr(AprTypes::IthType, f.groupId, &apr.parameters.Ip_th);
-        readAttr(AprTypes::DxType, f.groupId, &apr.parameters.dx);
-        readAttr(AprTypes::DyType, f.groupId, &apr.parameters.dy);
-        readAttr(AprTypes::DzType, f.groupId, &apr.parameters.dz);
-        readAttr(AprTypes::PsfXType, f.groupId, &apr.parameters.psfx);
-        readAttr(AprTypes::PsfYType, f.groupId, &apr.parameters.psfy);
-        readAttr(AprTypes::PsfZType, f.groupId, &apr.parameters.psfz);
-        readAttr(AprTypes::RelativeErrorType, f.groupId, &apr.parameters.rel_error);
-        readAttr(AprTypes::BackgroundIntensityEstimateType, f.groupId, &apr.parameters.background_intensity_estimate);
-        readAttr(AprTypes::NoiseSdEstimateType, f.groupId, &apr.parameters.noise_sd_estimate);
-
-        apr.apr_access.x_num.resize(apr.apr_access.level_max+1);
-        apr.apr_access.y_num.resize(apr.apr_access.level_max+1);
-        apr.apr_access.z_num.resize(apr.apr_access.level_max+1);
-
-        for (size_t i = apr.apr_access.level_min;i < apr.apr_access.level_max; i++) {
-            int x_num, y_num, z_num;
-            //TODO: x_num and other should have HDF5 type uint64?
-            readAttr(AprTypes::NumberOfLevelXType, i, f.groupId, &x_num);
-            readAttr(AprTypes::NumberOfLevelYType, i, f.groupId, &y_num);
-            readAttr(AprTypes::NumberOfLevelZType, i, f.groupId, &z_num);
-            apr.apr_access.x_num[i] = x_num;
-            apr.apr_access.y_num[i] = y_num;
-            apr.apr_access.z_num[i] = z_num;
-        }
+        readMetadata(apr, f, type_size, compress_type, quantization_factor);
 
         // ------------- read data ------------------------------
         apr.particles_intensities.data.resize(apr.apr_access.total_number_particles);
         if (apr.particles_intensities.data.size() > 0) {
             readData(AprTypes::ParticleIntensitiesType, f.objectId, apr.particles_intensities.data.data());
         }
-        apr.apr_access.y_num[apr.apr_access.level_max] = apr.apr_access.org_dims[0];
-        apr.apr_access.x_num[apr.apr_access.level_max] = apr.apr_access.org_dims[1];
-        apr.apr_access.z_num[apr.apr_access.level_max] = apr.apr_access.org_dims[2];
 
         // ------------- map handling ----------------------------
         auto map_data = std::make_shared<MapStorageData>();
+        readMapData(apr.apr_access, f, *map_data);
 
-        map_data->global_index.resize(apr.apr_access.total_number_gaps);
-
-        std::vector<int16_t> index_delta(apr.apr_access.total_number_gaps);
-        readData(AprTypes::MapGlobalIndexType, f.objectId, index_delta.data());
-        std::vector<uint64_t> index_delta_big(apr.apr_access.total_number_gaps);
-        std::copy(index_delta.begin(),index_delta.end(),index_delta_big.begin());
-        std::partial_sum(index_delta_big.begin(), index_delta_big.end(), map_data->global_index.begin());
-
-        map_data->y_end.resize(apr.apr_access.total_number_gaps);
-        readData(AprTypes::MapYendType, f.objectId, map_data->y_end.data());
-        map_data->y_begin.resize(apr.apr_access.total_number_gaps);
-        readData(AprTypes::MapYbeginType, f.objectId, map_data->y_begin.data());
-        map_data->number_gaps.resize(apr.apr_access.total_number_non_empty_rows);
-        readData(AprTypes::MapNumberGapsType, f.objectId, map_data->number_gaps.data());
-        map_data->level.resize(apr.apr_access.total_number_non_empty_rows);
-        readData(AprTypes::MapLevelType, f.objectId, map_data->level.data());
-        map_data->x.resize(apr.apr_access.total_number_non_empty_rows);
-        readData(AprTypes::MapXType, f.objectId, map_data->x.data());
-        map_data->z.resize(apr.apr_access.total_number_non_empty_rows);
-        readData(AprTypes::MapZType, f.objectId, map_data->z.data());
         apr.apr_access.particle_cell_type.data.resize(type_size);
         readData(AprTypes::ParticleCellType, f.objectId, apr.apr_access.particle_cell_type.data.data());
 
@@ -173,6 +135,461 @@ public:
         }
     }
 
+    /**
+     * Reads the part of the APR covering a region of interest into apr, the result is a valid (smaller) APR with the
+     * region's lower corner as its origin. For files written with write_apr_blocked only the blocks touched by the
+     * region are read and decompressed, for other files the access data is read in full and the particles partially.
+     *
+     * The lower corner of the region is aligned down to the size of the coarsest particle cells, so the sub-APR lies on
+     * the same grid as the original, region is updated to the bounds actually read. Particle cells at levels outside
+     * of the level range are not read, their rows are left empty.
+     */
+    template<typename ImageType>
+    bool read_apr_region(APR<ImageType>& apr, const std::string &file_name, APRRegion &region) {
+        AprFile f(file_name, AprFile::Operation::READ);
+        if (!f.isOpened()) return false;
+
+        // ------------- read metadata --------------------------
+        uint64_t type_size;
+        int compress_type;
+        float quantization_factor;
+        readMetadata(apr, f, type_size, compress_type, quantization_factor);
+
+        APRAccess &apr_access = apr.apr_access;
+        const uint64_t level_min = apr_access.level_min;
+        const uint64_t level_max = apr_access.level_max;
+
+        // ------------- align the region -----------------------
+        const uint64_t alignment = (uint64_t)1 << (level_max - level_min);
+        bool region_empty = false;
+        auto align_region = [&](uint64_t &aBegin, uint64_t &aEnd, const uint64_t aDim) {
+            aEnd = std::min(aEnd, aDim);
+            region_empty |= (aBegin >= aEnd);
+            aBegin = (std::min(aBegin, aEnd)/alignment)*alignment;
+        };
+        align_region(region.y_begin, region.y_end, apr_access.org_dims[0]);
+        align_region(region.x_begin, region.x_end, apr_access.org_dims[1]);
+        align_region(region.z_begin, region.z_end, apr_access.org_dims[2]);
+        region.level_begin = std::max(region.level_begin, level_min);
+        region.level_end = std::min(region.level_end, level_max);
+
+        if (region_empty || (region.level_begin > region.level_end)) {
+            std::cerr << "Region of interest does not intersect the APR in [" << file_name << "]" << std::endl;
+            return false;
+        }
+
+        // ------------- block index ----------------------------
+        uint64_t z_block_size = 0;
+        MapStorageData map_data_full;
+        std::vector<uint64_t> block_row_begin, block_gap_begin, block_particle_begin;
+
+        if (H5Aexists(f.groupId, AprTypes::BlockZSizeType.typeName) > 0) {
+            readAttr(AprTypes::BlockZSizeType, f.groupId, &z_block_size);
+            uint64_t number_blocks = 1;
+            for (uint64_t level = level_min; level <= level_max; ++level) {
+                number_blocks += numberOfBlocks(apr_access.z_num[level], z_block_size);
+            }
+            block_row_begin.resize(number_blocks);
+            readData(AprTypes::BlockRowBeginType, f.objectId, block_row_begin.data());
+            block_gap_begin.resize(number_blocks);
+            readData(AprTypes::BlockGapBeginType, f.objectId, block_gap_begin.data());
+            block_particle_begin.resize(number_blocks);
+            readData(AprTypes::BlockParticleBeginType, f.objectId, block_particle_begin.data());
+        } else {
+            // no block index (file written by write_apr), the access data has to be read in full
+            readMapData(apr_access, f, map_data_full);
+            z_block_size = 1;
+            computeBlockIndex(apr_access, map_data_full, z_block_size, block_row_begin, block_gap_begin, block_particle_begin);
+        }
+
+        // ------------- read the blocks touched by the region ----
+        MapStorageData map_data;
+        std::vector<ImageType> intensities;
+        std::vector<uint8_t> types;
+        uint64_t number_particles = 0;
+        uint64_t level_block_begin = 0;
+
+        for (uint64_t level = level_min; level <= level_max; ++level) {
+            const uint64_t block_offset = level_block_begin;
+            level_block_begin += numberOfBlocks(apr_access.z_num[level], z_block_size);
+
+            if ((level < region.level_begin) || (level > region.level_end)) {
+                continue;
+            }
+
+            // region in particle cells of this level
+            const uint64_t step = level_max - level;
+            const uint64_t y_begin = region.y_begin >> step;
+            const uint64_t y_end = (region.y_end + ((uint64_t)1 << step) - 1) >> step;
+            const uint64_t x_begin = region.x_begin >> step;
+            const uint64_t x_end = (region.x_end + ((uint64_t)1 << step) - 1) >> step;
+            const uint64_t z_begin = region.z_begin >> step;
+            const uint64_t z_end = (region.z_end + ((uint64_t)1 << step) - 1) >> step;
+
+            const uint64_t block_first = block_offset + z_begin/z_block_size;
+            const uint64_t block_last = block_offset + (z_end - 1)/z_block_size + 1;
+
+            if (block_row_begin[block_first] == block_row_begin[block_last]) {
+                continue;
+            }
+
+            MapStorageData block;
+            readMapBlock(f, map_data_full, block_row_begin[block_first], block_row_begin[block_last],
+                         block_gap_begin[block_first], block_gap_begin[block_last], block_particle_begin[block_first], block);
+
+            // particles are read as one range per z-slice, then the parts inside the region are copied out
+            std::vector<std::pair<uint64_t,uint64_t>> particle_ranges;
+            std::vector<std::pair<uint64_t,uint64_t>> particle_copies;
+            uint64_t range_offset = 0;
+            uint64_t current_z = UINT64_MAX;
+            uint64_t gap = 0;
+
+            for (uint64_t row = 0; row < block.number_gaps.size(); ++row) {
+                const uint64_t number_gaps = block.number_gaps[row];
+                const uint64_t x = block.x[row];
+                const uint64_t z = block.z[row];
+
+                if ((z >= z_begin) && (z < z_end) && (x >= x_begin) && (x < x_end)) {
+                    uint16_t number_gaps_region = 0;
+
+                    for (uint64_t g = gap; g < (gap + number_gaps); ++g) {
+                        const uint64_t gap_begin = std::max((uint64_t)block.y_begin[g], y_begin);
+                        const uint64_t gap_end = std::min((uint64_t)block.y_end[g] + 1, y_end);
+                        if (gap_begin >= gap_end) {
+                            continue;
+                        }
+
+                        const uint64_t file_begin = block.global_index[g] + (gap_begin - block.y_begin[g]);
+                        const uint64_t file_end = file_begin + (gap_end - gap_begin);
+
+                        if (z != current_z) {
+                            if (particle_ranges.size() > 0) {
+                                range_offset += particle_ranges.back().second - particle_ranges.back().first;
+                            }
+                            particle_ranges.push_back({file_begin, file_end});
+                            current_z = z;
+                        } else {
+                            particle_ranges.back().second = file_end;
+                        }
+                        particle_copies.push_back({range_offset + (file_begin - particle_ranges.back().first), file_end - file_begin});
+
+                        map_data.y_begin.push_back(gap_begin - y_begin);
+                        map_data.y_end.push_back(gap_end - 1 - y_begin);
+                        map_data.global_index.push_back(number_particles);
+                        number_particles += file_end - file_begin;
+                        number_gaps_region++;
+                    }
+
+                    if (number_gaps_region > 0) {
+                        map_data.x.push_back(x - x_begin);
+                        map_data.z.push_back(z - z_begin);
+                        map_data.level.push_back(level);
+                        map_data.number_gaps.push_back(number_gaps_region);
+                    }
+                }
+                gap += number_gaps;
+            }
+
+            if (particle_ranges.empty()) {
+                continue;
+            }
+
+            const uint64_t buffer_size = range_offset + particle_ranges.back().second - particle_ranges.back().first;
+
+            std::vector<ImageType> intensity_buffer(buffer_size);
+            readDataRanges({Hdf5Type<ImageType>::type(), AprTypes::ParticleIntensitiesType}, f.objectId, intensity_buffer.data(), particle_ranges);
+            for (const auto &copy : particle_copies) {
+                intensities.insert(intensities.end(), intensity_buffer.begin() + copy.first, intensity_buffer.begin() + copy.first + copy.second);
+            }
+
+            // particle cell types are only stored below level_max
+            if (level < level_max) {
+                std::vector<uint8_t> type_buffer(buffer_size);
+                readDataRanges(AprTypes::ParticleCellType, f.objectId, type_buffer.data(), particle_ranges);
+                for (const auto &copy : particle_copies) {
+                    types.insert(types.end(), type_buffer.begin() + copy.first, type_buffer.begin() + copy.first + copy.second);
+                }
+            }
+        }
+
+        // ------------- set up the sub-APR ---------------------
+        apr_access.org_dims[0] = region.y_end - region.y_begin;
+        apr_access.org_dims[1] = region.x_end - region.x_begin;
+        apr_access.org_dims[2] = region.z_end - region.z_begin;
+
+        for (uint64_t level = level_min; level <= level_max; ++level) {
+            const uint64_t step = level_max - level;
+            apr_access.y_num[level] = (apr_access.org_dims[0] + ((uint64_t)1 << step) - 1) >> step;
+            apr_access.x_num[level] = (apr_access.org_dims[1] + ((uint64_t)1 << step) - 1) >> step;
+            apr_access.z_num[level] = (apr_access.org_dims[2] + ((uint64_t)1 << step) - 1) >> step;
+        }
+
+        apr_access.total_number_particles = intensities.size();
+        apr_access.total_number_gaps = map_data.y_begin.size();
+        apr_access.total_number_non_empty_rows = map_data.number_gaps.size();
+
+        apr.particles_intensities.data.swap(intensities);
+        apr_access.particle_cell_type.data.swap(types);
+
+        apr_access.gap_map = ExtraPartCellData<ParticleCellGapMap>();
+        apr_access.rebuild_map(apr, map_data);
+
+        // ------------ decompress if needed ---------------------
+        if (compress_type > 0) {
+            APRCompress<ImageType> apr_compress;
+            apr_compress.set_compression_type(compress_type);
+            apr_compress.set_quantization_factor(quantization_factor);
+            apr_compress.decompress(apr, apr.particles_intensities);
+        }
+
+        return true;
+    }
+
+    /**
+     * Writes the APR in the native (uncompressed, memory mappable) format, see APRNativeFormat.hpp and read_apr_native
+     */
+    template<typename ImageType>
+    float write_apr_native(APR<ImageType> &apr, const std::string &save_loc, const std::string &file_name) {
+        using namespace AprNative;
+
+        APRAccess &apr_access = apr.apr_access;
+        const std::string native_file_name = save_loc + file_name + ".apr";
+
+        // ------------- header -------------------------------
+        NativeHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, Magic, sizeof(Magic));
+        header.version = Version;
+        header.byte_order = ByteOrderMark;
+        header.header_size = sizeof(NativeHeader);
+        std::copy(apr_access.org_dims, apr_access.org_dims + 3, header.org_dims);
+        header.level_min = apr_access.level_min;
+        header.level_max = apr_access.level_max;
+        header.total_number_particles = apr_access.total_number_particles;
+        header.total_number_gaps = apr_access.total_number_gaps;
+        header.total_number_non_empty_rows = apr_access.total_number_non_empty_rows;
+        header.intensity_type = NativeType<ImageType>::id();
+        header.compress_type = 0;
+        header.quantization_factor = 1;
+        header.lambda = apr.parameters.lambda;
+        header.sigma_th = apr.parameters.sigma_th;
+        header.sigma_th_max = apr.parameters.sigma_th_max;
+        header.Ip_th = apr.parameters.Ip_th;
+        header.dx = apr.parameters.dx;
+        header.dy = apr.parameters.dy;
+        header.dz = apr.parameters.dz;
+        header.psfx = apr.parameters.psfx;
+        header.psfy = apr.parameters.psfy;
+        header.psfz = apr.parameters.psfz;
+        header.rel_error = apr.parameters.rel_error;
+        header.background_intensity_estimate = apr.parameters.background_intensity_estimate;
+        header.noise_sd_estimate = apr.parameters.noise_sd_estimate;
+        apr.name.copy(header.name, sizeof(header.name) - 1);
+
+        // ------------- sections -----------------------------
+        std::vector<NativeSection> sections;
+        std::vector<const void*> section_data;
+        auto add_section = [&](uint32_t aType, uint32_t aLevel, uint64_t aElementSize, uint64_t aNumberOfElements, const void *aData) {
+            sections.push_back({aType, aLevel, aElementSize, aNumberOfElements, 0});
+            section_data.push_back(aData);
+        };
+
+        add_section(ParticleIntensities, 0, sizeof(ImageType), apr.particles_intensities.data.size(), apr.particles_intensities.data.data());
+        add_section(ParticleCellType, 0, sizeof(uint8_t), apr_access.particle_cell_type.data.size(), apr_access.particle_cell_type.data.data());
+        add_section(LevelXNum, 0, sizeof(uint64_t), apr_access.x_num.size(), apr_access.x_num.data());
+        add_section(LevelYNum, 0, sizeof(uint64_t), apr_access.y_num.size(), apr_access.y_num.data());
+        add_section(LevelZNum, 0, sizeof(uint64_t), apr_access.z_num.size(), apr_access.z_num.data());
+
+        // the flat (CSR) gap storage of each level, built from the flattened access structure (ordered by level, z, x)
+        MapStorageData map_data;
+        apr_access.flatten_structure(apr, map_data);
+
+        std::vector<std::vector<uint64_t>> row_begin(apr_access.level_max + 1);
+        uint64_t row = 0;
+        uint64_t gap = 0;
+
+        for (uint64_t level = apr_access.level_min; level <= apr_access.level_max; ++level) {
+            const uint64_t x_num = apr_access.x_num[level];
+            const uint64_t level_gap_begin = gap;
+
+            row_begin[level].assign(x_num*apr_access.z_num[level] + 1, 0);
+            for (; (row < map_data.level.size()) && (map_data.level[row] == level); ++row) {
+                row_begin[level][x_num*map_data.z[row] + map_data.x[row] + 1] = map_data.number_gaps[row];
+                gap += map_data.number_gaps[row];
+            }
+            std::partial_sum(row_begin[level].begin(), row_begin[level].end(), row_begin[level].begin());
+
+            add_section(RowBegin, level, sizeof(uint64_t), row_begin[level].size(), row_begin[level].data());
+            add_section(GapYBegin, level, sizeof(uint16_t), gap - level_gap_begin, map_data.y_begin.data() + level_gap_begin);
+            add_section(GapYEnd, level, sizeof(uint16_t), gap - level_gap_begin, map_data.y_end.data() + level_gap_begin);
+            add_section(GapGlobalIndex, level, sizeof(uint64_t), gap - level_gap_begin, map_data.global_index.data() + level_gap_begin);
+            const MappedVector<uint64_t> &row_end = apr_access.global_index_by_level_and_zx_end[level];
+            add_section(RowEnd, level, sizeof(uint64_t), row_end.size(), row_end.data());
+        }
+
+        header.number_sections = sections.size();
+        uint64_t offset = align(sizeof(NativeHeader) + sections.size()*sizeof(NativeSection));
+        for (auto &section : sections) {
+            section.offset = offset;
+            offset = align(offset + section.element_size*section.number_elements);
+        }
+
+        // ------------- write ---------------------------------
+        std::ofstream file(native_file_name, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            std::cerr << "Could not create file [" << native_file_name << "]" << std::endl;
+            return 0;
+        }
+
+        file.write((const char*)&header, sizeof(header));
+        file.write((const char*)sections.data(), sections.size()*sizeof(NativeSection));
+
+        const std::vector<char> padding(NativeAlignment, 0);
+        for (size_t i = 0; i < sections.size(); ++i) {
+            file.write(padding.data(), sections[i].offset - file.tellp());
+            file.write((const char*)section_data[i], sections[i].element_size*sections[i].number_elements);
+        }
+
+        const double sizeMB = file.tellp()/1e6;
+        std::cout << "Native Filesize: " << sizeMB << " MB\n" << "Writing Complete" << std::endl;
+        return sizeMB;
+    }
+
+    /**
+     * Opens an APR written by write_apr_native, the (flat) access structure views the memory mapped file (see
+     * read_apr_native below) and the particle intensities are copied to apr.particles_intensities.
+     */
+    template<typename ImageType>
+    bool read_apr_native(APR<ImageType> &apr, const std::string &file_name) {
+        MappedParticleData<ImageType> particles;
+        if (!read_apr_native(apr, file_name, particles)) {
+            return false;
+        }
+        particles.copy_to(apr.particles_intensities);
+        return true;
+    }
+
+    /**
+     * Opens an APR written by write_apr_native. The file is memory mapped (read only) and the (flat) access structure and
+     * the particle intensities (in particles, apr.particles_intensities is left empty) view directly into the mapping
+     * without copying, the pages are shared between processes opening the same file. Only the particle cell types and
+     * the per level sizes are copied. The views are read only (see MappedVector::detach), the file is never written.
+     */
+    template<typename ImageType>
+    bool read_apr_native(APR<ImageType> &apr, const std::string &file_name, MappedParticleData<ImageType> &particles) {
+        using namespace AprNative;
+
+        uint64_t file_size;
+        std::shared_ptr<const char> mapping = map_file(file_name, file_size);
+        if (!mapping) {
+            std::cerr << "Could not open file [" << file_name << "]" << std::endl;
+            return false;
+        }
+
+        // ------------- check header ---------------------------
+        NativeHeader header;
+        if (file_size < sizeof(NativeHeader)) {
+            std::cerr << "File [" << file_name << "] is not a native APR file" << std::endl;
+            return false;
+        }
+        std::memcpy(&header, mapping.get(), sizeof(header));
+
+        if (std::memcmp(header.magic, Magic, sizeof(Magic)) != 0 || header.byte_order != ByteOrderMark ||
+            header.header_size != sizeof(NativeHeader) || file_size < sizeof(NativeHeader) + header.number_sections*sizeof(NativeSection)) {
+            std::cerr << "File [" << file_name << "] is not a native APR file (or was written on a machine with different byte order)" << std::endl;
+            return false;
+        }
+        if (header.version > Version) {
+            std::cerr << "File [" << file_name << "] has unsupported version " << header.version << std::endl;
+            return false;
+        }
+        if (header.intensity_type != NativeType<ImageType>::id()) {
+            std::cerr << "Particle type of file [" << file_name << "] does not match the APR" << std::endl;
+            return false;
+        }
+
+        const NativeSection *sections = (const NativeSection*)(mapping.get() + sizeof(NativeHeader));
+        for (uint64_t i = 0; i < header.number_sections; ++i) {
+            if ((sections[i].offset + sections[i].element_size*sections[i].number_elements > file_size) || (sections[i].level > header.level_max)) {
+                std::cerr << "File [" << file_name << "] is truncated or corrupted" << std::endl;
+                return false;
+            }
+        }
+
+        // ------------- metadata -------------------------------
+        APRAccess &apr_access = apr.apr_access;
+        apr.name = std::string(header.name, strnlen(header.name, sizeof(header.name)));
+        std::copy(header.org_dims, header.org_dims + 3, apr_access.org_dims);
+        apr_access.level_min = header.level_min;
+        apr_access.level_max = header.level_max;
+        apr_access.total_number_particles = header.total_number_particles;
+        apr_access.total_number_gaps = header.total_number_gaps;
+        apr_access.total_number_non_empty_rows = header.total_number_non_empty_rows;
+        apr.parameters.lambda = header.lambda;
+        apr.parameters.sigma_th = header.sigma_th;
+        apr.parameters.sigma_th_max = header.sigma_th_max;
+        apr.parameters.Ip_th = header.Ip_th;
+        apr.parameters.dx = header.dx;
+        apr.parameters.dy = header.dy;
+        apr.parameters.dz = header.dz;
+        apr.parameters.psfx = header.psfx;
+        apr.parameters.psfy = header.psfy;
+        apr.parameters.psfz = header.psfz;
+        apr.parameters.rel_error = header.rel_error;
+        apr.parameters.background_intensity_estimate = header.background_intensity_estimate;
+        apr.parameters.noise_sd_estimate = header.noise_sd_estimate;
+
+        // ------------- view the data --------------------------
+        apr_access.gap_map = ExtraPartCellData<ParticleCellGapMap>();
+        apr_access.flat_map.clear();
+        apr_access.flat_map.resize(apr_access.level_max + 1);
+        apr_access.use_flat_map = true;
+        apr_access.global_index_by_level_and_zx_end.clear();
+        apr_access.global_index_by_level_and_zx_end.resize(apr_access.level_max + 1);
+        apr.particles_intensities.data.clear();
+        particles.data.clear();
+
+        bool success = true;
+        for (uint64_t i = 0; i < header.number_sections; ++i) {
+            const NativeSection &section = sections[i];
+            const char *data = mapping.get() + section.offset;
+
+            auto view = [&](auto &aVector) {
+                typedef typename std::remove_reference<decltype(aVector)>::type::value_type T;
+                if (section.element_size != sizeof(T)) { success = false; return; }
+                aVector.view((const T*)data, section.number_elements, mapping);
+            };
+            auto copy = [&](auto &aVector) {
+                typedef typename std::remove_reference<decltype(aVector)>::type::value_type T;
+                if (section.element_size != sizeof(T)) { success = false; return; }
+                aVector.assign((const T*)data, (const T*)data + section.number_elements);
+            };
+
+            switch (section.type) {
+                case ParticleIntensities: view(particles.data); break;
+                case ParticleCellType: copy(apr_access.particle_cell_type.data); break;
+                case LevelXNum: copy(apr_access.x_num); break;
+                case LevelYNum: copy(apr_access.y_num); break;
+                case LevelZNum: copy(apr_access.z_num); break;
+                case RowBegin: view(apr_access.flat_map[section.level].row_begin); break;
+                case GapYBegin: view(apr_access.flat_map[section.level].y_begin); break;
+                case GapYEnd: view(apr_access.flat_map[section.level].y_end); break;
+                case GapGlobalIndex: view(apr_access.flat_map[section.level].global_index_begin); break;
+                case RowEnd: view(apr_access.global_index_by_level_and_zx_end[section.level]); break;
+                default: break; // sections added by later versions
+            }
+        }
+
+        if (!success || apr_access.x_num.size() != (apr_access.level_max + 1)) {
+            std::cerr << "File [" << file_name << "] is corrupted" << std::endl;
+            return false;
+        }
+
+        apr_access.set_iteration_helpers_from_row_ends();
+
+        return true;
+    }
+
     template<typename ImageType>
     void write_apr(APR<ImageType>& apr, const std::string &save_loc, const std::string &file_name) {
         APRCompress<ImageType> apr_compressor;
@@ -180,11 +597,26 @@ public:
         write_apr(apr, save_loc, file_name, apr_compressor);
     }
 
+    /**
+     * Writes the APR in the block indexed layout: the particle and access data is stored in small chunks and an index
+     * of where each block of z_block_size z-slices (per level) starts is added to the file, allowing read_apr_region
+     * to only read and decompress the parts of the file covering a region of interest. The file remains readable by read_apr.
+     */
+    template<typename ImageType>
+    float write_apr_blocked(APR<ImageType>& apr, const std::string &save_loc, const std::string &file_name, uint64_t z_block_size = 16, uint64_t chunk_size = 16384) {
+        APRCompress<ImageType> apr_compressor;
+        apr_compressor.set_compression_type(0);
+        return write_apr(apr, save_loc, file_name, apr_compressor, BLOSC_ZSTD, 2, 1, z_block_size, chunk_size);
+    }
+
     /**
      * Writes the APR to the particle cell structure sparse format, using the p_map for reconstruction
+     *
+     * z_block_size > 0 additionally writes the block index used by read_apr_region, chunk_size sets the number of
+     * elements per HDF5 chunk of the datasets.
      */
     template<typename ImageType>
-    float write_apr(APR<ImageType> &apr, const std::string &save_loc, const std::string &file_name, APRCompress<ImageType> &apr_compressor, unsigned int blosc_comp_type = BLOSC_ZSTD, unsigned int blosc_comp_level = 2, unsigned int blosc_shuffle=1) {
+    float write_apr(APR<ImageType> &apr, const std::string &save_loc, const std::string &file_name, APRCompress<ImageType> &apr_compressor, unsigned int blosc_comp_type = BLOSC_ZSTD, unsigned int blosc_comp_level = 2, unsigned int blosc_shuffle=1, uint64_t z_block_size = 0, uint64_t chunk_size = 100000) {
         APRTimer write_timer;
         write_timer.verbose_flag = false;
 
@@ -231,7 +663,7 @@ public:
             apr_compressor.compress(apr,apr.particles_intensities);
         }
         hid_t type = Hdf5Type<ImageType>::type();
-        writeData({type, AprTypes::ParticleIntensitiesType}, f.objectId, apr.particles_intensities.data, blosc_comp_type, blosc_comp_level, blosc_shuffle);
+        writeData({type, AprTypes::ParticleIntensitiesType}, f.objectId, apr.particles_intensities.data, blosc_comp_type, blosc_comp_level, blosc_shuffle, chunk_size);
         write_timer.stop_timer();
 
         write_timer.start_timer("access_data");
@@ -246,15 +678,25 @@ public:
         std::vector<uint16_t> index_delta;
         index_delta.resize(map_data.global_index.size());
         std::adjacent_difference(map_data.global_index.begin(),map_data.global_index.end(),index_delta.begin());
-        writeData(AprTypes::MapGlobalIndexType, f.objectId, index_delta, blosc_comp_type, blosc_comp_level, blosc_shuffle);
-
-        writeData(AprTypes::MapYendType, f.objectId, map_data.y_end, blosc_comp_type, blosc_comp_level, blosc_shuffle);
-        writeData(AprTypes::MapYbeginType, f.objectId, map_data.y_begin, blosc_comp_type, blosc_comp_level, blosc_shuffle);
-        writeData(AprTypes::MapNumberGapsType, f.objectId, map_data.number_gaps, blosc_comp_type, blosc_comp_level, blosc_shuffle);
-        writeData(AprTypes::MapLevelType, f.objectId, map_data.level, blosc_comp_type, blosc_comp_level, blosc_shuffle);
-        writeData(AprTypes::MapXType, f.objectId, map_data.x, blosc_comp_type, blosc_comp_level, blosc_shuffle);
-        writeData(AprTypes::MapZType, f.objectId, map_data.z, blosc_comp_type, blosc_comp_level, blosc_shuffle);
-        writeData(AprTypes::ParticleCellType, f.objectId, apr.apr_access.particle_cell_type.data, blosc_comp_type, blosc_comp_level, blosc_shuffle);
+        writeData(AprTypes::MapGlobalIndexType, f.objectId, index_delta, blosc_comp_type, blosc_comp_level, blosc_shuffle, chunk_size);
+
+        writeData(AprTypes::MapYendType, f.objectId, map_data.y_end, blosc_comp_type, blosc_comp_level, blosc_shuffle, chunk_size);
+        writeData(AprTypes::MapYbeginType, f.objectId, map_data.y_begin, blosc_comp_type, blosc_comp_level, blosc_shuffle, chunk_size);
+        writeData(AprTypes::MapNumberGapsType, f.objectId, map_data.number_gaps, blosc_comp_type, blosc_comp_level, blosc_shuffle, chunk_size);
+        writeData(AprTypes::MapLevelType, f.objectId, map_data.level, blosc_comp_type, blosc_comp_level, blosc_shuffle, chunk_size);
+        writeData(AprTypes::MapXType, f.objectId, map_data.x, blosc_comp_type, blosc_comp_level, blosc_shuffle, chunk_size);
+        writeData(AprTypes::MapZType, f.objectId, map_data.z, blosc_comp_type, blosc_comp_level, blosc_shuffle, chunk_size);
+        writeData(AprTypes::ParticleCellType, f.objectId, apr.apr_access.particle_cell_type.data, blosc_comp_type, blosc_comp_level, blosc_shuffle, chunk_size);
+
+        if (z_block_size > 0) {
+            std::vector<uint64_t> block_row_begin, block_gap_begin, block_particle_begin;
+            computeBlockIndex(apr.apr_access, map_data, z_block_size, block_row_begin, block_gap_begin, block_particle_begin);
+
+            writeAttr(AprTypes::BlockZSizeType, f.groupId, &z_block_size);
+            writeData(AprTypes::BlockRowBeginType, f.objectId, block_row_begin, blosc_comp_type, blosc_comp_level, blosc_shuffle);
+            writeData(AprTypes::BlockGapBeginType, f.objectId, block_gap_begin, blosc_comp_type, blosc_comp_level, blosc_shuffle);
+            writeData(AprTypes::BlockParticleBeginType, f.objectId, block_particle_begin, blosc_comp_type, blosc_comp_level, blosc_shuffle);
+        }
         write_timer.stop_timer();
 
         for (size_t i = apr.level_min(); i <apr.level_max() ; ++i) {
@@ -269,6 +711,7 @@ public:
         // ------------- output the file size -------------------
         hsize_t file_size = f.getFileSize();
         double sizeMB = file_size / 1e6;
+
         std::cout << "HDF5 Filesize: " << sizeMB << " MB\n" << "Writing Complete" << std::endl;
         return sizeMB;
     }
@@ -371,6 +814,93 @@ public:
         readData(AprTypes::ExtraParticleDataType, f.objectId, extra_parts.data.data());
     }
 
+    /**
+     * Writes only the particle data given in a particle ordering, the file is written in the canonical order (and can
+     * be read with or without an ordering).
+     */
+    template<typename S>
+    float write_particles_only(const std::string &save_loc, const std::string &file_name, const ExtraParticleData<S> &parts_extra, const APRParticleOrder &particle_order) {
+        if (particle_order.is_canonical()) return write_particles_only(save_loc, file_name, parts_extra);
+
+        ExtraParticleData<S> canonical_parts;
+        particle_order.to_canonical(parts_extra, canonical_parts);
+        return write_particles_only(save_loc, file_name, canonical_parts);
+    }
+
+    /**
+     * Reads particle data into the given particle ordering
+     */
+    template<typename T>
+    void read_parts_only(const std::string &aFileName, ExtraParticleData<T>& extra_parts, const APRParticleOrder &particle_order) {
+        if (particle_order.is_canonical()) {
+            read_parts_only(aFileName, extra_parts);
+            return;
+        }
+
+        ExtraParticleData<T> canonical_parts;
+        read_parts_only(aFileName, canonical_parts);
+        particle_order.to_ordered(canonical_parts, extra_parts);
+    }
+
+    /**
+     * Writes only the multi-channel particle data (in its layout), requires the same APR to be read in correctly.
+     */
+    template<typename S>
+    float write_particles_only(const std::string &save_loc, const std::string &file_name, const MultiChannelParticleData<S> &parts_extra) {
+        std::string hdf5_file_name = save_loc + file_name + "_apr_extra_parts.h5";
+
+        AprFile f{hdf5_file_name, AprFile::Operation::WRITE};
+        if (!f.isOpened()) return 0;
+
+        // ------------- write metadata -------------------------
+        uint64_t total_number_parts = parts_extra.total_number_particles();
+        uint64_t number_channels = parts_extra.total_number_channels();
+        uint64_t layout = (uint64_t) parts_extra.layout();
+        writeAttr(AprTypes::TotalNumberOfParticlesType, f.groupId, &total_number_parts);
+        writeAttr(AprTypes::NumberOfChannelsType, f.groupId, &number_channels);
+        writeAttr(AprTypes::ChannelLayoutType, f.groupId, &layout);
+        writeString(AprTypes::GitType, f.groupId, ConfigAPR::APR_GIT_HASH);
+
+        // ------------- write data ----------------------------
+        unsigned int blosc_comp_type = BLOSC_ZSTD;
+        unsigned int blosc_comp_level = 3;
+        unsigned int blosc_shuffle = 2;
+        hid_t type = Hdf5Type<S>::type();
+        writeData({type, AprTypes::ExtraParticleDataType}, f.objectId, parts_extra.data, blosc_comp_type, blosc_comp_level, blosc_shuffle);
+
+        // ------------- output the file size -------------------
+        hsize_t file_size = f.getFileSize();
+        std::cout << "HDF5 Filesize: " << file_size/1e6 << " MB" << std::endl;
+        std::cout << "Writing MultiChannelParticleData Complete" << std::endl;
+
+        return file_size/1e6; //returns file size in MB
+    }
+
+    /**
+     * Reads multi-channel particle data (in the layout it was written), files written from ExtraParticleData are read as one channel
+     */
+    template<typename T>
+    void read_parts_only(const std::string &aFileName, MultiChannelParticleData<T>& extra_parts) {
+        AprFile f{aFileName, AprFile::Operation::READ};
+        if (!f.isOpened()) return;
+
+        // ------------- read metadata --------------------------
+        uint64_t numberOfParticles;
+        readAttr(AprTypes::TotalNumberOfParticlesType, f.groupId, &numberOfParticles);
+        uint64_t numberOfChannels = 1;
+        if (H5Aexists(f.groupId, AprTypes::NumberOfChannelsType.typeName) > 0) {
+            readAttr(AprTypes::NumberOfChannelsType, f.groupId, &numberOfChannels);
+        }
+        uint64_t layout = (uint64_t) ChannelLayout::Interleaved;
+        if (H5Aexists(f.groupId, AprTypes::ChannelLayoutType.typeName) > 0) {
+            readAttr(AprTypes::ChannelLayoutType, f.groupId, &layout);
+        }
+
+        // ------------- read data -----------------------------
+        extra_parts.init(numberOfParticles, numberOfChannels, (ChannelLayout) layout);
+        readData(AprTypes::ExtraParticleDataType, f.objectId, extra_parts.data.data());
+    }
+
 private:
     struct AprFile {
         enum class Operation {READ, WRITE};
@@ -422,6 +952,164 @@ private:
         }
     };
 
+    template<typename ImageType>
+    void readMetadata(APR<ImageType>& apr, const AprFile &f, uint64_t &type_size, int &compress_type, float &quantization_factor) {
+        char string_out[100] = {0};
+        hid_t attr_id = H5Aopen(f.groupId,"name",H5P_DEFAULT);
+        hid_t atype = H5Aget_type(attr_id);
+        hid_t atype_mem = H5Tget_native_type(atype, H5T_DIR_ASCEND);
+        H5Aread(attr_id, atype_mem, string_out) ;
+        H5Aclose(attr_id);
+        apr.name= string_out;
+
+        readAttr(AprTypes::TotalNumberOfParticlesType, f.groupId, &apr.apr_access.total_number_particles);
+        readAttr(AprTypes::TotalNumberOfGapsType, f.groupId, &apr.apr_access.total_number_gaps);
+        readAttr(AprTypes::TotalNumberOfNonEmptyRowsType, f.groupId, &apr.apr_access.total_number_non_empty_rows);
+        readAttr(AprTypes::VectorSizeType, f.groupId, &type_size);
+        readAttr(AprTypes::NumberOfYType, f.groupId, &apr.apr_access.org_dims[0]);
+        readAttr(AprTypes::NumberOfXType, f.groupId, &apr.apr_access.org_dims[1]);
+        readAttr(AprTypes::NumberOfZType, f.groupId, &apr.apr_access.org_dims[2]);
+        readAttr(AprTypes::MaxLevelType, f.groupId, &apr.apr_access.level_max);
+        readAttr(AprTypes::MinLevelType, f.groupId, &apr.apr_access.level_min);
+        readAttr(AprTypes::LambdaType, f.groupId, &apr.parameters.lambda);
+        readAttr(AprTypes::CompressionType, f.groupId, &compress_type);
+        readAttr(AprTypes::QuantizationFactorType, f.groupId, &quantization_factor);
+        readAttr(AprTypes::SigmaThType, f.groupId, &apr.parameters.sigma_th);
+        readAttr(AprTypes::SigmaThMaxType, f.groupId, &apr.parameters.sigma_th_max);
+        readAttr(AprTypes::IthType, f.groupId, &apr.parameters.Ip_th);
+        readAttr(AprTypes::DxType, f.groupId, &apr.parameters.dx);
+        readAttr(AprTypes::DyType, f.groupId, &apr.parameters.dy);
+        readAttr(AprTypes::DzType, f.groupId, &apr.parameters.dz);
+        readAttr(AprTypes::PsfXType, f.groupId, &apr.parameters.psfx);
+        readAttr(AprTypes::PsfYType, f.groupId, &apr.parameters.psfy);
+        readAttr(AprTypes::PsfZType, f.groupId, &apr.parameters.psfz);
+        readAttr(AprTypes::RelativeErrorType, f.groupId, &apr.parameters.rel_error);
+        readAttr(AprTypes::BackgroundIntensityEstimateType, f.groupId, &apr.parameters.background_intensity_estimate);
+        readAttr(AprTypes::NoiseSdEstimateType, f.groupId, &apr.parameters.noise_sd_estimate);
+
+        apr.apr_access.x_num.resize(apr.apr_access.level_max+1);
+        apr.apr_access.y_num.resize(apr.apr_access.level_max+1);
+        apr.apr_access.z_num.resize(apr.apr_access.level_max+1);
+
+        for (size_t i = apr.apr_access.level_min;i < apr.apr_access.level_max; i++) {
+            int x_num, y_num, z_num;
+            //TODO: x_num and other should have HDF5 type uint64?
+            readAttr(AprTypes::NumberOfLevelXType, i, f.groupId, &x_num);
+            readAttr(AprTypes::NumberOfLevelYType, i, f.groupId, &y_num);
+            readAttr(AprTypes::NumberOfLevelZType, i, f.groupId, &z_num);
+            apr.apr_access.x_num[i] = x_num;
+            apr.apr_access.y_num[i] = y_num;
+            apr.apr_access.z_num[i] = z_num;
+        }
+        apr.apr_access.y_num[apr.apr_access.level_max] = apr.apr_access.org_dims[0];
+        apr.apr_access.x_num[apr.apr_access.level_max] = apr.apr_access.org_dims[1];
+        apr.apr_access.z_num[apr.apr_access.level_max] = apr.apr_access.org_dims[2];
+    }
+
+    void readMapData(APRAccess &apr_access, const AprFile &f, MapStorageData &map_data) {
+        map_data.global_index.resize(apr_access.total_number_gaps);
+
+        // global index is stored as (unsigned) 16 bit differences between consecutive gaps
+        std::vector<int16_t> index_delta(apr_access.total_number_gaps);
+        readData(AprTypes::MapGlobalIndexType, f.objectId, index_delta.data());
+        std::vector<uint64_t> index_delta_big(apr_access.total_number_gaps);
+        std::transform(index_delta.begin(),index_delta.end(),index_delta_big.begin(),[](const int16_t delta){return (uint16_t)delta;});
+        std::partial_sum(index_delta_big.begin(), index_delta_big.end(), map_data.global_index.begin());
+
+        map_data.y_end.resize(apr_access.total_number_gaps);
+        readData(AprTypes::MapYendType, f.objectId, map_data.y_end.data());
+        map_data.y_begin.resize(apr_access.total_number_gaps);
+        readData(AprTypes::MapYbeginType, f.objectId, map_data.y_begin.data());
+        map_data.number_gaps.resize(apr_access.total_number_non_empty_rows);
+        readData(AprTypes::MapNumberGapsType, f.objectId, map_data.number_gaps.data());
+        map_data.level.resize(apr_access.total_number_non_empty_rows);
+        readData(AprTypes::MapLevelType, f.objectId, map_data.level.data());
+        map_data.x.resize(apr_access.total_number_non_empty_rows);
+        readData(AprTypes::MapXType, f.objectId, map_data.x.data());
+        map_data.z.resize(apr_access.total_number_non_empty_rows);
+        readData(AprTypes::MapZType, f.objectId, map_data.z.data());
+    }
+
+    static uint64_t numberOfBlocks(const uint64_t aNumberOfZ, const uint64_t aZBlockSize) {
+        return (aNumberOfZ + aZBlockSize - 1)/aZBlockSize;
+    }
+
+    /**
+     * Computes, for every block of z_block_size z-slices of every level, the first (non-empty) row, gap and particle
+     * in the block. A final entry holds the totals, so block b spans [begin[b], begin[b+1]).
+     */
+    void computeBlockIndex(const APRAccess &apr_access, const MapStorageData &map_data, const uint64_t z_block_size, std::vector<uint64_t> &row_begin, std::vector<uint64_t> &gap_begin, std::vector<uint64_t> &particle_begin) {
+        row_begin.clear();
+        gap_begin.clear();
+        particle_begin.clear();
+
+        const uint64_t number_rows = map_data.number_gaps.size();
+        const uint64_t number_gaps = map_data.y_begin.size();
+        uint64_t row = 0;
+        uint64_t gap = 0;
+
+        for (uint64_t level = apr_access.level_min; level <= apr_access.level_max; ++level) {
+            const uint64_t number_blocks = numberOfBlocks(apr_access.z_num[level], z_block_size);
+
+            for (uint64_t block = 0; block < number_blocks; ++block) {
+                while ((row < number_rows) && ((map_data.level[row] < level) || ((map_data.level[row] == level) && (map_data.z[row] < block*z_block_size)))) {
+                    gap += map_data.number_gaps[row];
+                    row++;
+                }
+                row_begin.push_back(row);
+                gap_begin.push_back(gap);
+                particle_begin.push_back((gap < number_gaps) ? map_data.global_index[gap] : apr_access.total_number_particles);
+            }
+        }
+
+        row_begin.push_back(number_rows);
+        gap_begin.push_back(number_gaps);
+        particle_begin.push_back(apr_access.total_number_particles);
+    }
+
+    /**
+     * Gets the rows [row_begin, row_end) and gaps [gap_begin, gap_end) of the access data, either from the file or, if
+     * it has been read in full, from map_data_full.
+     */
+    void readMapBlock(const AprFile &f, const MapStorageData &map_data_full, uint64_t row_begin, uint64_t row_end, uint64_t gap_begin, uint64_t gap_end, uint64_t particle_begin, MapStorageData &block) {
+        if (map_data_full.number_gaps.size() > 0) {
+            block.x.assign(map_data_full.x.begin() + row_begin, map_data_full.x.begin() + row_end);
+            block.z.assign(map_data_full.z.begin() + row_begin, map_data_full.z.begin() + row_end);
+            block.number_gaps.assign(map_data_full.number_gaps.begin() + row_begin, map_data_full.number_gaps.begin() + row_end);
+            block.y_begin.assign(map_data_full.y_begin.begin() + gap_begin, map_data_full.y_begin.begin() + gap_end);
+            block.y_end.assign(map_data_full.y_end.begin() + gap_begin, map_data_full.y_end.begin() + gap_end);
+            block.global_index.assign(map_data_full.global_index.begin() + gap_begin, map_data_full.global_index.begin() + gap_end);
+            return;
+        }
+
+        const std::vector<std::pair<uint64_t,uint64_t>> rows = {{row_begin, row_end}};
+        const std::vector<std::pair<uint64_t,uint64_t>> gaps = {{gap_begin, gap_end}};
+
+        block.x.resize(row_end - row_begin);
+        readDataRanges(AprTypes::MapXType, f.objectId, block.x.data(), rows);
+        block.z.resize(row_end - row_begin);
+        readDataRanges(AprTypes::MapZType, f.objectId, block.z.data(), rows);
+        block.number_gaps.resize(row_end - row_begin);
+        readDataRanges(AprTypes::MapNumberGapsType, f.objectId, block.number_gaps.data(), rows);
+        block.y_begin.resize(gap_end - gap_begin);
+        readDataRanges(AprTypes::MapYbeginType, f.objectId, block.y_begin.data(), gaps);
+        block.y_end.resize(gap_end - gap_begin);
+        readDataRanges(AprTypes::MapYendType, f.objectId, block.y_end.data(), gaps);
+
+        // the global index differences are relative to the previous gap, the first gap of a block starts at the
+        // particle stored in the block index
+        std::vector<int16_t> index_delta(gap_end - gap_begin);
+        readDataRanges(AprTypes::MapGlobalIndexType, f.objectId, index_delta.data(), gaps);
+        block.global_index.resize(gap_end - gap_begin);
+        uint64_t global_index = particle_begin;
+        for (uint64_t i = 0; i < index_delta.size(); ++i) {
+            if (i > 0) {
+                global_index += (uint16_t)index_delta[i];
+            }
+            block.global_index[i] = global_index;
+        }
+    }
+
     void readAttr(const AprType &aType, hid_t aGroupId, void *aDest) {
         hid_t attr_id = H5Aopen(aGroupId, aType.typeName, H5P_DEFAULT);
         H5Aread(attr_id, aType.hdf5type, aDest);
@@ -446,18 +1134,22 @@ private:
     }
 
     void readData(const AprType &aType, hid_t aObjectId, void *aDest) {
-        hdf5_load_data_blosc(aObjectId, aType.hdf5type, aDest, aType.typeName);
+        hdf5_load_data_blosc(aObjectId, aType.hdf5type, aDest, aType.typeName, direct_chunk_io);
     }
 
     void readData(const char * const aAprTypeName, hid_t aObjectId, void *aDest) {
-        hdf5_load_data_blosc(aObjectId, aDest, aAprTypeName);
+        hdf5_load_data_blosc(aObjectId, aDest, aAprTypeName, direct_chunk_io);
+    }
+
+    void readDataRanges(const AprType &aType, hid_t aObjectId, void *aDest, const std::vector<std::pair<uint64_t,uint64_t>> &aRanges) {
+        hdf5_load_data_blosc_ranges(aObjectId, aType.hdf5type, aDest, aType.typeName, aRanges);
     }
 
     template<typename T>
-    void writeData(const AprType &aType, hid_t aObjectId, T aContainer, unsigned int blosc_comp_type, unsigned int blosc_comp_level,unsigned int blosc_shuffle) {
+    void writeData(const AprType &aType, hid_t aObjectId, const T &aContainer, unsigned int blosc_comp_type, unsigned int blosc_comp_level,unsigned int blosc_shuffle,uint64_t chunk_size = 100000) {
         hsize_t dims[] = {aContainer.size()};
         const hsize_t rank = 1;
-        hdf5_write_data_blosc(aObjectId, aType.hdf5type, aType.typeName, rank, dims, aContainer.data(), blosc_comp_type, blosc_comp_level, blosc_shuffle);
+        hdf5_write_data_blosc(aObjectId, aType.hdf5type, aType.typeName, rank, dims, aContainer.data(), blosc_comp_type, blosc_comp_level, blosc_shuffle, chunk_size, direct_chunk_io);
     }
 
     void writeString(AprType aTypeName, hid_t aGroupId, const std::string &aValue) {
@@ -210,6 +210,34 @@ namespace TiffUtils {
         aInputMesh.x_num = aTiff.iImgHeight;
     }
 
+    /**
+     * Reads a range of z-slices (directories) [aZbegin, aZend) of a TIFF file to mesh
+     * @tparam T type of mesh/image (uint8_t, uint16_t, float)
+     * @param aTiff TiffInfo class with opened image
+     * @param aZbegin first slice to read
+     * @param aZend one past the last slice to read
+     * @return mesh with the slices or empty mesh if reading file failed
+     */
+    template<typename T>
+    MeshData<T> getMeshSlab(const TiffInfo &aTiff, size_t aZbegin, size_t aZend) {
+        if (!aTiff.isFileOpened() || aZbegin >= aZend || aZend > aTiff.iNumberOfDirectories) return MeshData<T>();
+
+        // x and y are exchanged giving transpose w.r.t. original file (as in getMesh)
+        MeshData<T> mesh(aTiff.iImgWidth, aTiff.iImgHeight, aZend - aZbegin);
+
+        size_t currentOffset = 0;
+        for (size_t i = aZbegin; i < aZend; ++i) {
+            TIFFSetDirectory(aTiff.iFile, i);
+
+            for (tstrip_t strip = 0; strip < TIFFNumberOfStrips(aTiff.iFile); ++strip) {
+                int64_t readLen = TIFFReadEncodedStrip(aTiff.iFile, strip, (&mesh.mesh[0] + currentOffset), (tsize_t) -1 /* read as much as possible */);
+                currentOffset += readLen/sizeof(T);
+            }
+        }
+
+        return mesh;
+    }
+
     /**
      * Saves provided mesh as a TIFF file
      * @tparam T handled types are uint8_t, uint16_t and float
@@ -9,6 +9,170 @@
 //////////////////////////////////////////
 
 #include "hdf5functions_blosc.h"
+extern "C" {
+    #include "blosc.h"
+}
+#include <cstring>
+#ifdef HAVE_OPENMP
+    #include "omp.h"
+#endif
+
+/**
+ * Number of chunks (de)compressed in parallel before they are written (read) serially
+ */
+static uint64_t chunk_batch_size(){
+#ifdef HAVE_OPENMP
+    return 4*omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+#if H5_VERSION_GE(1,10,3)
+/**
+ * reads a blosc compressed 1D dataset by reading the raw chunks and decompressing them in parallel, returns false if the
+ * dataset can not be read this way (it is then read through the filter pipeline)
+ */
+static bool hdf5_read_chunks_blosc(hid_t data_id, hid_t dataType, void* buff) {
+    // the chunks are decompressed straight into buff, so no type conversion is possible
+    hid_t file_type = H5Dget_type(data_id);
+    const bool same_type = H5Tequal(file_type, dataType) > 0;
+    const size_t type_size = H5Tget_size(file_type);
+    H5Tclose(file_type);
+
+    hid_t space_id = H5Dget_space(data_id);
+    hsize_t number_elements = 0;
+    const bool is_1d = (H5Sget_simple_extent_ndims(space_id) == 1);
+    if (is_1d) H5Sget_simple_extent_dims(space_id, &number_elements, NULL);
+    H5Sclose(space_id);
+
+    hid_t plist_id = H5Dget_create_plist(data_id);
+    hsize_t chunk_size = 0;
+    bool is_blosc = false;
+    if (H5Pget_layout(plist_id) == H5D_CHUNKED && H5Pget_nfilters(plist_id) == 1) {
+        H5Pget_chunk(plist_id, 1, &chunk_size);
+        unsigned int flags;
+        size_t number_values = 0;
+        is_blosc = (H5Pget_filter2(plist_id, 0, &flags, &number_values, NULL, 0, NULL, NULL) == FILTER_BLOSC);
+    }
+    H5Pclose(plist_id);
+
+    if (!same_type || !is_1d || !is_blosc || (number_elements == 0) || (chunk_size == 0)) {
+        return false;
+    }
+
+    const uint64_t chunk_bytes = chunk_size*type_size;
+    const uint64_t total_bytes = number_elements*type_size;
+    const int64_t number_chunks = (number_elements + chunk_size - 1)/chunk_size;
+    const int64_t batch_size = std::min((int64_t)chunk_batch_size(), number_chunks);
+
+    std::vector<std::vector<char>> chunks(batch_size);
+    std::vector<uint32_t> filter_masks(batch_size);
+    bool success = true;
+
+    for (int64_t batch_begin = 0; batch_begin < number_chunks; batch_begin += batch_size) {
+        const int64_t batch_end = std::min(batch_begin + batch_size, number_chunks);
+        int64_t c;
+
+        // HDF5 calls are serial
+        for (c = batch_begin; c < batch_end; ++c) {
+            hsize_t offset = c*chunk_size;
+            hsize_t storage_size = 0;
+            H5Dget_chunk_storage_size(data_id, &offset, &storage_size);
+            std::vector<char>& chunk = chunks[c - batch_begin];
+            chunk.resize(storage_size);
+            filter_masks[c - batch_begin] = 0;
+            if (storage_size > 0 && H5Dread_chunk(data_id, H5P_DEFAULT, &offset, &filter_masks[c - batch_begin], chunk.data()) < 0) {
+                success = false;
+            }
+        }
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(dynamic) private(c)
+#endif
+        for (c = batch_begin; c < batch_end; ++c) {
+            const std::vector<char>& chunk = chunks[c - batch_begin];
+            char* dest = (char*)buff + c*chunk_bytes;
+            const uint64_t bytes = std::min(chunk_bytes, total_bytes - c*chunk_bytes);
+
+            if (chunk.size() == 0) {
+                // chunk never written, fill value
+                std::memset(dest, 0, bytes);
+            } else if (filter_masks[c - batch_begin] & 1) {
+                // compression was skipped, the chunk is stored as is
+                std::memcpy(dest, chunk.data(), std::min(bytes, (uint64_t)chunk.size()));
+            } else if (bytes == chunk_bytes) {
+                if (blosc_decompress_ctx(chunk.data(), dest, chunk_bytes, 1) != (int)chunk_bytes) success = false;
+            } else {
+                // last (partial) chunk is stored padded to the full chunk size
+                std::vector<char> padded(chunk_bytes);
+                if (blosc_decompress_ctx(chunk.data(), padded.data(), chunk_bytes, 1) != (int)chunk_bytes) success = false;
+                std::memcpy(dest, padded.data(), bytes);
+            }
+        }
+
+        if (!success) return false;
+    }
+
+    return true;
+}
+
+/**
+ * compresses the chunks of a 1D dataset with blosc in parallel and writes them directly to the (blosc filtered) dataset
+ */
+static bool hdf5_write_chunks_blosc(hid_t dset_id, hid_t type_id, uint64_t number_elements, uint64_t chunk_size, const void* data, unsigned int comp_type, unsigned int comp_level, unsigned int shuffle) {
+    const char* compressor_name;
+    if (blosc_compcode_to_compname(comp_type, &compressor_name) < 0) {
+        return false;
+    }
+
+    const size_t type_size = H5Tget_size(type_id);
+    const size_t shuffle_type_size = (type_size > BLOSC_MAX_TYPESIZE) ? 1 : type_size;
+    const uint64_t chunk_bytes = chunk_size*type_size;
+    const uint64_t total_bytes = number_elements*type_size;
+    const int64_t number_chunks = (number_elements + chunk_size - 1)/chunk_size;
+    const int64_t batch_size = std::min((int64_t)chunk_batch_size(), number_chunks);
+
+    std::vector<std::vector<char>> compressed(batch_size, std::vector<char>(chunk_bytes));
+    std::vector<int> compressed_size(batch_size);
+
+    // the last (partial) chunk has to be written padded to the full chunk size
+    std::vector<char> last_chunk(chunk_bytes, 0);
+    const uint64_t last_chunk_bytes = total_bytes - (number_chunks - 1)*chunk_bytes;
+    std::memcpy(last_chunk.data(), (const char*)data + (number_chunks - 1)*chunk_bytes, last_chunk_bytes);
+
+    for (int64_t batch_begin = 0; batch_begin < number_chunks; batch_begin += batch_size) {
+        const int64_t batch_end = std::min(batch_begin + batch_size, number_chunks);
+        int64_t c;
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(dynamic) private(c)
+#endif
+        for (c = batch_begin; c < batch_end; ++c) {
+            const char* src = (c == (number_chunks - 1)) ? last_chunk.data() : (const char*)data + c*chunk_bytes;
+            // as in the filter, a chunk that does not compress is stored uncompressed (returns 0)
+            compressed_size[c - batch_begin] = blosc_compress_ctx(comp_level, shuffle, shuffle_type_size, chunk_bytes, src,
+                                                                  compressed[c - batch_begin].data(), chunk_bytes, compressor_name, 0, 1);
+        }
+
+        // HDF5 calls are serial
+        for (c = batch_begin; c < batch_end; ++c) {
+            hsize_t offset = c*chunk_size;
+            const int size = compressed_size[c - batch_begin];
+            herr_t status;
+            if (size > 0) {
+                status = H5Dwrite_chunk(dset_id, H5P_DEFAULT, 0, &offset, size, compressed[c - batch_begin].data());
+            } else {
+                const char* src = (c == (number_chunks - 1)) ? last_chunk.data() : (const char*)data + c*chunk_bytes;
+                status = H5Dwrite_chunk(dset_id, H5P_DEFAULT, 1, &offset, chunk_bytes, src);
+            }
+            if (status < 0) return false;
+        }
+    }
+
+    return true;
+}
+#endif
 
 
 /**
@@ -19,10 +183,16 @@ void hdf5_register_blosc(){
 }
 
 /**
- * reads data from hdf5
+ * reads data from hdf5, with direct_chunk_io the chunks are read directly (bypassing the HDF5 filter pipeline) and
+ * decompressed with blosc in parallel (requires HDF5 >= 1.10.3, otherwise ignored)
  */
-void hdf5_load_data_blosc(hid_t obj_id, hid_t dataType, void* buff, const char* data_name) {
+void hdf5_load_data_blosc(hid_t obj_id, hid_t dataType, void* buff, const char* data_name, bool direct_chunk_io) {
     hid_t data_id =  H5Dopen2(obj_id, data_name ,H5P_DEFAULT);
+#if H5_VERSION_GE(1,10,3)
+    if (!direct_chunk_io || !hdf5_read_chunks_blosc(data_id, dataType, buff))
+#else
+    (void) direct_chunk_io;
+#endif
     H5Dread(data_id, dataType, H5S_ALL, H5S_ALL, H5P_DEFAULT, buff);
     H5Dclose(data_id);
 }
@@ -30,22 +200,58 @@ void hdf5_load_data_blosc(hid_t obj_id, hid_t dataType, void* buff, const char*
 /**
  * reads data from hdf5 (data type auto-detection)
  */
-void hdf5_load_data_blosc(hid_t obj_id, void* buff, const char* data_name) {
+void hdf5_load_data_blosc(hid_t obj_id, void* buff, const char* data_name, bool direct_chunk_io) {
     hid_t data_id =  H5Dopen2(obj_id, data_name ,H5P_DEFAULT);
     hid_t dataType = H5Dget_type(data_id);
+#if H5_VERSION_GE(1,10,3)
+    if (!direct_chunk_io || !hdf5_read_chunks_blosc(data_id, dataType, buff))
+#else
+    (void) direct_chunk_io;
+#endif
     H5Dread(data_id, dataType, H5S_ALL, H5S_ALL, H5P_DEFAULT, buff);
     H5Tclose(dataType);
     H5Dclose(data_id);
 }
 
 /**
- * writes data to the hdf5 file or group identified by obj_id of hdf5 datatype data_type
+ * reads the element ranges [begin,end) of a 1D dataset from hdf5 into a contiguous buffer, the ranges have to be
+ * ascending and non-overlapping. Only the chunks touched by the ranges are read and decompressed.
  */
-void hdf5_write_data_blosc(hid_t obj_id, hid_t type_id, const char *ds_name, hsize_t rank, hsize_t *dims, void *data ,unsigned int comp_type,unsigned int comp_level,unsigned int shuffle) {
+void hdf5_load_data_blosc_ranges(hid_t obj_id, hid_t dataType, void* buff, const char* data_name, const std::vector<std::pair<uint64_t,uint64_t>>& ranges) {
+    hid_t data_id =  H5Dopen2(obj_id, data_name ,H5P_DEFAULT);
+    hid_t file_space_id = H5Dget_space(data_id);
+    H5Sselect_none(file_space_id);
+
+    hsize_t number_elements = 0;
+    for (const auto& range : ranges) {
+        if (range.second > range.first) {
+            hsize_t start = range.first;
+            hsize_t count = range.second - range.first;
+            H5Sselect_hyperslab(file_space_id, H5S_SELECT_OR, &start, NULL, &count, NULL);
+            number_elements += count;
+        }
+    }
+
+    if (number_elements > 0) {
+        hid_t mem_space_id = H5Screate_simple(1, &number_elements, NULL);
+        H5Dread(data_id, dataType, mem_space_id, file_space_id, H5P_DEFAULT, buff);
+        H5Sclose(mem_space_id);
+    }
+
+    H5Sclose(file_space_id);
+    H5Dclose(data_id);
+}
+
+/**
+ * writes data to the hdf5 file or group identified by obj_id of hdf5 datatype data_type, the data is stored in chunks
+ * of (at most) chunk_size elements, with direct_chunk_io compressed with blosc in parallel and written directly
+ * (requires HDF5 >= 1.10.3, otherwise ignored)
+ */
+void hdf5_write_data_blosc(hid_t obj_id, hid_t type_id, const char *ds_name, hsize_t rank, hsize_t *dims, const void *data ,unsigned int comp_type,unsigned int comp_level,unsigned int shuffle,uint64_t chunk_size,bool direct_chunk_io) {
     hid_t plist_id  = H5Pcreate(H5P_DATASET_CREATE);
 
     // Dataset must be chunked for compression
-    const uint64_t max_size = 100000;
+    const uint64_t max_size = std::max(chunk_size,(uint64_t)1);
     hsize_t cdims = (dims[0] < max_size) ? dims[0] : max_size;
     rank = 1;
     H5Pset_chunk(plist_id, rank, &cdims);
@@ -63,8 +269,14 @@ void hdf5_write_data_blosc(hid_t obj_id, hid_t type_id, const char *ds_name, hsi
     //create write and close
     hid_t space_id = H5Screate_simple(rank, dims, NULL);
     hid_t dset_id = H5Dcreate2(obj_id, ds_name, type_id, space_id, H5P_DEFAULT, plist_id, H5P_DEFAULT);
+#if H5_VERSION_GE(1,10,3)
+    if (!direct_chunk_io || (dims[0] == 0) || !hdf5_write_chunks_blosc(dset_id, type_id, dims[0], cdims, data, comp_type, comp_level, shuffle))
+#else
+    (void) direct_chunk_io;
+#endif
     H5Dwrite(dset_id,type_id,H5S_ALL,H5S_ALL,H5P_DEFAULT,data);
     H5Dclose(dset_id);
+    H5Sclose(space_id);
 
     H5Pclose(plist_id);
 }
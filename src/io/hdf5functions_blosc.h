@@ -24,10 +24,11 @@ extern "C" {
 
 void hdf5_register_blosc();
 hid_t hdf5_create_file_blosc(std::string file_name);
-void hdf5_load_data_blosc(hid_t obj_id, void* buff, const char* data_name);
-void hdf5_load_data_blosc(hid_t obj_id, hid_t dataType, void* buff, const char* data_name);
+void hdf5_load_data_blosc(hid_t obj_id, void* buff, const char* data_name, bool direct_chunk_io = true);
+void hdf5_load_data_blosc(hid_t obj_id, hid_t dataType, void* buff, const char* data_name, bool direct_chunk_io = true);
+void hdf5_load_data_blosc_ranges(hid_t obj_id, hid_t dataType, void* buff, const char* data_name, const std::vector<std::pair<uint64_t,uint64_t>>& ranges);
 void hdf5_write_attribute_blosc(hid_t obj_id,hid_t type_id,const char* attr_name,hsize_t rank,hsize_t* dims, const void * const data );
-void hdf5_write_data_blosc(hid_t obj_id,hid_t type_id,const char* ds_name,hsize_t rank,hsize_t* dims, void* data ,unsigned int comp_type,unsigned int comp_level,unsigned int shuffle);
+void hdf5_write_data_blosc(hid_t obj_id,hid_t type_id,const char* ds_name,hsize_t rank,hsize_t* dims, const void* data ,unsigned int comp_type,unsigned int comp_level,unsigned int shuffle,uint64_t chunk_size = 100000,bool direct_chunk_io = true);
 void write_main_paraview_xdmf_xml(std::string save_loc,std::string file_name,uint64_t num_parts);
 
 
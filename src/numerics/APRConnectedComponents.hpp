@@ -0,0 +1,257 @@
+//  Connected component labelling of thresholded particles, without reconstructing the image. Foreground particles
+//  are joined to their foreground face neighbours (at the same, parent or child level) with a lock-free union-find,
+//  in parallel over the particles. Each component is represented by its smallest global index, so the labels
+//  (1 ... number of objects, 0 for the background) are in the order of the first particle of each object and do not
+//  depend on the number of threads.
+//
+//  As neighbouring particle cells share a face, the objects are the 6-connected components of the piece-wise constant
+//  reconstruction of the mask (APRReconstruction::interp_img).
+//
+
+#ifndef PARTPLAY_APRCONNECTEDCOMPONENTS_HPP
+#define PARTPLAY_APRCONNECTEDCOMPONENTS_HPP
+
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+#include "../data_structures/APR/APR.hpp"
+#include "../data_structures/APR/APRIterator.hpp"
+#include "../data_structures/APR/APRNeighbourTable.hpp"
+
+struct APRObjectStatistics {
+    uint64_t volume = 0; // in pixels, particle cells clipped to the image
+    uint64_t number_particles = 0;
+    uint64_t y_min = std::numeric_limits<uint64_t>::max(); // bounding box in pixels (inclusive)
+    uint64_t y_max = 0;
+    uint64_t x_min = std::numeric_limits<uint64_t>::max();
+    uint64_t x_max = 0;
+    uint64_t z_min = std::numeric_limits<uint64_t>::max();
+    uint64_t z_max = 0;
+    double intensity_sum = 0; // sum of the intensities over the pixels of the object
+};
+
+class APRConnectedComponents {
+
+public:
+
+    /**
+     * Labels the connected components of the particles with parts > threshold, using the face neighbour iteration.
+     * Returns the number of objects.
+     */
+    template<typename T,typename S,typename L>
+    uint64_t label(const APR<T>& apr,const ExtraParticleData<S>& parts,const float threshold,ExtraParticleData<L>& labels){
+
+        const uint64_t total_number_particles = apr.total_number_particles();
+        init_sets(total_number_particles);
+
+        APRIterator<T> apr_iterator(apr);
+        APRIterator<T> neighbour_iterator(apr);
+        uint64_t particle_number;
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static) private(particle_number) firstprivate(apr_iterator, neighbour_iterator)
+#endif
+        for (particle_number = 0; particle_number < total_number_particles; ++particle_number) {
+            if(!(parts.data[particle_number] > threshold)){
+                continue;
+            }
+
+            apr_iterator.set_iterator_to_particle_by_number(particle_number);
+
+            //neighbours are symmetric, so only the positive faces [+y,+x,+z] are needed
+            for (uint8_t face = 0; face < 6; face += 2) {
+                apr_iterator.find_neighbours_in_direction(face);
+
+                for (int index = 0; index < apr_iterator.number_neighbours_in_direction(face); ++index) {
+                    if (neighbour_iterator.set_neighbour_iterator(apr_iterator, face, index)) {
+                        if(parts.data[neighbour_iterator.global_index()] > threshold) {
+                            unite(particle_number, neighbour_iterator.global_index());
+                        }
+                    }
+                }
+            }
+        }
+
+        return assign_labels(parts,threshold,labels);
+    }
+
+    /**
+     * Labels the connected components of the particles with parts > threshold using a precomputed (canonical)
+     * neighbour table. Returns the number of objects.
+     */
+    template<typename S,typename L>
+    uint64_t label(const APRNeighbourTable& neighbours,const ExtraParticleData<S>& parts,const float threshold,ExtraParticleData<L>& labels){
+
+        const uint64_t total_number_particles = neighbours.total_number_particles;
+        init_sets(total_number_particles);
+
+        int64_t particle_number;
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static) private(particle_number)
+#endif
+        for (particle_number = 0; particle_number < (int64_t)total_number_particles; ++particle_number) {
+            if(!(parts.data[particle_number] > threshold)){
+                continue;
+            }
+
+            for (uint8_t face = 0; face < 6; face += 2) {
+                for (const uint64_t neighbour : neighbours.face_neighbours(face,particle_number)) {
+                    if(parts.data[neighbour] > threshold) {
+                        unite(particle_number, neighbour);
+                    }
+                }
+            }
+        }
+
+        return assign_labels(parts,threshold,labels);
+    }
+
+    /**
+     * Volume, number of particles, bounding box and intensity sum of the objects, object_statistics[l - 1] is the
+     * object with label l
+     */
+    template<typename T,typename L,typename S>
+    void compute_object_statistics(const APR<T>& apr,const ExtraParticleData<L>& labels,const uint64_t number_objects,const ExtraParticleData<S>& intensities,std::vector<APRObjectStatistics>& object_statistics){
+
+        object_statistics.assign(number_objects,APRObjectStatistics());
+
+        APRIterator<T> apr_iterator(apr);
+
+        const uint64_t y_dim = apr.orginal_dimensions(0);
+        const uint64_t x_dim = apr.orginal_dimensions(1);
+        const uint64_t z_dim = apr.orginal_dimensions(2);
+
+        for (uint64_t particle_number = 0; particle_number < apr_iterator.total_number_particles(); ++particle_number) {
+            const uint64_t object_label = labels.data[particle_number];
+            if(object_label == 0){
+                continue;
+            }
+
+            apr_iterator.set_iterator_to_particle_by_number(particle_number);
+
+            //pixels of the particle cell
+            const uint64_t step_size = ((uint64_t) 1) << (apr_iterator.level_max() - apr_iterator.level());
+            const uint64_t y_begin = apr_iterator.y()*step_size;
+            const uint64_t x_begin = apr_iterator.x()*step_size;
+            const uint64_t z_begin = apr_iterator.z()*step_size;
+            const uint64_t y_end = std::min(y_begin + step_size, y_dim);
+            const uint64_t x_end = std::min(x_begin + step_size, x_dim);
+            const uint64_t z_end = std::min(z_begin + step_size, z_dim);
+            const uint64_t volume = (y_end - y_begin)*(x_end - x_begin)*(z_end - z_begin);
+
+            APRObjectStatistics& object = object_statistics[object_label - 1];
+            object.volume += volume;
+            object.number_particles++;
+            object.intensity_sum += ((double) intensities.data[particle_number])*volume;
+            object.y_min = std::min(object.y_min, y_begin);
+            object.y_max = std::max(object.y_max, y_end - 1);
+            object.x_min = std::min(object.x_min, x_begin);
+            object.x_max = std::max(object.x_max, x_end - 1);
+            object.z_min = std::min(object.z_min, z_begin);
+            object.z_max = std::max(object.z_max, z_end - 1);
+        }
+    }
+
+private:
+
+    std::vector<std::atomic<uint64_t>> parent;
+
+    void init_sets(const uint64_t total_number_particles){
+        std::vector<std::atomic<uint64_t>> sets(total_number_particles);
+        parent.swap(sets);
+
+        int64_t i;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static) private(i)
+#endif
+        for (i = 0; i < (int64_t)total_number_particles; ++i) {
+            parent[i].store(i, std::memory_order_relaxed);
+        }
+    }
+
+    inline uint64_t find(uint64_t x){
+        //
+        //  Root of the set of x, with path halving (parents only ever decrease, so a failed update can be ignored)
+        //
+
+        uint64_t p = parent[x].load(std::memory_order_relaxed);
+        while(p != x){
+            uint64_t grand_parent = parent[p].load(std::memory_order_relaxed);
+            if(grand_parent != p){
+                parent[x].compare_exchange_weak(p, grand_parent, std::memory_order_relaxed);
+            }
+            x = grand_parent;
+            p = parent[x].load(std::memory_order_relaxed);
+        }
+        return x;
+    }
+
+    inline void unite(uint64_t a,uint64_t b){
+        //
+        //  Links the larger root to the smaller one, retrying if the root was linked by another thread meanwhile
+        //
+
+        while(true){
+            a = find(a);
+            b = find(b);
+            if(a == b){
+                return;
+            }
+            if(a < b){
+                std::swap(a, b);
+            }
+            uint64_t expected = a;
+            if(parent[a].compare_exchange_strong(expected, b, std::memory_order_relaxed)){
+                return;
+            }
+        }
+    }
+
+    template<typename S,typename L>
+    uint64_t assign_labels(const ExtraParticleData<S>& parts,const float threshold,ExtraParticleData<L>& labels){
+
+        const int64_t total_number_particles = parent.size();
+        labels.data.resize(total_number_particles);
+
+        int64_t particle_number;
+
+        //flatten the sets, roots are marked with parent[p] == p
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static) private(particle_number)
+#endif
+        for (particle_number = 0; particle_number < total_number_particles; ++particle_number) {
+            parent[particle_number].store(find(particle_number), std::memory_order_relaxed);
+        }
+
+        //number the objects in the order of their roots
+        uint64_t number_objects = 0;
+        for (particle_number = 0; particle_number < total_number_particles; ++particle_number) {
+            if((parent[particle_number].load(std::memory_order_relaxed) == (uint64_t)particle_number) && (parts.data[particle_number] > threshold)){
+                labels.data[particle_number] = ++number_objects;
+            }
+        }
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static) private(particle_number)
+#endif
+        for (particle_number = 0; particle_number < total_number_particles; ++particle_number) {
+            const uint64_t root = parent[particle_number].load(std::memory_order_relaxed);
+            if(!(parts.data[particle_number] > threshold)){
+                labels.data[particle_number] = 0;
+            } else if(root != (uint64_t)particle_number){
+                labels.data[particle_number] = labels.data[root];
+            }
+        }
+
+        std::vector<std::atomic<uint64_t>>().swap(parent);
+
+        return number_objects;
+    }
+
+};
+
+
+#endif //PARTPLAY_APRCONNECTEDCOMPONENTS_HPP
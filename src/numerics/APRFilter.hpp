@@ -0,0 +1,498 @@
+//  Convolution of particle data with Gaussian, Laplacian of Gaussian and difference of Gaussians kernels of any (odd)
+//  size, without reconstructing the image. The kernels are sums of separable terms, defined in pixels and sampled at
+//  the resolution of each level (the radius shrinking with the level).
+//
+//  The particles of a level are filtered on the image of that level: each cell takes the value of the particle of the
+//  level, of the coarser particle covering it, or the mean of the finer particles in it (the interior cells of an
+//  APRTree). Only the parts of the rows within the kernel radius of the particles of the level are reconstructed,
+//  slice by slice in z: rows are filled from the gaps of the access structure and filtered in y, combined in x, and
+//  the last 2*radius + 1 slices are kept to filter in z at the particles. The memory used scales with the number of
+//  particles (and rows) instead of the number of pixels.
+//
+//  convolve_mesh applies the same kernels to a MeshData, for comparison with filtering the reconstructed image.
+//
+
+#ifndef PARTPLAY_APRFILTER_HPP
+#define PARTPLAY_APRFILTER_HPP
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <numeric>
+#include <limits>
+
+#ifdef HAVE_OPENMP
+	#include "omp.h"
+#endif
+
+#include "../data_structures/APR/APR.hpp"
+#include "../data_structures/APR/APRIterator.hpp"
+#include "../data_structures/APR/APRTree.hpp"
+#include "../data_structures/Mesh/MeshData.hpp"
+
+struct APRKernelTerm {
+    float coefficient;
+    float sigma; // in pixels
+    uint8_t derivative[3]; // order (0 or 2) of the derivative of the Gaussian in y, x and z
+};
+
+class APRConvolutionKernel {
+
+public:
+
+    std::vector<APRKernelTerm> terms; // the kernel is the sum of the terms
+    int size = 1; // number of taps (odd) in pixels
+
+    static APRConvolutionKernel gaussian(const float sigma, const int size){
+        APRConvolutionKernel kernel;
+        kernel.size = size;
+        kernel.terms.push_back({1.0f, sigma, {0, 0, 0}});
+        return kernel;
+    }
+
+    static APRConvolutionKernel laplacian_of_gaussian(const float sigma, const int size){
+        APRConvolutionKernel kernel;
+        kernel.size = size;
+        kernel.terms.push_back({1.0f, sigma, {2, 0, 0}});
+        kernel.terms.push_back({1.0f, sigma, {0, 2, 0}});
+        kernel.terms.push_back({1.0f, sigma, {0, 0, 2}});
+        return kernel;
+    }
+
+    static APRConvolutionKernel difference_of_gaussians(const float sigma_1, const float sigma_2, const int size){
+        APRConvolutionKernel kernel;
+        kernel.size = size;
+        kernel.terms.push_back({1.0f, sigma_1, {0, 0, 0}});
+        kernel.terms.push_back({-1.0f, sigma_2, {0, 0, 0}});
+        return kernel;
+    }
+
+    /**
+     * Radius in cells of size 2^level_delta pixels
+     */
+    int radius(const int level_delta) const {
+        const int radius_pixels = (size - 1)/2;
+        return (radius_pixels + (1 << level_delta) - 1) >> level_delta;
+    }
+
+    /**
+     * Taps of a term in a dimension for cells of size 2^level_delta pixels, the Gaussian is normalized to sum 1 and
+     * the second derivative to sum 0 and to be exact for quadratics
+     */
+    std::vector<float> weights(const APRKernelTerm &term, const int dimension, const int level_delta) const {
+        const int r = radius(level_delta);
+        const double step = (double) (1 << level_delta);
+        const double sigma = term.sigma;
+
+        std::vector<double> w(2*r + 1);
+        for (int i = -r; i <= r; ++i) {
+            const double t = i*step;
+            const double g = std::exp(-t*t/(2*sigma*sigma));
+            w[i + r] = (term.derivative[dimension] == 0) ? g : (t*t/(sigma*sigma) - 1)*g/(sigma*sigma);
+        }
+
+        if (term.derivative[dimension] == 0) {
+            const double sum = std::accumulate(w.begin(), w.end(), 0.0);
+            for (auto &v : w) v /= sum;
+        } else if (r == 0) {
+            w[0] = 0;
+        } else {
+            const double mean = std::accumulate(w.begin(), w.end(), 0.0)/w.size();
+            double second_moment = 0;
+            for (int i = -r; i <= r; ++i) {
+                w[i + r] -= mean;
+                second_moment += w[i + r]*(i*step)*(i*step)/2;
+            }
+            for (auto &v : w) v /= second_moment;
+        }
+
+        return std::vector<float>(w.begin(), w.end());
+    }
+};
+
+class APRFilter {
+
+public:
+
+    /**
+     * Convolves the particle data with the kernel (building the APRTree of the APR)
+     */
+    template<typename T,typename S,typename U>
+    void convolve(const APR<T>& apr,const ExtraParticleData<S>& input_data,ExtraParticleData<U>& output_data,const APRConvolutionKernel& kernel){
+        APRTree<T> apr_tree(apr);
+        convolve(apr,apr_tree,input_data,output_data,kernel);
+    }
+
+    /**
+     * Convolves the particle data with the kernel, using the tree of the APR for the finer particles
+     */
+    template<typename T,typename S,typename U>
+    void convolve(const APR<T>& apr,APRTree<T>& apr_tree,const ExtraParticleData<S>& input_data,ExtraParticleData<U>& output_data,const APRConvolutionKernel& kernel){
+
+        APRTimer timer;
+        timer.verbose_flag = false;
+
+        output_data.init(apr);
+
+        timer.start_timer("fill tree");
+        ExtraParticleData<float> tree_data;
+        apr_tree.fill_tree_mean(apr,input_data,tree_data);
+        timer.stop_timer();
+
+        for (uint64_t level = apr.level_min(); level <= apr.level_max(); ++level) {
+            timer.start_timer("convolve level");
+            convolve_level(apr,apr_tree,input_data,tree_data,output_data,kernel,level);
+            timer.stop_timer();
+        }
+    }
+
+    /**
+     * Convolves an image with the kernel sampled at cells of 2^level_delta pixels (pixels are repeated at the
+     * boundaries)
+     */
+    template<typename S,typename U>
+    static void convolve_mesh(const MeshData<S>& input,MeshData<U>& output,const APRConvolutionKernel& kernel,const int level_delta = 0){
+
+        const int64_t y_num = input.y_num;
+        const int64_t x_num = input.x_num;
+        const int64_t z_num = input.z_num;
+        const int r = kernel.radius(level_delta);
+
+        std::vector<float> result(y_num*x_num*z_num, 0);
+        std::vector<float> temp_y(y_num*x_num*z_num);
+        std::vector<float> temp_x(y_num*x_num*z_num);
+
+        for (const APRKernelTerm &term : kernel.terms) {
+            const std::vector<float> w_y = kernel.weights(term,0,level_delta);
+            const std::vector<float> w_x = kernel.weights(term,1,level_delta);
+            const std::vector<float> w_z = kernel.weights(term,2,level_delta);
+
+            int64_t z;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static) private(z)
+#endif
+            for (z = 0; z < z_num; ++z) {
+                std::vector<float> padded_row(y_num + 2*r);
+                for (int64_t x = 0; x < x_num; ++x) {
+                    const uint64_t row_offset = z*x_num*y_num + x*y_num;
+                    for (int64_t i = 0; i < y_num + 2*r; ++i) {
+                        padded_row[i] = input.mesh[row_offset + clamp(i - r, y_num)];
+                    }
+                    float* output = temp_y.data() + row_offset;
+                    std::fill(output, output + y_num, 0.0f);
+                    for (int k = 0; k < 2*r + 1; ++k) {
+                        const float weight = w_y[k];
+                        const float* row = padded_row.data() + k;
+#ifdef HAVE_OPENMP
+#pragma omp simd
+#endif
+                        for (int64_t y = 0; y < y_num; ++y) {
+                            output[y] += weight*row[y];
+                        }
+                    }
+                }
+                for (int64_t x = 0; x < x_num; ++x) {
+                    float* output = temp_x.data() + z*x_num*y_num + x*y_num;
+                    std::fill(output, output + y_num, 0.0f);
+                    for (int k = 0; k < 2*r + 1; ++k) {
+                        const float weight = w_x[k];
+                        const float* row = temp_y.data() + z*x_num*y_num + clamp(x + k - r, x_num)*y_num;
+#ifdef HAVE_OPENMP
+#pragma omp simd
+#endif
+                        for (int64_t y = 0; y < y_num; ++y) {
+                            output[y] += weight*row[y];
+                        }
+                    }
+                }
+            }
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static) private(z)
+#endif
+            for (z = 0; z < z_num; ++z) {
+                float* output = result.data() + z*x_num*y_num;
+                for (int k = 0; k < 2*r + 1; ++k) {
+                    const float weight = term.coefficient*w_z[k];
+                    const float* slice = temp_x.data() + clamp(z + k - r, z_num)*x_num*y_num;
+#ifdef HAVE_OPENMP
+#pragma omp simd
+#endif
+                    for (int64_t i = 0; i < x_num*y_num; ++i) {
+                        output[i] += weight*slice[i];
+                    }
+                }
+            }
+        }
+
+        output.init(y_num,x_num,z_num);
+        std::copy(result.begin(),result.end(),output.mesh.begin());
+    }
+
+private:
+
+    //filtered values of the rows of a slice, over the y range [y_begin[x], y_end[x]] of each row (empty if y_begin > y_end)
+    struct SliceRows {
+        std::vector<int64_t> y_begin;
+        std::vector<int64_t> y_end;
+        std::vector<uint64_t> offset;
+        std::vector<float> values; // number_terms blocks of number_values
+        uint64_t number_values = 0;
+
+        inline float* row(const size_t term,const int64_t x,const int64_t y){
+            return values.data() + term*number_values + offset[x] + (y - y_begin[x]);
+        }
+
+        void allocate(const size_t number_terms){
+            offset.resize(y_begin.size());
+            number_values = 0;
+            for (size_t x = 0; x < y_begin.size(); ++x) {
+                offset[x] = number_values;
+                number_values += std::max((int64_t) 0,y_end[x] - y_begin[x] + 1);
+            }
+            values.assign(number_terms*number_values,0);
+        }
+    };
+
+    static inline int64_t clamp(const int64_t i,const int64_t num){
+        return std::min(std::max(i,(int64_t) 0),num - 1);
+    }
+
+    template<typename T,typename S,typename U>
+    void convolve_level(const APR<T>& apr,APRTree<T>& apr_tree,const ExtraParticleData<S>& input_data,const ExtraParticleData<float>& tree_data,ExtraParticleData<U>& output_data,const APRConvolutionKernel& kernel,const uint64_t level){
+
+        APRIterator<T> apr_iterator(apr);
+        if(apr_iterator.particles_level_begin(level) == apr_iterator.particles_level_end(level)){
+            return;
+        }
+
+        const int64_t x_num = apr.spatial_index_x_max(level);
+        const int64_t z_num = apr.spatial_index_z_max(level);
+
+        //y range of the particles of each row
+        std::vector<int64_t> particles_y_begin(x_num*z_num,std::numeric_limits<int64_t>::max());
+        std::vector<int64_t> particles_y_end(x_num*z_num,-1);
+
+        int64_t z;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(dynamic) private(z) firstprivate(apr_iterator)
+#endif
+        for (z = 0; z < z_num; ++z) {
+            for (int64_t x = 0; x < x_num; ++x) {
+                if(apr_iterator.set_iterator_to_row(level,z,x)){
+                    particles_y_begin[z*x_num + x] = apr_iterator.gap_y_begin();
+                    do {
+                        particles_y_end[z*x_num + x] = apr_iterator.gap_y_end();
+                    } while(apr_iterator.move_to_next_gap_in_row());
+                }
+            }
+        }
+
+        //blocks of slices, each filtered in z sequentially (the 2*radius slices around a block are filtered twice)
+        int64_t number_blocks = 1;
+#ifdef HAVE_OPENMP
+        number_blocks = std::min(z_num,(int64_t) 2*omp_get_max_threads());
+#endif
+
+        int64_t block;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(dynamic) private(block)
+#endif
+        for (block = 0; block < number_blocks; ++block) {
+            convolve_slices(apr,apr_tree,input_data,tree_data,output_data,kernel,level,particles_y_begin,particles_y_end,
+                            block*z_num/number_blocks,(block + 1)*z_num/number_blocks);
+        }
+    }
+
+    template<typename T,typename S,typename U>
+    void convolve_slices(const APR<T>& apr,APRTree<T>& apr_tree,const ExtraParticleData<S>& input_data,const ExtraParticleData<float>& tree_data,ExtraParticleData<U>& output_data,const APRConvolutionKernel& kernel,const uint64_t level,
+                         const std::vector<int64_t>& particles_y_begin,const std::vector<int64_t>& particles_y_end,const int64_t z_begin,const int64_t z_end){
+        //
+        //  Filters the particles of the level in the slices [z_begin,z_end)
+        //
+
+        APRIterator<T> apr_iterator(apr);
+        APRIterator<T> tree_iterator = apr_tree.tree_iterator();
+
+        const int64_t y_num = apr.spatial_index_y_max(level);
+        const int64_t x_num = apr.spatial_index_x_max(level);
+        const int64_t z_num = apr.spatial_index_z_max(level);
+
+        const int level_delta = apr.level_max() - level;
+        const int r = kernel.radius(level_delta);
+        const int window = 2*r + 1;
+        const size_t number_terms = kernel.terms.size();
+
+        std::vector<std::vector<float>> weights(3*number_terms);
+        for (size_t term = 0; term < number_terms; ++term) {
+            for (int dimension = 0; dimension < 3; ++dimension) {
+                weights[3*term + dimension] = kernel.weights(kernel.terms[term],dimension,level_delta);
+            }
+        }
+
+        std::vector<SliceRows> slices(window); // filtered in y and x, slice z is stored in slices[z % window]
+        SliceRows filtered_y;
+        std::vector<float> row(y_num);
+        std::vector<float> padded_row;
+        std::vector<float> particle_values;
+
+        int64_t z_loaded = std::max(z_begin - r,(int64_t) 0) - 1;
+
+        for (int64_t z = z_begin; z < z_end; ++z) {
+
+            //filter the slices up to z + radius in y and x
+            for (int64_t z_slice = z_loaded + 1; z_slice <= std::min(z + r,z_num - 1); ++z_slice) {
+                SliceRows& slice = slices[z_slice % window];
+
+                //rows needed for the particles of the block within the radius in z
+                slice.y_begin.assign(x_num,std::numeric_limits<int64_t>::max());
+                slice.y_end.assign(x_num,-1);
+                for (int64_t z_particles = std::max(z_slice - r,z_begin); z_particles <= std::min(z_slice + r,z_end - 1); ++z_particles) {
+                    for (int64_t x = 0; x < x_num; ++x) {
+                        slice.y_begin[x] = std::min(slice.y_begin[x],particles_y_begin[z_particles*x_num + x]);
+                        slice.y_end[x] = std::max(slice.y_end[x],particles_y_end[z_particles*x_num + x]);
+                    }
+                }
+                slice.allocate(number_terms);
+
+                //and the rows within the radius in x of those
+                filtered_y.y_begin.assign(x_num,std::numeric_limits<int64_t>::max());
+                filtered_y.y_end.assign(x_num,-1);
+                for (int64_t x = 0; x < x_num; ++x) {
+                    for (int64_t x_n = std::max(x - r,(int64_t) 0); x_n <= std::min(x + r,x_num - 1); ++x_n) {
+                        filtered_y.y_begin[x] = std::min(filtered_y.y_begin[x],slice.y_begin[x_n]);
+                        filtered_y.y_end[x] = std::max(filtered_y.y_end[x],slice.y_end[x_n]);
+                    }
+                }
+                filtered_y.allocate(number_terms);
+
+                //reconstruct and filter in y
+                for (int64_t x = 0; x < x_num; ++x) {
+                    if(filtered_y.y_begin[x] > filtered_y.y_end[x]){
+                        continue;
+                    }
+
+                    const int64_t y_fill_begin = std::max(filtered_y.y_begin[x] - r,(int64_t) 0);
+                    const int64_t y_fill_end = std::min(filtered_y.y_end[x] + r,y_num - 1);
+                    fill_row(apr,apr_iterator,tree_iterator,input_data,tree_data,level,z_slice,x,y_fill_begin,y_fill_end,row);
+
+                    const int64_t length = filtered_y.y_end[x] - filtered_y.y_begin[x] + 1;
+                    padded_row.resize(length + 2*r);
+                    for (int64_t i = 0; i < length + 2*r; ++i) {
+                        padded_row[i] = row[clamp(filtered_y.y_begin[x] - r + i,y_num)];
+                    }
+
+                    for (size_t term = 0; term < number_terms; ++term) {
+                        float* output = filtered_y.row(term,x,filtered_y.y_begin[x]);
+                        const std::vector<float>& w = weights[3*term];
+                        for (int k = 0; k < window; ++k) {
+                            const float weight = w[k];
+                            const float* input = padded_row.data() + k;
+#ifdef HAVE_OPENMP
+#pragma omp simd
+#endif
+                            for (int64_t i = 0; i < length; ++i) {
+                                output[i] += weight*input[i];
+                            }
+                        }
+                    }
+                }
+
+                //filter in x
+                for (int64_t x = 0; x < x_num; ++x) {
+                    if(slice.y_begin[x] > slice.y_end[x]){
+                        continue;
+                    }
+
+                    const int64_t length = slice.y_end[x] - slice.y_begin[x] + 1;
+                    for (size_t term = 0; term < number_terms; ++term) {
+                        float* output = slice.row(term,x,slice.y_begin[x]);
+                        const std::vector<float>& w = weights[3*term + 1];
+                        for (int k = 0; k < window; ++k) {
+                            const float weight = w[k];
+                            const float* input = filtered_y.row(term,clamp(x + k - r,x_num),slice.y_begin[x]);
+#ifdef HAVE_OPENMP
+#pragma omp simd
+#endif
+                            for (int64_t i = 0; i < length; ++i) {
+                                output[i] += weight*input[i];
+                            }
+                        }
+                    }
+                }
+
+                z_loaded = z_slice;
+            }
+
+            //filter in z at the particles
+            for (int64_t x = 0; x < x_num; ++x) {
+                if(!apr_iterator.set_iterator_to_row(level,z,x)){
+                    continue;
+                }
+
+                do {
+                    const int64_t y_begin = apr_iterator.gap_y_begin();
+                    const int64_t length = apr_iterator.gap_y_end() - y_begin + 1;
+                    particle_values.assign(length,0);
+
+                    for (size_t term = 0; term < number_terms; ++term) {
+                        const std::vector<float>& w = weights[3*term + 2];
+                        for (int k = 0; k < window; ++k) {
+                            const float weight = kernel.terms[term].coefficient*w[k];
+                            const float* input = slices[clamp(z + k - r,z_num) % window].row(term,x,y_begin);
+#ifdef HAVE_OPENMP
+#pragma omp simd
+#endif
+                            for (int64_t i = 0; i < length; ++i) {
+                                particle_values[i] += weight*input[i];
+                            }
+                        }
+                    }
+
+                    std::copy(particle_values.begin(),particle_values.end(),output_data.data.begin() + apr_iterator.gap_particles_begin());
+                } while(apr_iterator.move_to_next_gap_in_row());
+            }
+        }
+    }
+
+    template<typename T,typename S>
+    void fill_row(const APR<T>& apr,APRIterator<T>& apr_iterator,APRIterator<T>& tree_iterator,const ExtraParticleData<S>& input_data,const ExtraParticleData<float>& tree_data,
+                  const uint64_t level,const int64_t z,const int64_t x,const int64_t y_begin,const int64_t y_end,std::vector<float>& row){
+        //
+        //  Values of the cells [y_begin,y_end] of the (level,z,x) row, from the particles of the level and below and the
+        //  interior cells of the level
+        //
+
+        auto fill_gaps = [&](APRIterator<T>& iterator,const uint64_t gap_level,const auto& values){
+            const int shift = level - gap_level;
+            if(!iterator.set_iterator_to_row(gap_level,z >> shift,x >> shift)){
+                return;
+            }
+            do {
+                const int64_t gap_y_begin = iterator.gap_y_begin();
+                const int64_t gap_y_end = iterator.gap_y_end();
+                const int64_t fill_begin = std::max(gap_y_begin << shift,y_begin);
+                const int64_t fill_end = std::min(((gap_y_end + 1) << shift) - 1,y_end);
+                if(fill_begin > y_end){
+                    break;
+                }
+                const uint64_t index_offset = iterator.gap_particles_begin() - gap_y_begin;
+                for (int64_t y = fill_begin; y <= fill_end; ++y) {
+                    row[y] = values.data[index_offset + (y >> shift)];
+                }
+            } while(iterator.move_to_next_gap_in_row());
+        };
+
+        for (uint64_t particle_level = apr.level_min(); particle_level <= level; ++particle_level) {
+            fill_gaps(apr_iterator,particle_level,input_data);
+        }
+
+        if(level < apr.level_max()){
+            fill_gaps(tree_iterator,level,tree_data);
+        }
+    }
+
+};
+
+
+#endif //PARTPLAY_APRFILTER_HPP
@@ -6,21 +6,23 @@
 #define PARTPLAY_APRNUMERICS_HPP
 
 #include "../data_structures/APR/APR.hpp"
+#include "../data_structures/APR/APRNeighbourTable.hpp"
 
 
 class APRNumerics {
 
 public:
+    /**
+     * Gradient of the particle intensities, three channels [y,x,z] per particle (in the layout gradient already has)
+     */
     template<typename T>
-    static void compute_gradient_vector(APR<T> apr,ExtraParticleData<std::vector<float>>& gradient,const bool normalize = true,const std::vector<float> delta = {1.0f,1.0f,1.0f}){
+    static void compute_gradient_vector(const APR<T>& apr,MultiChannelParticleData<float>& gradient,const bool normalize = true,const std::vector<float> delta = {1.0f,1.0f,1.0f}){
 
 
         APRTimer timer;
         timer.verbose_flag = true;
 
-        std::vector<float> init_val = {0,0,0};
-
-        gradient.data.resize(apr.total_number_particles(),init_val);
+        gradient.init(apr,3,gradient.layout());
 
         APRIterator<T> apr_iterator(apr);
         APRIterator<T> neighbour_iterator(apr);
@@ -60,8 +62,6 @@ public:
 
                     apr_iterator.find_neighbours_in_direction(direction);
 
-                    const float distance_between_particles = 0.5f*pow(2.0f,(float)(apr_iterator.level_max() - apr_iterator.level()))+0.5f*pow(2.0f,(float)(apr_iterator.level_max()-neighbour_iterator.level()))*delta[dimension]; //in pixels
-
                     // Neighbour Particle Cell Face definitions [+y,-y,+x,-x,+z,-z] =  [0,1,2,3,4,5]
                     for (int index = 0; index < apr_iterator.number_neighbours_in_direction(direction); ++index) {
                         if (neighbour_iterator.set_neighbour_iterator(apr_iterator, direction, index)) {
@@ -70,23 +70,25 @@ public:
                         }
                     }
                     if(count_neighbours > 0) {
+                        const float distance_between_particles = 0.5f*pow(2.0f,(float)(apr_iterator.level_max() - apr_iterator.level()))+0.5f*pow(2.0f,(float)(apr_iterator.level_max()-neighbour_iterator.level()))*delta[dimension]; //in pixels
+
                         gradient_estimate += sign[i] * (current_intensity - intensity_sum / count_neighbours) /
                                              distance_between_particles; //calculates the one sided finite difference in each direction using the average of particles
                         counter_dir++;
                     }
                 }
                 //store the estimate of the gradient
-                gradient[apr_iterator][dimension] = gradient_estimate/counter_dir;
+                gradient(apr_iterator,dimension) = gradient_estimate/counter_dir;
             }
 
             if(normalize) {
 
-                float gradient_mag = sqrt(gradient[apr_iterator][0] * gradient[apr_iterator][0] +
-                                          gradient[apr_iterator][1] * gradient[apr_iterator][1] +
-                                          gradient[apr_iterator][2] * gradient[apr_iterator][2]);
-                gradient[apr_iterator][0] /= gradient_mag;
-                gradient[apr_iterator][1] /= gradient_mag;
-                gradient[apr_iterator][2] /= gradient_mag;
+                float gradient_mag = sqrt(gradient(apr_iterator,0) * gradient(apr_iterator,0) +
+                                          gradient(apr_iterator,1) * gradient(apr_iterator,1) +
+                                          gradient(apr_iterator,2) * gradient(apr_iterator,2));
+                gradient(apr_iterator,0) /= gradient_mag;
+                gradient(apr_iterator,1) /= gradient_mag;
+                gradient(apr_iterator,2) /= gradient_mag;
             }
 
         }
@@ -96,7 +98,7 @@ public:
     }
 
     template<typename T,typename S,typename U>
-    void seperable_smooth_filter(APR<T> apr,const ExtraParticleData<S>& input_data,ExtraParticleData<U>& output_data,const std::vector<float>& filter,unsigned int repeats = 1){
+    void seperable_smooth_filter(const APR<T>& apr,const ExtraParticleData<S>& input_data,ExtraParticleData<U>& output_data,const std::vector<float>& filter,unsigned int repeats = 1){
 
         output_data.init(apr);
 
@@ -115,7 +117,7 @@ public:
 
 
     template<typename T,typename S,typename U>
-    void face_neighbour_filter(APR<T> apr,ExtraParticleData<S>& input_data,ExtraParticleData<U>& output_data,const std::vector<float>& filter,const int direction){
+    void face_neighbour_filter(const APR<T>& apr,const ExtraParticleData<S>& input_data,ExtraParticleData<U>& output_data,const std::vector<float>& filter,const int direction){
 
         std::vector<uint8_t> faces;
         if(direction == 0){
@@ -167,6 +169,131 @@ public:
             }
         }
     }
+
+    /////////////////////////////////////////////////////////////
+    ///
+    /// Versions using precomputed neighbours (APRNeighbourTable), faster when visiting the neighbours repeatedly.
+    /// The results are the same as above. The filters can also use a table built for another particle ordering
+    /// (APRParticleOrder), with the particle data in that ordering.
+    ///
+    /////////////////////////////////////////////////////////////
+
+    /**
+     * Gradient using precomputed neighbours, the table has to be in the canonical order (as the particle intensities),
+     * returns false (gradient unchanged) otherwise
+     */
+    template<typename T>
+    static bool compute_gradient_vector(const APR<T>& apr,const APRNeighbourTable& neighbours,MultiChannelParticleData<float>& gradient,const bool normalize = true,const std::vector<float> delta = {1.0f,1.0f,1.0f}){
+
+        if((neighbours.ordering != ParticleOrdering::Canonical) || (neighbours.total_number_particles != apr.total_number_particles())){
+            std::cerr << "The neighbour table has to be built for the APR in the canonical particle order" << std::endl;
+            return false;
+        }
+
+        gradient.init(apr,3,gradient.layout());
+
+        const ExtraParticleData<T>& intensities = apr.particles_intensities;
+        const float sign[2] = {1.0,-1.0};
+
+        int64_t particle_number;
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static) private(particle_number)
+#endif
+        for (particle_number = 0; particle_number < (int64_t)neighbours.total_number_particles; ++particle_number) {
+
+            const float current_intensity = intensities.data[particle_number];
+            const ParticleChannels<float> gradient_particle = gradient[particle_number];
+
+            for (int dimension = 0; dimension < 3; ++dimension) {
+                float gradient_estimate= 0;
+                float counter_dir = 0;
+
+                for (int i = 0; i < 2; ++i) {
+                    const uint8_t face = 2*dimension + i; // [+y,-y,+x,-x,+z,-z] =  [0,1,2,3,4,5]
+                    const APRNeighbourTable::FaceNeighbours face_neighbours = neighbours.face_neighbours(face,particle_number);
+
+                    if(!face_neighbours.empty()) {
+                        float intensity_sum = 0;
+                        float count_neighbours = 0;
+                        for (const uint64_t neighbour : face_neighbours) {
+                            intensity_sum += intensities.data[neighbour];
+                            count_neighbours++;
+                        }
+
+                        const float distance_between_particles = 0.5f*pow(2.0f,(float)(neighbours.level_max - neighbours.particle_level[particle_number]))+0.5f*pow(2.0f,(float)(neighbours.level_max-neighbours.particle_level[face_neighbours.back()]))*delta[dimension]; //in pixels
+                        gradient_estimate += sign[i] * (current_intensity - intensity_sum / count_neighbours) / distance_between_particles;
+                        counter_dir++;
+                    }
+                }
+                gradient_particle[dimension] = gradient_estimate/counter_dir;
+            }
+
+            if(normalize) {
+                float gradient_mag = sqrt(gradient_particle[0] * gradient_particle[0] +
+                                          gradient_particle[1] * gradient_particle[1] +
+                                          gradient_particle[2] * gradient_particle[2]);
+                gradient_particle[0] /= gradient_mag;
+                gradient_particle[1] /= gradient_mag;
+                gradient_particle[2] /= gradient_mag;
+            }
+        }
+
+        return true;
+    }
+
+    template<typename T,typename S,typename U>
+    void seperable_smooth_filter(const APR<T>& apr,const APRNeighbourTable& neighbours,const ExtraParticleData<S>& input_data,ExtraParticleData<U>& output_data,const std::vector<float>& filter,unsigned int repeats = 1){
+
+        output_data.init(apr);
+
+        ExtraParticleData<U> output_data_2(apr);
+        output_data_2.copy_parts(apr,input_data);
+
+        for (unsigned int i = 0; i < repeats; ++i) {
+            face_neighbour_filter(neighbours,output_data_2,output_data,filter,0);
+            face_neighbour_filter(neighbours,output_data,output_data_2,filter,1);
+            face_neighbour_filter(neighbours,output_data_2,output_data,filter,2);
+            std::swap(output_data_2.data,output_data.data);
+        }
+
+        std::swap(output_data_2.data,output_data.data);
+    }
+
+    template<typename S,typename U>
+    void face_neighbour_filter(const APRNeighbourTable& neighbours,const ExtraParticleData<S>& input_data,ExtraParticleData<U>& output_data,const std::vector<float>& filter,const int direction){
+
+        const float filter_t[2] = {filter[2],filter[0]};
+
+        int64_t particle_number;
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static) private(particle_number)
+#endif
+        for (particle_number = 0; particle_number < (int64_t)neighbours.total_number_particles; ++particle_number) {
+
+            const float current_intensity = input_data.data[particle_number];
+            U& output = output_data.data[particle_number];
+            output = current_intensity*filter[1];
+
+            for (int i = 0; i < 2; ++i) {
+                const uint8_t face = 2*direction + i; // [+y,-y,+x,-x,+z,-z] =  [0,1,2,3,4,5]
+                const APRNeighbourTable::FaceNeighbours face_neighbours = neighbours.face_neighbours(face,particle_number);
+
+                if(!face_neighbours.empty()) {
+                    float intensity_sum = 0;
+                    float count_neighbours = 0;
+                    for (const uint64_t neighbour : face_neighbours) {
+                        intensity_sum += input_data.data[neighbour];
+                        count_neighbours++;
+                    }
+                    output += filter_t[i]*intensity_sum/count_neighbours;
+                } else {
+                    output += filter_t[i]*current_intensity;
+                }
+            }
+        }
+    }
 };
 
 
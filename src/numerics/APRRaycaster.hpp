@@ -42,7 +42,7 @@ public:
     std::string name = "raycast";
 
     template<typename U,typename S,typename V,class BinaryOperation>
-    void perform_raycast(APR<U>& apr,ExtraParticleData<S>& particle_data,MeshData<V>& cast_views,BinaryOperation op);
+    void perform_raycast(const APR<U>& apr,const ExtraParticleData<S>& particle_data,MeshData<V>& cast_views,BinaryOperation op);
 
     template<typename S,typename U>
     float perpsective_mesh_raycast(MeshData<S>& image,MeshData<U>& cast_views);
@@ -58,7 +58,7 @@ public:
 
 
 template<typename U,typename S,typename V,class BinaryOperation>
-void APRRaycaster::perform_raycast(APR<U>& apr,ExtraParticleData<S>& particle_data,MeshData<V>& cast_views,BinaryOperation op) {
+void APRRaycaster::perform_raycast(const APR<U>& apr,const ExtraParticleData<S>& particle_data,MeshData<V>& cast_views,BinaryOperation op) {
 
     //
     //  Bevan Cheeseman 2018
@@ -13,7 +13,7 @@ public:
 
 
     template<typename U,typename V,typename S>
-    void interp_img(APR<S>& apr, MeshData<U>& img,ExtraParticleData<V>& parts){
+    void interp_img(const APR<S>& apr, MeshData<U>& img,const ExtraParticleData<V>& parts){
         //
         //  Bevan Cheeseman 2016
         //
@@ -66,7 +66,7 @@ public:
 
 
     template<typename U,typename S>
-    void interp_depth_ds(APR<S>& apr,MeshData<U>& img){
+    void interp_depth_ds(const APR<S>& apr,MeshData<U>& img){
         //
         //  Returns an image of the depth, this is down-sampled by one, as the Particle Cell solution reflects this
         //
@@ -99,7 +99,7 @@ public:
     }
 
     template<typename U,typename S>
-    void interp_level(APR<S> &apr, MeshData<U> &img){
+    void interp_level(const APR<S>& apr, MeshData<U> &img){
         //
         //  Returns an image of the depth, this is down-sampled by one, as the Particle Cell solution reflects this
         //
@@ -129,7 +129,7 @@ public:
     }
 
     template<typename U,typename S>
-    void interp_type(APR<S>& apr,MeshData<U>& img){
+    void interp_type(const APR<S>& apr,MeshData<U>& img){
 
         //get depth
         ExtraParticleData<U> type_parts(apr);
@@ -514,7 +514,7 @@ public:
 
 
     template<typename U,typename V,typename S>
-    void interp_parts_smooth(APR<S>& apr,MeshData<U>& out_image,ExtraParticleData<V>& interp_data,std::vector<float> scale_d = {2,2,2}){
+    void interp_parts_smooth(const APR<S>& apr,MeshData<U>& out_image,const ExtraParticleData<V>& interp_data,std::vector<float> scale_d = {2,2,2}){
         //
         //  Performs a smooth interpolation, based on the depth (level l) in each direction.
         //
@@ -0,0 +1,598 @@
+//  Linear diffusion / Poisson solver on the particles, solving
+//
+//  alpha*u - lambda*laplacian(u) = f
+//
+//  with a finite volume discretisation on the particle cells (Neumann boundary). Each particle cell i (size
+//  h_i = 2^(level_max - level), volume V_i = h_i^3) exchanges with its face neighbours j (at the same, parent or child
+//  level) the flux lambda*A_ij*(u_j - u_i)/d_ij, with the face area A_ij = min(h_i,h_j)^2 and the distance of the
+//  centres d_ij = (h_i + h_j)/2, giving the symmetric system
+//
+//  alpha*V_i*u_i + sum_j lambda*A_ij/d_ij*(u_i - u_j) = V_i*f_i
+//
+//  The system is smoothed with weighted Jacobi or a (multi-colour, so parallel) Gauss-Seidel iteration, which can be
+//  accelerated with multigrid V-cycles using the levels of the APR as the grid hierarchy: the grid of level k has the
+//  particles of the levels <= k and the interior cells (APRTree) of level k, so going to the next coarser grid merges
+//  the particles and interior cells of the finest level into their parents. The coarse operators are re-discretised
+//  from the merged faces, the residuals are restricted by summation and the corrections prolongated as constants.
+//
+//  With alpha = 0 (Poisson) the right hand side is projected to a zero (volume weighted) mean, and the returned
+//  solution has a zero mean.
+//
+
+#ifndef PARTPLAY_APRSOLVER_HPP
+#define PARTPLAY_APRSOLVER_HPP
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+#include "../data_structures/APR/APR.hpp"
+#include "../data_structures/APR/APRIterator.hpp"
+#include "../data_structures/APR/APRNeighbourTable.hpp"
+#include "../data_structures/APR/APRTree.hpp"
+
+enum class APRSmoother {
+    Jacobi = 0,
+    GaussSeidel = 1
+};
+
+class APRDiffusionSolver {
+
+public:
+
+    APRSmoother smoother = APRSmoother::GaussSeidel;
+    bool use_multigrid = true;
+    unsigned int max_iterations = 100; // V-cycles, or smoother sweeps without multigrid
+    double tolerance = 1e-6; // of the residual relative to the right hand side
+    unsigned int pre_smoothing_steps = 2;
+    unsigned int post_smoothing_steps = 2;
+    unsigned int coarse_smoothing_steps = 50;
+    float jacobi_weight = 0.8f;
+
+    APRDiffusionSolver() {}
+
+    template<typename ImageType>
+    APRDiffusionSolver(const APR<ImageType> &apr, const float lambda, const float alpha = 1.0f) {
+        init(apr, lambda, alpha);
+    }
+
+    /**
+     * Builds the operator on the particles and the coarser grids, has to be called again if the APR changes
+     */
+    template<typename ImageType>
+    void init(const APR<ImageType> &apr, const float lambda_, const float alpha_ = 1.0f) {
+        lambda = lambda_;
+        alpha = alpha_;
+        grids.clear();
+
+        APRTimer timer;
+        timer.verbose_flag = false;
+
+        timer.start_timer("finest grid");
+        APRNeighbourTable neighbours(apr);
+        grids.emplace_back();
+        init_finest_grid(apr.level_max(), neighbours, grids.back());
+        timer.stop_timer();
+
+        timer.start_timer("coarse grids");
+        APRTree<ImageType> apr_tree(apr);
+        for (int64_t level = (int64_t) apr.level_max() - 1; level >= (int64_t) apr.level_min(); --level) {
+            grids.emplace_back();
+            init_coarse_grid(apr, apr_tree, level, grids[grids.size() - 2], grids.back());
+        }
+        timer.stop_timer();
+
+        for (Grid &grid : grids) {
+            finish_grid(grid);
+        }
+    }
+
+    uint64_t number_grids() const { return grids.size(); }
+    uint64_t number_cells(const uint64_t grid) const { return grids[grid].size(); }
+    uint64_t number_colours(const uint64_t grid) const { return grids[grid].colour_begin.size() - 1; }
+
+    /**
+     * Solves alpha*u - lambda*laplacian(u) = rhs, starting from solution if use_initial_guess (otherwise from zero).
+     * Returns the relative residual before the first and after each iteration.
+     */
+    template<typename S, typename U>
+    std::vector<double> solve(const ExtraParticleData<S> &rhs, ExtraParticleData<U> &solution, const bool use_initial_guess = false) {
+
+        Grid &grid = grids[0];
+        const int64_t number_cells = grid.size();
+        int64_t i;
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static) private(i)
+#endif
+        for (i = 0; i < number_cells; ++i) {
+            grid.b[i] = ((double) grid.volume[i])*rhs.data[i];
+            grid.u[i] = use_initial_guess ? (double) solution.data[i] : 0.0;
+        }
+
+        if (alpha == 0) {
+            //the pure Neumann problem only has a solution for a zero mean right hand side
+            remove_mean(grid, grid.b, true);
+        }
+
+        double b_norm = 0;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static) private(i) reduction(+:b_norm)
+#endif
+        for (i = 0; i < number_cells; ++i) {
+            b_norm += grid.b[i]*grid.b[i];
+        }
+        b_norm = std::sqrt(b_norm);
+        if (b_norm == 0) {
+            b_norm = 1;
+        }
+
+        std::vector<double> residual_history;
+        residual_history.push_back(std::sqrt(residual(grid))/b_norm);
+
+        for (unsigned int iteration = 0; (iteration < max_iterations) && (residual_history.back() > tolerance); ++iteration) {
+            if (use_multigrid) {
+                v_cycle(0);
+            } else {
+                smooth(grid, 1, false);
+            }
+            residual_history.push_back(std::sqrt(residual(grid))/b_norm);
+        }
+
+        if (alpha == 0) {
+            remove_mean(grid, grid.u, false);
+        }
+
+        solution.data.resize(number_cells);
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static) private(i)
+#endif
+        for (i = 0; i < number_cells; ++i) {
+            solution.data[i] = grid.u[i];
+        }
+
+        return residual_history;
+    }
+
+    /**
+     * Finite volume laplacian of the particle data (the net flux through the faces of each particle cell divided by its
+     * volume)
+     */
+    template<typename S, typename U>
+    void laplacian(const ExtraParticleData<S> &input, ExtraParticleData<U> &output) const {
+
+        const Grid &grid = grids[0];
+        const int64_t number_cells = grid.size();
+        output.data.resize(number_cells);
+
+        int64_t i;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static) private(i)
+#endif
+        for (i = 0; i < number_cells; ++i) {
+            const float u_i = input.data[i];
+            float flux = 0;
+            for (uint64_t e = grid.edge_begin[i]; e < grid.edge_begin[i + 1]; ++e) {
+                flux += grid.edge_weight[e]*(((float) input.data[grid.edge_cell[e]]) - u_i);
+            }
+            output.data[i] = flux/grid.volume[i];
+        }
+    }
+
+private:
+
+    struct Grid {
+        std::vector<float> cell_size;
+        std::vector<float> volume;
+        std::vector<double> diagonal;
+
+        // faces of cell i: edge_cell[edge_begin[i]] ... edge_cell[edge_begin[i + 1] - 1], weighted by area/distance
+        std::vector<uint64_t> edge_begin;
+        std::vector<uint64_t> edge_cell;
+        std::vector<float> edge_weight;
+
+        // cells merged into cell I of this grid from the next finer grid (empty for the finest grid)
+        std::vector<uint64_t> child_begin;
+        std::vector<uint64_t> child_cell;
+        // cell of the next coarser grid containing cell i (empty for the coarsest grid)
+        std::vector<uint64_t> coarse_cell;
+
+        // cells without common faces have the same colour, and are updated together by Gauss-Seidel
+        std::vector<uint64_t> colour_begin;
+        std::vector<uint64_t> colour_cell;
+
+        // solution, right hand side and residual (in double, as the residual of the Poisson problem cancels)
+        std::vector<double> u;
+        std::vector<double> b;
+        std::vector<double> r;
+
+        uint64_t size() const { return volume.size(); }
+    };
+
+    std::vector<Grid> grids;
+    float lambda = 1;
+    float alpha = 1;
+
+    static void init_finest_grid(const uint64_t level_max, const APRNeighbourTable &neighbours, Grid &grid) {
+
+        const int64_t number_cells = neighbours.total_number_particles;
+        grid.cell_size.resize(number_cells);
+        grid.volume.resize(number_cells);
+        grid.edge_begin.assign(number_cells + 1, 0);
+
+        int64_t i;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static) private(i)
+#endif
+        for (i = 0; i < number_cells; ++i) {
+            const float h = (float) (((uint64_t) 1) << (level_max - neighbours.particle_level[i]));
+            grid.cell_size[i] = h;
+            grid.volume[i] = h*h*h;
+            uint64_t number_edges = 0;
+            for (uint8_t face = 0; face < 6; ++face) {
+                number_edges += neighbours.number_neighbours(face, i);
+            }
+            grid.edge_begin[i + 1] = number_edges;
+        }
+
+        for (i = 0; i < number_cells; ++i) {
+            grid.edge_begin[i + 1] += grid.edge_begin[i];
+        }
+
+        grid.edge_cell.resize(grid.edge_begin.back());
+        grid.edge_weight.resize(grid.edge_begin.back());
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static) private(i)
+#endif
+        for (i = 0; i < number_cells; ++i) {
+            uint64_t e = grid.edge_begin[i];
+            for (uint8_t face = 0; face < 6; ++face) {
+                for (const uint64_t neighbour : neighbours.face_neighbours(face, i)) {
+                    const float h_min = std::min(grid.cell_size[i], grid.cell_size[neighbour]);
+                    grid.edge_cell[e] = neighbour;
+                    grid.edge_weight[e] = h_min*h_min/(0.5f*(grid.cell_size[i] + grid.cell_size[neighbour]));
+                    e++;
+                }
+            }
+        }
+    }
+
+    /**
+     * Grid of the particles of levels <= level and the interior cells of level, from the grid of level + 1
+     */
+    template<typename ImageType>
+    static void init_coarse_grid(const APR<ImageType> &apr, APRTree<ImageType> &apr_tree, const uint64_t level, Grid &fine, Grid &coarse) {
+
+        APRIterator<ImageType> apr_iterator(apr);
+        APRIterator<ImageType> tree_iterator = apr_tree.tree_iterator();
+
+        // particles of levels <= level are kept, followed by the interior cells of level
+        const uint64_t number_kept = apr_iterator.particles_level_end(level);
+        const uint64_t tree_begin = tree_iterator.particles_level_begin(level);
+        const uint64_t number_cells = number_kept + tree_iterator.particles_level_end(level) - tree_begin;
+
+        fine.coarse_cell.resize(fine.size());
+        for (uint64_t i = 0; i < number_kept; ++i) {
+            fine.coarse_cell[i] = i;
+        }
+
+        // the particles and interior cells of level + 1 (after the kept particles in the finer grid) go to their parent
+        auto set_parent = [&](APRIterator<ImageType> &children, const uint64_t child_offset, const uint64_t child_begin) {
+            map_to_parents(children, tree_iterator, level + 1, [&](const uint64_t child, const uint64_t parent) {
+                fine.coarse_cell[child_offset + child - child_begin] = number_kept + parent - tree_begin;
+            });
+        };
+        set_parent(apr_iterator, 0, 0);
+        if (level + 1 < apr.level_max()) {
+            APRIterator<ImageType> child_tree_iterator = apr_tree.tree_iterator();
+            set_parent(child_tree_iterator, apr_iterator.particles_level_end(level + 1), child_tree_iterator.particles_level_begin(level + 1));
+        }
+
+        // the cells merged into each coarse cell
+        coarse.child_begin.assign(number_cells + 1, 0);
+        for (uint64_t i = 0; i < fine.size(); ++i) {
+            coarse.child_begin[fine.coarse_cell[i] + 1]++;
+        }
+        for (uint64_t c = 0; c < number_cells; ++c) {
+            coarse.child_begin[c + 1] += coarse.child_begin[c];
+        }
+        coarse.child_cell.resize(fine.size());
+        {
+            std::vector<uint64_t> position(coarse.child_begin.begin(), coarse.child_begin.end() - 1);
+            for (uint64_t i = 0; i < fine.size(); ++i) {
+                coarse.child_cell[position[fine.coarse_cell[i]]++] = i;
+            }
+        }
+
+        const float tree_cell_size = (float) (((uint64_t) 1) << (apr.level_max() - level));
+        coarse.cell_size.resize(number_cells);
+        coarse.volume.resize(number_cells);
+        coarse.edge_begin.assign(number_cells + 1, 0);
+
+        // the faces of the merged cells, summing the areas of the faces to the same coarse cell
+        struct Face { uint64_t cell; float area; };
+
+        auto merge_faces = [&](const uint64_t c, std::vector<Face> &faces) {
+            faces.clear();
+            for (uint64_t k = coarse.child_begin[c]; k < coarse.child_begin[c + 1]; ++k) {
+                const uint64_t i = coarse.child_cell[k];
+                for (uint64_t e = fine.edge_begin[i]; e < fine.edge_begin[i + 1]; ++e) {
+                    const uint64_t j = fine.edge_cell[e];
+                    const uint64_t c_j = fine.coarse_cell[j];
+                    if (c_j != c) {
+                        const float area = fine.edge_weight[e]*0.5f*(fine.cell_size[i] + fine.cell_size[j]);
+                        faces.push_back({c_j, area});
+                    }
+                }
+            }
+            std::sort(faces.begin(), faces.end(), [](const Face &a, const Face &b) { return a.cell < b.cell; });
+            uint64_t number_faces = 0;
+            for (uint64_t f = 0; f < faces.size(); ++f) {
+                if ((number_faces > 0) && (faces[number_faces - 1].cell == faces[f].cell)) {
+                    faces[number_faces - 1].area += faces[f].area;
+                } else {
+                    faces[number_faces++] = faces[f];
+                }
+            }
+            faces.resize(number_faces);
+        };
+
+        std::vector<Face> faces;
+        int64_t c;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(dynamic, 1024) private(c) firstprivate(faces)
+#endif
+        for (c = 0; c < (int64_t) number_cells; ++c) {
+            coarse.cell_size[c] = ((uint64_t) c < number_kept) ? fine.cell_size[c] : tree_cell_size;
+            float volume = 0;
+            for (uint64_t k = coarse.child_begin[c]; k < coarse.child_begin[c + 1]; ++k) {
+                volume += fine.volume[coarse.child_cell[k]];
+            }
+            coarse.volume[c] = volume;
+            merge_faces(c, faces);
+            coarse.edge_begin[c + 1] = faces.size();
+        }
+
+        for (c = 0; c < (int64_t) number_cells; ++c) {
+            coarse.edge_begin[c + 1] += coarse.edge_begin[c];
+        }
+        coarse.edge_cell.resize(coarse.edge_begin.back());
+        coarse.edge_weight.resize(coarse.edge_begin.back());
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(dynamic, 1024) private(c) firstprivate(faces)
+#endif
+        for (c = 0; c < (int64_t) number_cells; ++c) {
+            merge_faces(c, faces);
+            uint64_t e = coarse.edge_begin[c];
+            for (const Face &face : faces) {
+                coarse.edge_cell[e] = face.cell;
+                coarse.edge_weight[e] = face.area/(0.5f*(coarse.cell_size[c] + coarse.cell_size[face.cell]));
+                e++;
+            }
+        }
+    }
+
+    /**
+     * Calls function(child, parent) with the (iterator) indices of the cells of child_level and their parent interior
+     * cells, in parallel over the rows of the children
+     */
+    template<typename ImageType, typename Function>
+    static void map_to_parents(APRIterator<ImageType> &child_iterator, APRIterator<ImageType> &parent_iterator, const uint64_t child_level, Function function) {
+
+        const int64_t z_num = child_iterator.spatial_index_z_max(child_level);
+        const uint64_t x_num = child_iterator.spatial_index_x_max(child_level);
+        int64_t z;
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(dynamic) private(z) firstprivate(child_iterator, parent_iterator)
+#endif
+        for (z = 0; z < z_num; ++z) {
+            for (uint64_t x = 0; x < x_num; ++x) {
+                if (!child_iterator.set_iterator_to_row(child_level, z, x)) continue;
+                parent_iterator.set_iterator_to_row(child_level - 1, z/2, x/2);
+                do {
+                    const uint64_t y_begin = child_iterator.gap_y_begin();
+                    const uint64_t index_begin = child_iterator.gap_particles_begin();
+                    for (uint64_t y = y_begin; y <= child_iterator.gap_y_end(); ++y) {
+                        const uint64_t y_parent = y/2;
+                        while (parent_iterator.gap_y_end() < y_parent) parent_iterator.move_to_next_gap_in_row();
+                        function(index_begin + y - y_begin, parent_iterator.gap_particles_begin() + y_parent - parent_iterator.gap_y_begin());
+                    }
+                } while (child_iterator.move_to_next_gap_in_row());
+            }
+        }
+    }
+
+    void finish_grid(Grid &grid) {
+
+        const int64_t number_cells = grid.size();
+        grid.diagonal.resize(number_cells);
+        grid.u.assign(number_cells, 0);
+        grid.b.assign(number_cells, 0);
+        grid.r.assign(number_cells, 0);
+
+        int64_t i;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static) private(i)
+#endif
+        for (i = 0; i < number_cells; ++i) {
+            double weight_sum = 0;
+            for (uint64_t e = grid.edge_begin[i]; e < grid.edge_begin[i + 1]; ++e) {
+                weight_sum += grid.edge_weight[e];
+            }
+            grid.diagonal[i] = ((double) alpha)*grid.volume[i] + ((double) lambda)*weight_sum;
+        }
+
+        // greedy colouring in the order of the cells
+        std::vector<uint8_t> colour(number_cells, 0);
+        uint64_t number_colours = 1;
+        for (i = 0; i < number_cells; ++i) {
+            uint64_t used = 0;
+            for (uint64_t e = grid.edge_begin[i]; e < grid.edge_begin[i + 1]; ++e) {
+                if ((int64_t) grid.edge_cell[e] < i) {
+                    used |= ((uint64_t) 1) << colour[grid.edge_cell[e]];
+                }
+            }
+            uint8_t c = 0;
+            while (used & (((uint64_t) 1) << c)) c++;
+            colour[i] = c;
+            number_colours = std::max(number_colours, (uint64_t) c + 1);
+        }
+
+        grid.colour_begin.assign(number_colours + 1, 0);
+        for (i = 0; i < number_cells; ++i) {
+            grid.colour_begin[colour[i] + 1]++;
+        }
+        for (uint64_t c = 0; c < number_colours; ++c) {
+            grid.colour_begin[c + 1] += grid.colour_begin[c];
+        }
+        grid.colour_cell.resize(number_cells);
+        std::vector<uint64_t> position(grid.colour_begin.begin(), grid.colour_begin.end() - 1);
+        for (i = 0; i < number_cells; ++i) {
+            grid.colour_cell[position[colour[i]]++] = i;
+        }
+    }
+
+    void v_cycle(const uint64_t g) {
+
+        Grid &grid = grids[g];
+
+        if (g + 1 == grids.size()) {
+            smooth(grid, coarse_smoothing_steps, false);
+            return;
+        }
+
+        Grid &coarse = grids[g + 1];
+
+        smooth(grid, pre_smoothing_steps, false);
+        residual(grid);
+
+        int64_t c;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static) private(c)
+#endif
+        for (c = 0; c < (int64_t) coarse.size(); ++c) {
+            double sum = 0;
+            for (uint64_t k = coarse.child_begin[c]; k < coarse.child_begin[c + 1]; ++k) {
+                sum += grid.r[coarse.child_cell[k]];
+            }
+            coarse.b[c] = sum;
+            coarse.u[c] = 0;
+        }
+
+        v_cycle(g + 1);
+
+        int64_t i;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static) private(i)
+#endif
+        for (i = 0; i < (int64_t) grid.size(); ++i) {
+            grid.u[i] += coarse.u[grid.coarse_cell[i]];
+        }
+
+        smooth(grid, post_smoothing_steps, true);
+    }
+
+    /**
+     * Smoother sweeps on grid.u, Gauss-Seidel sweeps go through the colours in reverse order if reverse (so that a pre-
+     * and post-smoothing pair is symmetric)
+     */
+    void smooth(Grid &grid, const unsigned int number_sweeps, const bool reverse) {
+
+        const int64_t number_cells = grid.size();
+
+        for (unsigned int sweep = 0; sweep < number_sweeps; ++sweep) {
+            if (smoother == APRSmoother::Jacobi) {
+                int64_t i;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static) private(i)
+#endif
+                for (i = 0; i < number_cells; ++i) {
+                    grid.r[i] = (1.0 - jacobi_weight)*grid.u[i] + jacobi_weight*update(grid, i);
+                }
+                std::swap(grid.u, grid.r);
+            } else {
+                const int64_t number_colours = grid.colour_begin.size() - 1;
+                for (int64_t k = 0; k < number_colours; ++k) {
+                    const uint64_t c = reverse ? number_colours - 1 - k : k;
+                    int64_t n;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static) private(n)
+#endif
+                    for (n = grid.colour_begin[c]; n < (int64_t) grid.colour_begin[c + 1]; ++n) {
+                        const uint64_t i = grid.colour_cell[n];
+                        grid.u[i] = update(grid, i);
+                    }
+                }
+            }
+        }
+    }
+
+    inline double update(const Grid &grid, const uint64_t i) const {
+        double sum = 0;
+        for (uint64_t e = grid.edge_begin[i]; e < grid.edge_begin[i + 1]; ++e) {
+            sum += grid.edge_weight[e]*grid.u[grid.edge_cell[e]];
+        }
+        return (grid.b[i] + ((double) lambda)*sum)/grid.diagonal[i];
+    }
+
+    /**
+     * Computes grid.r = grid.b - A*grid.u and returns its squared norm
+     */
+    double residual(Grid &grid) const {
+
+        const int64_t number_cells = grid.size();
+        double norm = 0;
+        int64_t i;
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static) private(i) reduction(+:norm)
+#endif
+        for (i = 0; i < number_cells; ++i) {
+            //in flux form, so that the residuals sum to the sum of b for alpha = 0
+            const double u_i = grid.u[i];
+            double flux = 0;
+            for (uint64_t e = grid.edge_begin[i]; e < grid.edge_begin[i + 1]; ++e) {
+                flux += grid.edge_weight[e]*(grid.u[grid.edge_cell[e]] - u_i);
+            }
+            const double r = grid.b[i] - ((double) alpha)*grid.volume[i]*u_i + ((double) lambda)*flux;
+            grid.r[i] = r;
+            norm += r*r;
+        }
+
+        return norm;
+    }
+
+    /**
+     * Subtracts the volume weighted mean of the cell values, or of the values per volume if per_volume
+     */
+    static void remove_mean(const Grid &grid, std::vector<double> &values, const bool per_volume) {
+
+        const int64_t number_cells = grid.size();
+        double sum = 0;
+        double total_volume = 0;
+        int64_t i;
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static) private(i) reduction(+:sum, total_volume)
+#endif
+        for (i = 0; i < number_cells; ++i) {
+            sum += per_volume ? values[i] : values[i]*grid.volume[i];
+            total_volume += grid.volume[i];
+        }
+
+        const double mean = sum/total_volume;
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static) private(i)
+#endif
+        for (i = 0; i < number_cells; ++i) {
+            values[i] -= per_volume ? mean*grid.volume[i] : mean;
+        }
+    }
+};
+
+
+#endif //PARTPLAY_APRSOLVER_HPP
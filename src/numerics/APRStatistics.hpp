@@ -0,0 +1,313 @@
+//  Reductions of particle data (sum, min, max, mean, variance, histogram and quantiles) without reconstructing the
+//  image. Each particle counts either once (unweighted) or by the number of pixels of its particle cell (volume
+//  weighted, 2^(level_max - level) pixels in each direction clipped to the image), in which case the results are the
+//  statistics of the piece-wise constant reconstruction (APRReconstruction::interp_img).
+//
+//  The particles can be restricted to a region of interest and a range of levels (an APRRegion), volume weighted
+//  results then count only the pixels of the cells inside the region. The particles are visited level by level in
+//  parallel over z, each thread reducing into its own partial result, combined at the end.
+//
+
+#ifndef PARTPLAY_APRSTATISTICS_HPP
+#define PARTPLAY_APRSTATISTICS_HPP
+
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <numeric>
+#include <type_traits>
+
+#ifdef HAVE_OPENMP
+	#include "omp.h"
+#endif
+
+#include "../data_structures/APR/APR.hpp"
+#include "../data_structures/APR/APRIterator.hpp"
+
+struct ParticleSummary {
+    double weight = 0; // number of particles, or of pixels if volume weighted
+    double sum = 0;
+    double min = std::numeric_limits<double>::max();
+    double max = std::numeric_limits<double>::lowest();
+    double mean = 0;
+    double variance = 0; // population variance
+};
+
+class APRStatistics {
+
+public:
+
+    /**
+     * Weight, sum, min, max, mean and variance of the particle data in one pass
+     */
+    template<typename T,typename S>
+    static ParticleSummary summary(const APR<T>& apr,const ExtraParticleData<S>& parts,const bool volume_weighted = false,const APRRegion& region = APRRegion()){
+
+        //partial results (the variance as the sum of squared differences from the mean, merged pairwise)
+        auto combine = [](ParticleSummary& a,const ParticleSummary& b){
+            if(b.weight == 0){
+                return;
+            }
+            const double weight = a.weight + b.weight;
+            const double delta = b.mean - a.mean;
+            a.variance += b.variance + delta*delta*a.weight*b.weight/weight;
+            a.mean += delta*b.weight/weight;
+            a.weight = weight;
+            a.sum += b.sum;
+            a.min = std::min(a.min,b.min);
+            a.max = std::max(a.max,b.max);
+        };
+
+        ParticleSummary result = reduce(apr,volume_weighted,region,ParticleSummary(),[&parts](ParticleSummary& partial,const uint64_t particle_number,const uint64_t weight){
+            const double value = parts.data[particle_number];
+            partial.weight += weight;
+            const double delta = value - partial.mean;
+            partial.mean += delta*weight/partial.weight;
+            partial.variance += weight*delta*(value - partial.mean);
+            partial.sum += weight*value;
+            partial.min = std::min(partial.min,value);
+            partial.max = std::max(partial.max,value);
+        },combine);
+
+        if(result.weight > 0){
+            result.variance /= result.weight;
+        }
+        return result;
+    }
+
+    template<typename T,typename S>
+    static double sum(const APR<T>& apr,const ExtraParticleData<S>& parts,const bool volume_weighted = false,const APRRegion& region = APRRegion()){
+        return summary(apr,parts,volume_weighted,region).sum;
+    }
+
+    template<typename T,typename S>
+    static double min(const APR<T>& apr,const ExtraParticleData<S>& parts,const APRRegion& region = APRRegion()){
+        return summary(apr,parts,false,region).min;
+    }
+
+    template<typename T,typename S>
+    static double max(const APR<T>& apr,const ExtraParticleData<S>& parts,const APRRegion& region = APRRegion()){
+        return summary(apr,parts,false,region).max;
+    }
+
+    template<typename T,typename S>
+    static double mean(const APR<T>& apr,const ExtraParticleData<S>& parts,const bool volume_weighted = false,const APRRegion& region = APRRegion()){
+        return summary(apr,parts,volume_weighted,region).mean;
+    }
+
+    template<typename T,typename S>
+    static double variance(const APR<T>& apr,const ExtraParticleData<S>& parts,const bool volume_weighted = false,const APRRegion& region = APRRegion()){
+        return summary(apr,parts,volume_weighted,region).variance;
+    }
+
+    /**
+     * Histogram of number_bins equal bins over [range_min,range_max] (the last bin includes range_max, values outside
+     * the range are not counted). An empty range (range_min == range_max, e.g. a constant image) counts range_min in bin 0.
+     */
+    template<typename T,typename S>
+    static std::vector<uint64_t> histogram(const APR<T>& apr,const ExtraParticleData<S>& parts,const uint64_t number_bins,const double range_min,const double range_max,const bool volume_weighted = false,const APRRegion& region = APRRegion()){
+
+        if(number_bins == 0){
+            return std::vector<uint64_t>();
+        }
+        const double bin_scale = (range_max > range_min) ? number_bins/(range_max - range_min) : 0;
+
+        return reduce(apr,volume_weighted,region,std::vector<uint64_t>(number_bins,0),[&](std::vector<uint64_t>& partial,const uint64_t particle_number,const uint64_t weight){
+            const double value = parts.data[particle_number];
+            if((value >= range_min) && (value <= range_max)){
+                partial[std::min((uint64_t)((value - range_min)*bin_scale),number_bins - 1)] += weight;
+            }
+        },[](std::vector<uint64_t>& a,const std::vector<uint64_t>& b){
+            std::transform(a.begin(),a.end(),b.begin(),a.begin(),std::plus<uint64_t>());
+        });
+    }
+
+    /**
+     * Quantiles (probabilities in [0,1]), the smallest value with at least the fraction probability of the particles
+     * (or pixels) less or equal to it. Exact, by counting the values of 8 and 16 bit integer data and by sorting the
+     * selected values otherwise.
+     */
+    template<typename T,typename S>
+    static std::vector<double> quantiles(const APR<T>& apr,const ExtraParticleData<S>& parts,const std::vector<double>& probabilities,const bool volume_weighted = false,const APRRegion& region = APRRegion()){
+        //8 and 16 bit integers are counted, other types sorted (selected at compile time, as the counts of wider types would not fit)
+        return quantiles(apr,parts,probabilities,volume_weighted,region,std::integral_constant<bool,std::is_integral<S>::value && (sizeof(S) <= 2)>());
+    }
+
+private:
+
+    template<typename T,typename S>
+    static std::vector<double> quantiles(const APR<T>& apr,const ExtraParticleData<S>& parts,const std::vector<double>& probabilities,const bool volume_weighted,const APRRegion& region,std::true_type /*counted*/){
+
+        std::vector<double> result(probabilities.size(),std::numeric_limits<double>::quiet_NaN());
+
+        const int64_t value_min = std::numeric_limits<S>::min();
+        std::vector<uint64_t> counts = reduce(apr,volume_weighted,region,std::vector<uint64_t>(((int64_t) std::numeric_limits<S>::max()) - value_min + 1,0),[&](std::vector<uint64_t>& partial,const uint64_t particle_number,const uint64_t weight){
+            partial[parts.data[particle_number] - value_min] += weight;
+        },[](std::vector<uint64_t>& a,const std::vector<uint64_t>& b){
+            std::transform(a.begin(),a.end(),b.begin(),a.begin(),std::plus<uint64_t>());
+        });
+
+        std::partial_sum(counts.begin(),counts.end(),counts.begin());
+        if(counts.back() == 0){
+            return result;
+        }
+
+        for (size_t i = 0; i < probabilities.size(); ++i) {
+            result[i] = value_min + (std::lower_bound(counts.begin(),counts.end(),quantile_rank(probabilities[i],counts.back())) - counts.begin());
+        }
+        return result;
+    }
+
+    template<typename T,typename S>
+    static std::vector<double> quantiles(const APR<T>& apr,const ExtraParticleData<S>& parts,const std::vector<double>& probabilities,const bool volume_weighted,const APRRegion& region,std::false_type /*sorted*/){
+
+        std::vector<double> result(probabilities.size(),std::numeric_limits<double>::quiet_NaN());
+
+        std::vector<std::pair<S,uint64_t>> values = reduce(apr,volume_weighted,region,std::vector<std::pair<S,uint64_t>>(),[&parts](std::vector<std::pair<S,uint64_t>>& partial,const uint64_t particle_number,const uint64_t weight){
+            partial.emplace_back(parts.data[particle_number],weight);
+        },[](std::vector<std::pair<S,uint64_t>>& a,const std::vector<std::pair<S,uint64_t>>& b){
+            a.insert(a.end(),b.begin(),b.end());
+        });
+
+        if(values.empty()){
+            return result;
+        }
+
+        std::sort(values.begin(),values.end());
+
+        std::vector<uint64_t> cumulative_weight(values.size());
+        uint64_t total_weight = 0;
+        for (size_t i = 0; i < values.size(); ++i) {
+            total_weight += values[i].second;
+            cumulative_weight[i] = total_weight;
+        }
+
+        for (size_t i = 0; i < probabilities.size(); ++i) {
+            const size_t index = std::lower_bound(cumulative_weight.begin(),cumulative_weight.end(),quantile_rank(probabilities[i],total_weight)) - cumulative_weight.begin();
+            result[i] = values[index].first;
+        }
+
+        return result;
+    }
+
+
+    static uint64_t quantile_rank(const double probability,const uint64_t total_weight){
+        //1 based rank of the quantile
+        return std::min(std::max((uint64_t) std::ceil(std::max(probability,0.0)*total_weight),(uint64_t) 1),total_weight);
+    }
+
+    template<typename T,typename Partial,typename Accumulate,typename Combine>
+    static Partial reduce(const APR<T>& apr,const bool volume_weighted,const APRRegion& region,const Partial& initial,Accumulate accumulate,Combine combine){
+        //
+        //  Calls accumulate(partial,particle_number,weight) for the selected particles into per thread partial results,
+        //  combined in the order of the threads
+        //
+
+        int number_threads = 1;
+#ifdef HAVE_OPENMP
+        number_threads = omp_get_max_threads();
+#endif
+        std::vector<Partial> partials(number_threads,initial);
+
+        const uint64_t level_begin = std::max(region.level_begin,(uint64_t) apr.level_min());
+        const uint64_t level_end = std::min(region.level_end,(uint64_t) apr.level_max());
+
+        //pixels selected in each dimension [begin,end)
+        const uint64_t y_begin = region.y_begin;
+        const uint64_t y_end = std::min(region.y_end,(uint64_t) apr.orginal_dimensions(0));
+        const uint64_t x_begin = region.x_begin;
+        const uint64_t x_end = std::min(region.x_end,(uint64_t) apr.orginal_dimensions(1));
+        const uint64_t z_begin = region.z_begin;
+        const uint64_t z_end = std::min(region.z_end,(uint64_t) apr.orginal_dimensions(2));
+        if((y_begin >= y_end) || (x_begin >= x_end) || (z_begin >= z_end)){
+            return initial;
+        }
+
+        const bool whole_image = (y_begin == 0) && (x_begin == 0) && (z_begin == 0) && (y_end == apr.orginal_dimensions(0)) &&
+                                 (x_end == apr.orginal_dimensions(1)) && (z_end == apr.orginal_dimensions(2));
+
+        APRIterator<T> apr_iterator(apr);
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel firstprivate(apr_iterator)
+#endif
+        {
+            Partial partial = initial;
+
+            for (uint64_t level = level_begin; level <= level_end; ++level) {
+
+                if(whole_image && !volume_weighted){
+                    //all particles of the level
+                    const int64_t particles_begin = apr_iterator.particles_level_begin(level);
+                    const int64_t particles_end = apr_iterator.particles_level_end(level);
+#ifdef HAVE_OPENMP
+#pragma omp for schedule(static) nowait
+#endif
+                    for (int64_t particle_number = particles_begin; particle_number < particles_end; ++particle_number) {
+                        accumulate(partial,particle_number,1);
+                    }
+                    continue;
+                }
+
+                //the cells of the level touching the region, and the pixels of a cell [cell_begin,cell_end) inside it
+                const uint64_t shift = apr.level_max() - level;
+                auto overlap = [shift](const uint64_t cell,const uint64_t begin,const uint64_t end){
+                    return std::min((cell + 1) << shift,end) - std::max(cell << shift,begin);
+                };
+
+                const int64_t z_cell_begin = z_begin >> shift;
+                const int64_t z_cell_end = ((z_end - 1) >> shift) + 1;
+                const uint64_t x_cell_begin = x_begin >> shift;
+                const uint64_t x_cell_end = ((x_end - 1) >> shift) + 1;
+                const uint64_t y_cell_begin = y_begin >> shift;
+                const uint64_t y_cell_end = ((y_end - 1) >> shift) + 1;
+
+#ifdef HAVE_OPENMP
+#pragma omp for schedule(dynamic) nowait
+#endif
+                for (int64_t z = z_cell_begin; z < z_cell_end; ++z) {
+                    const uint64_t z_weight = overlap(z,z_begin,z_end);
+
+                    for (uint64_t x = x_cell_begin; x < x_cell_end; ++x) {
+                        const uint64_t zx_weight = z_weight*overlap(x,x_begin,x_end);
+
+                        if(!apr_iterator.set_iterator_to_row(level,z,x)){
+                            continue;
+                        }
+
+                        do {
+                            const uint64_t gap_y_begin = apr_iterator.gap_y_begin();
+                            if(gap_y_begin >= y_cell_end){
+                                break;
+                            }
+                            const uint64_t gap_y_end = std::min((uint64_t) apr_iterator.gap_y_end() + 1,y_cell_end);
+                            const uint64_t particles_begin = apr_iterator.gap_particles_begin();
+
+                            for (uint64_t y = std::max(gap_y_begin,y_cell_begin); y < gap_y_end; ++y) {
+                                const uint64_t weight = volume_weighted ? zx_weight*overlap(y,y_begin,y_end) : 1;
+                                accumulate(partial,particles_begin + y - gap_y_begin,weight);
+                            }
+                        } while(apr_iterator.move_to_next_gap_in_row());
+                    }
+                }
+            }
+
+#ifdef HAVE_OPENMP
+            partials[omp_get_thread_num()] = std::move(partial);
+#else
+            partials[0] = std::move(partial);
+#endif
+        }
+
+        Partial result = std::move(partials[0]);
+        for (int thread = 1; thread < number_threads; ++thread) {
+            combine(result,partials[thread]);
+        }
+        return result;
+    }
+
+};
+
+
+#endif //PARTPLAY_APRSTATISTICS_HPP
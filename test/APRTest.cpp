@@ -6,8 +6,19 @@
 #include "data_structures/APR/APR.hpp"
 #include "data_structures/Mesh/MeshData.hpp"
 #include "algorithm/APRConverter.hpp"
+#include "algorithm/APRBatchConverter.hpp"
+#include "numerics/APRNumerics.hpp"
+#include "data_structures/APR/SharedAPR.hpp"
+#include "data_structures/APR/APRTree.hpp"
+#include "numerics/APRConnectedComponents.hpp"
+#include "numerics/APRFilter.hpp"
+#include "numerics/APRStatistics.hpp"
+#include "numerics/APRSolver.hpp"
 #include <utility>
 #include <cmath>
+#include <random>
+#include <array>
+#include <cstdio>
 
 struct TestData{
 
@@ -84,151 +95,285 @@ bool check_neighbour_out_of_bounds(APRIterator<uint16_t>& current,uint8_t face){
     return true;
 }
 
-bool test_apr_input_output(TestData& test_data){
+bool test_apr_neighbour_table(TestData& test_data){
+    //
+    //  Checks the precomputed neighbours against the iterator, and the numerics using them against the iterator versions
+    //
 
     bool success = true;
 
+    APR<uint16_t>& apr = test_data.apr;
+    APRNeighbourTable neighbours(apr);
 
+    APRIterator<uint16_t> neighbour_iterator(apr);
+    APRIterator<uint16_t> apr_iterator(apr);
 
-    APRIterator<uint16_t> apr_iterator(test_data.apr);
-
-    std::string save_loc = "";
-    std::string file_name = "read_write_test";
-
-    //write the APR
-    test_data.apr.write_apr(save_loc,file_name);
-
-    APR<uint16_t> apr_read;
-
-    apr_read.read_apr(save_loc + file_name + "_apr.h5");
-    APRIterator<uint16_t> apr_iterator_read(apr_read);
-
-    uint64_t particle_number;
+    if(neighbours.total_number_particles != apr.total_number_particles()){
+        return false;
+    }
 
-    for (particle_number = 0; particle_number < apr_iterator.total_number_particles(); ++particle_number) {
+    for (uint64_t particle_number = 0; particle_number < apr_iterator.total_number_particles(); ++particle_number) {
 
         apr_iterator.set_iterator_to_particle_by_number(particle_number);
-        apr_iterator_read.set_iterator_to_particle_by_number(particle_number);
-        //counter++;
 
-        //check the functionality
-        if(test_data.apr.particles_intensities[apr_iterator]!=apr_read.particles_intensities[apr_iterator_read]){
+        if(neighbours.particle_level[particle_number] != apr_iterator.level()){
             success = false;
         }
 
-        if(apr_iterator.level()!=apr_iterator_read.level()){
-            success = false;
-        }
+        for (uint8_t face = 0; face < 6; ++face) {
+            apr_iterator.find_neighbours_in_direction(face);
 
-        if(apr_iterator.x()!=apr_iterator_read.x()){
-            success = false;
-        }
+            std::vector<uint64_t> neighbours_iterator;
+            for (int index = 0; index < apr_iterator.number_neighbours_in_direction(face); ++index) {
+                if(neighbour_iterator.set_neighbour_iterator(apr_iterator, face, index)){
+                    neighbours_iterator.push_back(neighbour_iterator.global_index());
+                }
+            }
 
-        if(apr_iterator.y()!=apr_iterator_read.y()){
-            success = false;
+            if((neighbours_iterator.size() != neighbours.number_neighbours(face, particle_number)) ||
+               !std::equal(neighbours_iterator.begin(), neighbours_iterator.end(), neighbours.face_neighbours(face, particle_number).begin())){
+                success = false;
+            }
         }
+    }
 
-        if(apr_iterator.z()!=apr_iterator_read.z()){
-            success = false;
-        }
+    APRNumerics apr_numerics;
+    const std::vector<float> filter = {0.1f, 0.8f, 0.1f};
 
-        if(apr_iterator.type()!=apr_iterator_read.type()){
-            success = false;
-        }
+    ExtraParticleData<float> smooth(apr);
+    apr_numerics.seperable_smooth_filter(apr, apr.particles_intensities, smooth, filter, 2);
+    ExtraParticleData<float> smooth_table(apr);
+    apr_numerics.seperable_smooth_filter(apr, neighbours, apr.particles_intensities, smooth_table, filter, 2);
 
+    if(!std::equal(smooth.data.begin(), smooth.data.end(), smooth_table.data.begin())){
+        success = false;
     }
 
+    const std::vector<float> delta = {1, 1, 2};
+    MultiChannelParticleData<float> gradient;
+    APRNumerics::compute_gradient_vector(apr, gradient, false, delta);
+    MultiChannelParticleData<float> gradient_table;
+    if(!APRNumerics::compute_gradient_vector(apr, neighbours, gradient_table, false, delta)){
+        success = false;
+    }
 
-    //
-    // Now check the Extra Part Cell Data
-    //
-
-    APRIterator<uint16_t> neighbour_iterator(apr_read);
-    APRIterator<uint16_t> apr_iterator_read2(apr_read);
+    for (uint64_t i = 0; i < gradient.total_number_particles(); ++i) {
+        for (int d = 0; d < 3; ++d) {
+            const float a = gradient(i, d);
+            const float b = gradient_table(i, d);
+            if(!(a == b || (std::isnan(a) && std::isnan(b)))){
+                success = false;
+            }
+        }
+    }
 
-    for (particle_number = 0; particle_number < apr_iterator_read.total_number_particles(); ++particle_number) {
-        apr_iterator_read2.set_iterator_to_particle_by_number(particle_number);
+    return success;
+}
 
-        //loop over all the neighbours and set the neighbour iterator to it
-        for (int direction = 0; direction < 6; ++direction) {
-            // Neighbour Particle Cell Face definitions [+y,-y,+x,-x,+z,-z] =  [0,1,2,3,4,5]
-            apr_iterator_read2.find_neighbours_in_direction(direction);
+bool test_shared_apr(TestData& test_data){
+    //
+    //  Checks that copies of a shared APR handle refer to the same APR, and the numerics give the same results using it
+    //
 
-            success = check_neighbour_out_of_bounds(apr_iterator_read2,direction);
+    bool success = true;
 
-            for (int index = 0; index < apr_iterator_read2.number_neighbours_in_direction(direction); ++index) {
+    APR<uint16_t> apr_copy = test_data.apr;
+    SharedAPR<uint16_t> shared_apr(std::move(apr_copy));
+    SharedAPR<uint16_t> shared_apr_2 = shared_apr;
 
-                // on each face, there can be 0-4 neighbours accessed by index
-                if(neighbour_iterator.set_neighbour_iterator(apr_iterator_read2, direction, index)){
-                    //will return true if there is a neighbour defined
-                    uint16_t apr_intensity = test_data.apr.particles_intensities[neighbour_iterator];
-                    uint16_t check_intensity = test_data.img_pc(neighbour_iterator.y_nearest_pixel(),neighbour_iterator.x_nearest_pixel(),neighbour_iterator.z_nearest_pixel());
+    if((shared_apr.get() != shared_apr_2.get()) || (shared_apr.use_count() != 2)){
+        success = false;
+    }
 
-                    if(check_intensity!=apr_intensity){
-                        success = false;
-                    }
+    if(shared_apr->total_number_particles() != test_data.apr.total_number_particles()){
+        success = false;
+    }
 
-                    if(!check_neighbours(apr_read,apr_iterator_read2,neighbour_iterator)){
-                        success = false;
-                    }
-                }
-            }
+    //read through the handle
+    APRIterator<uint16_t> apr_iterator = shared_apr.iterator();
+    APRIterator<uint16_t> apr_iterator_ref(test_data.apr);
+    for (uint64_t particle_number = 0; particle_number < apr_iterator.total_number_particles(); ++particle_number) {
+        apr_iterator.set_iterator_to_particle_by_number(particle_number);
+        apr_iterator_ref.set_iterator_to_particle_by_number(particle_number);
+        if((apr_iterator.x() != apr_iterator_ref.x()) || (apr_iterator.y() != apr_iterator_ref.y()) || (apr_iterator.z() != apr_iterator_ref.z()) ||
+           (apr_iterator.level() != apr_iterator_ref.level()) || (shared_apr->particles_intensities[apr_iterator] != test_data.apr.particles_intensities[apr_iterator_ref])){
+            success = false;
         }
     }
 
+    APRNumerics apr_numerics;
+    const std::vector<float> filter = {0.1f, 0.8f, 0.1f};
 
-    ExtraParticleData<float> extra_data(test_data.apr);
-
-    for (particle_number = 0; particle_number < apr_iterator_read.total_number_particles(); ++particle_number) {
-        apr_iterator_read.set_iterator_to_particle_by_number(particle_number);
-        extra_data[apr_iterator_read] = apr_iterator_read.type();
+    ExtraParticleData<float> smooth(test_data.apr);
+    apr_numerics.seperable_smooth_filter(test_data.apr, test_data.apr.particles_intensities, smooth, filter, 2);
+    ExtraParticleData<float> smooth_shared(*shared_apr);
+    apr_numerics.seperable_smooth_filter(*shared_apr, shared_apr->particles_intensities, smooth_shared, filter, 2);
 
+    if(!std::equal(smooth.data.begin(), smooth.data.end(), smooth_shared.data.begin())){
+        success = false;
     }
 
-    //write one of the above results to file
-    test_data.apr.write_particles_only(save_loc,"example_output",extra_data);
-
-    std::string extra_file_name = save_loc + "example_output" + "_apr_extra_parts.h5";
+    MeshData<uint16_t> img;
+    APRReconstruction apr_reconstruction;
+    apr_reconstruction.interp_img(*shared_apr, img, shared_apr->particles_intensities);
+    MeshData<uint16_t> img_ref;
+    test_data.apr.interp_img(img_ref, test_data.apr.particles_intensities);
 
-    ExtraParticleData<float> extra_data_read;
+    if(!std::equal(img.mesh.begin(), img.mesh.end(), img_ref.mesh.begin())){
+        success = false;
+    }
 
-    //you need the same apr used to write it to load it (doesn't save location data)
-    test_data.apr.read_parts_only(extra_file_name,extra_data_read);
+    return success;
+}
 
-    for (particle_number = 0; particle_number < apr_iterator_read.total_number_particles(); ++particle_number) {
-        apr_iterator_read.set_iterator_to_particle_by_number(particle_number);
+bool test_apr_batch_converter(TestData& test_data){
+    //
+    //  The pipelined batch conversion of a series of files has to write the same APRs as converting each file on its
+    //  own, skipping (and reporting) the files that can not be read
+    //
 
-        extra_data[apr_iterator_read] = apr_iterator_read.type();
-        if((extra_data[apr_iterator_read]) != (extra_data_read[apr_iterator_read])){
+    bool success = true;
 
-            success = false;
+    MeshData<uint16_t> input_image = TiffUtils::getMesh<uint16_t>(test_data.filename);
+    MeshData<uint16_t> cropped_image(input_image.y_num - 3, input_image.x_num/2 + 5, input_image.z_num - 1);
+    for (size_t z = 0; z < cropped_image.z_num; ++z) {
+        for (size_t x = 0; x < cropped_image.x_num; ++x) {
+            for (size_t y = 0; y < cropped_image.y_num; ++y) {
+                cropped_image(y, x, z) = input_image(y, x, z);
+            }
         }
     }
+    std::string cropped_file_name = test_data.output_name + "_batch_cropped.tif";
+    TiffUtils::saveMeshAsTiff(cropped_file_name, cropped_image);
+
+    const std::vector<std::string> input_files = {test_data.filename, cropped_file_name, "no_file.tif", cropped_file_name, test_data.filename};
+    const std::vector<std::string> output_names = {"batch_0", "batch_1", "batch_2", "batch_3", "batch_4"};
+
+    APRBatchConverter<uint16_t> batch_converter;
+    batch_converter.par.Ip_th = test_data.apr.parameters.Ip_th;
+    batch_converter.par.rel_error = test_data.apr.parameters.rel_error;
+    batch_converter.par.lambda = test_data.apr.parameters.lambda;
+    batch_converter.par.min_signal = test_data.apr.parameters.min_signal;
+    batch_converter.par.sigma_th_max = test_data.apr.parameters.sigma_th_max;
+    batch_converter.par.sigma_th = test_data.apr.parameters.sigma_th;
+    batch_converter.par.SNR_min = test_data.apr.parameters.SNR_min;
+    batch_converter.queue_size = 1;
+    batch_converter.read_threads = 2;
+    batch_converter.convert_threads = 2;
+    batch_converter.write_threads = 1;
+
+    //the missing file fails, the others are converted
+    if(batch_converter.convert_files(input_files, output_names) || (batch_converter.failed_files.size() != 1) ||
+       (batch_converter.failed_files[0] != "no_file.tif")){
+        success = false;
+    }
+    if((batch_converter.read_statistics.items != 4) || (batch_converter.convert_statistics.items != 4) || (batch_converter.write_statistics.items != 4)){
+        success = false;
+    }
 
-    //Repeat with different data-type
-    ExtraParticleData<uint16_t> extra_data16(test_data.apr);
+    for (size_t i = 0; i < input_files.size(); ++i) {
+        if (i == 2) {
+            continue;
+        }
 
-    for (particle_number = 0; particle_number < apr_iterator_read.total_number_particles(); ++particle_number) {
-        apr_iterator_read.set_iterator_to_particle_by_number(particle_number);
+        APR<uint16_t> apr;
+        APRConverter<uint16_t> apr_converter;
+        apr_converter.par = batch_converter.par;
+        apr_converter.par.input_image_name = input_files[i];
+        apr_converter.get_apr(apr);
 
-        extra_data16[apr_iterator_read] = apr_iterator_read.level();
+        APR<uint16_t> apr_read;
+        apr_read.read_apr(output_names[i] + "_apr.h5");
+
+        if((apr.total_number_particles() != apr_read.total_number_particles()) ||
+           !std::equal(apr.particles_intensities.data.begin(), apr.particles_intensities.data.end(), apr_read.particles_intensities.data.begin())){
+            success = false;
+            continue;
+        }
+
+        APRIterator<uint16_t> apr_iterator(apr);
+        APRIterator<uint16_t> apr_iterator_read(apr_read);
+        for (uint64_t particle_number = 0; particle_number < apr_iterator.total_number_particles(); ++particle_number) {
+            apr_iterator.set_iterator_to_particle_by_number(particle_number);
+            apr_iterator_read.set_iterator_to_particle_by_number(particle_number);
+            if((apr_iterator.x() != apr_iterator_read.x()) || (apr_iterator.y() != apr_iterator_read.y()) ||
+               (apr_iterator.z() != apr_iterator_read.z()) || (apr_iterator.level() != apr_iterator_read.level())){
+                success = false;
+            }
+        }
+    }
 
+    std::remove(cropped_file_name.c_str());
+    for (const std::string &output_name : output_names) {
+        std::remove((output_name + "_apr.h5").c_str());
     }
 
-    //write one of the above results to file
-    test_data.apr.write_particles_only(save_loc,"example_output16",extra_data16);
+    return success;
+}
 
-    std::string extra_file_name16 = save_loc + "example_output16" + "_apr_extra_parts.h5";
+bool test_apr_converter_workspace(TestData& test_data){
+    //
+    //  A converter reusing its workspace (par.reuse_workspace) over a sequence of images, with a change of dimensions in
+    //  between, has to give the same APRs as a new converter for each image
+    //
 
-    ExtraParticleData<uint16_t> extra_data_read16;
+    bool success = true;
 
-    //you need the same apr used to write it to load it (doesn't save location data)
-    test_data.apr.read_parts_only(extra_file_name16,extra_data_read16);
+    MeshData<uint16_t> input_image = TiffUtils::getMesh<uint16_t>(test_data.filename);
+    MeshData<uint16_t> cropped_image(input_image.y_num - 3, input_image.x_num/2 + 5, input_image.z_num - 1);
+    for (size_t z = 0; z < cropped_image.z_num; ++z) {
+        for (size_t x = 0; x < cropped_image.x_num; ++x) {
+            for (size_t y = 0; y < cropped_image.y_num; ++y) {
+                cropped_image(y, x, z) = input_image(y, x, z);
+            }
+        }
+    }
 
-    for (particle_number = 0; particle_number < apr_iterator_read.total_number_particles(); ++particle_number) {
-        apr_iterator_read.set_iterator_to_particle_by_number(particle_number);
+    auto set_parameters = [&](APRConverter<uint16_t>& apr_converter){
+        apr_converter.par.Ip_th = test_data.apr.parameters.Ip_th;
+        apr_converter.par.rel_error = test_data.apr.parameters.rel_error;
+        apr_converter.par.lambda = test_data.apr.parameters.lambda;
+        apr_converter.par.min_signal = test_data.apr.parameters.min_signal;
+        apr_converter.par.sigma_th_max = test_data.apr.parameters.sigma_th_max;
+        apr_converter.par.sigma_th = test_data.apr.parameters.sigma_th;
+        apr_converter.par.SNR_min = test_data.apr.parameters.SNR_min;
+    };
+
+    //with the dense and the packed particle cell tree
+    for (bool packed : {false, true}) {
+        APRConverter<uint16_t> apr_converter_workspace;
+        set_parameters(apr_converter_workspace);
+        apr_converter_workspace.par.reuse_workspace = true;
+        apr_converter_workspace.par.packed_pulling_scheme = packed;
+
+        for (MeshData<uint16_t>* image : {&input_image, &input_image, &cropped_image, &input_image}) {
+            APR<uint16_t> apr_workspace;
+            apr_converter_workspace.get_apr(apr_workspace, *image);
+
+            APR<uint16_t> apr;
+            APRConverter<uint16_t> apr_converter;
+            set_parameters(apr_converter);
+            apr_converter.get_apr(apr, *image);
+
+            if((apr.total_number_particles() != apr_workspace.total_number_particles()) ||
+               !std::equal(apr.particles_intensities.data.begin(), apr.particles_intensities.data.end(), apr_workspace.particles_intensities.data.begin())){
+                return false;
+            }
 
-        if(extra_data16[apr_iterator_read] != (extra_data_read16[apr_iterator_read])){
+            APRIterator<uint16_t> apr_iterator(apr);
+            APRIterator<uint16_t> workspace_iterator(apr_workspace);
+            for (uint64_t particle_number = 0; particle_number < apr_iterator.total_number_particles(); ++particle_number) {
+                apr_iterator.set_iterator_to_particle_by_number(particle_number);
+                workspace_iterator.set_iterator_to_particle_by_number(particle_number);
+                if((apr_iterator.x() != workspace_iterator.x()) || (apr_iterator.y() != workspace_iterator.y()) ||
+                   (apr_iterator.z() != workspace_iterator.z()) || (apr_iterator.level() != workspace_iterator.level())){
+                    success = false;
+                }
+            }
+        }
+
+        apr_converter_workspace.release_workspace();
+        if(apr_converter_workspace.particle_cell_tree_size_in_bytes() != 0){
             success = false;
         }
     }
@@ -236,460 +381,2507 @@ bool test_apr_input_output(TestData& test_data){
     return success;
 }
 
+bool test_apr_direct_sampling(TestData& test_data){
+    //
+    //  Sampling the particles directly from the image has to give the same intensities as sampling them from the
+    //  down-sampled pyramid, and the max reducer has to give the max over the pixels of each particle cell
+    //
+
+    bool success = true;
 
+    MeshData<uint16_t> input_image = TiffUtils::getMesh<uint16_t>(test_data.filename);
 
-bool test_apr_neighbour_access(TestData& test_data){
+    ExtraParticleData<uint16_t> parts_direct;
+    test_data.apr.get_parts_from_img(input_image, parts_direct);
 
-    bool success = true;
+    ExtraParticleData<uint16_t> parts_max(test_data.apr);
+    test_data.apr.get_parts_from_img(input_image, parts_max, [](const float x, const float y) -> float { return std::max(x, y); },
+                                     [](const float x) -> float { return x; });
 
-    APRIterator<uint16_t> neighbour_iterator(test_data.apr);
     APRIterator<uint16_t> apr_iterator(test_data.apr);
-
     uint64_t particle_number;
-
     for (particle_number = 0; particle_number < apr_iterator.total_number_particles(); ++particle_number) {
-
         apr_iterator.set_iterator_to_particle_by_number(particle_number);
+        const size_t size = ((size_t) 1) << (apr_iterator.level_max() - apr_iterator.level());
+        uint16_t max_value = 0;
+        for (size_t z = apr_iterator.z()*size; z < std::min((apr_iterator.z() + 1)*size, input_image.z_num); ++z) {
+            for (size_t x = apr_iterator.x()*size; x < std::min((apr_iterator.x() + 1)*size, input_image.x_num); ++x) {
+                for (size_t y = apr_iterator.y()*size; y < std::min((apr_iterator.y() + 1)*size, input_image.y_num); ++y) {
+                    max_value = std::max(max_value, input_image(y, x, z));
+                }
+            }
+        }
+        if(parts_max[apr_iterator] != max_value){
+            success = false;
+        }
+    }
 
-        //loop over all the neighbours and set the neighbour iterator to it
-        for (int direction = 0; direction < 6; ++direction) {
-            // Neighbour Particle Cell Face definitions [+y,-y,+x,-x,+z,-z] =  [0,1,2,3,4,5]
-            apr_iterator.find_neighbours_in_direction(direction);
-
-            success = check_neighbour_out_of_bounds(apr_iterator,direction);
-
-            for (int index = 0; index < apr_iterator.number_neighbours_in_direction(direction); ++index) {
+    //the pyramid takes the original image
+    std::vector<MeshData<uint16_t>> downsampled_img;
+    downsamplePyrmaid(input_image, downsampled_img, test_data.apr.level_max(), test_data.apr.level_min());
+    ExtraParticleData<uint16_t> parts_pyramid;
+    test_data.apr.get_parts_from_img(downsampled_img, parts_pyramid);
 
-                // on each face, there can be 0-4 neighbours accessed by index
-                if(neighbour_iterator.set_neighbour_iterator(apr_iterator, direction, index)){
-                    //will return true if there is a neighbour defined
-                    uint16_t apr_intensity = test_data.apr.particles_intensities[neighbour_iterator];
-                    uint16_t check_intensity = test_data.img_pc(neighbour_iterator.y_nearest_pixel(),neighbour_iterator.x_nearest_pixel(),neighbour_iterator.z_nearest_pixel());
+    if((parts_pyramid.data.size() != parts_direct.data.size()) ||
+       !std::equal(parts_pyramid.data.begin(), parts_pyramid.data.end(), parts_direct.data.begin())){
+        success = false;
+    }
 
-                    if(check_intensity!=apr_intensity){
-                        success = false;
-                    }
+    return success;
+}
 
-                    uint16_t apr_level = neighbour_iterator.level();
-                    uint16_t check_level = test_data.img_level(neighbour_iterator.y_nearest_pixel(),neighbour_iterator.x_nearest_pixel(),neighbour_iterator.z_nearest_pixel());
+bool check_slab_apr(APR<uint16_t>& apr,APR<uint16_t>& apr_slabs){
+    //
+    //  Compares an APR converted in z-slabs with the one of the whole image (slab conversion is approximate, see
+    //  APRConverter::get_slab_halo): the levels of the piecewise constant reconstructions have to agree at all but 0.1% of
+    //  the pixels, and the intensities where the levels agree
+    //
 
-                    if(check_level!=apr_level){
-                        success = false;
-                    }
+    bool success = true;
 
-                    uint16_t apr_type = neighbour_iterator.type();
-                    uint16_t check_type = test_data.img_type(neighbour_iterator.y_nearest_pixel(),neighbour_iterator.x_nearest_pixel(),neighbour_iterator.z_nearest_pixel());
+    APRReconstruction apr_reconstruction;
+    MeshData<uint8_t> level_image;
+    MeshData<uint8_t> level_image_slabs;
+    apr_reconstruction.interp_level(apr, level_image);
+    apr_reconstruction.interp_level(apr_slabs, level_image_slabs);
+    MeshData<uint16_t> pc_image;
+    MeshData<uint16_t> pc_image_slabs;
+    apr_reconstruction.interp_img(apr, pc_image, apr.particles_intensities);
+    apr_reconstruction.interp_img(apr_slabs, pc_image_slabs, apr_slabs.particles_intensities);
+
+    if(level_image.mesh.size() != level_image_slabs.mesh.size()){
+        return false;
+    }
 
-                    if(check_type!=apr_type){
-                        success = false;
-                    }
+    const double max_level_difference = 0.001;
+    size_t level_differences = 0;
+    for (size_t i = 0; i < level_image.mesh.size(); ++i) {
+        if(level_image.mesh[i] != level_image_slabs.mesh[i]){
+            level_differences++;
+        } else if(std::abs((int) pc_image.mesh[i] - (int) pc_image_slabs.mesh[i]) > 1){
+            //the same Particle Cell, its mean only differs by rounding
+            success = false;
+        }
+    }
+    if(level_differences > max_level_difference*level_image.mesh.size()){
+        success = false;
+    }
 
-                    uint16_t apr_x = neighbour_iterator.x();
-                    uint16_t check_x = test_data.img_x(neighbour_iterator.y_nearest_pixel(),neighbour_iterator.x_nearest_pixel(),neighbour_iterator.z_nearest_pixel());
+    return success;
+}
 
-                    if(check_x!=apr_x){
-                        success = false;
-                    }
+bool test_apr_packed_pulling_scheme(TestData& test_data){
+    //
+    //  The packed particle cell tree in the pulling scheme has to give the same APR as the dense one (nearly the same in
+    //  z-slabs, see check_slab_apr), on the image cropped to odd dimensions (through the sphere), where the particle cells
+    //  also have to cover each pixel once
+    //
 
-                    uint16_t apr_y = neighbour_iterator.y();
-                    uint16_t check_y = test_data.img_y(neighbour_iterator.y_nearest_pixel(),neighbour_iterator.x_nearest_pixel(),neighbour_iterator.z_nearest_pixel());
+    bool success = true;
 
-                    if(check_y!=apr_y){
-                        success = false;
-                    }
+    MeshData<uint16_t> input_image = TiffUtils::getMesh<uint16_t>(test_data.filename);
+    MeshData<uint16_t> cropped_image(input_image.y_num - 3, input_image.x_num/2 + 5, input_image.z_num - 1);
+    for (size_t z = 0; z < cropped_image.z_num; ++z) {
+        for (size_t x = 0; x < cropped_image.x_num; ++x) {
+            for (size_t y = 0; y < cropped_image.y_num; ++y) {
+                cropped_image(y, x, z) = input_image(y, x, z);
+            }
+        }
+    }
+    std::string file_name = test_data.output_name + "_cropped.tif";
+    TiffUtils::saveMeshAsTiff(file_name, cropped_image);
 
-                    uint16_t apr_z = neighbour_iterator.z();
-                    uint16_t check_z = test_data.img_z(neighbour_iterator.y_nearest_pixel(),neighbour_iterator.x_nearest_pixel(),neighbour_iterator.z_nearest_pixel());
+    APR<uint16_t> apr;
+    APR<uint16_t> apr_packed;
+    APR<uint16_t> apr_packed_slabs;
 
-                    if(check_z!=apr_z){
-                        success = false;
-                    }
+    for (APR<uint16_t>* apr_current : {&apr,&apr_packed,&apr_packed_slabs}) {
+        APRConverter<uint16_t> apr_converter;
 
-                    if(!check_neighbours(test_data.apr,apr_iterator,neighbour_iterator)){
-                        success = false;
-                    }
+        apr_converter.par.Ip_th = test_data.apr.parameters.Ip_th;
+        apr_converter.par.rel_error = test_data.apr.parameters.rel_error;
+        apr_converter.par.lambda = test_data.apr.parameters.lambda;
+        apr_converter.par.min_signal = test_data.apr.parameters.min_signal;
+        apr_converter.par.sigma_th_max = test_data.apr.parameters.sigma_th_max;
+        apr_converter.par.sigma_th = test_data.apr.parameters.sigma_th;
+        apr_converter.par.SNR_min = test_data.apr.parameters.SNR_min;
 
-                }
+        apr_converter.par.input_image_name = file_name;
+        apr_converter.par.input_dir = "";
 
-            }
+        apr_converter.par.packed_pulling_scheme = (apr_current != &apr);
+        apr_converter.par.memory_budget_mb = (apr_current == &apr_packed_slabs) ? 0.5 : 0;
 
+        if(!apr_converter.get_apr(*apr_current)){
+            success = false;
         }
     }
 
-#ifdef HAVE_OPENMP
-	#pragma omp parallel for schedule(static) private(particle_number) firstprivate(apr_iterator,neighbour_iterator)
-#endif
-    for (particle_number = 0; particle_number < apr_iterator.total_number_particles(); ++particle_number) {
+    std::remove(file_name.c_str());
+    if(!success){
+        return false;
+    }
+
+    MeshData<uint16_t> covered(cropped_image.y_num, cropped_image.x_num, cropped_image.z_num, 0);
+    APRIterator<uint16_t> apr_iterator(apr);
+    uint64_t particle_number;
+    for (particle_number = 0; particle_number < apr_iterator.total_number_particles(); ++particle_number) {
+        apr_iterator.set_iterator_to_particle_by_number(particle_number);
+        const size_t size = ((size_t) 1) << (apr_iterator.level_max() - apr_iterator.level());
+        for (size_t z = apr_iterator.z()*size; z < std::min((apr_iterator.z() + 1)*size, covered.z_num); ++z) {
+            for (size_t x = apr_iterator.x()*size; x < std::min((apr_iterator.x() + 1)*size, covered.x_num); ++x) {
+                for (size_t y = apr_iterator.y()*size; y < std::min((apr_iterator.y() + 1)*size, covered.y_num); ++y) {
+                    covered(y, x, z)++;
+                }
+            }
+        }
+    }
+    for (size_t i = 0; i < covered.mesh.size(); ++i) {
+        if (covered.mesh[i] != 1) {
+            success = false;
+        }
+    }
+
+    if(apr.total_number_particles() != apr_packed.total_number_particles()){
+        return false;
+    }
+
+    APRIterator<uint16_t> packed_iterator(apr_packed);
+
+    for (particle_number = 0; particle_number < apr_iterator.total_number_particles(); ++particle_number) {
+        apr_iterator.set_iterator_to_particle_by_number(particle_number);
+        packed_iterator.set_iterator_to_particle_by_number(particle_number);
+
+        if((apr_iterator.x() != packed_iterator.x()) || (apr_iterator.y() != packed_iterator.y()) || (apr_iterator.z() != packed_iterator.z()) ||
+           (apr_iterator.level() != packed_iterator.level()) || (apr_iterator.type() != packed_iterator.type())){
+            success = false;
+        }
+
+        if(apr.particles_intensities[apr_iterator] != apr_packed.particles_intensities[packed_iterator]){
+            success = false;
+        }
+    }
+
+    if(!check_slab_apr(apr,apr_packed_slabs)){
+        success = false;
+    }
+
+    return success;
+}
+
+bool test_apr_sparse_pulling_scheme(TestData& test_data){
+    //
+    //  The sparse particle cell tree in the pulling scheme has to give the same APR as the dense one (nearly the same in
+    //  z-slabs, see check_slab_apr)
+    //
+
+    bool success = true;
+
+    APR<uint16_t> apr;
+    APR<uint16_t> apr_sparse;
+    APR<uint16_t> apr_sparse_slabs;
+
+    for (APR<uint16_t>* apr_current : {&apr,&apr_sparse,&apr_sparse_slabs}) {
+        APRConverter<uint16_t> apr_converter;
+
+        apr_converter.par.Ip_th = test_data.apr.parameters.Ip_th;
+        apr_converter.par.rel_error = test_data.apr.parameters.rel_error;
+        apr_converter.par.lambda = test_data.apr.parameters.lambda;
+        apr_converter.par.min_signal = test_data.apr.parameters.min_signal;
+        apr_converter.par.sigma_th_max = test_data.apr.parameters.sigma_th_max;
+        apr_converter.par.sigma_th = test_data.apr.parameters.sigma_th;
+        apr_converter.par.SNR_min = test_data.apr.parameters.SNR_min;
+
+        apr_converter.par.input_image_name = test_data.filename;
+        apr_converter.par.input_dir = "";
+
+        apr_converter.par.sparse_pulling_scheme = (apr_current != &apr);
+        apr_converter.par.memory_budget_mb = (apr_current == &apr_sparse_slabs) ? 0.5 : 0;
+
+        if(!apr_converter.get_apr(*apr_current)){
+            return false;
+        }
+    }
+
+    if(apr.total_number_particles() != apr_sparse.total_number_particles()){
+        return false;
+    }
+
+    APRIterator<uint16_t> apr_iterator(apr);
+    APRIterator<uint16_t> sparse_iterator(apr_sparse);
+
+    uint64_t particle_number;
+    for (particle_number = 0; particle_number < apr_iterator.total_number_particles(); ++particle_number) {
+        apr_iterator.set_iterator_to_particle_by_number(particle_number);
+        sparse_iterator.set_iterator_to_particle_by_number(particle_number);
+
+        if((apr_iterator.x() != sparse_iterator.x()) || (apr_iterator.y() != sparse_iterator.y()) || (apr_iterator.z() != sparse_iterator.z()) ||
+           (apr_iterator.level() != sparse_iterator.level()) || (apr_iterator.type() != sparse_iterator.type())){
+            success = false;
+        }
+
+        if(apr.particles_intensities[apr_iterator] != apr_sparse.particles_intensities[sparse_iterator]){
+            success = false;
+        }
+    }
+
+    if(!check_slab_apr(apr,apr_sparse_slabs)){
+        success = false;
+    }
+
+    return success;
+}
+
+bool test_apr_solver(TestData& test_data){
+    //
+    //  Checks the finite volume laplacian (symmetric, zero for constants), and that the multigrid and smoother-only
+    //  solutions of the diffusion and Poisson problems satisfy the discrete equations and conserve the mass
+    //
+
+    bool success = true;
+
+    APR<uint16_t>& apr = test_data.apr;
+    ExtraParticleData<uint16_t>& parts = apr.particles_intensities;
+    const uint64_t total_number_particles = apr.total_number_particles();
+
+    std::vector<double> volume(total_number_particles);
+    APRIterator<uint16_t> apr_iterator(apr);
+    for (uint64_t particle_number = 0; particle_number < total_number_particles; ++particle_number) {
+        apr_iterator.set_iterator_to_particle_by_number(particle_number);
+        volume[particle_number] = std::pow(8.0, apr_iterator.level_max() - apr_iterator.level());
+    }
+
+    APRDiffusionSolver solver(apr, 2.0f);
+
+    //laplacian
+    std::mt19937 generator(7);
+    std::uniform_real_distribution<float> distribution(0, 1);
+    ExtraParticleData<float> a(apr), b(apr), constant(apr), laplacian_a, laplacian_b, laplacian_constant;
+    for (uint64_t i = 0; i < total_number_particles; ++i) {
+        a.data[i] = distribution(generator);
+        b.data[i] = distribution(generator);
+        constant.data[i] = 3;
+    }
+    solver.laplacian(a, laplacian_a);
+    solver.laplacian(b, laplacian_b);
+    solver.laplacian(constant, laplacian_constant);
+
+    double a_lb = 0, b_la = 0;
+    for (uint64_t i = 0; i < total_number_particles; ++i) {
+        a_lb += volume[i]*a.data[i]*laplacian_b.data[i];
+        b_la += volume[i]*b.data[i]*laplacian_a.data[i];
+        if(laplacian_constant.data[i] != 0){
+            success = false;
+        }
+    }
+    if(std::abs(a_lb - b_la) > 1e-5*std::abs(a_lb)){
+        success = false;
+    }
+
+    //relative residual of alpha*u - lambda*laplacian(u) = f, and the change in mass
+    auto check_solution = [&](const float lambda, const float alpha, ExtraParticleData<float>& u, const double f_mean) {
+        ExtraParticleData<float> laplacian_u;
+        solver.laplacian(u, laplacian_u);
+        double residual = 0, norm = 0, mass_u = 0, mass_f = 0;
+        for (uint64_t i = 0; i < total_number_particles; ++i) {
+            const double f = parts.data[i] - f_mean;
+            const double r = alpha*u.data[i] - lambda*laplacian_u.data[i] - f;
+            residual += volume[i]*volume[i]*r*r;
+            norm += volume[i]*volume[i]*f*f;
+            mass_u += volume[i]*u.data[i];
+            mass_f += volume[i]*f;
+        }
+        return std::abs(std::sqrt(residual/norm)) < 1e-4 && (std::abs(alpha*mass_u - mass_f) < 1e-4*std::sqrt(norm));
+    };
+
+    ExtraParticleData<float> u_multigrid, u_smoother;
+
+    solver.tolerance = 1e-7;
+    std::vector<double> residuals_multigrid = solver.solve(parts, u_multigrid);
+    solver.use_multigrid = false;
+    solver.max_iterations = residuals_multigrid.size() - 1;
+    std::vector<double> residuals_smoother = solver.solve(parts, u_smoother);
+
+    //multigrid converges, and faster than the smoother alone
+    if((residuals_multigrid.back() > 1e-7) || (residuals_multigrid.size() > 20) || !(residuals_smoother.back() > 100*residuals_multigrid.back())){
+        success = false;
+    }
+    if(!check_solution(2.0f, 1.0f, u_multigrid, 0)){
+        success = false;
+    }
+
+    //the smoother alone converges to the same solution
+    solver.max_iterations = 1000;
+    solver.tolerance = 1e-6;
+    residuals_smoother = solver.solve(parts, u_smoother, true);
+    for (uint64_t i = 0; i < total_number_particles; ++i) {
+        if(std::abs(u_smoother.data[i] - u_multigrid.data[i]) > 1e-3*std::abs(u_multigrid.data[i]) + 1e-3){
+            success = false;
+        }
+    }
+
+    //Poisson problem (zero mean right hand side) with the Jacobi smoother
+    double f_mean = 0, total_volume = 0;
+    for (uint64_t i = 0; i < total_number_particles; ++i) {
+        f_mean += volume[i]*parts.data[i];
+        total_volume += volume[i];
+    }
+    f_mean /= total_volume;
+
+    solver.init(apr, 1.0f, 0.0f);
+    solver.smoother = APRSmoother::Jacobi;
+    solver.use_multigrid = true;
+    solver.max_iterations = 100;
+    solver.tolerance = 1e-7;
+    std::vector<double> residuals_poisson = solver.solve(parts, u_multigrid);
+    if((residuals_poisson.back() > 1e-7) || !check_solution(1.0f, 0.0f, u_multigrid, f_mean)){
+        success = false;
+    }
+
+    double mean_u = 0;
+    for (uint64_t i = 0; i < total_number_particles; ++i) {
+        mean_u += volume[i]*u_multigrid.data[i];
+    }
+    if(std::abs(mean_u/total_volume) > 1e-3){
+        success = false;
+    }
+
+    return success;
+}
+
+bool test_apr_statistics(TestData& test_data){
+    //
+    //  Compares the volume weighted statistics with the pixels of the reconstructed image (in the whole image and a
+    //  region of interest), and the unweighted statistics with a loop over the particles of a range of levels
+    //
+
+    bool success = true;
+
+    APR<uint16_t>& apr = test_data.apr;
+    ExtraParticleData<uint16_t>& parts = apr.particles_intensities;
+
+    MeshData<uint16_t> reconstruction;
+    apr.interp_img(reconstruction, parts);
+
+    APRRegion whole_image;
+    APRRegion region;
+    region.y_begin = 5; region.y_end = 40;
+    region.x_begin = 13; region.x_end = 50;
+    region.z_begin = 1; region.z_end = 37;
+
+    const std::vector<double> probabilities = {0, 0.05, 0.5, 0.9, 0.999, 1};
+
+    for (const APRRegion& roi : {whole_image, region}) {
+        std::vector<uint16_t> pixels;
+        for (uint64_t z = roi.z_begin; z < std::min(roi.z_end, (uint64_t)reconstruction.z_num); ++z) {
+            for (uint64_t x = roi.x_begin; x < std::min(roi.x_end, (uint64_t)reconstruction.x_num); ++x) {
+                for (uint64_t y = roi.y_begin; y < std::min(roi.y_end, (uint64_t)reconstruction.y_num); ++y) {
+                    pixels.push_back(reconstruction.at(y, x, z));
+                }
+            }
+        }
+
+        double sum = 0;
+        for (uint16_t v : pixels) sum += v;
+        const double mean = sum/pixels.size();
+        double variance = 0;
+        for (uint16_t v : pixels) variance += (v - mean)*(v - mean);
+        variance /= pixels.size();
+
+        ParticleSummary summary = APRStatistics::summary(apr, parts, true, roi);
+        if((summary.weight != pixels.size()) || (summary.sum != sum) || (std::abs(summary.mean - mean) > 1e-9*mean) ||
+           (std::abs(summary.variance - variance) > 1e-6*variance) || (summary.min != *std::min_element(pixels.begin(), pixels.end())) ||
+           (summary.max != *std::max_element(pixels.begin(), pixels.end()))){
+            success = false;
+        }
+
+        std::vector<uint64_t> histogram = APRStatistics::histogram(apr, parts, 100, summary.min, summary.max, true, roi);
+        std::vector<uint64_t> pixel_histogram(100, 0);
+        for (uint16_t v : pixels) {
+            pixel_histogram[std::min((uint64_t)((v - summary.min)*(100/(summary.max - summary.min))), (uint64_t)99)]++;
+        }
+        if(histogram != pixel_histogram){
+            success = false;
+        }
+
+        //empty range, only the values equal to it are counted (in the first bin)
+        const double value = pixels[0];
+        std::vector<uint64_t> histogram_empty_range = APRStatistics::histogram(apr, parts, 10, value, value, true, roi);
+        if((histogram_empty_range[0] != (uint64_t)std::count(pixels.begin(), pixels.end(), pixels[0])) ||
+           (std::accumulate(histogram_empty_range.begin(), histogram_empty_range.end(), (uint64_t)0) != histogram_empty_range[0])){
+            success = false;
+        }
+
+        std::vector<double> quantiles = APRStatistics::quantiles(apr, parts, probabilities, true, roi);
+        std::sort(pixels.begin(), pixels.end());
+        for (size_t i = 0; i < probabilities.size(); ++i) {
+            const size_t rank = std::max(std::ceil(probabilities[i]*pixels.size()), 1.0) - 1;
+            if(quantiles[i] != pixels[rank]){
+                success = false;
+            }
+        }
+    }
+
+    //unweighted over a range of levels
+    APRRegion levels;
+    levels.level_begin = apr.level_max() - 1;
+    levels.level_end = apr.level_max();
+
+    APRIterator<uint16_t> apr_iterator(apr);
+    std::vector<uint16_t> values;
+    for (uint64_t particle_number = 0; particle_number < apr.total_number_particles(); ++particle_number) {
+        apr_iterator.set_iterator_to_particle_by_number(particle_number);
+        if(apr_iterator.level() >= levels.level_begin){
+            values.push_back(parts[apr_iterator]);
+        }
+    }
+    double sum = 0;
+    for (uint16_t v : values) sum += v;
+
+    ParticleSummary summary = APRStatistics::summary(apr, parts, false, levels);
+    if((summary.weight != values.size()) || (summary.sum != sum) || (APRStatistics::sum(apr, parts, false, levels) != sum) ||
+       (APRStatistics::summary(apr, parts).weight != apr.total_number_particles())){
+        success = false;
+    }
+
+    std::vector<double> quantiles = APRStatistics::quantiles(apr, parts, probabilities, false, levels);
+    std::sort(values.begin(), values.end());
+    for (size_t i = 0; i < probabilities.size(); ++i) {
+        const size_t rank = std::max(std::ceil(probabilities[i]*values.size()), 1.0) - 1;
+        if(quantiles[i] != values[rank]){
+            success = false;
+        }
+    }
+
+    //quantiles of float data (sorted instead of counted)
+    ExtraParticleData<float> parts_float(apr);
+    std::copy(parts.data.begin(), parts.data.end(), parts_float.data.begin());
+    if((APRStatistics::quantiles(apr, parts_float, probabilities, true, region) != APRStatistics::quantiles(apr, parts, probabilities, true, region)) ||
+       (APRStatistics::quantiles(apr, parts_float, probabilities, false, levels) != quantiles)){
+        success = false;
+    }
+
+    return success;
+}
+
+void make_gap_map_reference(APR<uint16_t>& apr){
+    //
+    //  Switches the APR to the std::map gap storage, used as the reference the flat storage (the default) is compared with
+    //
+
+    apr.apr_access.build_gap_map();
+}
+
+bool test_apr_filter(TestData& test_data){
+    //
+    //  Compares the convolution of the particles with filtering the image of each level (APRTree::get_level_image)
+    //  with the kernel sampled at that level, for the three kernels and both gap storages
+    //
+
+    bool success = true;
+
+    make_gap_map_reference(test_data.apr);
+    APR<uint16_t> apr_flat = test_data.apr;
+    apr_flat.apr_access.build_flat_map();
+
+    const std::vector<APRConvolutionKernel> kernels = {APRConvolutionKernel::gaussian(1.5f, 7),
+                                                       APRConvolutionKernel::laplacian_of_gaussian(1.5f, 9),
+                                                       APRConvolutionKernel::difference_of_gaussians(1.0f, 2.0f, 9)};
+
+    const float max_intensity = *std::max_element(test_data.apr.particles_intensities.data.begin(), test_data.apr.particles_intensities.data.end());
+
+    std::vector<APR<uint16_t>*> aprs = {&test_data.apr, &apr_flat};
+    for (APR<uint16_t>* apr : aprs) {
+        APRTree<uint16_t> apr_tree(*apr);
+        ExtraParticleData<float> tree_data;
+        apr_tree.fill_tree_mean(*apr, apr->particles_intensities, tree_data);
+
+        for (const APRConvolutionKernel& kernel : kernels) {
+            APRFilter apr_filter;
+            ExtraParticleData<float> filtered;
+            apr_filter.convolve(*apr, apr_tree, apr->particles_intensities, filtered, kernel);
+
+            APRIterator<uint16_t> apr_iterator(*apr);
+            for (uint64_t level = apr_iterator.level_min(); level <= apr_iterator.level_max(); ++level) {
+                MeshData<float> level_image;
+                MeshData<float> filtered_image;
+                apr_tree.get_level_image(*apr, apr->particles_intensities, tree_data, level, level_image);
+                APRFilter::convolve_mesh(level_image, filtered_image, kernel, apr_iterator.level_max() - level);
+
+                for (uint64_t particle_number = apr_iterator.particles_level_begin(level); particle_number < apr_iterator.particles_level_end(level); ++particle_number) {
+                    apr_iterator.set_iterator_to_particle_by_number(particle_number);
+                    if(std::abs(filtered[apr_iterator] - filtered_image.at(apr_iterator.y(), apr_iterator.x(), apr_iterator.z())) > 1e-5*max_intensity){
+                        success = false;
+                    }
+                }
+            }
+        }
+    }
+
+    return success;
+}
+
+bool test_apr_connected_components(TestData& test_data){
+    //
+    //  Labels the connected components of a mask (the sphere with randomly removed particles) and compares them with
+    //  the 6-connected components of the reconstructed mask
+    //
+
+    bool success = true;
+
+    APR<uint16_t>& apr = test_data.apr;
+
+    //mask
+    float threshold = 0;
+    for (uint64_t p = 0; p < apr.total_number_particles(); ++p) {
+        threshold += apr.particles_intensities.data[p];
+    }
+    threshold /= apr.total_number_particles();
+
+    std::mt19937 generator(0);
+    std::bernoulli_distribution keep(0.7);
+    ExtraParticleData<uint8_t> mask(apr);
+    for (uint64_t p = 0; p < apr.total_number_particles(); ++p) {
+        mask.data[p] = (apr.particles_intensities.data[p] > threshold) && keep(generator);
+    }
+
+    APRConnectedComponents connected_components;
+    ExtraParticleData<uint32_t> labels;
+    const uint64_t number_objects = connected_components.label(apr, mask, 0.5f, labels);
+
+    ExtraParticleData<uint32_t> labels_table;
+    APRNeighbourTable neighbours(apr);
+    if((connected_components.label(neighbours, mask, 0.5f, labels_table) != number_objects) || !std::equal(labels.data.begin(), labels.data.end(), labels_table.data.begin())){
+        success = false;
+    }
+
+    if(number_objects < 2){
+        success = false;
+    }
+
+    std::vector<APRObjectStatistics> object_statistics;
+    connected_components.compute_object_statistics(apr, labels, number_objects, apr.particles_intensities, object_statistics);
+
+    //6-connected components of the reconstructed mask
+    MeshData<uint32_t> label_image;
+    MeshData<uint16_t> intensity_image;
+    apr.interp_img(label_image, labels);
+    apr.interp_img(intensity_image, apr.particles_intensities);
+
+    std::vector<APRObjectStatistics> pixel_statistics(number_objects);
+    std::vector<uint32_t> object_of_component;
+    MeshData<int64_t> component_image(label_image.y_num, label_image.x_num, label_image.z_num, -1);
+    for (int z = 0; z < (int)label_image.z_num; ++z) {
+        for (int x = 0; x < (int)label_image.x_num; ++x) {
+            for (int y = 0; y < (int)label_image.y_num; ++y) {
+                const uint32_t object_label = label_image.at(y, x, z);
+                if(object_label == 0){
+                    continue;
+                }
+
+                APRObjectStatistics& object = pixel_statistics[object_label - 1];
+                object.volume++;
+                object.intensity_sum += intensity_image.at(y, x, z);
+                object.y_min = std::min(object.y_min, (uint64_t)y);
+                object.y_max = std::max(object.y_max, (uint64_t)y);
+                object.x_min = std::min(object.x_min, (uint64_t)x);
+                object.x_max = std::max(object.x_max, (uint64_t)x);
+                object.z_min = std::min(object.z_min, (uint64_t)z);
+                object.z_max = std::max(object.z_max, (uint64_t)z);
+
+                if(component_image.at(y, x, z) >= 0){
+                    continue;
+                }
+
+                //flood fill a new component, all its pixels have to have the same label
+                const int64_t component = object_of_component.size();
+                object_of_component.push_back(object_label);
+                std::vector<std::array<int, 3>> stack = {{y, x, z}};
+                component_image.at(y, x, z) = component;
+                while(!stack.empty()){
+                    const std::array<int, 3> pixel = stack.back();
+                    stack.pop_back();
+                    const int offsets[6][3] = {{1,0,0},{-1,0,0},{0,1,0},{0,-1,0},{0,0,1},{0,0,-1}};
+                    for (const auto& offset : offsets) {
+                        const int yn = pixel[0] + offset[0];
+                        const int xn = pixel[1] + offset[1];
+                        const int zn = pixel[2] + offset[2];
+                        if((yn < 0) || (xn < 0) || (zn < 0) || (yn >= (int)label_image.y_num) || (xn >= (int)label_image.x_num) || (zn >= (int)label_image.z_num)){
+                            continue;
+                        }
+                        if((label_image.at(yn, xn, zn) == 0) || (component_image.at(yn, xn, zn) >= 0)){
+                            continue;
+                        }
+                        if(label_image.at(yn, xn, zn) != object_label){
+                            success = false;
+                        }
+                        component_image.at(yn, xn, zn) = component;
+                        stack.push_back({yn, xn, zn});
+                    }
+                }
+            }
+        }
+    }
+
+    //one component per object
+    std::sort(object_of_component.begin(), object_of_component.end());
+    if((object_of_component.size() != number_objects) || (std::unique(object_of_component.begin(), object_of_component.end()) != object_of_component.end())){
+        success = false;
+    }
+
+    uint64_t number_particles = 0;
+    for (uint64_t i = 0; i < number_objects; ++i) {
+        const APRObjectStatistics& object = object_statistics[i];
+        const APRObjectStatistics& pixels = pixel_statistics[i];
+        number_particles += object.number_particles;
+        if((object.volume != pixels.volume) || (object.intensity_sum != pixels.intensity_sum) ||
+           (object.y_min != pixels.y_min) || (object.y_max != pixels.y_max) || (object.x_min != pixels.x_min) ||
+           (object.x_max != pixels.x_max) || (object.z_min != pixels.z_min) || (object.z_max != pixels.z_max)){
+            success = false;
+        }
+    }
+
+    if(number_particles != (uint64_t)std::count(mask.data.begin(), mask.data.end(), 1)){
+        success = false;
+    }
+
+    return success;
+}
+
+bool test_apr_batch_point_location(TestData& test_data){
+    //
+    //  Checks the batched point location against set_iterator_by_global_coordinate, for random points (some outside the
+    //  image and at pixel boundaries) with both gap storages
+    //
+
+    bool success = true;
+
+    make_gap_map_reference(test_data.apr);
+    APR<uint16_t> apr_flat = test_data.apr;
+    apr_flat.apr_access.build_flat_map();
+
+    const float y_max = test_data.apr.apr_access.org_dims[0];
+    const float x_max = test_data.apr.apr_access.org_dims[1];
+    const float z_max = test_data.apr.apr_access.org_dims[2];
+
+    std::mt19937 generator(0);
+    std::uniform_real_distribution<float> position(-2.0f, 1.0f);
+    std::vector<float> x, y, z;
+    for (int i = 0; i < 100000; ++i) {
+        x.push_back(position(generator)*x_max + 2*x_max*(i%2));
+        y.push_back(std::abs(position(generator))*y_max);
+        z.push_back(std::abs(position(generator))*z_max);
+        if(i%10 == 0){
+            y.back() = std::floor(y.back()) + 0.5f;
+        }
+    }
+    x.push_back(x_max - 0.6f); y.push_back(0); z.push_back(0);
+    x.push_back(-0.4f); y.push_back(y_max - 0.4f); z.push_back(z_max - 1);
+
+    std::vector<APR<uint16_t>*> aprs = {&test_data.apr, &apr_flat};
+    for (APR<uint16_t>* apr : aprs) {
+        APRIterator<uint16_t> apr_iterator(*apr);
+
+        std::vector<uint64_t> global_index;
+        std::vector<uint16_t> level;
+        uint64_t number_found = apr_iterator.find_particles_by_global_coordinates(x, y, z, global_index, level);
+
+        uint64_t number_found_single = 0;
+        for (size_t i = 0; i < x.size(); ++i) {
+            if(apr_iterator.set_iterator_by_global_coordinate(x[i], y[i], z[i])){
+                number_found_single++;
+                if((global_index[i] != apr_iterator.global_index()) || (level[i] != apr_iterator.level())){
+                    success = false;
+                }
+            } else if(global_index[i] != UINT64_MAX){
+                success = false;
+            }
+        }
+
+        if((number_found != number_found_single) || (number_found == 0) || (number_found == x.size())){
+            success = false;
+        }
+    }
+
+    return success;
+}
+
+bool test_apr_tree(TestData& test_data){
+    //
+    //  Checks the interior cells of the APR tree against the ancestors of all particles, and the pooled level images
+    //  against pooling the reconstructed image
+    //
+
+    bool success = true;
+
+    APR<uint16_t>& apr = test_data.apr;
+    APRTree<uint16_t> apr_tree(apr);
+
+    //all ancestors of the particles
+    std::vector<std::vector<uint64_t>> ancestors(apr.level_max());
+    APRIterator<uint16_t> apr_iterator(apr);
+    uint64_t particle_number;
+
+    for (particle_number = 0; particle_number < apr_iterator.total_number_particles(); ++particle_number) {
+        apr_iterator.set_iterator_to_particle_by_number(particle_number);
+        for (uint64_t level = apr.level_min(); level < apr_iterator.level(); ++level) {
+            const uint64_t shift = apr_iterator.level() - level;
+            const uint64_t y = apr_iterator.y() >> shift;
+            const uint64_t x = apr_iterator.x() >> shift;
+            const uint64_t z = apr_iterator.z() >> shift;
+            ancestors[level].push_back((z*apr.spatial_index_x_max(level) + x)*apr.spatial_index_y_max(level) + y);
+        }
+    }
+
+    uint64_t number_ancestors = 0;
+    for (uint64_t level = apr.level_min(); level < apr.level_max(); ++level) {
+        std::sort(ancestors[level].begin(), ancestors[level].end());
+        ancestors[level].erase(std::unique(ancestors[level].begin(), ancestors[level].end()), ancestors[level].end());
+        number_ancestors += ancestors[level].size();
+    }
+
+    if((apr_tree.total_number_parent_cells() != number_ancestors) || (apr_tree.level_max() != apr.level_max() - 1)){
+        success = false;
+    }
+
+    //the cells are ordered by level, z, x and y as the particles
+    APRIterator<uint16_t> tree_iterator = apr_tree.tree_iterator();
+    uint64_t level_offset = 0;
+    for (uint64_t level = apr.level_min(); (level < apr.level_max()) && success; ++level) {
+        for (uint64_t i = 0; i < ancestors[level].size(); ++i) {
+            tree_iterator.set_iterator_to_particle_by_number(level_offset + i);
+            const uint64_t cell = (tree_iterator.z()*apr.spatial_index_x_max(level) + tree_iterator.x())*apr.spatial_index_y_max(level) + tree_iterator.y();
+            if((tree_iterator.level() != level) || (cell != ancestors[level][i])){
+                success = false;
+                break;
+            }
+        }
+        level_offset += ancestors[level].size();
+    }
+
+    //pooled values
+    ExtraParticleData<float> tree_max;
+    apr_tree.fill_tree_max(apr, apr.particles_intensities, tree_max);
+    ExtraParticleData<float> tree_mean;
+    apr_tree.fill_tree_mean(apr, apr.particles_intensities, tree_mean);
+
+    MeshData<uint16_t> reconstruction;
+    apr.interp_img(reconstruction, apr.particles_intensities);
+
+    for (uint64_t level = apr.level_min(); level <= apr.level_max(); ++level) {
+        MeshData<float> level_max_image;
+        apr_tree.get_level_image(apr, apr.particles_intensities, tree_max, level, level_max_image);
+        MeshData<float> level_mean_image;
+        apr_tree.get_level_image(apr, apr.particles_intensities, tree_mean, level, level_mean_image);
+
+        const uint64_t size = 1 << (apr.level_max() - level);
+
+        for (uint64_t z = 0; z < (uint64_t)level_max_image.z_num; ++z) {
+            for (uint64_t x = 0; x < (uint64_t)level_max_image.x_num; ++x) {
+                for (uint64_t y = 0; y < (uint64_t)level_max_image.y_num; ++y) {
+                    float max = 0;
+                    double sum = 0;
+                    uint64_t count = 0;
+                    for (uint64_t zi = z*size; zi < std::min((z + 1)*size, (uint64_t)reconstruction.z_num); ++zi) {
+                        for (uint64_t xi = x*size; xi < std::min((x + 1)*size, (uint64_t)reconstruction.x_num); ++xi) {
+                            for (uint64_t yi = y*size; yi < std::min((y + 1)*size, (uint64_t)reconstruction.y_num); ++yi) {
+                                max = std::max(max, (float)reconstruction.at(yi, xi, zi));
+                                sum += reconstruction.at(yi, xi, zi);
+                                count++;
+                            }
+                        }
+                    }
+
+                    if(level_max_image.at(y, x, z) != max){
+                        success = false;
+                    }
+
+                    //the mean is over the children, equal to the mean of the pixels away from the image boundary
+                    const bool inside = ((z + 1)*size <= (uint64_t)reconstruction.z_num) && ((x + 1)*size <= (uint64_t)reconstruction.x_num) && ((y + 1)*size <= (uint64_t)reconstruction.y_num);
+                    if(inside && (std::abs(level_mean_image.at(y, x, z) - sum/count) > 1e-4*sum/count)){
+                        success = false;
+                    }
+                }
+            }
+        }
+    }
+
+    //same tree using the flat gap storage
+    APR<uint16_t> apr_flat = apr;
+    apr_flat.apr_access.build_flat_map();
+    APRTree<uint16_t> apr_tree_flat(apr_flat);
+    ExtraParticleData<float> tree_mean_flat;
+    apr_tree_flat.fill_tree_mean(apr_flat, apr_flat.particles_intensities, tree_mean_flat);
+
+    if(!std::equal(tree_mean.data.begin(), tree_mean.data.end(), tree_mean_flat.data.begin()) || (tree_mean.data.size() != tree_mean_flat.data.size())){
+        success = false;
+    }
+
+    return success;
+}
+
+bool test_apr_particle_order(TestData& test_data){
+    //
+    //  Checks the Morton particle ordering, iterating, filtering and reading/writing particle data in that order
+    //
+
+    bool success = true;
+
+    APR<uint16_t>& apr = test_data.apr;
+    const uint64_t number_particles = apr.total_number_particles();
+
+    APRParticleOrder particle_order(apr, ParticleOrdering::Morton, apr.level_max() - 2);
+
+    //it is a permutation, and the particles follow the curve (and are grouped by block)
+    std::vector<bool> found(number_particles, false);
+    for (uint64_t p = 0; p < number_particles; ++p) {
+        const uint64_t ordered = particle_order.ordered_index(p);
+        if((ordered >= number_particles) || found[ordered] || (particle_order.canonical_index(ordered) != p)){
+            success = false;
+        } else {
+            found[ordered] = true;
+        }
+    }
+
+    APRIterator<uint16_t> apr_iterator(apr);
+    apr_iterator.set_particle_order(particle_order);
+
+    uint64_t previous_key = 0;
+    uint64_t previous_position_key = 0;
+    for (uint64_t p = 0; p < number_particles; ++p) {
+        apr_iterator.set_iterator_to_particle_by_index(p);
+        if((apr_iterator.global_index() != particle_order.canonical_index(p)) || (apr_iterator.particle_index() != p)){
+            success = false;
+        }
+
+        const int level_difference = apr_iterator.level() - particle_order.block_level;
+        uint64_t key;
+        if(level_difference >= 0){
+            key = APRParticleOrder::morton_key(apr_iterator.y() >> level_difference, apr_iterator.x() >> level_difference, apr_iterator.z() >> level_difference);
+        } else {
+            key = APRParticleOrder::morton_key(apr_iterator.y() << -level_difference, apr_iterator.x() << -level_difference, apr_iterator.z() << -level_difference);
+        }
+        const int shift = apr_iterator.level_max() - apr_iterator.level();
+        const uint64_t position_key = APRParticleOrder::morton_key(apr_iterator.y() << shift, apr_iterator.x() << shift, apr_iterator.z() << shift);
+        if((key < previous_key) || (position_key < previous_position_key)){
+            success = false;
+        }
+        previous_key = key;
+        previous_position_key = position_key;
+    }
+
+    //reordering the data
+    ExtraParticleData<uint16_t> ordered_intensities;
+    particle_order.to_ordered(apr.particles_intensities, ordered_intensities);
+    ExtraParticleData<uint16_t> canonical_intensities;
+    particle_order.to_canonical(ordered_intensities, canonical_intensities);
+
+    if(!std::equal(canonical_intensities.data.begin(), canonical_intensities.data.end(), apr.particles_intensities.data.begin())){
+        success = false;
+    }
+
+    //the neighbour table and the filters in the Morton order
+    APRNeighbourTable neighbours(apr);
+    APRNeighbourTable neighbours_ordered(apr, particle_order);
+
+    for (uint64_t p = 0; p < number_particles; ++p) {
+        const uint64_t ordered = particle_order.ordered_index(p);
+        if(neighbours_ordered.particle_level[ordered] != neighbours.particle_level[p]){
+            success = false;
+        }
+        for (uint8_t face = 0; face < 6; ++face) {
+            const APRNeighbourTable::FaceNeighbours face_neighbours = neighbours.face_neighbours(face, p);
+            const APRNeighbourTable::FaceNeighbours face_neighbours_ordered = neighbours_ordered.face_neighbours(face, ordered);
+            if(face_neighbours_ordered.size() != face_neighbours.size()){
+                success = false;
+                continue;
+            }
+            for (uint8_t i = 0; i < face_neighbours.size(); ++i) {
+                if(face_neighbours_ordered[i] != particle_order.ordered_index(face_neighbours[i])){
+                    success = false;
+                }
+            }
+        }
+    }
+
+    APRNumerics apr_numerics;
+    const std::vector<float> filter = {0.1f, 0.8f, 0.1f};
+
+    ExtraParticleData<float> smooth;
+    apr_numerics.seperable_smooth_filter(apr, neighbours, apr.particles_intensities, smooth, filter, 2);
+    ExtraParticleData<float> smooth_ordered;
+    apr_numerics.seperable_smooth_filter(apr, neighbours_ordered, ordered_intensities, smooth_ordered, filter, 2);
+
+    ExtraParticleData<float> smooth_canonical;
+    particle_order.to_canonical(smooth_ordered, smooth_canonical);
+    if(!std::equal(smooth.data.begin(), smooth.data.end(), smooth_canonical.data.begin())){
+        success = false;
+    }
+
+    //the gradient needs the table in the canonical order
+    MultiChannelParticleData<float> gradient;
+    if(APRNumerics::compute_gradient_vector(apr, neighbours_ordered, gradient) || (gradient.total_number_particles() != 0)){
+        success = false;
+    }
+
+    //files are written in the canonical order
+    std::string save_loc = "";
+    apr.write_particles_only(save_loc, "example_output_ordered", smooth_ordered, particle_order);
+    std::string extra_file_name = save_loc + "example_output_ordered" + "_apr_extra_parts.h5";
+
+    ExtraParticleData<float> smooth_read;
+    apr.read_parts_only(extra_file_name, smooth_read);
+    ExtraParticleData<float> smooth_read_ordered;
+    apr.read_parts_only(extra_file_name, smooth_read_ordered, particle_order);
+
+    if(!std::equal(smooth.data.begin(), smooth.data.end(), smooth_read.data.begin()) ||
+       !std::equal(smooth_ordered.data.begin(), smooth_ordered.data.end(), smooth_read_ordered.data.begin())){
+        success = false;
+    }
+
+    std::remove(extra_file_name.c_str());
+
+    return success;
+}
+
+bool test_multi_channel_particle_data(TestData& test_data){
+    //
+    //  Checks the channel access, layout conversion, map/zip and reading/writing of multi-channel particle data
+    //
+
+    bool success = true;
+
+    APR<uint16_t>& apr = test_data.apr;
+    const uint64_t number_channels = 3;
+
+    MultiChannelParticleData<float> interleaved(apr, number_channels, ChannelLayout::Interleaved);
+    MultiChannelParticleData<float> planar(apr, number_channels, ChannelLayout::Planar);
+
+    APRIterator<uint16_t> apr_iterator(apr);
+    uint64_t particle_number;
+
+    for (particle_number = 0; particle_number < apr_iterator.total_number_particles(); ++particle_number) {
+        apr_iterator.set_iterator_to_particle_by_number(particle_number);
+        for (uint64_t c = 0; c < number_channels; ++c) {
+            const float val = apr.particles_intensities[apr_iterator] + 1000.0f*c;
+            interleaved(apr_iterator, c) = val;
+            planar(apr_iterator, c) = val;
+        }
+    }
+
+    const uint64_t number_particles = apr.total_number_particles();
+    for (uint64_t p = 0; p < number_particles; ++p) {
+        for (uint64_t c = 0; c < number_channels; ++c) {
+            if((interleaved.data[p*number_channels + c] != planar.data[c*number_particles + p]) || (interleaved[p][c] != planar[p][c])){
+                success = false;
+            }
+        }
+    }
+
+    //layout conversion
+    MultiChannelParticleData<float> converted = planar;
+    converted.set_layout(ChannelLayout::Interleaved);
+    if((converted.layout() != ChannelLayout::Interleaved) || !std::equal(converted.data.begin(), converted.data.end(), interleaved.data.begin())){
+        success = false;
+    }
+
+    //single channels
+    ExtraParticleData<float> channel;
+    planar.get_channel(1, channel);
+    converted.set_channel(0, channel);
+    for (uint64_t p = 0; p < number_particles; ++p) {
+        if((channel.data[p] != apr.particles_intensities.data[p] + 1000.0f) || (converted(p, 0) != channel.data[p])){
+            success = false;
+        }
+    }
+
+    //map and zip
+    ExtraParticleData<float> channel_sum;
+    interleaved.map(channel_sum, [](const ParticleChannels<const float> &a) { return a[0] + a[1] + a[2]; });
+
+    MultiChannelParticleData<float> doubled;
+    planar.map(doubled, [](const float a) { return 2*a; });
+    doubled.map_inplace([](const float a) { return a + 1; });
+
+    MultiChannelParticleData<float> difference;
+    doubled.zip(interleaved, difference, [](const float a, const float b) { return a - b; });
+    difference.zip_inplace(planar, [](const float a, const float b) { return a - b; });
+
+    //mismatching sizes are rejected
+    MultiChannelParticleData<float> two_channels(apr, 2);
+    ExtraParticleData<float> too_few_particles;
+    too_few_particles.data.resize(number_particles - 1);
+    if(difference.zip_inplace(two_channels, [](const float a, const float b) { return a - b; }) ||
+       doubled.zip(two_channels, difference, [](const float a, const float b) { return a - b; }) ||
+       converted.set_channel(0, too_few_particles) || planar.get_channel(number_channels, channel)){
+        success = false;
+    }
+
+    for (uint64_t p = 0; p < number_particles; ++p) {
+        if(channel_sum.data[p] != (3*apr.particles_intensities.data[p] + 3000.0f)){
+            success = false;
+        }
+        for (uint64_t c = 0; c < number_channels; ++c) {
+            if((difference.layout() != ChannelLayout::Planar) || (difference(p, c) != 1)){
+                success = false;
+            }
+        }
+    }
+
+    //write and read in both layouts
+    std::string save_loc = "";
+    const std::vector<MultiChannelParticleData<float>*> written = {&interleaved, &planar};
+    for (MultiChannelParticleData<float>* parts : written) {
+        apr.write_particles_only(save_loc, "example_output_channels", *parts);
+
+        MultiChannelParticleData<float> parts_read;
+        apr.read_parts_only(save_loc + "example_output_channels" + "_apr_extra_parts.h5", parts_read);
+
+        if((parts_read.layout() != parts->layout()) || (parts_read.total_number_channels() != number_channels) ||
+           (parts_read.total_number_particles() != number_particles) ||
+           !std::equal(parts_read.data.begin(), parts_read.data.end(), parts->data.begin())){
+            success = false;
+        }
+    }
+
+    //single channel files are read as one channel
+    apr.write_particles_only(save_loc, "example_output_channels", channel);
+    MultiChannelParticleData<float> channel_read;
+    apr.read_parts_only(save_loc + "example_output_channels" + "_apr_extra_parts.h5", channel_read);
+    if((channel_read.total_number_channels() != 1) || !std::equal(channel_read.data.begin(), channel_read.data.end(), channel.data.begin())){
+        success = false;
+    }
+
+    //the gradient does not depend on the layout
+    MultiChannelParticleData<float> gradient_interleaved;
+    APRNumerics::compute_gradient_vector(apr, gradient_interleaved, false);
+    MultiChannelParticleData<float> gradient_planar(apr, 3, ChannelLayout::Planar);
+    APRNumerics::compute_gradient_vector(apr, gradient_planar, false);
+
+    if(gradient_planar.layout() != ChannelLayout::Planar){
+        success = false;
+    }
+    for (uint64_t p = 0; p < number_particles; ++p) {
+        for (uint64_t c = 0; c < 3; ++c) {
+            const float a = gradient_interleaved(p, c);
+            const float b = gradient_planar(p, c);
+            if(!(a == b || (std::isnan(a) && std::isnan(b)))){
+                success = false;
+            }
+        }
+    }
+
+    std::remove((save_loc + "example_output_channels" + "_apr_extra_parts.h5").c_str());
+
+    return success;
+}
+
+bool test_apr_input_output(TestData& test_data){
+
+    bool success = true;
+
+
+
+    APRIterator<uint16_t> apr_iterator(test_data.apr);
+
+    std::string save_loc = "";
+    std::string file_name = "read_write_test";
+
+    //write the APR
+    test_data.apr.write_apr(save_loc,file_name);
+
+    APR<uint16_t> apr_read;
+
+    apr_read.read_apr(save_loc + file_name + "_apr.h5");
+    APRIterator<uint16_t> apr_iterator_read(apr_read);
+
+    uint64_t particle_number;
+
+    for (particle_number = 0; particle_number < apr_iterator.total_number_particles(); ++particle_number) {
+
+        apr_iterator.set_iterator_to_particle_by_number(particle_number);
+        apr_iterator_read.set_iterator_to_particle_by_number(particle_number);
+        //counter++;
+
+        //check the functionality
+        if(test_data.apr.particles_intensities[apr_iterator]!=apr_read.particles_intensities[apr_iterator_read]){
+            success = false;
+        }
+
+        if(apr_iterator.level()!=apr_iterator_read.level()){
+            success = false;
+        }
+
+        if(apr_iterator.x()!=apr_iterator_read.x()){
+            success = false;
+        }
+
+        if(apr_iterator.y()!=apr_iterator_read.y()){
+            success = false;
+        }
+
+        if(apr_iterator.z()!=apr_iterator_read.z()){
+            success = false;
+        }
+
+        if(apr_iterator.type()!=apr_iterator_read.type()){
+            success = false;
+        }
+
+    }
+
+
+    //
+    // Now check the Extra Part Cell Data
+    //
+
+    APRIterator<uint16_t> neighbour_iterator(apr_read);
+    APRIterator<uint16_t> apr_iterator_read2(apr_read);
+
+    for (particle_number = 0; particle_number < apr_iterator_read.total_number_particles(); ++particle_number) {
+        apr_iterator_read2.set_iterator_to_particle_by_number(particle_number);
+
+        //loop over all the neighbours and set the neighbour iterator to it
+        for (int direction = 0; direction < 6; ++direction) {
+            // Neighbour Particle Cell Face definitions [+y,-y,+x,-x,+z,-z] =  [0,1,2,3,4,5]
+            apr_iterator_read2.find_neighbours_in_direction(direction);
+
+            success = check_neighbour_out_of_bounds(apr_iterator_read2,direction);
+
+            for (int index = 0; index < apr_iterator_read2.number_neighbours_in_direction(direction); ++index) {
+
+                // on each face, there can be 0-4 neighbours accessed by index
+                if(neighbour_iterator.set_neighbour_iterator(apr_iterator_read2, direction, index)){
+                    //will return true if there is a neighbour defined
+                    uint16_t apr_intensity = test_data.apr.particles_intensities[neighbour_iterator];
+                    uint16_t check_intensity = test_data.img_pc(neighbour_iterator.y_nearest_pixel(),neighbour_iterator.x_nearest_pixel(),neighbour_iterator.z_nearest_pixel());
+
+                    if(check_intensity!=apr_intensity){
+                        success = false;
+                    }
+
+                    if(!check_neighbours(apr_read,apr_iterator_read2,neighbour_iterator)){
+                        success = false;
+                    }
+                }
+            }
+        }
+    }
+
+
+    ExtraParticleData<float> extra_data(test_data.apr);
+
+    for (particle_number = 0; particle_number < apr_iterator_read.total_number_particles(); ++particle_number) {
+        apr_iterator_read.set_iterator_to_particle_by_number(particle_number);
+        extra_data[apr_iterator_read] = apr_iterator_read.type();
+
+    }
+
+    //write one of the above results to file
+    test_data.apr.write_particles_only(save_loc,"example_output",extra_data);
+
+    std::string extra_file_name = save_loc + "example_output" + "_apr_extra_parts.h5";
+
+    ExtraParticleData<float> extra_data_read;
+
+    //you need the same apr used to write it to load it (doesn't save location data)
+    test_data.apr.read_parts_only(extra_file_name,extra_data_read);
+
+    for (particle_number = 0; particle_number < apr_iterator_read.total_number_particles(); ++particle_number) {
+        apr_iterator_read.set_iterator_to_particle_by_number(particle_number);
+
+        extra_data[apr_iterator_read] = apr_iterator_read.type();
+        if((extra_data[apr_iterator_read]) != (extra_data_read[apr_iterator_read])){
+
+            success = false;
+        }
+    }
+
+    //Repeat with different data-type
+    ExtraParticleData<uint16_t> extra_data16(test_data.apr);
+
+    for (particle_number = 0; particle_number < apr_iterator_read.total_number_particles(); ++particle_number) {
+        apr_iterator_read.set_iterator_to_particle_by_number(particle_number);
+
+        extra_data16[apr_iterator_read] = apr_iterator_read.level();
+
+    }
+
+    //write one of the above results to file
+    test_data.apr.write_particles_only(save_loc,"example_output16",extra_data16);
+
+    std::string extra_file_name16 = save_loc + "example_output16" + "_apr_extra_parts.h5";
+
+    ExtraParticleData<uint16_t> extra_data_read16;
+
+    //you need the same apr used to write it to load it (doesn't save location data)
+    test_data.apr.read_parts_only(extra_file_name16,extra_data_read16);
+
+    for (particle_number = 0; particle_number < apr_iterator_read.total_number_particles(); ++particle_number) {
+        apr_iterator_read.set_iterator_to_particle_by_number(particle_number);
+
+        if(extra_data16[apr_iterator_read] != (extra_data_read16[apr_iterator_read])){
+            success = false;
+        }
+    }
+
+    return success;
+}
+
+
+
+bool test_apr_neighbour_access(TestData& test_data){
+
+    bool success = true;
+
+    APRIterator<uint16_t> neighbour_iterator(test_data.apr);
+    APRIterator<uint16_t> apr_iterator(test_data.apr);
+
+    uint64_t particle_number;
+
+    for (particle_number = 0; particle_number < apr_iterator.total_number_particles(); ++particle_number) {
+
+        apr_iterator.set_iterator_to_particle_by_number(particle_number);
+
+        //loop over all the neighbours and set the neighbour iterator to it
+        for (int direction = 0; direction < 6; ++direction) {
+            // Neighbour Particle Cell Face definitions [+y,-y,+x,-x,+z,-z] =  [0,1,2,3,4,5]
+            apr_iterator.find_neighbours_in_direction(direction);
+
+            success = check_neighbour_out_of_bounds(apr_iterator,direction);
+
+            for (int index = 0; index < apr_iterator.number_neighbours_in_direction(direction); ++index) {
+
+                // on each face, there can be 0-4 neighbours accessed by index
+                if(neighbour_iterator.set_neighbour_iterator(apr_iterator, direction, index)){
+                    //will return true if there is a neighbour defined
+                    uint16_t apr_intensity = test_data.apr.particles_intensities[neighbour_iterator];
+                    uint16_t check_intensity = test_data.img_pc(neighbour_iterator.y_nearest_pixel(),neighbour_iterator.x_nearest_pixel(),neighbour_iterator.z_nearest_pixel());
+
+                    if(check_intensity!=apr_intensity){
+                        success = false;
+                    }
+
+                    uint16_t apr_level = neighbour_iterator.level();
+                    uint16_t check_level = test_data.img_level(neighbour_iterator.y_nearest_pixel(),neighbour_iterator.x_nearest_pixel(),neighbour_iterator.z_nearest_pixel());
+
+                    if(check_level!=apr_level){
+                        success = false;
+                    }
+
+                    uint16_t apr_type = neighbour_iterator.type();
+                    uint16_t check_type = test_data.img_type(neighbour_iterator.y_nearest_pixel(),neighbour_iterator.x_nearest_pixel(),neighbour_iterator.z_nearest_pixel());
+
+                    if(check_type!=apr_type){
+                        success = false;
+                    }
+
+                    uint16_t apr_x = neighbour_iterator.x();
+                    uint16_t check_x = test_data.img_x(neighbour_iterator.y_nearest_pixel(),neighbour_iterator.x_nearest_pixel(),neighbour_iterator.z_nearest_pixel());
+
+                    if(check_x!=apr_x){
+                        success = false;
+                    }
+
+                    uint16_t apr_y = neighbour_iterator.y();
+                    uint16_t check_y = test_data.img_y(neighbour_iterator.y_nearest_pixel(),neighbour_iterator.x_nearest_pixel(),neighbour_iterator.z_nearest_pixel());
+
+                    if(check_y!=apr_y){
+                        success = false;
+                    }
+
+                    uint16_t apr_z = neighbour_iterator.z();
+                    uint16_t check_z = test_data.img_z(neighbour_iterator.y_nearest_pixel(),neighbour_iterator.x_nearest_pixel(),neighbour_iterator.z_nearest_pixel());
+
+                    if(check_z!=apr_z){
+                        success = false;
+                    }
+
+                    if(!check_neighbours(test_data.apr,apr_iterator,neighbour_iterator)){
+                        success = false;
+                    }
+
+                }
+
+            }
+
+        }
+    }
+
+#ifdef HAVE_OPENMP
+	#pragma omp parallel for schedule(static) private(particle_number) firstprivate(apr_iterator,neighbour_iterator)
+#endif
+    for (particle_number = 0; particle_number < apr_iterator.total_number_particles(); ++particle_number) {
 
         apr_iterator.set_iterator_to_particle_by_number(particle_number);
 
         //loop over all the neighbours and set the neighbour iterator to it
         for (int direction = 0; direction < 6; ++direction) {
-            // Neighbour Particle Cell Face definitions [+y,-y,+x,-x,+z,-z] =  [0,1,2,3,4,5]
+            // Neighbour Particle Cell Face definitions [+y,-y,+x,-x,+z,-z] =  [0,1,2,3,4,5]
+            apr_iterator.find_neighbours_in_direction(direction);
+
+            success = check_neighbour_out_of_bounds(apr_iterator,direction);
+
+            for (int index = 0; index < apr_iterator.number_neighbours_in_direction(direction); ++index) {
+
+                // on each face, there can be 0-4 neighbours accessed by index
+                if(neighbour_iterator.set_neighbour_iterator(apr_iterator, direction, index)){
+                    //will return true if there is a neighbour defined
+                    uint16_t apr_intensity = (test_data.apr.particles_intensities[neighbour_iterator]);
+                    uint16_t check_intensity = test_data.img_pc(neighbour_iterator.y_nearest_pixel(),neighbour_iterator.x_nearest_pixel(),neighbour_iterator.z_nearest_pixel());
+
+                    if(check_intensity!=apr_intensity){
+                        success = false;
+                    }
+
+                    uint16_t apr_level = neighbour_iterator.level();
+                    uint16_t check_level = test_data.img_level(neighbour_iterator.y_nearest_pixel(),neighbour_iterator.x_nearest_pixel(),neighbour_iterator.z_nearest_pixel());
+
+                    if(check_level!=apr_level){
+                        success = false;
+                    }
+
+                    uint16_t apr_type = neighbour_iterator.type();
+                    uint16_t check_type = test_data.img_type(neighbour_iterator.y_nearest_pixel(),neighbour_iterator.x_nearest_pixel(),neighbour_iterator.z_nearest_pixel());
+
+                    if(check_type!=apr_type){
+                        success = false;
+                    }
+
+                    uint16_t apr_x = neighbour_iterator.x();
+                    uint16_t check_x = test_data.img_x(neighbour_iterator.y_nearest_pixel(),neighbour_iterator.x_nearest_pixel(),neighbour_iterator.z_nearest_pixel());
+
+                    if(check_x!=apr_x){
+                        success = false;
+                    }
+
+                    uint16_t apr_y = neighbour_iterator.y();
+                    uint16_t check_y = test_data.img_y(neighbour_iterator.y_nearest_pixel(),neighbour_iterator.x_nearest_pixel(),neighbour_iterator.z_nearest_pixel());
+
+                    if(check_y!=apr_y){
+                        success = false;
+                    }
+
+                    uint16_t apr_z = neighbour_iterator.z();
+                    uint16_t check_z = test_data.img_z(neighbour_iterator.y_nearest_pixel(),neighbour_iterator.x_nearest_pixel(),neighbour_iterator.z_nearest_pixel());
+
+                    if(check_z!=apr_z){
+                        success = false;
+                    }
+
+                }
+
+            }
+
+        }
+    }
+
+
+
+
+    return success;
+
+
+}
+
+
+
+bool test_apr_iterate(TestData& test_data){
+    //
+    //  Bevan Cheeseman 2018
+    //
+    //  Test for the serial APR iterator
+    //
+
+    bool success = true;
+
+    APRIterator<uint16_t> apr_iterator(test_data.apr);
+    uint64_t particle_number = 0;
+
+    for (particle_number = 0; particle_number < apr_iterator.total_number_particles(); ++particle_number) {
+        apr_iterator.set_iterator_to_particle_by_number(particle_number);
+
+        uint16_t apr_intensity = (test_data.apr.particles_intensities[apr_iterator]);
+        uint16_t check_intensity = test_data.img_pc(apr_iterator.y_nearest_pixel(),apr_iterator.x_nearest_pixel(),apr_iterator.z_nearest_pixel());
+
+        if(check_intensity!=apr_intensity){
+            success = false;
+        }
+
+        uint16_t apr_level = apr_iterator.level();
+        uint16_t check_level = test_data.img_level(apr_iterator.y_nearest_pixel(),apr_iterator.x_nearest_pixel(),apr_iterator.z_nearest_pixel());
+
+        if(check_level!=apr_level){
+            success = false;
+        }
+
+        uint16_t apr_type = apr_iterator.type();
+        uint16_t check_type = test_data.img_type(apr_iterator.y_nearest_pixel(),apr_iterator.x_nearest_pixel(),apr_iterator.z_nearest_pixel());
+
+        if(check_type!=apr_type){
+            success = false;
+        }
+
+        uint16_t apr_x = apr_iterator.x();
+        uint16_t check_x = test_data.img_x(apr_iterator.y_nearest_pixel(),apr_iterator.x_nearest_pixel(),apr_iterator.z_nearest_pixel());
+
+        if(check_x!=apr_x){
+            success = false;
+        }
+
+        uint16_t apr_y = apr_iterator.y();
+        uint16_t check_y = test_data.img_y(apr_iterator.y_nearest_pixel(),apr_iterator.x_nearest_pixel(),apr_iterator.z_nearest_pixel());
+
+        if(check_y!=apr_y){
+            success = false;
+        }
+
+        uint16_t apr_z = apr_iterator.z();
+        uint16_t check_z = test_data.img_z(apr_iterator.y_nearest_pixel(),apr_iterator.x_nearest_pixel(),apr_iterator.z_nearest_pixel());
+
+        if(check_z!=apr_z){
+            success = false;
+        }
+
+    }
+
+    //Test parallel loop
+
+#ifdef HAVE_OPENMP
+	#pragma omp parallel for schedule(static) private(particle_number) firstprivate(apr_iterator)
+#endif
+    for (particle_number = 0; particle_number < apr_iterator.total_number_particles(); ++particle_number) {
+        apr_iterator.set_iterator_to_particle_by_number(particle_number);
+
+        uint16_t apr_intensity = (test_data.apr.particles_intensities[apr_iterator]);
+        uint16_t check_intensity = test_data.img_pc(apr_iterator.y_nearest_pixel(),apr_iterator.x_nearest_pixel(),apr_iterator.z_nearest_pixel());
+
+        if(check_intensity!=apr_intensity){
+            success = false;
+        }
+
+        uint16_t apr_level = apr_iterator.level();
+        uint16_t check_level = test_data.img_level(apr_iterator.y_nearest_pixel(),apr_iterator.x_nearest_pixel(),apr_iterator.z_nearest_pixel());
+
+        if(check_level!=apr_level){
+            success = false;
+        }
+
+        uint16_t apr_type = apr_iterator.type();
+        uint16_t check_type = test_data.img_type(apr_iterator.y_nearest_pixel(),apr_iterator.x_nearest_pixel(),apr_iterator.z_nearest_pixel());
+
+        if(check_type!=apr_type){
+            success = false;
+        }
+
+        uint16_t apr_x = apr_iterator.x();
+        uint16_t check_x = test_data.img_x(apr_iterator.y_nearest_pixel(),apr_iterator.x_nearest_pixel(),apr_iterator.z_nearest_pixel());
+
+        if(check_x!=apr_x){
+            success = false;
+        }
+
+        uint16_t apr_y = apr_iterator.y();
+        uint16_t check_y = test_data.img_y(apr_iterator.y_nearest_pixel(),apr_iterator.x_nearest_pixel(),apr_iterator.z_nearest_pixel());
+
+        if(check_y!=apr_y){
+            success = false;
+        }
+
+        uint16_t apr_z = apr_iterator.z();
+        uint16_t check_z = test_data.img_z(apr_iterator.y_nearest_pixel(),apr_iterator.x_nearest_pixel(),apr_iterator.z_nearest_pixel());
+
+        if(check_z!=apr_z){
+            success = false;
+        }
+
+    }
+
+    uint64_t counter = 0;
+    for (unsigned int level = apr_iterator.level_min(); level <= apr_iterator.level_max(); ++level) {
+        for (particle_number = apr_iterator.particles_level_begin(level); particle_number < apr_iterator.particles_level_end(level); ++particle_number) {
+
+            apr_iterator.set_iterator_to_particle_by_number(particle_number); // (Required step), sets the iterator to the particle
+
+            counter++;
+
+            if(apr_iterator.level() != level){
+                //set all particles in calc_ex with an particle intensity greater then 100 to 0.
+               success = false;
+            }
+        }
+    }
+
+    if(counter != apr_iterator.total_number_particles()){
+        success = false;
+    }
+
+    counter = 0;
+
+    for (int level = apr_iterator.level_min(); level <= apr_iterator.level_max(); ++level) {
+        for(unsigned int z = 0; z < apr_iterator.spatial_index_z_max(level); ++z) {
+
+            for (particle_number = apr_iterator.particles_z_begin(level,z);
+                 particle_number < apr_iterator.particles_z_end(level,z); ++particle_number) {
+                //
+                //  Parallel loop over level
+                //
+                apr_iterator.set_iterator_to_particle_by_number(particle_number);
+
+                counter++;
+
+                if (apr_iterator.z() != z) {
+                    success = false;
+                }
+            }
+        }
+    }
+
+    if(counter != apr_iterator.total_number_particles()){
+        success = false;
+    }
+
+    return success;
+}
+
+
+bool test_apr_pipeline(TestData& test_data){
+    ///
+    /// Tests the pipeline, comparing the results with existing results
+    ///
+
+    bool success = true;
+
+    //the apr datastructure
+    APR<uint16_t> apr;
+
+    APRConverter<uint16_t> apr_converter;
+
+    //read in the command line options into the parameters file
+    apr_converter.par.Ip_th = test_data.apr.parameters.Ip_th;
+    apr_converter.par.rel_error = test_data.apr.parameters.rel_error;
+    apr_converter.par.lambda = test_data.apr.parameters.lambda;
+    apr_converter.par.mask_file = "";
+    apr_converter.par.min_signal = test_data.apr.parameters.min_signal;
+
+    apr_converter.par.sigma_th_max = test_data.apr.parameters.sigma_th_max;
+    apr_converter.par.sigma_th = test_data.apr.parameters.sigma_th;
+
+    apr_converter.par.SNR_min = test_data.apr.parameters.SNR_min;
+
+    //where things are
+    apr_converter.par.input_image_name =test_data.filename;
+    apr_converter.par.input_dir = "";
+    apr_converter.par.name = test_data.output_name;
+    apr_converter.par.output_dir = "";
+
+    //Gets the APR
+    if(apr_converter.get_apr(apr)){
+        APRIterator<uint16_t> apr_iterator(apr);
+        uint64_t particle_number = 0;
+
+        for (particle_number = 0; particle_number < apr_iterator.total_number_particles(); ++particle_number) {
+            apr_iterator.set_iterator_to_particle_by_number(particle_number);
+
+            uint16_t apr_intensity = (apr.particles_intensities[apr_iterator]);
+            uint16_t check_intensity = test_data.img_pc(apr_iterator.y_nearest_pixel(),apr_iterator.x_nearest_pixel(),apr_iterator.z_nearest_pixel());
+
+            if(check_intensity!=apr_intensity){
+                success = false;
+            }
+
+            uint16_t apr_level = apr_iterator.level();
+            uint16_t check_level = test_data.img_level(apr_iterator.y_nearest_pixel(),apr_iterator.x_nearest_pixel(),apr_iterator.z_nearest_pixel());
+
+            if(check_level!=apr_level){
+                success = false;
+            }
+
+            uint16_t apr_type = apr_iterator.type();
+            uint16_t check_type = test_data.img_type(apr_iterator.y_nearest_pixel(),apr_iterator.x_nearest_pixel(),apr_iterator.z_nearest_pixel());
+
+            if(check_type!=apr_type){
+                success = false;
+            }
+
+            uint16_t apr_x = apr_iterator.x();
+            uint16_t check_x = test_data.img_x(apr_iterator.y_nearest_pixel(),apr_iterator.x_nearest_pixel(),apr_iterator.z_nearest_pixel());
+
+            if(check_x!=apr_x){
+                success = false;
+            }
+
+            uint16_t apr_y = apr_iterator.y();
+            uint16_t check_y = test_data.img_y(apr_iterator.y_nearest_pixel(),apr_iterator.x_nearest_pixel(),apr_iterator.z_nearest_pixel());
+
+            if(check_y!=apr_y){
+                success = false;
+            }
+
+            uint16_t apr_z = apr_iterator.z();
+            uint16_t check_z = test_data.img_z(apr_iterator.y_nearest_pixel(),apr_iterator.x_nearest_pixel(),apr_iterator.z_nearest_pixel());
+
+            if(check_z!=apr_z){
+                success = false;
+            }
+
+        }
+
+    } else {
+
+        success = false;
+    }
+
+
+    return success;
+}
+
+bool test_apr_flat_access(TestData& test_data){
+    //
+    //  Checks that the flat (CSR) gap storage gives the same iteration, neighbour and random access results as the map
+    //
+
+    bool success = true;
+
+    make_gap_map_reference(test_data.apr);
+    if(test_data.apr.apr_access.use_flat_map || (test_data.apr.apr_access.flat_map.size() > 0)){
+        success = false;
+    }
+
+    APR<uint16_t> apr_flat = test_data.apr;
+    apr_flat.apr_access.build_flat_map();
+
+    if(!apr_flat.apr_access.use_flat_map || (apr_flat.apr_access.gap_map.data.size() > 0)){
+        success = false;
+    }
+
+    APRIterator<uint16_t> apr_iterator(test_data.apr);
+    APRIterator<uint16_t> neighbour_iterator(test_data.apr);
+    APRIterator<uint16_t> flat_iterator(apr_flat);
+    APRIterator<uint16_t> flat_neighbour_iterator(apr_flat);
+
+    uint64_t particle_number;
+
+    for (particle_number = 0; particle_number < apr_iterator.total_number_particles(); ++particle_number) {
+        apr_iterator.set_iterator_to_particle_by_number(particle_number);
+        flat_iterator.set_iterator_to_particle_by_number(particle_number);
+
+        if((apr_iterator.x() != flat_iterator.x()) || (apr_iterator.y() != flat_iterator.y()) || (apr_iterator.z() != flat_iterator.z()) ||
+           (apr_iterator.level() != flat_iterator.level()) || (apr_iterator.type() != flat_iterator.type())){
+            success = false;
+        }
+
+        for (int direction = 0; direction < 6; ++direction) {
             apr_iterator.find_neighbours_in_direction(direction);
+            flat_iterator.find_neighbours_in_direction(direction);
+
+            if(apr_iterator.number_neighbours_in_direction(direction) != flat_iterator.number_neighbours_in_direction(direction)){
+                success = false;
+                continue;
+            }
+
+            for (int index = 0; index < apr_iterator.number_neighbours_in_direction(direction); ++index) {
+                bool exists = neighbour_iterator.set_neighbour_iterator(apr_iterator, direction, index);
+                bool exists_flat = flat_neighbour_iterator.set_neighbour_iterator(flat_iterator, direction, index);
+
+                if((exists != exists_flat) || (exists && (neighbour_iterator.global_index() != flat_neighbour_iterator.global_index()))){
+                    success = false;
+                }
+            }
+        }
+    }
+
+    //random access, including particle cells that do not exist
+    for (particle_number = 0; particle_number < apr_iterator.total_number_particles(); ++particle_number) {
+        apr_iterator.set_iterator_to_particle_by_number(particle_number);
+
+        ParticleCell cell;
+        cell.x = apr_iterator.x();
+        cell.z = apr_iterator.z();
+        cell.level = apr_iterator.level();
+
+        for (int shift = -1; shift <= 1; ++shift) {
+            cell.y = std::min((int)apr_iterator.spatial_index_y_max(cell.level) - 1, std::max(0, apr_iterator.y() + shift));
+            ParticleCell cell_flat = cell;
+
+            bool found = neighbour_iterator.set_iterator_by_particle_cell(cell);
+            bool found_flat = flat_neighbour_iterator.set_iterator_by_particle_cell(cell_flat);
+
+            if((found != found_flat) || (found && (cell.global_index != cell_flat.global_index))){
+                success = false;
+            }
+        }
+    }
+
+    //the flattened structure (as written to file) has to be identical
+    MapStorageData map_data;
+    test_data.apr.apr_access.flatten_structure(test_data.apr,map_data);
+    MapStorageData map_data_flat;
+    apr_flat.apr_access.flatten_structure(apr_flat,map_data_flat);
+
+    if((map_data.y_begin != map_data_flat.y_begin) || (map_data.y_end != map_data_flat.y_end) || (map_data.global_index != map_data_flat.global_index) ||
+       (map_data.x != map_data_flat.x) || (map_data.z != map_data_flat.z) || (map_data.level != map_data_flat.level) || (map_data.number_gaps != map_data_flat.number_gaps)){
+        success = false;
+    }
 
-            success = check_neighbour_out_of_bounds(apr_iterator,direction);
+    //bulk construction from the flattened structure (as on loading) gives the same flat storage and iteration helpers
+    APR<uint16_t> apr_bulk = test_data.apr;
+    apr_bulk.apr_access.use_flat_map = true;
+    apr_bulk.apr_access.global_index_by_level_and_zx_end.clear();
+    apr_bulk.apr_access.rebuild_map(apr_bulk,map_data);
 
-            for (int index = 0; index < apr_iterator.number_neighbours_in_direction(direction); ++index) {
+    APRAccess& bulk_access = apr_bulk.apr_access;
+    APRAccess& flat_access = apr_flat.apr_access;
 
-                // on each face, there can be 0-4 neighbours accessed by index
-                if(neighbour_iterator.set_neighbour_iterator(apr_iterator, direction, index)){
-                    //will return true if there is a neighbour defined
-                    uint16_t apr_intensity = (test_data.apr.particles_intensities[neighbour_iterator]);
-                    uint16_t check_intensity = test_data.img_pc(neighbour_iterator.y_nearest_pixel(),neighbour_iterator.x_nearest_pixel(),neighbour_iterator.z_nearest_pixel());
+    if((bulk_access.gap_map.data.size() > 0) || (bulk_access.flat_map.size() != flat_access.flat_map.size())){
+        success = false;
+    } else {
+        APRAccess& map_access = test_data.apr.apr_access;
+        for (uint64_t level = bulk_access.level_min; level <= bulk_access.level_max; ++level) {
+            if((bulk_access.global_index_by_level_and_zx_end[level] != map_access.global_index_by_level_and_zx_end[level]) ||
+               (bulk_access.global_index_by_level_and_z_begin[level] != map_access.global_index_by_level_and_z_begin[level]) ||
+               (bulk_access.global_index_by_level_and_z_end[level] != map_access.global_index_by_level_and_z_end[level]) ||
+               (bulk_access.global_index_by_level_begin[level] != map_access.global_index_by_level_begin[level]) ||
+               (bulk_access.global_index_by_level_end[level] != map_access.global_index_by_level_end[level])){
+                success = false;
+            }
 
-                    if(check_intensity!=apr_intensity){
-                        success = false;
-                    }
+            const FlatGapMap& bulk_map = bulk_access.flat_map[level];
+            const FlatGapMap& flat_map = flat_access.flat_map[level];
+            if(!std::equal(bulk_map.row_begin.begin(),bulk_map.row_begin.end(),flat_map.row_begin.begin(),flat_map.row_begin.end()) ||
+               !std::equal(bulk_map.y_begin.begin(),bulk_map.y_begin.end(),flat_map.y_begin.begin(),flat_map.y_begin.end()) ||
+               !std::equal(bulk_map.y_end.begin(),bulk_map.y_end.end(),flat_map.y_end.begin(),flat_map.y_end.end()) ||
+               !std::equal(bulk_map.global_index_begin.begin(),bulk_map.global_index_begin.end(),flat_map.global_index_begin.begin(),flat_map.global_index_begin.end())){
+                success = false;
+            }
+        }
+    }
 
-                    uint16_t apr_level = neighbour_iterator.level();
-                    uint16_t check_level = test_data.img_level(neighbour_iterator.y_nearest_pixel(),neighbour_iterator.x_nearest_pixel(),neighbour_iterator.z_nearest_pixel());
+    return success;
+}
 
-                    if(check_level!=apr_level){
-                        success = false;
-                    }
+bool test_apr_particle_number_access(TestData& test_data){
+    //
+    //  Checks that jumping to particle numbers out of order gives the same particle cells as sequential iteration
+    //
 
-                    uint16_t apr_type = neighbour_iterator.type();
-                    uint16_t check_type = test_data.img_type(neighbour_iterator.y_nearest_pixel(),neighbour_iterator.x_nearest_pixel(),neighbour_iterator.z_nearest_pixel());
+    bool success = true;
 
-                    if(check_type!=apr_type){
-                        success = false;
-                    }
+    make_gap_map_reference(test_data.apr);
+    APRIterator<uint16_t> apr_iterator(test_data.apr);
 
-                    uint16_t apr_x = neighbour_iterator.x();
-                    uint16_t check_x = test_data.img_x(neighbour_iterator.y_nearest_pixel(),neighbour_iterator.x_nearest_pixel(),neighbour_iterator.z_nearest_pixel());
+    std::vector<ParticleCell> cells(apr_iterator.total_number_particles());
 
-                    if(check_x!=apr_x){
-                        success = false;
-                    }
+    uint64_t particle_number;
+    for (particle_number = 0; particle_number < apr_iterator.total_number_particles(); ++particle_number) {
+        apr_iterator.set_iterator_to_particle_by_number(particle_number);
+        cells[particle_number].x = apr_iterator.x();
+        cells[particle_number].y = apr_iterator.y();
+        cells[particle_number].z = apr_iterator.z();
+        cells[particle_number].level = apr_iterator.level();
+    }
 
-                    uint16_t apr_y = neighbour_iterator.y();
-                    uint16_t check_y = test_data.img_y(neighbour_iterator.y_nearest_pixel(),neighbour_iterator.x_nearest_pixel(),neighbour_iterator.z_nearest_pixel());
+    //check both gap storage backends
+    APR<uint16_t> apr_flat = test_data.apr;
+    apr_flat.apr_access.build_flat_map();
+    APRIterator<uint16_t> flat_iterator(apr_flat);
 
-                    if(check_y!=apr_y){
+    std::vector<uint64_t> step_sizes = {2,7,113,apr_iterator.total_number_particles()/3 + 1};
+
+    for (APRIterator<uint16_t>* jump_iterator : {&apr_iterator,&flat_iterator}) {
+        for (uint64_t step : step_sizes) {
+            //backwards, so that each access is a jump
+            for (int64_t number = jump_iterator->total_number_particles() - 1; number >= 0; number -= step) {
+
+                if (!jump_iterator->set_iterator_to_particle_by_number(number)) {
+                    success = false;
+                }
+
+                const ParticleCell &cell = cells[number];
+                if ((jump_iterator->x() != cell.x) || (jump_iterator->y() != cell.y) || (jump_iterator->z() != cell.z) ||
+                    (jump_iterator->level() != cell.level) || (jump_iterator->global_index() != (uint64_t) number)) {
+                    success = false;
+                }
+            }
+        }
+    }
+
+    return success;
+}
+
+bool test_apr_row_iteration(TestData& test_data){
+    //
+    //  Checks that row iteration visits every particle once, with the same particle cells as the particle number iteration
+    //
+
+    bool success = true;
+
+    APRIterator<uint16_t> apr_iterator(test_data.apr);
+    APRIterator<uint16_t> check_iterator(test_data.apr);
+
+    uint64_t counter = 0;
+
+    for (unsigned int level = apr_iterator.level_min(); level <= apr_iterator.level_max(); ++level) {
+        for (uint64_t z = 0; z < apr_iterator.spatial_index_z_max(level); ++z) {
+            for (uint64_t x = 0; x < apr_iterator.spatial_index_x_max(level); ++x) {
+
+                if (apr_iterator.set_iterator_to_row(level, z, x)) {
+
+                    uint64_t row_begin = apr_iterator.particles_zx_begin(level, z, x);
+                    uint64_t row_end = apr_iterator.particles_zx_end(level, z, x);
+
+                    if(apr_iterator.global_index() != row_begin){
                         success = false;
                     }
 
-                    uint16_t apr_z = neighbour_iterator.z();
-                    uint16_t check_z = test_data.img_z(neighbour_iterator.y_nearest_pixel(),neighbour_iterator.x_nearest_pixel(),neighbour_iterator.z_nearest_pixel());
+                    uint64_t expected_index = row_begin;
 
-                    if(check_z!=apr_z){
+                    do {
+                        if((apr_iterator.gap_particles_begin() != expected_index) || (apr_iterator.y() != apr_iterator.gap_y_begin()) ||
+                           ((apr_iterator.gap_particles_end() - apr_iterator.gap_particles_begin()) != (uint64_t)(apr_iterator.gap_y_end() - apr_iterator.gap_y_begin() + 1))){
+                            success = false;
+                        }
+
+                        uint16_t y = apr_iterator.gap_y_begin();
+                        for (uint64_t index = apr_iterator.gap_particles_begin(); index < apr_iterator.gap_particles_end(); ++index, ++y) {
+                            check_iterator.set_iterator_to_particle_by_number(index);
+                            if((check_iterator.x() != x) || (check_iterator.z() != z) || (check_iterator.y() != y) || (check_iterator.level() != level)){
+                                success = false;
+                            }
+                            counter++;
+                        }
+
+                        expected_index = apr_iterator.gap_particles_end();
+                    } while (apr_iterator.move_to_next_gap_in_row());
+
+                    if(expected_index != row_end){
                         success = false;
                     }
 
+                } else if (apr_iterator.particles_zx_begin(level, z, x) != UINT64_MAX) {
+                    success = false;
                 }
-
             }
-
         }
     }
 
+    if(counter != apr_iterator.total_number_particles()){
+        success = false;
+    }
+
+    return success;
+}
+
+bool test_apr_slab_pipeline(TestData& test_data){
+    //
+    //  Converting the image in z-slabs (with a small memory budget) has to give nearly the same APR as converting the whole
+    //  image, the B-spline smoothing being truncated at the slab halos the level can differ at a few pixels
+    //
+
+    bool success = true;
 
+    //stack the image three times in z, so the halos of the slabs do not cover the whole image
+    MeshData<uint16_t> input_image = TiffUtils::getMesh<uint16_t>(test_data.filename);
+    MeshData<uint16_t> stacked_image(input_image.y_num, input_image.x_num, 3*input_image.z_num);
+    for (int i = 0; i < 3; ++i) {
+        std::copy(input_image.mesh.begin(), input_image.mesh.end(), stacked_image.mesh.begin() + i*input_image.mesh.size());
+    }
+    std::string file_name = test_data.output_name + "_stacked.tif";
+    TiffUtils::saveMeshAsTiff(file_name, stacked_image);
 
+    APR<uint16_t> apr;
+    APR<uint16_t> apr_slabs;
 
-    return success;
+    for (APR<uint16_t>* apr_current : {&apr,&apr_slabs}) {
+        APRConverter<uint16_t> apr_converter;
 
+        apr_converter.par.Ip_th = test_data.apr.parameters.Ip_th;
+        apr_converter.par.rel_error = test_data.apr.parameters.rel_error;
+        apr_converter.par.lambda = test_data.apr.parameters.lambda;
+        apr_converter.par.min_signal = test_data.apr.parameters.min_signal;
+        apr_converter.par.sigma_th_max = test_data.apr.parameters.sigma_th_max;
+        apr_converter.par.sigma_th = test_data.apr.parameters.sigma_th;
+        apr_converter.par.SNR_min = test_data.apr.parameters.SNR_min;
 
+        apr_converter.par.input_image_name = file_name;
+        apr_converter.par.input_dir = "";
+
+        //small enough to force several slabs
+        apr_converter.par.memory_budget_mb = (apr_current == &apr_slabs) ? 0.5 : 0;
+
+        if(!apr_converter.get_apr(*apr_current)){
+            success = false;
+        }
+    }
+
+    std::remove(file_name.c_str());
+    if(!success){
+        return false;
+    }
+
+    return check_slab_apr(apr,apr_slabs);
 }
 
+std::string get_source_directory_apr(){
+    // returns path to the directory where utils.cpp is stored
 
+    std::string tests_directory = std::string(__FILE__);
+    tests_directory = tests_directory.substr(0, tests_directory.find_last_of("\\/") + 1);
 
-bool test_apr_iterate(TestData& test_data){
-    //
-    //  Bevan Cheeseman 2018
+    return tests_directory;
+}
+
+
+void CreateSmallSphereTest::SetUp(){
+
+
+    std::string file_name = get_source_directory_apr() + "files/Apr/sphere_120/sphere_apr.h5";
+    test_data.apr.read_apr(file_name);
+
+    file_name = get_source_directory_apr() + "files/Apr/sphere_120/sphere_level.tif";
+    test_data.img_level = TiffUtils::getMesh<uint16_t>(file_name);
+    file_name = get_source_directory_apr() + "files/Apr/sphere_120/sphere_type.tif";
+    test_data.img_type = TiffUtils::getMesh<uint16_t>(file_name);
+    file_name = get_source_directory_apr() + "files/Apr/sphere_120/sphere_original.tif";
+    test_data.img_original = TiffUtils::getMesh<uint16_t>(file_name);
+    file_name = get_source_directory_apr() + "files/Apr/sphere_120/sphere_pc.tif";
+    test_data.img_pc = TiffUtils::getMesh<uint16_t>(file_name);
+    file_name = get_source_directory_apr() + "files/Apr/sphere_120/sphere_x.tif";
+    test_data.img_x = TiffUtils::getMesh<uint16_t>(file_name);
+    file_name =  get_source_directory_apr() + "files/Apr/sphere_120/sphere_y.tif";
+    test_data.img_y = TiffUtils::getMesh<uint16_t>(file_name);
+    file_name =  get_source_directory_apr() + "files/Apr/sphere_120/sphere_z.tif";
+    test_data.img_z = TiffUtils::getMesh<uint16_t>(file_name);
+
+    test_data.filename = get_source_directory_apr() + "files/Apr/sphere_120/sphere_original.tif";
+    test_data.output_name = "sphere_small";
+}
+
+bool check_apr_region(APR<uint16_t>& apr,APR<uint16_t>& apr_region,APRRegion& region){
     //
-    //  Test for the serial APR iterator
+    //  Checks that apr_region holds exactly the particle cells of apr intersecting the region (with the same intensities and types)
     //
 
     bool success = true;
 
-    APRIterator<uint16_t> apr_iterator(test_data.apr);
-    uint64_t particle_number = 0;
+    APRIterator<uint16_t> apr_iterator(apr);
+    APRIterator<uint16_t> region_iterator(apr_region);
+
+    uint64_t number_in_region = 0;
+    uint64_t particle_number;
 
     for (particle_number = 0; particle_number < apr_iterator.total_number_particles(); ++particle_number) {
         apr_iterator.set_iterator_to_particle_by_number(particle_number);
 
-        uint16_t apr_intensity = (test_data.apr.particles_intensities[apr_iterator]);
-        uint16_t check_intensity = test_data.img_pc(apr_iterator.y_nearest_pixel(),apr_iterator.x_nearest_pixel(),apr_iterator.z_nearest_pixel());
+        const uint64_t step = apr.level_max() - apr_iterator.level();
+        const uint64_t size = (uint64_t)1 << step;
 
-        if(check_intensity!=apr_intensity){
-            success = false;
+        if((apr_iterator.level() < region.level_begin) || (apr_iterator.level() > region.level_end) ||
+           ((apr_iterator.y()+1)*size <= region.y_begin) || (apr_iterator.y()*size >= region.y_end) ||
+           ((apr_iterator.x()+1)*size <= region.x_begin) || (apr_iterator.x()*size >= region.x_end) ||
+           ((apr_iterator.z()+1)*size <= region.z_begin) || (apr_iterator.z()*size >= region.z_end)){
+            continue;
         }
+        number_in_region++;
 
-        uint16_t apr_level = apr_iterator.level();
-        uint16_t check_level = test_data.img_level(apr_iterator.y_nearest_pixel(),apr_iterator.x_nearest_pixel(),apr_iterator.z_nearest_pixel());
+        ParticleCell cell;
+        cell.level = apr_iterator.level();
+        cell.y = apr_iterator.y() - (region.y_begin >> step);
+        cell.x = apr_iterator.x() - (region.x_begin >> step);
+        cell.z = apr_iterator.z() - (region.z_begin >> step);
 
-        if(check_level!=apr_level){
+        if(!region_iterator.set_iterator_by_particle_cell(cell)){
             success = false;
+            continue;
         }
 
-        uint16_t apr_type = apr_iterator.type();
-        uint16_t check_type = test_data.img_type(apr_iterator.y_nearest_pixel(),apr_iterator.x_nearest_pixel(),apr_iterator.z_nearest_pixel());
+        if((apr.particles_intensities[apr_iterator] != apr_region.particles_intensities[region_iterator]) ||
+           (apr_iterator.type() != region_iterator.type())){
+            success = false;
+        }
+    }
 
-        if(check_type!=apr_type){
+    if(number_in_region != apr_region.total_number_particles()){
+        success = false;
+    }
+
+    return success;
+}
+
+bool test_apr_region_read(TestData& test_data){
+    //
+    //  Reads regions of interest from the block indexed and the standard file layout
+    //
+
+    bool success = true;
+
+    std::string save_loc = "";
+    std::string file_name = "region_test";
+    std::string file_name_blocked = "region_test_blocked";
+
+    test_data.apr.write_apr(save_loc,file_name);
+    test_data.apr.write_apr_blocked(save_loc,file_name_blocked,4);
+
+    std::vector<APRRegion> regions(3);
+
+    //full APR
+    //unaligned sub-volume
+    regions[1].y_begin = 13; regions[1].y_end = test_data.apr.orginal_dimensions(0)/2 + 3;
+    regions[1].x_begin = 7; regions[1].x_end = test_data.apr.orginal_dimensions(1) - 5;
+    regions[1].z_begin = test_data.apr.orginal_dimensions(2)/3; regions[1].z_end = test_data.apr.orginal_dimensions(2)/3 + 17;
+    //sub-volume at the finest two levels only
+    regions[2] = regions[1];
+    regions[2].level_begin = test_data.apr.level_max() - 1;
+
+    for (size_t i = 0; i < regions.size(); ++i) {
+        for (const std::string& name : {file_name, file_name_blocked}) {
+            APRRegion region = regions[i];
+            APR<uint16_t> apr_region;
+
+            if(!apr_region.read_apr_region(save_loc + name + "_apr.h5",region)){
+                success = false;
+                continue;
+            }
+
+            if(!check_apr_region(test_data.apr,apr_region,region)){
+                success = false;
+            }
+        }
+    }
+
+    //the blocked layout has to remain readable in full
+    APR<uint16_t> apr_read;
+    apr_read.read_apr(save_loc + file_name_blocked + "_apr.h5");
+    APRRegion full;
+    if(!check_apr_region(test_data.apr,apr_read,full)){
+        success = false;
+    }
+
+    std::remove((save_loc + file_name + "_apr.h5").c_str());
+    std::remove((save_loc + file_name_blocked + "_apr.h5").c_str());
+
+    return success;
+}
+
+bool test_apr_io_direct_chunks(TestData& test_data){
+    //
+    //  Checks that files written with the parallel direct chunk IO are read correctly through the HDF5 filter pipeline and vice versa
+    //
+
+    bool success = true;
+
+    std::string save_loc = "";
+    std::string file_name = "direct_chunk_test";
+    APRRegion full;
+
+    APRWriter apr_writer;
+    APRCompress<uint16_t> apr_compressor;
+    apr_compressor.set_compression_type(0);
+
+    for (bool direct_write : {true, false}) {
+        apr_writer.direct_chunk_io = direct_write;
+        //small chunks, so the datasets span many chunks (the last one partial)
+        apr_writer.write_apr(test_data.apr, save_loc, file_name, apr_compressor, BLOSC_ZSTD, 2, 1, 0, 1001);
+
+        for (bool direct_read : {true, false}) {
+            apr_writer.direct_chunk_io = direct_read;
+
+            APR<uint16_t> apr_read;
+            apr_writer.read_apr(apr_read, save_loc + file_name + "_apr.h5");
+
+            if(!check_apr_region(test_data.apr,apr_read,full)){
+                success = false;
+            }
+        }
+    }
+
+    std::remove((save_loc + file_name + "_apr.h5").c_str());
+
+    return success;
+}
+
+bool test_apr_native_format(TestData& test_data){
+    //
+    //  Checks the memory mapped native format: the access structure (and optionally the particles) view the read only
+    //  mapping, copies own their data and changes never reach the file
+    //
+
+    bool success = true;
+
+    std::string save_loc = "";
+    std::string file_name = "native_test";
+    APRRegion full;
+
+    test_data.apr.write_apr_native(save_loc,file_name);
+
+    APR<uint16_t> apr_read;
+    if(!apr_read.read_apr_native(save_loc + file_name + ".apr")){
+        return false;
+    }
+
+    if(!check_apr_region(test_data.apr,apr_read,full)){
+        success = false;
+    }
+
+    //still viewing the mapping after iterating
+    const uint64_t level = apr_read.level_max();
+    if(!apr_read.apr_access.use_flat_map || !apr_read.apr_access.flat_map[level].y_begin.is_view() ||
+       !apr_read.apr_access.global_index_by_level_and_zx_end[level].is_view()){
+        success = false;
+    }
+
+    //particles viewing the mapping
+    APR<uint16_t> apr_mapped;
+    MappedParticleData<uint16_t> mapped_parts;
+    if(!apr_mapped.read_apr_native(save_loc + file_name + ".apr",mapped_parts)){
+        return false;
+    }
+
+    if(!mapped_parts.data.is_view() || (apr_mapped.particles_intensities.data.size() != 0) ||
+       (mapped_parts.total_number_particles() != test_data.apr.total_number_particles())){
+        success = false;
+    }
+
+    APRIterator<uint16_t> apr_iterator(apr_mapped);
+    for (uint64_t particle_number = 0; particle_number < apr_iterator.total_number_particles(); ++particle_number) {
+        apr_iterator.set_iterator_to_particle_by_number(particle_number);
+        if(mapped_parts[apr_iterator] != test_data.apr.particles_intensities.data[particle_number]){
             success = false;
         }
+    }
+
+    //copies own their data
+    APR<uint16_t> apr_copy = apr_read;
+    if(apr_copy.apr_access.flat_map[level].y_begin.is_view() || apr_copy.apr_access.global_index_by_level_and_zx_end[level].is_view()){
+        success = false;
+    }
+
+    //a view is copied before it is modified, the file is unchanged
+    FlatGapMap& level_map = apr_read.apr_access.flat_map[level];
+    level_map.y_begin.detach();
+    level_map.y_begin[0] += 1;
+    if(level_map.y_begin.is_view() || !level_map.y_end.is_view()){
+        success = false;
+    }
+
+    APR<uint16_t> apr_reread;
+    apr_reread.read_apr_native(save_loc + file_name + ".apr");
+    if(apr_reread.apr_access.flat_map[level].y_begin != apr_copy.apr_access.flat_map[level].y_begin){
+        success = false;
+    }
+
+    //not a native file
+    APR<uint16_t> apr_fail;
+    if(apr_fail.read_apr_native(test_data.filename)){
+        success = false;
+    }
+
+    std::remove((save_loc + file_name + ".apr").c_str());
+
+    return success;
+}
+
+/**
+ * Relative comparison of filter outputs, a tolerance of 0 requires equal values
+ */
+inline bool values_close(double a, double b, double tolerance){
+    return std::abs(a - b) <= tolerance*std::max(1.0, std::abs(a));
+}
+
+template<typename T>
+bool check_bspline_fused(const MeshData<T>& image){
+    //
+    //  Compares the fused (streamed in z) b-spline smoothing and gradient with the separate passes
+    //
 
-        uint16_t apr_x = apr_iterator.x();
-        uint16_t check_x = test_data.img_x(apr_iterator.y_nearest_pixel(),apr_iterator.x_nearest_pixel(),apr_iterator.z_nearest_pixel());
+    ComputeGradient compute_gradient;
+    const float lambda = 3;
+    const float tol = 0.0001;
+
+    MeshData<T> image_ref(image, true);
+    MeshData<T> grad_ref;
+    grad_ref.initDownsampled(image.y_num, image.x_num, image.z_num, 0);
+    MeshData<float> local_scale_ref;
+    local_scale_ref.initDownsampled(image.y_num, image.x_num, image.z_num);
+
+    compute_gradient.bspline_filt_rec_y(image_ref, lambda, tol);
+    compute_gradient.bspline_filt_rec_x(image_ref, lambda, tol);
+    compute_gradient.bspline_filt_rec_z(image_ref, lambda, tol);
+    compute_gradient.calc_bspline_fd_ds_mag(image_ref, grad_ref, 1, 1, 1);
+    downsample(image_ref, local_scale_ref,
+               [](const float &x, const float &y) -> float { return x + y; },
+               [](const float &x) -> float { return x / 8.0; });
+    compute_gradient.calc_inv_bspline_y(local_scale_ref);
+    compute_gradient.calc_inv_bspline_x(local_scale_ref);
+
+    MeshData<T> image_fused(image, true);
+    MeshData<T> grad_fused;
+    grad_fused.initDownsampled(image.y_num, image.x_num, image.z_num, 0);
+    MeshData<float> local_scale_fused;
+    local_scale_fused.initDownsampled(image.y_num, image.x_num, image.z_num);
+
+    compute_gradient.get_gradient_bspline_fused(image_fused, grad_fused, local_scale_fused, lambda, 1, 1, 1);
+
+    //integer types are truncated after each pass, allow for a difference in rounding
+    const double tolerance = std::is_integral<T>::value ? 1.0 : 1e-4;
+    auto equal = [tolerance](double a, double b) { return values_close(a, b, tolerance); };
 
-        if(check_x!=apr_x){
+    bool success = true;
+
+    for (size_t i = 0; i < image_ref.mesh.size(); ++i) {
+        if(!equal(image_ref.mesh[i], image_fused.mesh[i])){
             success = false;
         }
+    }
 
-        uint16_t apr_y = apr_iterator.y();
-        uint16_t check_y = test_data.img_y(apr_iterator.y_nearest_pixel(),apr_iterator.x_nearest_pixel(),apr_iterator.z_nearest_pixel());
-
-        if(check_y!=apr_y){
+    for (size_t i = 0; i < grad_ref.mesh.size(); ++i) {
+        if(!equal(grad_ref.mesh[i], grad_fused.mesh[i]) || !equal(local_scale_ref.mesh[i], local_scale_fused.mesh[i])){
             success = false;
         }
+    }
 
-        uint16_t apr_z = apr_iterator.z();
-        uint16_t check_z = test_data.img_z(apr_iterator.y_nearest_pixel(),apr_iterator.x_nearest_pixel(),apr_iterator.z_nearest_pixel());
+    return success;
+}
 
-        if(check_z!=apr_z){
-            success = false;
-        }
+bool test_bspline_fused(TestData& test_data){
+
+    bool success = true;
 
+    if(!check_bspline_fused(test_data.img_original)){
+        success = false;
     }
 
-    //Test parallel loop
+    MeshData<float> image_float(test_data.img_original, true);
+    if(!check_bspline_fused(image_float)){
+        success = false;
+    }
 
-#ifdef HAVE_OPENMP
-	#pragma omp parallel for schedule(static) private(particle_number) firstprivate(apr_iterator)
-#endif
-    for (particle_number = 0; particle_number < apr_iterator.total_number_particles(); ++particle_number) {
-        apr_iterator.set_iterator_to_particle_by_number(particle_number);
+    //fewer z-slices than needed for the boundary conditions
+    MeshData<float> image_thin(image_float.y_num, image_float.x_num, 7);
+    std::copy(image_float.mesh.begin(), image_float.mesh.begin() + image_thin.mesh.size(), image_thin.mesh.begin());
+    if(!check_bspline_fused(image_thin)){
+        success = false;
+    }
 
-        uint16_t apr_intensity = (test_data.apr.particles_intensities[apr_iterator]);
-        uint16_t check_intensity = test_data.img_pc(apr_iterator.y_nearest_pixel(),apr_iterator.x_nearest_pixel(),apr_iterator.z_nearest_pixel());
+    return success;
+}
 
-        if(check_intensity!=apr_intensity){
-            success = false;
-        }
+template<typename T>
+void run_bspline_passes(MeshData<T>& image, MeshData<T>& image_fused, MeshData<T>& grad_fused, MeshData<float>& local_scale_fused){
+    ComputeGradient compute_gradient;
+    const float lambda = 3;
+    const float tol = 0.0001;
 
-        uint16_t apr_level = apr_iterator.level();
-        uint16_t check_level = test_data.img_level(apr_iterator.y_nearest_pixel(),apr_iterator.x_nearest_pixel(),apr_iterator.z_nearest_pixel());
+    compute_gradient.bspline_filt_rec_y(image, lambda, tol);
+    compute_gradient.bspline_filt_rec_x(image, lambda, tol);
+    compute_gradient.bspline_filt_rec_z(image, lambda, tol);
 
-        if(check_level!=apr_level){
-            success = false;
-        }
+    grad_fused.initDownsampled(image_fused.y_num, image_fused.x_num, image_fused.z_num, 0);
+    local_scale_fused.initDownsampled(image_fused.y_num, image_fused.x_num, image_fused.z_num);
+    compute_gradient.get_gradient_bspline_fused(image_fused, grad_fused, local_scale_fused, lambda, 1, 1, 1);
+}
 
-        uint16_t apr_type = apr_iterator.type();
-        uint16_t check_type = test_data.img_type(apr_iterator.y_nearest_pixel(),apr_iterator.x_nearest_pixel(),apr_iterator.z_nearest_pixel());
+template<typename T>
+bool check_bspline_simd(const MeshData<T>& image){
+    //
+    //  Compares the b-spline filters using the SIMD kernels of each supported instruction set with the scalar code
+    //
 
-        if(check_type!=apr_type){
-            success = false;
-        }
+    const BsplineSimd::InstructionSet default_set = BsplineSimd::instruction_set();
+
+    BsplineSimd::set_instruction_set(BsplineSimd::InstructionSet::Scalar);
+    MeshData<T> image_ref(image, true);
+    MeshData<T> image_fused_ref(image, true);
+    MeshData<T> grad_ref;
+    MeshData<float> local_scale_ref;
+    run_bspline_passes(image_ref, image_fused_ref, grad_ref, local_scale_ref);
+
+    //the kernels do the same operations in the same order, so the results are identical unless the compiler may reorder
+    //the scalar code (-ffast-math), then the values (and integer truncations) can differ by rounding, amplified in the
+    //gradient (differences of the smoothed values)
+#ifdef __FAST_MATH__
+    const double tolerance = std::is_integral<T>::value ? 1.0 : 1e-3;
+#else
+    const double tolerance = 0;
+#endif
+    auto equal = [tolerance](double a, double b) { return values_close(a, b, tolerance); };
 
-        uint16_t apr_x = apr_iterator.x();
-        uint16_t check_x = test_data.img_x(apr_iterator.y_nearest_pixel(),apr_iterator.x_nearest_pixel(),apr_iterator.z_nearest_pixel());
+    bool success = true;
 
-        if(check_x!=apr_x){
-            success = false;
+    for (BsplineSimd::InstructionSet instruction_set : {BsplineSimd::InstructionSet::SSE2, BsplineSimd::InstructionSet::AVX2, BsplineSimd::InstructionSet::AVX512}) {
+        if (instruction_set > BsplineSimd::supported_instruction_set()) {
+            continue;
         }
-
-        uint16_t apr_y = apr_iterator.y();
-        uint16_t check_y = test_data.img_y(apr_iterator.y_nearest_pixel(),apr_iterator.x_nearest_pixel(),apr_iterator.z_nearest_pixel());
-
-        if(check_y!=apr_y){
+        BsplineSimd::set_instruction_set(instruction_set);
+
+        MeshData<T> image_simd(image, true);
+        MeshData<T> image_fused_simd(image, true);
+        MeshData<T> grad_simd;
+        MeshData<float> local_scale_simd;
+        run_bspline_passes(image_simd, image_fused_simd, grad_simd, local_scale_simd);
+
+        if (!std::equal(image_ref.mesh.begin(), image_ref.mesh.end(), image_simd.mesh.begin(), equal) ||
+            !std::equal(image_fused_ref.mesh.begin(), image_fused_ref.mesh.end(), image_fused_simd.mesh.begin(), equal) ||
+            !std::equal(grad_ref.mesh.begin(), grad_ref.mesh.end(), grad_simd.mesh.begin(), equal) ||
+            !std::equal(local_scale_ref.mesh.begin(), local_scale_ref.mesh.end(), local_scale_simd.mesh.begin(), equal)) {
+            std::cout << "b-spline filters differ using " << BsplineSimd::instruction_set_name(instruction_set) << std::endl;
             success = false;
         }
+    }
 
-        uint16_t apr_z = apr_iterator.z();
-        uint16_t check_z = test_data.img_z(apr_iterator.y_nearest_pixel(),apr_iterator.x_nearest_pixel(),apr_iterator.z_nearest_pixel());
+    BsplineSimd::set_instruction_set(default_set);
 
-        if(check_z!=apr_z){
-            success = false;
-        }
+    return success;
+}
 
-    }
+bool test_bspline_simd(TestData& test_data){
 
-    uint64_t counter = 0;
-    for (unsigned int level = apr_iterator.level_min(); level <= apr_iterator.level_max(); ++level) {
-        for (particle_number = apr_iterator.particles_level_begin(level); particle_number < apr_iterator.particles_level_end(level); ++particle_number) {
+    bool success = true;
 
-            apr_iterator.set_iterator_to_particle_by_number(particle_number); // (Required step), sets the iterator to the particle
+    if(!check_bspline_simd(test_data.img_original)){
+        success = false;
+    }
 
-            counter++;
+    MeshData<float> image_float(test_data.img_original, true);
+    if(!check_bspline_simd(image_float)){
+        success = false;
+    }
 
-            if(apr_iterator.level() != level){
-                //set all particles in calc_ex with an particle intensity greater then 100 to 0.
-               success = false;
+    //sizes which are not a multiple of the vector width
+    const size_t y_num = std::min((size_t)test_data.img_original.y_num, (size_t)27);
+    const size_t x_num = std::min((size_t)test_data.img_original.x_num, (size_t)19);
+    const size_t z_num = std::min((size_t)test_data.img_original.z_num, (size_t)23);
+    MeshData<uint16_t> image_odd(y_num, x_num, z_num);
+    for (size_t z = 0; z < z_num; ++z) {
+        for (size_t x = 0; x < x_num; ++x) {
+            for (size_t y = 0; y < y_num; ++y) {
+                image_odd(y, x, z) = test_data.img_original(y, x, z);
             }
         }
     }
-
-    if(counter != apr_iterator.total_number_particles()){
+    if(!check_bspline_simd(image_odd)){
         success = false;
     }
 
-    counter = 0;
+    return success;
+}
 
-    for (int level = apr_iterator.level_min(); level <= apr_iterator.level_max(); ++level) {
-        for(unsigned int z = 0; z < apr_iterator.spatial_index_z_max(level); ++z) {
+TEST_F(CreateSmallSphereTest, APR_ITERATION) {
 
-            for (particle_number = apr_iterator.particles_z_begin(level,z);
-                 particle_number < apr_iterator.particles_z_end(level,z); ++particle_number) {
-                //
-                //  Parallel loop over level
-                //
-                apr_iterator.set_iterator_to_particle_by_number(particle_number);
+//test iteration
+ASSERT_TRUE(test_apr_iterate(test_data));
 
-                counter++;
+}
 
-                if (apr_iterator.z() != z) {
-                    success = false;
-                }
-            }
-        }
-    }
+TEST_F(CreateSmallSphereTest, APR_NEIGHBOUR_ACCESS) {
 
-    if(counter != apr_iterator.total_number_particles()){
-        success = false;
-    }
+//test iteration
+ASSERT_TRUE(test_apr_neighbour_access(test_data));
 
-    return success;
 }
 
+TEST_F(CreateSmallSphereTest, APR_NEIGHBOUR_TABLE) {
 
-bool test_apr_pipeline(TestData& test_data){
-    ///
-    /// Tests the pipeline, comparing the results with existing results
-    ///
+//test the precomputed neighbours
+    ASSERT_TRUE(test_apr_neighbour_table(test_data));
 
-    bool success = true;
+}
 
-    //the apr datastructure
-    APR<uint16_t> apr;
+TEST_F(CreateSmallSphereTest, APR_SHARED) {
 
-    APRConverter<uint16_t> apr_converter;
+//test the shared read-only APR handle
+    ASSERT_TRUE(test_shared_apr(test_data));
 
-    //read in the command line options into the parameters file
-    apr_converter.par.Ip_th = test_data.apr.parameters.Ip_th;
-    apr_converter.par.rel_error = test_data.apr.parameters.rel_error;
-    apr_converter.par.lambda = test_data.apr.parameters.lambda;
-    apr_converter.par.mask_file = "";
-    apr_converter.par.min_signal = test_data.apr.parameters.min_signal;
+}
 
-    apr_converter.par.sigma_th_max = test_data.apr.parameters.sigma_th_max;
-    apr_converter.par.sigma_th = test_data.apr.parameters.sigma_th;
+TEST_F(CreateSmallSphereTest, APR_BATCH_CONVERTER) {
 
-    apr_converter.par.SNR_min = test_data.apr.parameters.SNR_min;
+//test the pipelined conversion of a series of files
+    ASSERT_TRUE(test_apr_batch_converter(test_data));
 
-    //where things are
-    apr_converter.par.input_image_name =test_data.filename;
-    apr_converter.par.input_dir = "";
-    apr_converter.par.name = test_data.output_name;
-    apr_converter.par.output_dir = "";
+}
 
-    //Gets the APR
-    if(apr_converter.get_apr(apr)){
-        APRIterator<uint16_t> apr_iterator(apr);
-        uint64_t particle_number = 0;
+TEST_F(CreateSmallSphereTest, APR_CONVERTER_WORKSPACE) {
 
-        for (particle_number = 0; particle_number < apr_iterator.total_number_particles(); ++particle_number) {
-            apr_iterator.set_iterator_to_particle_by_number(particle_number);
+//test reusing the converter workspace over a sequence of images
+    ASSERT_TRUE(test_apr_converter_workspace(test_data));
 
-            uint16_t apr_intensity = (apr.particles_intensities[apr_iterator]);
-            uint16_t check_intensity = test_data.img_pc(apr_iterator.y_nearest_pixel(),apr_iterator.x_nearest_pixel(),apr_iterator.z_nearest_pixel());
+}
 
-            if(check_intensity!=apr_intensity){
-                success = false;
-            }
+TEST_F(CreateSmallSphereTest, APR_DIRECT_SAMPLING) {
 
-            uint16_t apr_level = apr_iterator.level();
-            uint16_t check_level = test_data.img_level(apr_iterator.y_nearest_pixel(),apr_iterator.x_nearest_pixel(),apr_iterator.z_nearest_pixel());
+//test sampling the particles directly from the image
+    ASSERT_TRUE(test_apr_direct_sampling(test_data));
 
-            if(check_level!=apr_level){
-                success = false;
-            }
+}
 
-            uint16_t apr_type = apr_iterator.type();
-            uint16_t check_type = test_data.img_type(apr_iterator.y_nearest_pixel(),apr_iterator.x_nearest_pixel(),apr_iterator.z_nearest_pixel());
+TEST_F(CreateSmallSphereTest, APR_PACKED_PULLING_SCHEME) {
 
-            if(check_type!=apr_type){
-                success = false;
-            }
+//test the packed particle cell tree in the pulling scheme
+    ASSERT_TRUE(test_apr_packed_pulling_scheme(test_data));
 
-            uint16_t apr_x = apr_iterator.x();
-            uint16_t check_x = test_data.img_x(apr_iterator.y_nearest_pixel(),apr_iterator.x_nearest_pixel(),apr_iterator.z_nearest_pixel());
+}
 
-            if(check_x!=apr_x){
-                success = false;
-            }
+TEST_F(CreateSmallSphereTest, APR_SPARSE_PULLING_SCHEME) {
 
-            uint16_t apr_y = apr_iterator.y();
-            uint16_t check_y = test_data.img_y(apr_iterator.y_nearest_pixel(),apr_iterator.x_nearest_pixel(),apr_iterator.z_nearest_pixel());
+//test the sparse particle cell tree in the pulling scheme
+    ASSERT_TRUE(test_apr_sparse_pulling_scheme(test_data));
 
-            if(check_y!=apr_y){
-                success = false;
-            }
+}
 
-            uint16_t apr_z = apr_iterator.z();
-            uint16_t check_z = test_data.img_z(apr_iterator.y_nearest_pixel(),apr_iterator.x_nearest_pixel(),apr_iterator.z_nearest_pixel());
+TEST_F(CreateSmallSphereTest, APR_SOLVER) {
 
-            if(check_z!=apr_z){
-                success = false;
-            }
+//test the multigrid diffusion solver on the particles
+    ASSERT_TRUE(test_apr_solver(test_data));
 
-        }
+}
 
-    } else {
+TEST_F(CreateSmallSphereTest, APR_STATISTICS) {
 
-        success = false;
-    }
+//test the (volume weighted) reductions of particle data
+    ASSERT_TRUE(test_apr_statistics(test_data));
 
+}
+
+TEST_F(CreateSmallSphereTest, APR_FILTER) {
+
+//test the multi-level convolution of particles
+    ASSERT_TRUE(test_apr_filter(test_data));
 
-    return success;
 }
 
-std::string get_source_directory_apr(){
-    // returns path to the directory where utils.cpp is stored
+TEST_F(CreateSmallSphereTest, APR_CONNECTED_COMPONENTS) {
 
-    std::string tests_directory = std::string(__FILE__);
-    tests_directory = tests_directory.substr(0, tests_directory.find_last_of("\\/") + 1);
+//test the connected component labelling of particles
+    ASSERT_TRUE(test_apr_connected_components(test_data));
 
-    return tests_directory;
 }
 
+TEST_F(CreateSmallSphereTest, APR_BATCH_POINT_LOCATION) {
 
-void CreateSmallSphereTest::SetUp(){
+//test the batched point location
+    ASSERT_TRUE(test_apr_batch_point_location(test_data));
 
+}
 
-    std::string file_name = get_source_directory_apr() + "files/Apr/sphere_120/sphere_apr.h5";
-    test_data.apr.read_apr(file_name);
+TEST_F(CreateSmallSphereTest, APR_TREE) {
 
-    file_name = get_source_directory_apr() + "files/Apr/sphere_120/sphere_level.tif";
-    test_data.img_level = TiffUtils::getMesh<uint16_t>(file_name);
-    file_name = get_source_directory_apr() + "files/Apr/sphere_120/sphere_type.tif";
-    test_data.img_type = TiffUtils::getMesh<uint16_t>(file_name);
-    file_name = get_source_directory_apr() + "files/Apr/sphere_120/sphere_original.tif";
-    test_data.img_original = TiffUtils::getMesh<uint16_t>(file_name);
-    file_name = get_source_directory_apr() + "files/Apr/sphere_120/sphere_pc.tif";
-    test_data.img_pc = TiffUtils::getMesh<uint16_t>(file_name);
-    file_name = get_source_directory_apr() + "files/Apr/sphere_120/sphere_x.tif";
-    test_data.img_x = TiffUtils::getMesh<uint16_t>(file_name);
-    file_name =  get_source_directory_apr() + "files/Apr/sphere_120/sphere_y.tif";
-    test_data.img_y = TiffUtils::getMesh<uint16_t>(file_name);
-    file_name =  get_source_directory_apr() + "files/Apr/sphere_120/sphere_z.tif";
-    test_data.img_z = TiffUtils::getMesh<uint16_t>(file_name);
+//test the tree of interior cells and the pooled values
+    ASSERT_TRUE(test_apr_tree(test_data));
 
-    test_data.filename = get_source_directory_apr() + "files/Apr/sphere_120/sphere_original.tif";
-    test_data.output_name = "sphere_small";
 }
 
-TEST_F(CreateSmallSphereTest, APR_ITERATION) {
+TEST_F(CreateSmallSphereTest, APR_PARTICLE_ORDER) {
 
-//test iteration
-ASSERT_TRUE(test_apr_iterate(test_data));
+//test the Morton particle ordering
+    ASSERT_TRUE(test_apr_particle_order(test_data));
 
 }
 
-TEST_F(CreateSmallSphereTest, APR_NEIGHBOUR_ACCESS) {
+TEST_F(CreateSmallSphereTest, MULTI_CHANNEL_PARTICLE_DATA) {
 
-//test iteration
-ASSERT_TRUE(test_apr_neighbour_access(test_data));
+//test multi-channel particle data (layouts, map/zip, io)
+    ASSERT_TRUE(test_multi_channel_particle_data(test_data));
 
 }
 
@@ -700,6 +2892,48 @@ TEST_F(CreateSmallSphereTest, APR_INPUT_OUTPUT) {
 
 }
 
+TEST_F(CreateSmallSphereTest, APR_REGION_READ) {
+
+//test reading regions of interest
+    ASSERT_TRUE(test_apr_region_read(test_data));
+
+}
+
+TEST_F(CreateSmallSphereTest, APR_IO_DIRECT_CHUNKS) {
+
+//test the parallel chunk (de)compression
+    ASSERT_TRUE(test_apr_io_direct_chunks(test_data));
+
+}
+
+TEST_F(CreateSmallSphereTest, APR_NATIVE_FORMAT) {
+
+    //test the memory mapped native format
+    ASSERT_TRUE(test_apr_native_format(test_data));
+
+}
+
+TEST_F(CreateSmallSphereTest, APR_PARTICLE_NUMBER_ACCESS) {
+
+//test setting the iterator by particle number out of order
+    ASSERT_TRUE(test_apr_particle_number_access(test_data));
+
+}
+
+TEST_F(CreateSmallSphereTest, APR_ROW_ITERATION) {
+
+//test iteration by (level,z,x) rows
+    ASSERT_TRUE(test_apr_row_iteration(test_data));
+
+}
+
+TEST_F(CreateSmallSphereTest, APR_FLAT_ACCESS) {
+
+//test the flat gap storage against the map
+    ASSERT_TRUE(test_apr_flat_access(test_data));
+
+}
+
 TEST_F(CreateSmallSphereTest, APR_PIPELINE) {
 
 //test iteration
@@ -707,6 +2941,26 @@ TEST_F(CreateSmallSphereTest, APR_PIPELINE) {
 
 }
 
+TEST_F(CreateSmallSphereTest, APR_SLAB_PIPELINE) {
+
+//test converting the image in slabs
+    ASSERT_TRUE(test_apr_slab_pipeline(test_data));
+
+}
+
+TEST_F(CreateSmallSphereTest, BSPLINE_FUSED) {
+
+//test the fused b-spline smoothing and gradient
+    ASSERT_TRUE(test_bspline_fused(test_data));
+
+}
+
+TEST_F(CreateSmallSphereTest, BSPLINE_SIMD) {
+
+//test the SIMD b-spline filter kernels against the scalar code
+    ASSERT_TRUE(test_bspline_simd(test_data));
+
+}
 
 int main(int argc, char **argv) {
 